@@ -1,5 +1,13 @@
 #include <iostream>             // cout, cerr
 #include <cstdlib>              // EXIT_FAILURE
+#include <cstring>              // strcmp
+#include <algorithm>            // sort
+#include <chrono>               // steady_clock
+#include <vector>               // vector
+#include <thread>               // startup workers
+#include <atomic>               // heap allocation counter
+#include <new>                  // bad_alloc
+#include <cstddef>              // offsetof
 #include <GL/glew.h>            // GLEW library
 #include <GLFW/glfw3.h>         // GLFW library
 
@@ -9,6 +17,30 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "camera.h" // Camera class
+#include "shadow.h" // Cascaded shadow maps
+#include "geometry.h" // Procedural shapes and the geometry cache
+#include "primitives.h" // Compile-time box, plane and pyramid meshes
+#include "resources.h" // GPU resource tracking and budget
+#include "ring.h" // Persistently mapped upload ring
+#include "cull.h" // GPU-driven culling and the mesh pool
+#include "bvh.h" // Object picking
+#include "resolution.h" // Dynamic resolution scaling
+#include "pacing.h" // Frame limiter and input latency
+#include "streaming.h" // Background streaming of world cells
+#include "texarray.h" // Texture array packing
+#include "texcook.h" // Offline block compression of textures
+#include "startup.h" // Parallel program compilation and the startup timeline
+#include "simdmath.h" // Batched transform math
+#include "overdraw.h" // Depth prepass, draw order and overdraw counter
+#include "terrain.h" // Chunked LOD terrain floor
+#include "memory.h" // Frame arena and object pools
+#include "jobs.h" // Work-stealing job system every CPU stage runs on
+#include "particles.h" // Multithreaded particle effects
+#include "animation.h" // Keyframed object animation
+#include "collision.h" // Camera collision, sweep and prune and swept sphere tests
+#include "hud.h" // Performance overlay
+#include "service.h" // Render service for other local processes
+#include "ssao.h" // Half resolution ambient occlusion
 
 using namespace std; // Standard namespace
 
@@ -32,6 +64,61 @@ namespace
         GLuint vaoPlane, vaoPyr, vaoCube, vaoRec, vaoRec2, vaoRec3;       // Handle for the vertex array object
         GLuint vboPlane, vboPyr, vboCube, vboRec, vboRec2, vboRec3;       // Handle for the vertex buffer object
         GLuint nVertices;                                                 // Number of indices of the mesh
+        GLuint nIndices;                                                  // Number of elements for indexed meshes, 0 when drawn as arrays
+        GLuint ebo;                                                       // Element buffer of indexed meshes
+        glm::vec3 boundsMin, boundsMax;                                   // Object-space bounding box
+    };
+
+    // Identifies each object of the scene, in draw order
+    enum SceneObject_Id {
+        OBJ_PLANE,      // Desk
+        OBJ_PYR,        // Pencil tip
+        OBJ_CUBE,       // Rubix cube
+        OBJ_REC,        // IPad
+        OBJ_REC2,       // Pencil body
+        OBJ_REC3,       // Airpods
+        NUM_SCENE_OBJECTS
+    };
+
+    // Stores the placement of a mesh in the world
+    struct GLSceneObject
+    {
+        GLuint vao;                     // Vertex array object of the mesh
+        GLuint vbo, ebo;                // Vertex and element buffers, copied into the mesh pool
+        GLuint nVertices;               // Number of vertices to draw
+        GLuint nIndices;                // Number of elements for indexed meshes, 0 when drawn as arrays
+        glm::mat4 model;                // World transform
+        glm::vec3 boundsMin, boundsMax; // Object-space bounding box
+        glm::vec4 material;             // Color tint (rgb) and the light kept in shadow (a)
+        int texture;                    // Handle of the surface texture in the texture array, -1 when untextured
+        bool isStatic;                  // Static objects are drawn into the cached shadow layer, dynamic ones every frame
+    };
+
+    // Per-object shader data, matches the std430 ObjectData struct of the shaders
+    struct GLObjectData
+    {
+        glm::mat4 model;
+        glm::vec4 material;
+        glm::vec4 uvProjection;     // object-space xz to texture coordinates: scale (xy) and offset (zw)
+        glm::vec4 uvRect;           // part of the array layer holding the object's texture
+        GLint layer;                // texture array layer, -1 when untextured
+        GLint padding[3];
+    };
+
+    // Object data slot of the streamed world cells, whose vertices are already in world space
+    const int OBJ_STREAMED_WORLD = NUM_SCENE_OBJECTS;
+    const int NUM_OBJECT_SLOTS = NUM_SCENE_OBJECTS + 1;
+
+    // Shader storage binding of the object data, "binding = 1" in the shaders
+    const GLuint OBJECT_DATA_BINDING = 1;
+    // Bytes each frame may upload through the ring
+    const GLsizeiptr OBJECT_RING_BYTES = 256 * 1024;
+
+    // How the scene pass decides what to draw
+    enum Cull_Mode {
+        CULL_NONE,      // every object drawn by its own URender* function
+        CULL_CPU,       // frustum test on the CPU, one multi-draw from the ring
+        CULL_GPU        // frustum test and draw commands generated by a compute shader
     };
 
     // Main GLFW window
@@ -43,8 +130,130 @@ namespace
     GLMesh gMeshRec;
     GLMesh gMeshRec2;
     GLMesh gMeshRec3;
+    // Generated shapes, shared between meshes with the same description
+    GeometryCache gGeometryCache;
+    // Their descriptions, so startup can build the vertex data before the context exists
+    const GeometryDesc PENCIL_TIP_SHAPE = GeometryDesc::Cone(0.5f, 1.0f, 24, glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
+    const GeometryDesc PENCIL_BODY_SHAPE = GeometryDesc::Cylinder(0.5f, 1.0f, 6, glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
+    const GeometryDesc AIRPODS_SHAPE = GeometryDesc::RoundedBox(glm::vec3(0.5f, 0.25f, 0.5f), 0.15f, 6, glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
+    // The boxy meshes are generated by the compiler and live in the executable's read-only data
+    constexpr PrimitiveColor RUBIX_FACE_COLORS[NUM_BOX_FACES] = {
+        { 0.0f, 1.0f, 0.0f, 1.0f },     // back, green
+        { 0.0f, 0.0f, 1.0f, 1.0f },     // front, blue
+        { 1.0f, 0.0f, 1.0f, 1.0f },     // left, purple
+        { 1.0f, 0.0f, 0.0f, 1.0f },     // right, red
+        { 1.0f, 1.0f, 1.0f, 1.0f },     // bottom, white
+        { 1.0f, 1.0f, 0.0f, 1.0f } };   // top, yellow
+    constexpr PrimitiveColor IPAD_FACE_COLORS[NUM_BOX_FACES] = {
+        { 0.33f, 0.33f, 0.33f, 1.0f }, { 0.33f, 0.33f, 0.33f, 1.0f }, { 0.33f, 0.33f, 0.33f, 1.0f },
+        { 0.33f, 0.33f, 0.33f, 1.0f }, { 0.33f, 0.33f, 0.33f, 1.0f },
+        { 0.0f, 0.0f, 0.0f, 1.0f } };   // black screen on top
+    constexpr PrimitiveBoxMesh<VERTEX_POSITION_COLOR> RUBIX_CUBE_MESH = PrimitiveBox<VERTEX_POSITION_COLOR>(0.5f, 0.5f, 0.5f, RUBIX_FACE_COLORS);
+    constexpr PrimitiveBoxMesh<VERTEX_POSITION_COLOR> IPAD_MESH = PrimitiveBox<VERTEX_POSITION_COLOR>(0.5f, 0.25f, 0.5f, IPAD_FACE_COLORS);
+    constexpr PrimitivePlaneMesh<VERTEX_POSITION_COLOR> DESK_MESH = PrimitivePlane<VERTEX_POSITION_COLOR>(2.0f, 2.0f, -2.0f, { 0.59f, 0.29f, 0.0f, 1.0f });
+    // the objects are placed resting on the desk top
+    static_assert(DESK_MESH.boundsMax[1] == -2.0f, "desk top moved");
+    // Scene objects
+    GLSceneObject gSceneObjects[NUM_SCENE_OBJECTS];
+    glm::vec3 gSceneBoundsMin, gSceneBoundsMax;   // World-space bounds of every object
+    // Per-object data upload, read by the shaders through the object index attribute
+    UploadRing gObjectRing;
+    GLuint gObjectIndexBuffer = 0;
+    // Culling: every scene mesh packed in one pool and drawn with multi-draw indirect
+    Cull_Mode gCullMode = CULL_GPU;
+    MeshPool gMeshPool;
+    GpuCuller gCuller;
+    std::vector<CullObject> gCullObjects;
+    std::vector<DrawElementsIndirectCommand> gCpuCommands;
+    // Picking: world boxes of the objects in a BVH, triangles kept on the CPU for the exact test
+    Bvh4 gPickBvh;
+    PickMesh gPickMeshes[NUM_SCENE_OBJECTS];
+    int gSelectedObject = -1;
+    // Camera collision, "--collide": object boxes in a sweep and prune, the camera's reach as one more box
+    bool gCollide = false;
+    SweepAndPrune gBroadphase;
+    int gCameraProxy = -1;
+    std::vector<glm::vec3> gCollisionScratch;   // world positions of the mesh being tested
+    GLuint gCullProgramId;
+    GLuint gDepthPyramidProgramId;
+    // Scene target scaled to hold the GPU frame time budget
+    DynamicResolution gResolution;
+    GLuint gUpscaleProgramId;
+    // Swap interval, frame limiter and input to swap latency
+    FramePacer gPacer;
+    // Frames drawn on demand, "--on-demand", or continuously
+    RedrawTracker gRedraw;
+    // World cells streamed from disk around the camera
+    CellStreamer gStreamer;
+    bool gStreaming = false;
+    // Surface textures of every object, packed into one array texture
+    TextureArrayPacker gTextures;
     // Shader program
     GLuint gProgramId;
+    GLuint gShadowProgramId;
+    // Vertex colors only, drawn while the other programs are still compiling
+    GLuint gPreviewProgramId;
+    // Every program is compiled through here, in parallel where the driver allows
+    ProgramCompiler gShaders;
+    // Startup phases, printed with the first full frame
+    StartupTimeline gStartup;
+    // Order of the opaque scene against the depth buffer, and the fragments it ends up shading
+    Depth_Order gDepthOrder = DEPTH_ORDER_FIXED;
+    GLuint gPrepassProgramId;
+    int gDrawOrder[NUM_SCENE_OBJECTS] = { OBJ_PLANE, OBJ_PYR, OBJ_CUBE, OBJ_REC, OBJ_REC2, OBJ_REC3 };
+    bool gCountOverdraw = false;
+    OverdrawCounter gOverdraw;
+    // Heightfield terrain that replaces the desk as the floor
+    ChunkedTerrain gTerrain;
+    GLuint gTerrainProgramId;
+    const float TERRAIN_SAMPLE_SPACING = 0.5f;  // world units between heightfield samples
+    const float TERRAIN_HEIGHT_SCALE = 40.0f;   // world height of the full 16-bit range
+    const float TERRAIN_CENTER_HEIGHT = -4.0f;  // the desk top, so the objects stand on the ground
+    // Every CPU stage runs as jobs on these workers, the main thread included, "--threads <n>"
+    JobSystem gJobs;
+    // Dust over the desk and sparks off the pencil tip, simulated on the job workers
+    ParticleSystem gParticles;
+    bool gParticlesOn = false;
+    UploadRing gParticleRing;       // live particles written straight into mapped memory
+    GLuint gParticleVao;
+    GLuint gParticleProgramId;
+    GLintptr gParticleOffset = 0;   // this frame's particles in the ring
+    GLsizei gParticleCount = 0;
+    const float PARTICLE_SIZE = 0.025f; // half the side of a particle's quad
+    const float PARTICLE_FLOOR = -4.0f; // the desk top
+    // Turntables spinning products on the desk, evaluated on the job workers
+    AnimationSet gAnimations;
+    bool gAnimating = false;
+    int gAnimatedObjects[NUM_SCENE_OBJECTS];    // scene object moved by each animation instance
+    const float TURNTABLE_SECONDS = 8.0f;       // one full turn
+    // Memory the frame builds and throws away, released all at once at the top of the next frame
+    FrameArena gFrameArena;
+    const size_t FRAME_ARENA_BYTES = 256 * 1024;
+    // Every C++ heap allocation of the process, counted by the operator new below in builds with
+    // MEMORY_COUNT_ALLOCATIONS; "--check-allocs <frames>" fails the run if the frame loop makes any once warmed up
+    std::atomic<unsigned long long> gHeapAllocations(0);
+#if MEMORY_COUNT_ALLOCATIONS
+    unsigned long long gReportAllocations = 0;      // count at the last report
+#endif
+    int gCheckAllocFrames = 0;
+    const float ALLOC_CHECK_WARMUP_SECONDS = 5.0f;  // caches, lists and arenas reach their size first
+    // Performance overlay, toggled with h or shown from the start with "--hud"
+    PerformanceHud gHud;
+    GLuint gHudProgramId;
+    bool gHudKeyDown = false;
+    // Ambient occlusion over the shaded scene, "--ssao"
+    AmbientOcclusion gAmbientOcclusion;
+    GLuint gSsaoPrepareProgramId;
+    GLuint gSsaoProgramId;
+    GLuint gSsaoBlurProgramId;
+    GLuint gSsaoUpsampleProgramId;
+    // Render service, "--serve"; requests bring their own camera and image size
+    RenderService gService;
+    GLfloat gViewAspect = 0.0f;     // aspect of the image being drawn, 0 for the window's
+
+    // shadows
+    ShadowCascades gShadows;
+    glm::vec3 gLightDirection(-0.4f, -1.0f, -0.3f); // direction the light travels in
 
     // camera
     Camera gCamera(glm::vec3(0.0f, 0.0f, 10.0f));
@@ -55,9 +264,57 @@ namespace
     // timing
     float gDeltaTime = 0.0f; // time between current frame and last frame
     float gLastFrame = 0.0f;
+    float gLastReport = 0.0f; // time the frame statistics were last printed
+
+    // shadow pass totals since the last report
+    unsigned int gShadowFrames = 0;
+    unsigned int gShadowRebuilds = 0;
+    float gShadowCpuMs = 0.0f;
+
+    // culling totals since the last report
+    unsigned int gCullFrames = 0;
+    unsigned int gCullVisible = 0;
+    float gCullCpuMs = 0.0f;
+
+    // camera collision totals since the last report
+    unsigned int gCollisionFrames = 0;
+    unsigned int gCollisionHits = 0;
+    size_t gCollisionTriangles = 0;
+    float gBroadphaseMs = 0.0f;     // object moves and the camera's, all counted
+    float gNarrowphaseMs = 0.0f;
 
 }
 
+#if MEMORY_COUNT_ALLOCATIONS
+// GCC checks that what operator new returns reaches operator delete; with the delete inlined into its caller it
+// would see the pointer go to free instead, so the delete stays a call
+#ifdef __GNUC__
+#define ALLOCATION_NOINLINE __attribute__((noinline))
+#else
+#define ALLOCATION_NOINLINE
+#endif
+
+// Replaces the global allocation functions only to count the calls; new[], the nothrow and the sized forms go through these
+void* operator new(size_t size)
+{
+    gHeapAllocations.fetch_add(1, std::memory_order_relaxed);
+    void* memory = malloc(size > 0 ? size : 1);
+    if (!memory)
+        throw std::bad_alloc();
+    return memory;
+}
+
+ALLOCATION_NOINLINE void operator delete(void* memory) noexcept
+{
+    free(memory);
+}
+
+ALLOCATION_NOINLINE void operator delete(void* memory, size_t) noexcept
+{
+    free(memory);
+}
+#endif
+
 /* User-defined Function prototypes to:
  * initialize the program, set the window size,
  * redraw graphics on the window when resized,
@@ -66,15 +323,45 @@ namespace
 bool UInitialize(int, char* [], GLFWwindow** window);
 void UResizeWindow(GLFWwindow* window, int width, int height);
 void UProcessInput(GLFWwindow* window);
+void USampleInput();
+bool USceneActive();
 void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos);
 void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset);
 void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
+void UWindowRefreshCallback(GLFWwindow*);
 void UCreateMeshPlane(GLMesh& meshPlane);
 void UCreateMeshPyr(GLMesh& meshPyr);
 void UCreateMeshCube(GLMesh& meshCube);
 void UCreateMeshRec(GLMesh& meshRec);
 void UCreateMeshRec2(GLMesh& meshRec2);
 void UCreateMeshRec3(GLMesh& meshRec3);
+void UCreateSceneObjects();
+void UComputeWorldBounds(const GLSceneObject& object, glm::vec3& worldMin, glm::vec3& worldMax);
+void UUpdateObjectTransform(int objectIndex, const glm::mat4& model);
+void UBuildPickData();
+int ULoadTextures();
+void UCreateTextures(int floorTexture);
+int UCookTexture(int argc, char* argv[], int first);
+int UPickObject(GLFWwindow* window, float& distance);
+void UBuildBroadphase();
+glm::vec3 UCollideCamera(const glm::vec3& from, const glm::vec3& to);
+int UBenchmarkCollision();
+void URecordStartupJob(const JobTiming& timing, void*);
+int UBenchmarkJobs();
+int UBenchmarkPicking();
+int UBenchmarkMath();
+void UAddParticleEmitters(ParticleSystem& particles, const glm::vec3& sparkSource);
+void UCreateParticles(int maxParticles);
+void USimulateParticles();
+void URenderParticles();
+int UBenchmarkParticles();
+AnimationTrackKeys UTurntableTrack(const glm::vec3& position, float angle, const glm::vec3& scale, float lift);
+void UCreateAnimations();
+void UAnimateObjects();
+int UBenchmarkAnimation();
+void UUseGeometry(const GeometryDesc& desc, GLuint& vao, GLuint& vbo, GLMesh& mesh);
+void UUsePrimitive(const PrimitiveData& primitive, const char* name, GLuint& vao, GLuint& vbo, GLMesh& mesh);
+int UBenchmarkGeometry();
 void UDestroyMeshPlane(GLMesh& meshPlane);
 void UDestroyMeshPyr(GLMesh& meshPyr);
 void UDestroyMeshCube(GLMesh& meshCube);
@@ -87,7 +374,32 @@ void URenderCube();
 void URenderRec();
 void URenderRec2();
 void URenderRec3();
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId);
+void URenderShadows();
+void UUploadObjectData();
+void USortFrontToBack();
+void UBeginScenePass();
+void UBeginDepthPrepass();
+void UBeginColorPass();
+void UEndColorPass();
+void UEndScenePass();
+void UBuildDrawLists();
+void URenderCulled();
+void URenderStreamedCells();
+bool UFileExists(const char* path);
+bool UOpenStreamedWorld(const char* path);
+void URenderTerrain();
+bool UOpenTerrain(const char* path);
+void UPresentFrame();
+void UPresentLastFrame();
+void URenderPreview();
+glm::mat4 UGetProjection();
+GLfloat UViewAspect();
+bool UServe(const char* socketPath);
+void UPoseServiceCamera(const ServiceRequest& request);
+void URenderServiceView();
+void USetCameraUniforms();
+int UBenchmarkCulling();
+void UReportFrameStats();
 void UDestroyShaderProgram(GLuint programId);
 
 
@@ -95,18 +407,51 @@ void UDestroyShaderProgram(GLuint programId);
 const GLchar* vertexShaderSource = GLSL(440,
     layout(location = 0) in vec3 position; // Vertex data from Vertex Attrib Pointer 0
     layout(location = 1) in vec4 color;  // Color data from Vertex Attrib Pointer 1
+    layout(location = 3) in uint objectIndex; // base instance of the draw, selects the object data
 
     out vec4 vertexColor; // variable to transfer color data to the fragment shader
+    out vec3 vertexWorldPosition; // world position, used for the shadow lookup
+    out float vertexViewDepth; // distance along the view direction, used to pick the shadow cascade
+    flat out vec4 vertexMaterial; // tint and shadow level of the object
+    out vec2 vertexUv; // 0..1 across the object's texture
+    flat out vec4 vertexUvRect; // where that texture sits in its layer
+    flat out int vertexLayer; // texture array layer, -1 when untextured
+
+    // Per-object data written by the CPU into the upload ring
+    struct ObjectData
+    {
+        mat4 model;
+        vec4 material;
+        vec4 uvProjection;
+        vec4 uvRect;
+        int layer;
+    };
+    layout(std430, binding = 1) readonly buffer Objects
+    {
+        ObjectData objects[];
+    };
 
     //Global variables for the  transform matrices
-    uniform mat4 model;
     uniform mat4 view;
     uniform mat4 projection;
 
+    // the depth prepass computes the same position, and the color pass tests it with GL_EQUAL
+    invariant gl_Position;
+
     void main()
     {
-        gl_Position = projection * view * model * vec4(position, 1.0f); // transforms vertices to clip coordinates
+        vec4 worldPosition = objects[objectIndex].model * vec4(position, 1.0f);
+        vec4 viewPosition = view * worldPosition;
+        gl_Position = projection * viewPosition; // transforms vertices to clip coordinates
         vertexColor = color; // references incoming color data
+        vertexWorldPosition = worldPosition.xyz;
+        vertexViewDepth = -viewPosition.z;
+        vertexMaterial = objects[objectIndex].material;
+
+        // Planar projection from above until the meshes carry their own texture coordinates
+        vertexUv = position.xz * objects[objectIndex].uvProjection.xy + objects[objectIndex].uvProjection.zw;
+        vertexUvRect = objects[objectIndex].uvRect;
+        vertexLayer = objects[objectIndex].layer;
     }
 );
 
@@ -114,919 +459,3507 @@ const GLchar* vertexShaderSource = GLSL(440,
 /* Fragment Shader Source Code*/
 const GLchar* fragmentShaderSource = GLSL(440,
     in vec4 vertexColor; // Variable to hold incoming color data from vertex shader
+    in vec3 vertexWorldPosition;
+    in float vertexViewDepth;
+    flat in vec4 vertexMaterial;
+    in vec2 vertexUv;
+    flat in vec4 vertexUvRect;
+    flat in int vertexLayer;
 
     out vec4 fragmentColor;
 
+    // Depth is tested before the shader runs, so hidden fragments are neither shaded nor counted
+    layout(early_fragment_tests) in;
+
+    // Shaded fragments of the frame, counted when measuring overdraw (OVERDRAW_COUNTER_BINDING = 0)
+    layout(binding = 0) uniform atomic_uint shadedFragments;
+    uniform bool countOverdraw;
+
+    // Every surface texture, one layer or atlas part per image
+    uniform sampler2DArray surfaceTextures;
+
+    // Shadow cascades (SHADOW_CASCADES = 3)
+    uniform sampler2DArrayShadow shadowMap;
+    uniform mat4 lightSpaceMatrices[3];
+    uniform vec3 cascadeSplits; // far distance of each cascade
+
+    // Returns 1 when the fragment is lit, 0 when fully in shadow (3x3 PCF)
+    float shadowFactor()
+    {
+        int cascade = 0;
+        if (vertexViewDepth > cascadeSplits.x)
+            cascade = 1;
+        if (vertexViewDepth > cascadeSplits.y)
+            cascade = 2;
+        if (vertexViewDepth > cascadeSplits.z)
+            return 1.0;
+
+        vec4 lightPosition = lightSpaceMatrices[cascade] * vec4(vertexWorldPosition, 1.0);
+        vec3 coords = lightPosition.xyz / lightPosition.w * 0.5 + 0.5;
+        if (coords.z > 1.0)
+            return 1.0;
+
+        vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+        float lit = 0.0;
+        for (int x = -1; x <= 1; ++x)
+            for (int y = -1; y <= 1; ++y)
+                lit += texture(shadowMap, vec4(coords.xy + vec2(x, y) * texel, float(cascade), coords.z));
+        return lit / 9.0;
+    }
+
     void main()
     {
-        fragmentColor = vec4(vertexColor);
+        vec4 surface = vertexColor;
+        if (vertexLayer >= 0)
+        {
+            // stay half a texel inside the image so filtering never reaches its atlas neighbours
+            vec2 halfTexel = 0.5 / vec2(textureSize(surfaceTextures, 0).xy);
+            vec2 uv = vertexUvRect.xy + clamp(vertexUv, 0.0, 1.0) * vertexUvRect.zw;
+            uv = clamp(uv, vertexUvRect.xy + halfTexel, vertexUvRect.xy + vertexUvRect.zw - halfTexel);
+            surface = texture(surfaceTextures, vec3(uv, float(vertexLayer)));
+        }
+        fragmentColor = vec4(surface.rgb * vertexMaterial.rgb * mix(vertexMaterial.a, 1.0, shadowFactor()), surface.a);
+        if (countOverdraw)
+            atomicCounterIncrement(shadedFragments);
     }
 );
 
 
-int main(int argc, char* argv[])
-{
-    if (!UInitialize(argc, argv, &gWindow))
-        return EXIT_FAILURE;
+/* Depth Prepass Vertex Shader Source Code*/
+const GLchar* prepassVertexShaderSource = GLSL(440,
+    layout(location = 0) in vec3 position; // Vertex data from Vertex Attrib Pointer 0
+    layout(location = 3) in uint objectIndex; // base instance of the draw, selects the object data
 
-    // Create the mesh
-    UCreateMeshPlane(gMeshPlane); // Calls the function to create the Vertex Buffer Object
-    UCreateMeshPyr(gMeshPyr); 
-    UCreateMeshCube(gMeshCube);
-    UCreateMeshRec(gMeshRec);
-    UCreateMeshRec2(gMeshRec2);
-    UCreateMeshRec3(gMeshRec3);
+    struct ObjectData
+    {
+        mat4 model;
+        vec4 material;
+        vec4 uvProjection;
+        vec4 uvRect;
+        int layer;
+    };
+    layout(std430, binding = 1) readonly buffer Objects
+    {
+        ObjectData objects[];
+    };
 
-    // Create the shader program
-    if (!UCreateShaderProgram(vertexShaderSource, fragmentShaderSource, gProgramId))
-        return EXIT_FAILURE;
+    uniform mat4 view;
+    uniform mat4 projection;
 
-    // Sets the background color of the window to black (it will be implicitely used by glClear)
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    // written exactly as in the scene vertex shader, so both passes produce the same depth
+    invariant gl_Position;
 
-    // render loop
-    // -----------
-    while (!glfwWindowShouldClose(gWindow))
+    void main()
     {
-        // per-frame timing
-        // --------------------
-        float currentFrame = glfwGetTime();
-        gDeltaTime = currentFrame - gLastFrame;
-        gLastFrame = currentFrame;
+        vec4 worldPosition = objects[objectIndex].model * vec4(position, 1.0f);
+        vec4 viewPosition = view * worldPosition;
+        gl_Position = projection * viewPosition;
+    }
+);
 
-        // input
-        // -----
-        UProcessInput(gWindow);
 
-        // Render this frame
-        URenderPlane();
-        URenderPyr();
-        URenderCube();
-        URenderRec();
-        URenderRec2();
-        URenderRec3();
+/* Terrain Vertex Shader Source Code, drawn with the scene fragment shader*/
+const GLchar* terrainVertexShaderSource = GLSL(440,
+    layout(location = 0) in vec3 grid; // column and row in the node, z is 1 on the skirt
+    layout(location = 4) in vec4 node; // per node: world x and z of its corner, side, height tile layer
+    layout(location = 5) in vec4 lod; // per node: morph start and end distance, skirt depth
+
+    out vec4 vertexColor;
+    out vec3 vertexWorldPosition;
+    out float vertexViewDepth;
+    flat out vec4 vertexMaterial;
+    out vec2 vertexUv;
+    flat out vec4 vertexUvRect;
+    flat out int vertexLayer;
+
+    uniform mat4 view;
+    uniform mat4 projection;
+    uniform sampler2DArray heights; // one TERRAIN_TILE_SAMPLES square tile per node
+    uniform vec2 heightMap; // 0..1 sample to world height: scale and offset
+    uniform vec2 terrainMax; // far corner of the heightfield, nodes hanging over it are pulled back to the edge
+    uniform vec3 cameraPosition;
+    uniform vec3 lightDirection;
+
+    const float QUADS = 32.0; // TERRAIN_TILE_QUADS
 
-        glfwPollEvents();
+    float heightAt(vec2 g)
+    {
+        return texture(heights, vec3((g + 0.5) / (QUADS + 1.0), node.w)).r * heightMap.x + heightMap.y;
     }
 
-    // Release mesh data
-    UDestroyMeshPlane(gMeshPlane);
-    UDestroyMeshPyr(gMeshPyr);
-    UDestroyMeshCube(gMeshCube);
-    UDestroyMeshRec(gMeshRec);
-    UDestroyMeshRec2(gMeshRec2);
-    UDestroyMeshRec3(gMeshRec3);
+    void main()
+    {
+        // Towards the end of the node's range odd vertices slide onto their even neighbours, so the node
+        // matches the next coarser level where the two meet
+        float quad = node.z / QUADS;
+        vec2 g = grid.xy;
+        vec2 xz = node.xy + g * quad;
+        float morph = clamp((distance(vec3(xz.x, heightAt(g), xz.y), cameraPosition) - lod.x) / (lod.y - lod.x), 0.0, 1.0);
+        g -= fract(g * 0.5) * 2.0 * morph;
+        xz = min(node.xy + g * quad, terrainMax);
+        float height = heightAt(g) - grid.z * lod.z;
+
+        // Grass on the flats and rock on the slopes, lit by the sun
+        float dx = heightAt(g + vec2(1.0, 0.0)) - heightAt(g - vec2(1.0, 0.0));
+        float dz = heightAt(g + vec2(0.0, 1.0)) - heightAt(g - vec2(0.0, 1.0));
+        vec3 normal = normalize(vec3(-dx, 2.0 * quad, -dz));
+        vec3 ground = mix(vec3(0.45, 0.42, 0.38), vec3(0.3, 0.45, 0.2), smoothstep(0.75, 0.9, normal.y));
+        vertexColor = vec4(ground * (0.35 + 0.65 * max(dot(normal, -lightDirection), 0.0)), 1.0);
+
+        vec4 viewPosition = view * vec4(xz.x, height, xz.y, 1.0);
+        gl_Position = projection * viewPosition;
+        vertexWorldPosition = vec3(xz.x, height, xz.y);
+        vertexViewDepth = -viewPosition.z;
+        vertexMaterial = vec4(1.0, 1.0, 1.0, 0.4);
+        vertexUv = vec2(0.0);
+        vertexUvRect = vec4(0.0);
+        vertexLayer = -1;
+    }
+);
 
-    // Release shader program
-    UDestroyShaderProgram(gProgramId);
 
-    exit(EXIT_SUCCESS); // Terminates the program successfully
-}
+/* Particle Vertex Shader Source Code*/
+const GLchar* particleVertexShaderSource = GLSL(440,
+    layout(location = 0) in vec3 position; // per particle
+    layout(location = 1) in vec4 color; // per particle, alpha fades with age
 
+    out vec4 vertexColor;
+    out vec2 corner;
 
-// Initialize GLFW, GLEW, and create a window
-bool UInitialize(int argc, char* argv[], GLFWwindow** window)
-{
-    // GLFW: initialize and configure
-    // ------------------------------
-    glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    uniform mat4 view;
+    uniform mat4 projection;
+    uniform float particleSize;
 
-#ifdef __APPLE__
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-#endif
+    void main()
+    {
+        // two triangles facing the camera, the corner picked by the vertex index
+        vec2 corners[6] = vec2[](vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(1.0, 1.0), vec2(1.0, 1.0), vec2(-1.0, 1.0), vec2(-1.0, -1.0));
+        corner = corners[gl_VertexID];
+        vec4 viewPosition = view * vec4(position, 1.0);
+        viewPosition.xy += corner * particleSize;
+        gl_Position = projection * viewPosition;
+        vertexColor = color;
+    }
+);
 
-    // GLFW: window creation
-    // ---------------------
-    * window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
-    if (*window == NULL)
+
+/* Particle Fragment Shader Source Code*/
+const GLchar* particleFragmentShaderSource = GLSL(440,
+    in vec4 vertexColor;
+    in vec2 corner;
+
+    out vec4 fragmentColor;
+
+    void main()
     {
-        std::cout << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
-        return false;
+        // round and soft edged, added onto what is behind
+        float falloff = max(1.0 - dot(corner, corner), 0.0);
+        fragmentColor = vec4(vertexColor.rgb * vertexColor.a * falloff, 1.0);
     }
-    glfwMakeContextCurrent(*window);
-    glfwSetFramebufferSizeCallback(*window, UResizeWindow);
-    glfwSetCursorPosCallback(*window, UMousePositionCallback);
-    glfwSetScrollCallback(*window, UMouseScrollCallback);
-    glfwSetMouseButtonCallback(*window, UMouseButtonCallback);
+);
 
-    // tell GLFW to capture our mouse
-    glfwSetInputMode(*window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
-    // GLEW: initialize
-    // ----------------
-    // Note: if using GLEW version 1.13 or earlier
-    glewExperimental = GL_TRUE;
-    GLenum GlewInitResult = glewInit();
+/* Performance Overlay Vertex Shader Source Code*/
+const GLchar* hudVertexShaderSource = GLSL(440,
+    layout(location = 0) in vec2 position; // window pixels from the top left
+    layout(location = 1) in vec2 texel; // font texel, the solid cell for plain quads
+    layout(location = 2) in vec4 color;
 
-    if (GLEW_OK != GlewInitResult)
+    out vec2 vertexTexel;
+    out vec4 vertexColor;
+
+    uniform vec2 screenSize;
+
+    void main()
     {
-        std::cerr << glewGetErrorString(GlewInitResult) << std::endl;
-        return false;
+        gl_Position = vec4(position / screenSize * vec2(2.0, -2.0) + vec2(-1.0, 1.0), 0.0, 1.0);
+        vertexTexel = texel;
+        vertexColor = color;
     }
+);
 
-    // Displays GPU OpenGL version
-    cout << "INFO: OpenGL Version: " << glGetString(GL_VERSION) << endl;
 
-    return true;
-}
+/* Performance Overlay Fragment Shader Source Code*/
+const GLchar* hudFragmentShaderSource = GLSL(440,
+    in vec2 vertexTexel;
+    in vec4 vertexColor;
 
+    out vec4 fragmentColor;
 
-void URenderPlane()
-{
-    // Enable z-depth
-    glEnable(GL_DEPTH_TEST);
+    uniform sampler2D font;
 
-    // Clear the frame and z buffers
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    void main()
+    {
+        // the font is only ever fetched texel for texel, glyphs stay sharp at any scale
+        fragmentColor = vec4(vertexColor.rgb, vertexColor.a * texelFetch(font, ivec2(vertexTexel), 0).r);
+    }
+);
 
-    // 1. Scales the object by 2
-    glm::mat4 scale = glm::scale(glm::vec3(2.0f, 2.0f, 2.0f));
-    // 2. Rotates shape by 15 degrees in the x axis
-    glm::mat4 rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-    // 3. Place object at the origin
-    glm::mat4 translation = glm::translate(glm::vec3(0.0f, 0.0f, 0.0f));
-    // Model matrix: transformations are applied right-to-left order
-    glm::mat4 model = translation * rotation * scale;
 
-    // camera/view transformation
-    glm::mat4 view = gCamera.GetViewMatrix();
+/* Shadow Depth Vertex Shader Source Code*/
+const GLchar* shadowVertexShaderSource = GLSL(440,
+    layout(location = 0) in vec3 position; // Vertex data from Vertex Attrib Pointer 0
+    layout(location = 3) in uint objectIndex; // base instance of the draw, selects the object data
 
-    // Creates a perspective projection
-    glm::mat4 projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+    struct ObjectData
+    {
+        mat4 model;
+        vec4 material;
+        vec4 uvProjection;
+        vec4 uvRect;
+        int layer;
+    };
+    layout(std430, binding = 1) readonly buffer Objects
+    {
+        ObjectData objects[];
+    };
 
-    // Set the shader to be used
-    glUseProgram(gProgramId);
+    uniform mat4 lightSpace; // view-projection of the cascade being rendered
 
-    // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(gProgramId, "model");
-    GLint viewLoc = glGetUniformLocation(gProgramId, "view");
-    GLint projLoc = glGetUniformLocation(gProgramId, "projection");
+    void main()
+    {
+        gl_Position = lightSpace * objects[objectIndex].model * vec4(position, 1.0f);
+    }
+);
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(gMeshPlane.vaoPlane);
+/* Shadow Depth Fragment Shader Source Code*/
+const GLchar* shadowFragmentShaderSource = GLSL(440,
+    void main()
+    {
+    }
+);
 
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, gMeshPlane.nVertices);
 
-}
+/* Culling Compute Shader Source Code*/
+const GLchar* cullComputeShaderSource = GLSL(440,
+    layout(local_size_x = 64) in; // CULL_GROUP_SIZE
 
-// Pencil Tip
-// ----------
-void URenderPyr()
-{
-    // Enable z-depth
-    glEnable(GL_DEPTH_TEST);
+    struct ObjectData
+    {
+        mat4 model;
+        vec4 material;
+        vec4 uvProjection;
+        vec4 uvRect;
+        int layer;
+    };
+    layout(std430, binding = 1) readonly buffer Objects
+    {
+        ObjectData objects[];
+    };
 
-    // 1. Scales the object by 2
-    glm::mat4 scale = glm::scale(glm::vec3(0.25f, 0.5f,0.25f));
-    // 2. Rotates shape by 15 degrees in the x axis
-    glm::mat4 rotation = glm::rotate(45.5f, glm::vec3(1.0f, 0.0f, 0.0f));
-    // 3. Place object at the origin
-    glm::mat4 translation = glm::translate(glm::vec3(-2.5f, -3.86f, 2.0f));
-    // Model matrix: transformations are applied right-to-left order
-    glm::mat4 model = translation * rotation * scale;
+    struct CullObject
+    {
+        vec4 boundsMin;
+        vec4 boundsMax;
+        uint firstIndex;
+        uint indexCount;
+        int baseVertex;
+        uint objectIndex;
+    };
+    layout(std430, binding = 2) readonly buffer CullObjects
+    {
+        CullObject cullObjects[];
+    };
 
-    // camera/view transformation
-    glm::mat4 view = gCamera.GetViewMatrix();
+    struct DrawCommand
+    {
+        uint count;
+        uint instanceCount;
+        uint firstIndex;
+        int baseVertex;
+        uint baseInstance;
+    };
+    layout(std430, binding = 3) writeonly buffer DrawCommands
+    {
+        DrawCommand commands[];
+    };
+    layout(std430, binding = 4) buffer DrawCount
+    {
+        uint drawCount;
+    };
 
-    // Creates a perspective projection
-    glm::mat4 projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+    uniform vec4 frustumPlanes[6];
+    uniform uint objectCount;
+    uniform bool compact; // append visible commands, otherwise keep every slot and zero the instance count
 
-    // Set the shader to be used
-    glUseProgram(gProgramId);
+    // Occlusion against last frame's max-depth pyramid
+    uniform bool useDepthPyramid;
+    uniform sampler2D depthPyramid;
+    uniform int pyramidLevels;
+    uniform vec2 pyramidSize;
+    uniform mat4 previousViewProjection;
 
-    // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(gProgramId, "model");
-    GLint viewLoc = glGetUniformLocation(gProgramId, "view");
-    GLint projLoc = glGetUniformLocation(gProgramId, "projection");
+    bool occluded(vec3 center, vec3 extent)
+    {
+        vec3 ndcMin = vec3(1.0);
+        vec3 ndcMax = vec3(-1.0);
+        for (int k = 0; k < 8; ++k)
+        {
+            vec3 corner = center + extent * vec3((k & 1) != 0 ? 1.0 : -1.0, (k & 2) != 0 ? 1.0 : -1.0, (k & 4) != 0 ? 1.0 : -1.0);
+            vec4 clip = previousViewProjection * vec4(corner, 1.0);
+            if (clip.w <= 0.0)
+                return false; // crosses the camera plane, keep it
+            vec3 ndc = clip.xyz / clip.w;
+            ndcMin = min(ndcMin, ndc);
+            ndcMax = max(ndcMax, ndc);
+        }
+
+        vec2 uvMin = clamp(ndcMin.xy * 0.5 + 0.5, 0.0, 1.0);
+        vec2 uvMax = clamp(ndcMax.xy * 0.5 + 0.5, 0.0, 1.0);
+        vec2 extentPixels = (uvMax - uvMin) * pyramidSize;
+        float level = clamp(ceil(log2(max(max(extentPixels.x, extentPixels.y), 1.0))), 0.0, float(pyramidLevels - 1));
+
+        // at this level the box covers at most 2x2 texels
+        float farthest = max(max(textureLod(depthPyramid, uvMin, level).r, textureLod(depthPyramid, vec2(uvMax.x, uvMin.y), level).r),
+            max(textureLod(depthPyramid, vec2(uvMin.x, uvMax.y), level).r, textureLod(depthPyramid, uvMax, level).r));
+        return ndcMin.z * 0.5 + 0.5 > farthest;
+    }
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    void main()
+    {
+        uint i = gl_GlobalInvocationID.x;
+        if (i >= objectCount)
+            return;
+
+        CullObject object = cullObjects[i];
+        mat4 model = objects[object.objectIndex].model;
+
+        vec3 center = (object.boundsMin.xyz + object.boundsMax.xyz) * 0.5;
+        vec3 extent = (object.boundsMax.xyz - object.boundsMin.xyz) * 0.5;
+        vec3 worldCenter = (model * vec4(center, 1.0)).xyz;
+        vec3 worldExtent = abs(model[0].xyz) * extent.x + abs(model[1].xyz) * extent.y + abs(model[2].xyz) * extent.z;
+
+        bool visible = true;
+        for (int p = 0; p < 6; ++p)
+        {
+            float radius = dot(worldExtent, abs(frustumPlanes[p].xyz));
+            if (dot(frustumPlanes[p].xyz, worldCenter) + frustumPlanes[p].w < -radius)
+                visible = false;
+        }
+        if (visible && useDepthPyramid)
+            visible = !occluded(worldCenter, worldExtent);
+
+        DrawCommand command;
+        command.count = object.indexCount;
+        command.instanceCount = visible ? 1u : 0u;
+        command.firstIndex = object.firstIndex;
+        command.baseVertex = object.baseVertex;
+        command.baseInstance = object.objectIndex;
+
+        if (compact)
+        {
+            if (visible)
+                commands[atomicAdd(drawCount, 1u)] = command;
+        }
+        else
+        {
+            commands[i] = command;
+        }
+    }
+);
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(gMeshPyr.vaoPyr);
 
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, gMeshPyr.nVertices);
+/* Depth Pyramid Compute Shader Source Code*/
+const GLchar* depthPyramidComputeShaderSource = GLSL(440,
+    layout(local_size_x = 8, local_size_y = 8) in;
 
-}
+    layout(r32f, binding = 0) writeonly uniform image2D destination;
+    uniform sampler2D source;
+    uniform int sourceLevel;
+    uniform bool copyLevel; // level 0: copy the depth buffer as is
+
+    void main()
+    {
+        ivec2 size = imageSize(destination);
+        ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+        if (texel.x >= size.x || texel.y >= size.y)
+            return;
+
+        if (copyLevel)
+        {
+            imageStore(destination, texel, vec4(texelFetch(source, texel, 0).r));
+            return;
+        }
+
+        // farthest depth of the 2x2 source texels, the last row and column also take an odd remainder
+        ivec2 sourceSize = textureSize(source, sourceLevel);
+        ivec2 first = texel * 2;
+        ivec2 last = min(first + ivec2(1), sourceSize - ivec2(1));
+        if (texel.x == size.x - 1)
+            last.x = sourceSize.x - 1;
+        if (texel.y == size.y - 1)
+            last.y = sourceSize.y - 1;
+
+        float farthest = 0.0;
+        for (int y = first.y; y <= last.y; ++y)
+            for (int x = first.x; x <= last.x; ++x)
+                farthest = max(farthest, texelFetch(source, ivec2(x, y), sourceLevel).r);
+        imageStore(destination, texel, vec4(farthest));
+    }
+);
+
+
+/* Ambient Occlusion Compute Shaders Source Code*/
+// View space normal and depth of one depth buffer texel in each 2x2, alternating in a checkerboard
+const GLchar* ssaoPrepareComputeShaderSource = GLSL(440,
+    layout(local_size_x = 8, local_size_y = 8) in;
+
+    layout(rgba16f, binding = 0) writeonly uniform image2D destination;
+    uniform sampler2D depthBuffer;
+    uniform ivec2 renderSize;           // part of the depth buffer the scene was drawn into
+    uniform mat4 inverseProjection;
+
+    vec3 viewPosition(ivec2 texel)
+    {
+        float depth = texelFetch(depthBuffer, texel, 0).r;
+        vec2 uv = (vec2(texel) + 0.5) / vec2(renderSize);
+        vec4 position = inverseProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+        return position.xyz / position.w;
+    }
+
+    void main()
+    {
+        ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+        ivec2 size = (renderSize + 1) / 2;
+        if (texel.x >= size.x || texel.y >= size.y)
+            return;
+
+        ivec2 source = min(texel * 2 + ivec2((texel.x + texel.y) & 1), renderSize - 1);
+        if (texelFetch(depthBuffer, source, 0).r >= 1.0)
+        {
+            // the background is far enough that nothing occludes it or is occluded by it
+            imageStore(destination, texel, vec4(0.0, 0.0, 1.0, -60000.0));
+            return;
+        }
+
+        // the normal takes the neighbor nearer in depth on each axis, so it does not bend over silhouettes
+        vec3 center = viewPosition(source);
+        vec3 right = viewPosition(min(source + ivec2(1, 0), renderSize - 1)) - center;
+        vec3 left = center - viewPosition(max(source - ivec2(1, 0), ivec2(0)));
+        vec3 up = viewPosition(min(source + ivec2(0, 1), renderSize - 1)) - center;
+        vec3 down = center - viewPosition(max(source - ivec2(0, 1), ivec2(0)));
+        vec3 dx = abs(right.z) < abs(left.z) ? right : left;
+        vec3 dy = abs(up.z) < abs(down.z) ? up : down;
+        imageStore(destination, texel, vec4(normalize(cross(dx, dy)), center.z));
+    }
+);
+
+
+// Occlusion from samples spiralling over a disc of fixed view space radius, rotated per 4x4 block
+const GLchar* ssaoComputeShaderSource = GLSL(440,
+    layout(local_size_x = 8, local_size_y = 8) in;
+
+    layout(r8, binding = 0) writeonly uniform image2D destination;
+    uniform sampler2D depthNormal;
+    uniform ivec2 size;
+    uniform vec2 viewScale;             // view space x and y of the screen edges at depth -1
+    uniform float projectionScale;      // pixels per view space unit at depth -1
+    uniform float radius;
+    uniform float maxRadiusPixels;
+    uniform float intensity;
+    uniform int sampleCount;
+
+    const float BACKGROUND_DEPTH = -50000.0;
+
+    vec3 viewPosition(ivec2 texel, float depth)
+    {
+        vec2 ndc = (vec2(texel) + 0.5) / vec2(size) * 2.0 - 1.0;
+        return vec3(ndc * viewScale * -depth, depth);
+    }
+
+    void main()
+    {
+        ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+        if (texel.x >= size.x || texel.y >= size.y)
+            return;
+
+        vec4 center = texelFetch(depthNormal, texel, 0);
+        float discPixels = projectionScale * radius / -center.w;
+        if (center.w < BACKGROUND_DEPTH || discPixels < 1.0)
+        {
+            imageStore(destination, texel, vec4(1.0));
+            return;
+        }
+        discPixels = min(discPixels, maxRadiusPixels);
+        vec3 position = viewPosition(texel, center.w);
+
+        // neighboring pixels start the spiral at different angles and distances; the blur averages them
+        int pattern = (texel.x & 3) + (texel.y & 3) * 4;
+        float rotation = float((pattern * 7) & 15) * (6.2831853 / 16.0);
+        float jitter = (float(pattern) + 0.5) / 16.0;
+
+        float radius2 = radius * radius;
+        float sum = 0.0;
+        for (int i = 0; i < sampleCount; ++i)
+        {
+            float alpha = (float(i) + jitter) / float(sampleCount);
+            float angle = alpha * 6.2831853 * 7.0 + rotation;
+            ivec2 tap = clamp(texel + ivec2(round(vec2(cos(angle), sin(angle)) * alpha * discPixels)), ivec2(0), size - 1);
+            float tapDepth = texelFetch(depthNormal, tap, 0).w;
+            if (tapDepth < BACKGROUND_DEPTH)
+                continue;
+
+            // falls off to nothing at the radius; the bias keeps flat surfaces from shadowing themselves
+            vec3 v = viewPosition(tap, tapDepth) - position;
+            float vv = dot(v, v);
+            float f = max(radius2 - vv, 0.0);
+            sum += f * f * f * max((dot(v, center.xyz) - 0.01) / (vv + 0.01), 0.0);
+        }
+        float occlusion = max(0.0, 1.0 - sum * intensity * 5.0 / (radius2 * radius2 * radius2 * float(sampleCount)));
+        imageStore(destination, texel, vec4(occlusion));
+    }
+);
+
+
+// One direction of the blur; taps across a depth edge get no weight, so occlusion stays on its surface
+const GLchar* ssaoBlurComputeShaderSource = GLSL(440,
+    layout(local_size_x = 8, local_size_y = 8) in;
+
+    layout(r8, binding = 0) writeonly uniform image2D destination;
+    uniform sampler2D occlusion;
+    uniform sampler2D depthNormal;
+    uniform ivec2 size;
+    uniform ivec2 direction;
+    uniform int blurRadius;
+    uniform float sharpness;
+
+    void main()
+    {
+        ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+        if (texel.x >= size.x || texel.y >= size.y)
+            return;
+
+        float depth = texelFetch(depthNormal, texel, 0).w;
+        float sigma = (float(blurRadius) + 1.0) * 0.5;
+        float sum = texelFetch(occlusion, texel, 0).r;
+        float weights = 1.0;
+        for (int r = -blurRadius; r <= blurRadius; ++r)
+        {
+            if (r == 0)
+                continue;
+            ivec2 tap = clamp(texel + direction * r, ivec2(0), size - 1);
+            float tapDepth = texelFetch(depthNormal, tap, 0).w;
+            float weight = exp(-float(r * r) / (2.0 * sigma * sigma)) * max(0.0, 1.0 - sharpness * abs(tapDepth - depth) / -depth);
+            sum += texelFetch(occlusion, tap, 0).r * weight;
+            weights += weight;
+        }
+        imageStore(destination, texel, vec4(sum / weights));
+    }
+);
+
+
+// Full resolution occlusion from the four nearest half resolution texels, weighted bilinearly and by depth,
+// multiplied into the shaded scene
+const GLchar* ssaoUpsampleComputeShaderSource = GLSL(440,
+    layout(local_size_x = 8, local_size_y = 8) in;
+
+    layout(rgba8, binding = 0) uniform image2D scene;
+    uniform sampler2D depthBuffer;
+    uniform sampler2D depthNormal;
+    uniform sampler2D occlusion;
+    uniform ivec2 renderSize;
+    uniform mat4 inverseProjection;
+    uniform float sharpness;
+
+    void main()
+    {
+        ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+        if (texel.x >= renderSize.x || texel.y >= renderSize.y)
+            return;
+
+        float depth = texelFetch(depthBuffer, texel, 0).r;
+        if (depth >= 1.0)
+            return;
+        // view space depth does not depend on x and y
+        vec4 position = inverseProjection * vec4(0.0, 0.0, depth * 2.0 - 1.0, 1.0);
+        float viewDepth = position.z / position.w;
+
+        ivec2 size = (renderSize + 1) / 2;
+        vec2 halfPosition = (vec2(texel) + 0.5) * 0.5 - 0.5;
+        ivec2 base = ivec2(floor(halfPosition));
+        vec2 fraction = halfPosition - vec2(base);
+        float sum = 0.0;
+        float weights = 0.0;
+        float nearest = 1.0;
+        float nearestDifference = 1.0e30;
+        for (int i = 0; i < 4; ++i)
+        {
+            ivec2 corner = ivec2(i & 1, i >> 1);
+            ivec2 tap = clamp(base + corner, ivec2(0), size - 1);
+            vec2 bilinear = mix(1.0 - fraction, fraction, vec2(corner));
+            float difference = abs(texelFetch(depthNormal, tap, 0).w - viewDepth);
+            float value = texelFetch(occlusion, tap, 0).r;
+            float weight = bilinear.x * bilinear.y * max(0.0, 1.0 - sharpness * difference / -viewDepth);
+            sum += value * weight;
+            weights += weight;
+            if (difference < nearestDifference)
+            {
+                nearestDifference = difference;
+                nearest = value;
+            }
+        }
+
+        // where no neighbor shares this surface, the one nearest in depth stands in
+        float ambient = weights > 0.001 ? sum / weights : nearest;
+        vec4 color = imageLoad(scene, texel);
+        imageStore(scene, texel, vec4(color.rgb * ambient, color.a));
+    }
+);
 
-// Rubix Cube
-// ----------
-void URenderCube()
-{
-    // Enable z-depth
-    glEnable(GL_DEPTH_TEST);
 
-    // 1. Scales the object by 2
-    glm::mat4 scale = glm::scale(glm::vec3(1.0f, 1.0f, 1.0f));
-    // 2. Rotates shape by 15 degrees in the y axis
-    glm::mat4 rotation = glm::rotate(10.0f, glm::vec3(0.0, 1.0f, 0.0f));
-    // 3. Place object at the origin
-    glm::mat4 translation = glm::translate(glm::vec3(2.5f, -3.5f, -1.0f));
-    // Model matrix: transformations are applied right-to-left order
-    glm::mat4 model = translation * rotation * scale;
+/* Upscale Vertex Shader Source Code*/
+const GLchar* upscaleVertexShaderSource = GLSL(440,
+    out vec2 uv;
+
+    void main()
+    {
+        // one triangle covering the screen, no vertex buffer needed
+        uv = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+        gl_Position = vec4(uv * 2.0 - 1.0, 0.0, 1.0);
+    }
+);
+
+
+/* Upscale Fragment Shader Source Code*/
+const GLchar* upscaleFragmentShaderSource = GLSL(440,
+    in vec2 uv;
+    out vec4 fragmentColor;
+
+    uniform sampler2D scene;
+    uniform vec2 uvScale;   // part of the target the scene was rendered into
+    uniform vec2 texelSize; // one texel of the target
+    uniform float sharpness; // 0 is plain bilinear
+
+    void main()
+    {
+        // keep the filter inside the rendered part of the target
+        vec2 limit = uvScale - texelSize * 0.5;
+        vec2 sceneUv = min(uv * uvScale, limit);
+        vec3 color = texture(scene, sceneUv).rgb;
+
+        if (sharpness > 0.0)
+        {
+            // unsharp mask against the four neighbours to win back detail lost to the bilinear stretch
+            vec3 neighbours = texture(scene, clamp(sceneUv + vec2(texelSize.x, 0.0), vec2(0.0), limit)).rgb
+                + texture(scene, clamp(sceneUv - vec2(texelSize.x, 0.0), vec2(0.0), limit)).rgb
+                + texture(scene, clamp(sceneUv + vec2(0.0, texelSize.y), vec2(0.0), limit)).rgb
+                + texture(scene, clamp(sceneUv - vec2(0.0, texelSize.y), vec2(0.0), limit)).rgb;
+            color = clamp(color + (color - neighbours * 0.25) * sharpness, 0.0, 1.0);
+        }
+        fragmentColor = vec4(color, 1.0);
+    }
+);
+
+
+/* Preview Shader Source Code, the smallest program that shows the scene while the others compile */
+const GLchar* previewVertexShaderSource = GLSL(440,
+    layout(location = 0) in vec3 position;
+    layout(location = 1) in vec4 color;
+
+    out vec4 vertexColor;
+
+    uniform mat4 model;
+    uniform mat4 view;
+    uniform mat4 projection;
+
+    void main()
+    {
+        gl_Position = projection * view * model * vec4(position, 1.0f);
+        vertexColor = color;
+    }
+);
+
+const GLchar* previewFragmentShaderSource = GLSL(440,
+    in vec4 vertexColor;
+    uniform vec3 tint;
+
+    out vec4 fragmentColor;
+
+    void main()
+    {
+        fragmentColor = vec4(vertexColor.rgb * tint, 1.0f);
+    }
+);
+
+
+int main(int argc, char* argv[])
+{
+    // Benchmarks and the texture cooker run without opening a window
+    // "--cook <image> <output.ktx2> [bc1|bc3|bc7] [--max-size <pixels>]"
+    // Job workers, "--threads <n>" (0, the default, uses every hardware thread)
+    int workerThreads = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--cook") == 0)
+            return UCookTexture(argc, argv, i + 1);
+        if (strcmp(argv[i], "--bench-geometry") == 0)
+            return UBenchmarkGeometry();
+        if (strcmp(argv[i], "--bench-pick") == 0)
+            return UBenchmarkPicking();
+        if (strcmp(argv[i], "--bench-math") == 0)
+            return UBenchmarkMath();
+        if (strcmp(argv[i], "--bench-particles") == 0)
+            return UBenchmarkParticles();
+        if (strcmp(argv[i], "--bench-animation") == 0)
+            return UBenchmarkAnimation();
+        if (strcmp(argv[i], "--bench-collision") == 0)
+            return UBenchmarkCollision();
+        if (strcmp(argv[i], "--bench-jobs") == 0)
+            return UBenchmarkJobs();
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+            workerThreads = atoi(argv[i + 1]);
+    }
+
+    // Startup jobs go on the timeline under the worker that ran them
+    gJobs.Start(workerThreads);
+    gJobs.SetTimingHook(URecordStartupJob, NULL);
+
+    // Shape data and image decoding need no GL context, so jobs build them while it is created
+    const int nShapes = 3;
+    const GeometryDesc shapes[nShapes] = { PENCIL_TIP_SHAPE, PENCIL_BODY_SHAPE, AIRPODS_SHAPE };
+    GeometryData shapeData[nShapes];
+    float shapeMs[nShapes];
+    JobCounter startupJobs;
+    for (int i = 0; i < nShapes; ++i)
+    {
+        gJobs.Run([&, i]() {
+            StartupTimeline::Clock::time_point start = gStartup.Now();
+            GenerateGeometry(shapes[i], shapeData[i]);
+            shapeMs[i] = chrono::duration<float, milli>(gStartup.Now() - start).count();
+        }, &startupJobs, "generate shape");
+    }
+    int floorTexture = -1;
+    gJobs.Run([&]() { floorTexture = ULoadTextures(); }, &startupJobs, "load textures");
+
+    StartupTimeline::Clock::time_point phase = gStartup.Now();
+    bool initialized = UInitialize(argc, argv, &gWindow);
+    gStartup.Record("window, context and GLEW", phase);
+    if (!initialized)
+    {
+        gJobs.Wait(startupJobs);
+        return EXIT_FAILURE;
+    }
+
+    // GPU memory budget, "--gpu-budget <MB>" overrides the default and 0 disables it
+    // Culling mode, "--cull none|cpu|gpu"
+    // GPU frame time budget, "--frame-budget <ms>", 0 keeps full resolution; "--upscale bilinear|sharpen"
+    // Pacing, "--swap-interval <n>", "--fps <limit>" and "--late-latch"
+    // Draw only when the camera, the objects or the resources change, "--on-demand"; continuous otherwise
+    // Streamed world, "--stream <file>" (generated when missing) and "--stream-budget <MB>"
+    // Draw order, "--depth-order fixed|prepass|sorted", and "--overdraw" to count shaded fragments per pixel
+    // Terrain floor instead of the desk, "--terrain <heights.r16|heights.png>" (a raw file is generated when missing)
+    // Particle effects, "--particles <max count>"
+    // Turntable animation of the cube and the airpods, "--animate"
+    // Camera collision with the scene objects, "--collide"
+    // Zero heap allocation check of the frame loop, "--check-allocs <frames>", exits when done; needs MEMORY_COUNT_ALLOCATIONS
+    // Performance overlay shown from the start, "--hud"; h toggles it
+    // Render service for other local processes, "--serve <socket path>"; the window stays hidden, SIGINT or SIGTERM stop it
+    // Ambient occlusion, "--ssao low|medium|high|auto" (auto picks by measured cost) and "--ssao-budget <ms>"
+    int swapInterval = 1;
+    int maxParticles = 0;
+    bool animate = false;
+    const char* streamPath = NULL;
+    const char* terrainPath = NULL;
+    const char* servePath = NULL;
+    const char* ssaoQuality = NULL;
+    bool benchCulling = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--gpu-budget") == 0 && i + 1 < argc)
+            GpuResources().SetBudget((size_t)atoi(argv[i + 1]) << 20);
+        if (strcmp(argv[i], "--cull") == 0 && i + 1 < argc)
+            gCullMode = strcmp(argv[i + 1], "none") == 0 ? CULL_NONE : strcmp(argv[i + 1], "cpu") == 0 ? CULL_CPU : CULL_GPU;
+        if (strcmp(argv[i], "--bench-cull") == 0)
+            benchCulling = true;
+        if (strcmp(argv[i], "--frame-budget") == 0 && i + 1 < argc)
+            gResolution.SetBudget((float)atof(argv[i + 1]));
+        if (strcmp(argv[i], "--upscale") == 0 && i + 1 < argc)
+            gResolution.SetFilter(strcmp(argv[i + 1], "bilinear") == 0 ? UPSCALE_BILINEAR : UPSCALE_SHARPEN);
+        if (strcmp(argv[i], "--swap-interval") == 0 && i + 1 < argc)
+            swapInterval = atoi(argv[i + 1]);
+        if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc)
+            gPacer.SetTargetFps(atof(argv[i + 1]));
+        if (strcmp(argv[i], "--late-latch") == 0)
+            gPacer.LateLatch = true;
+        if (strcmp(argv[i], "--on-demand") == 0)
+            gRedraw.OnDemand = true;
+        if (strcmp(argv[i], "--stream") == 0 && i + 1 < argc)
+            streamPath = argv[i + 1];
+        if (strcmp(argv[i], "--stream-budget") == 0 && i + 1 < argc)
+            gStreamer.SetBudget((size_t)atoi(argv[i + 1]) << 20);
+        if (strcmp(argv[i], "--depth-order") == 0 && i + 1 < argc)
+            gDepthOrder = strcmp(argv[i + 1], "prepass") == 0 ? DEPTH_ORDER_PREPASS : strcmp(argv[i + 1], "sorted") == 0 ? DEPTH_ORDER_FRONT_TO_BACK : DEPTH_ORDER_FIXED;
+        if (strcmp(argv[i], "--overdraw") == 0)
+            gCountOverdraw = true;
+        if (strcmp(argv[i], "--terrain") == 0 && i + 1 < argc)
+            terrainPath = argv[i + 1];
+        if (strcmp(argv[i], "--particles") == 0 && i + 1 < argc)
+            maxParticles = atoi(argv[i + 1]);
+        if (strcmp(argv[i], "--animate") == 0)
+            animate = true;
+        if (strcmp(argv[i], "--collide") == 0)
+            gCollide = true;
+        if (strcmp(argv[i], "--check-allocs") == 0 && i + 1 < argc)
+        {
+#if MEMORY_COUNT_ALLOCATIONS
+            gCheckAllocFrames = atoi(argv[i + 1]);
+#else
+            cerr << "ERROR: --check-allocs needs a build with MEMORY_COUNT_ALLOCATIONS defined to 1" << endl;
+            return EXIT_FAILURE;
+#endif
+        }
+        if (strcmp(argv[i], "--hud") == 0)
+            gHud.Visible = true;
+        if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+            servePath = argv[i + 1];
+        if (strcmp(argv[i], "--ssao") == 0 && i + 1 < argc)
+            ssaoQuality = argv[i + 1];
+        if (strcmp(argv[i], "--ssao-budget") == 0 && i + 1 < argc)
+            gAmbientOcclusion.SetBudget((float)atof(argv[i + 1]));
+    }
+    gPacer.SetSwapInterval(swapInterval);
+
+    // Every program goes to the driver at once, the small preview program first so it is ready soonest
+    phase = gStartup.Now();
+    const int previewShaders = gShaders.Add("preview program", previewVertexShaderSource, previewFragmentShaderSource);
+    const int sceneShaders = gShaders.Add("scene program", vertexShaderSource, fragmentShaderSource);
+    const int shadowShaders = gShaders.Add("shadow program", shadowVertexShaderSource, shadowFragmentShaderSource);
+    const int upscaleShaders = gShaders.Add("upscale program", upscaleVertexShaderSource, upscaleFragmentShaderSource);
+    // the shadow fragment shader writes nothing either, the prepass only needs its depth
+    const int prepassShaders = gShaders.Add("depth prepass program", prepassVertexShaderSource, shadowFragmentShaderSource);
+    const int cullShaders = gShaders.AddCompute("cull program", cullComputeShaderSource);
+    const int pyramidShaders = gShaders.AddCompute("depth pyramid program", depthPyramidComputeShaderSource);
+    const int terrainShaders = terrainPath ? gShaders.Add("terrain program", terrainVertexShaderSource, fragmentShaderSource) : -1;
+    const int particleShaders = maxParticles > 0 ? gShaders.Add("particle program", particleVertexShaderSource, particleFragmentShaderSource) : -1;
+    const int hudShaders = gShaders.Add("hud program", hudVertexShaderSource, hudFragmentShaderSource);
+    const int ssaoPrepareShaders = ssaoQuality ? gShaders.AddCompute("ssao prepare program", ssaoPrepareComputeShaderSource) : -1;
+    const int ssaoShaders = ssaoQuality ? gShaders.AddCompute("ssao program", ssaoComputeShaderSource) : -1;
+    const int ssaoBlurShaders = ssaoQuality ? gShaders.AddCompute("ssao blur program", ssaoBlurComputeShaderSource) : -1;
+    const int ssaoUpsampleShaders = ssaoQuality ? gShaders.AddCompute("ssao upsample program", ssaoUpsampleComputeShaderSource) : -1;
+    gStartup.Record(gShaders.Parallel() ? "submit programs, compiled in parallel" : "compile programs, no parallel compile", phase);
+
+    phase = gStartup.Now();
+    gJobs.Wait(startupJobs);
+    gJobs.SetTimingHook(NULL, NULL);
+    gStartup.Record("wait for startup jobs", phase);
+    for (int i = 0; i < nShapes; ++i)
+        gGeometryCache.Prepare(shapes[i], shapeData[i], shapeMs[i]);
+
+    // Unused generated shapes are the first thing given up when over budget
+    GpuResources().AddEvictionCallback([](size_t bytesOver) { return gGeometryCache.Evict(bytesOver); });
+    // then streamed cells out of view
+    GpuResources().AddEvictionCallback([](size_t bytesOver) { return gStreamer.Evict(bytesOver); });
+
+    // Create the mesh
+    phase = gStartup.Now();
+    UCreateMeshPlane(gMeshPlane); // Calls the function to create the Vertex Buffer Object
+    if (terrainPath)
+    {
+        // the terrain is the floor; the desk keeps its bounds but draws nothing
+        gMeshPlane.nVertices = 0;
+        gMeshPlane.nIndices = 0;
+    }
+    UCreateMeshPyr(gMeshPyr); 
+    UCreateMeshCube(gMeshCube);
+    UCreateMeshRec(gMeshRec);
+    UCreateMeshRec2(gMeshRec2);
+    UCreateMeshRec3(gMeshRec3);
+    gObjectRing.Create(OBJECT_RING_BYTES);
+    gObjectIndexBuffer = CreateObjectIndexBuffer();
+    UCreateSceneObjects();
+    UBuildDrawLists();
+    UBuildPickData();
+    UCreateTextures(floorTexture);
+    gStartup.Record("upload meshes and textures", phase);
+    if (streamPath && !UOpenStreamedWorld(streamPath))
+        return EXIT_FAILURE;
+    if (terrainPath && !UOpenTerrain(terrainPath))
+        return EXIT_FAILURE;
+    if (maxParticles > 0)
+        UCreateParticles(maxParticles);
+    if (animate)
+        UCreateAnimations();
+    if (gCollide)
+        UBuildBroadphase();
+    cout << "INFO: Geometry cache: " << gGeometryCache.Size() << " shapes generated, " << gGeometryCache.Hits << " shared" << endl;
+
+    // Until the rest of the pipeline has linked, frames are drawn with the preview program alone
+    phase = gStartup.Now();
+    gPreviewProgramId = gShaders.Finish(previewShaders);
+    gStartup.Record("link preview program", phase);
+    unsigned int previewFrames = 0;
+    while (gPreviewProgramId && !gShaders.AllReady() && !glfwWindowShouldClose(gWindow))
+    {
+        USampleInput();
+        URenderPreview();
+        glfwSwapBuffers(gWindow);
+        if (previewFrames++ == 0)
+            gStartup.Mark("first frame, preview");
+    }
+
+    // Check every program; compute programs failing only turns GPU culling off, the prepass one the prepass
+    phase = gStartup.Now();
+    gProgramId = gShaders.Finish(sceneShaders);
+    gShadowProgramId = gShaders.Finish(shadowShaders);
+    gUpscaleProgramId = gShaders.Finish(upscaleShaders);
+    gPrepassProgramId = gShaders.Finish(prepassShaders);
+    gCullProgramId = gShaders.Finish(cullShaders);
+    gDepthPyramidProgramId = gShaders.Finish(pyramidShaders);
+    gTerrainProgramId = terrainPath ? gShaders.Finish(terrainShaders) : 0;
+    gParticleProgramId = maxParticles > 0 ? gShaders.Finish(particleShaders) : 0;
+    gHudProgramId = gShaders.Finish(hudShaders);
+    gSsaoPrepareProgramId = ssaoQuality ? gShaders.Finish(ssaoPrepareShaders) : 0;
+    gSsaoProgramId = ssaoQuality ? gShaders.Finish(ssaoShaders) : 0;
+    gSsaoBlurProgramId = ssaoQuality ? gShaders.Finish(ssaoBlurShaders) : 0;
+    gSsaoUpsampleProgramId = ssaoQuality ? gShaders.Finish(ssaoUpsampleShaders) : 0;
+    if (!gProgramId || !gShadowProgramId || !gUpscaleProgramId || (terrainPath && !gTerrainProgramId))
+        return EXIT_FAILURE;
+    // the scene does not depend on the particles, they are only switched off
+    gParticlesOn = gParticlesOn && gParticleProgramId;
+    if (!gPrepassProgramId && gDepthOrder == DEPTH_ORDER_PREPASS)
+        gDepthOrder = DEPTH_ORDER_FIXED;
+
+    // Create the shadow cascades
+    gShadows.Create(gShadowProgramId);
+
+    // Create the scaled scene target stretched over the window
+    int framebufferWidth, framebufferHeight;
+    glfwGetFramebufferSize(gWindow, &framebufferWidth, &framebufferHeight);
+    gResolution.Create(gUpscaleProgramId, framebufferWidth, framebufferHeight);
+
+    // Ambient occlusion at half the scene's resolution; without every one of its programs the scene goes without
+    if (gSsaoPrepareProgramId && gSsaoProgramId && gSsaoBlurProgramId && gSsaoUpsampleProgramId)
+    {
+        gAmbientOcclusion.Create(gSsaoPrepareProgramId, gSsaoProgramId, gSsaoBlurProgramId, gSsaoUpsampleProgramId, framebufferWidth, framebufferHeight);
+        const bool automatic = strcmp(ssaoQuality, "auto") == 0;
+        gAmbientOcclusion.SetQuality(strcmp(ssaoQuality, "low") == 0 ? SSAO_LOW : strcmp(ssaoQuality, "high") == 0 ? SSAO_HIGH : SSAO_MEDIUM, automatic);
+        cout << "INFO: Ambient occlusion: " << gAmbientOcclusion.QualityName() << " preset" << (automatic ? ", picked by cost" : "")
+            << ", " << gAmbientOcclusion.Budget() << " ms budget" << endl;
+    }
+
+    // Create the culler; without the compute programs the scene falls back to CPU culling
+    if (gCullProgramId && gDepthPyramidProgramId)
+    {
+        gCuller.Create(gCullProgramId, gDepthPyramidProgramId);
+        gCuller.SetKeepOrder(gDepthOrder == DEPTH_ORDER_FRONT_TO_BACK);
+        gCuller.SetObjects(gCullObjects);
+        cout << "INFO: GPU culling: " << gCullObjects.size() << " objects, draw count " << (gCuller.HasDrawCount() ? "from the GPU" : "not supported, culled draws are zeroed") << endl;
+    }
+    else if (gCullMode == CULL_GPU)
+    {
+        gCullMode = CULL_CPU;
+    }
+    if (gCountOverdraw || gDepthOrder == DEPTH_ORDER_PREPASS)
+        gOverdraw.Create();
+    // without its program the overlay stays off, like the particles
+    if (gHudProgramId)
+        gHud.Create(gHudProgramId);
+    cout << "INFO: Scene drawn in " << DepthOrderName(gDepthOrder) << (gCountOverdraw ? ", counting overdraw" : "") << endl;
+    gStartup.Record("finish programs and render targets", phase);
+
+    if (benchCulling)
+        return UBenchmarkCulling();
+
+    // Sets the background color of the window to black (it will be implicitely used by glClear)
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+    gFrameArena.Create(FRAME_ARENA_BYTES);
+    int checkedFrames = 0;
+    unsigned long long checkedAllocations = 0, worstFrameAllocations = 0;
+    const float checkStart = (float)glfwGetTime() + ALLOC_CHECK_WARMUP_SECONDS;
+
+    // The service takes the place of the render loop and closes the window when it stops
+    if (servePath && !UServe(servePath))
+        return EXIT_FAILURE;
+
+    // render loop
+    // -----------
+    while (!glfwWindowShouldClose(gWindow))
+    {
+        const unsigned long long frameAllocations = gHeapAllocations.load(std::memory_order_relaxed);
+        gFrameArena.Reset();
+        RenderCounters() = FrameCounters();
+        gHud.BeginFrame();
+
+        // input, sampled here or after the waits below when late latching
+        // -----
+        if (!gPacer.LateLatch)
+            USampleInput();
+
+        // Wait for the frame limiter and for the GPU to release this frame's ring region
+        gRedraw.WaitForFrame(gPacer);
+        gObjectRing.BeginFrame();
+        if (gPacer.LateLatch)
+            USampleInput();
+        gHud.EndCpuPhase(HUD_CPU_WAIT);
+
+        // Move the animated objects before anything reads this frame's transforms
+        if (gAnimating)
+            UAnimateObjects();
+
+        // Advance the particles on the worker threads and write the live ones for this frame's draw
+        if (gParticlesOn)
+            USimulateParticles();
+
+        // Request cells around the camera and upload the ones that arrived
+        const unsigned int resourceLoads = gStreamer.Loads + gTerrain.Loads;
+        if (gStreaming)
+            gStreamer.Update(gCamera.Position, gCamera.Front);
+        // Pick the terrain nodes for this view and upload the height tiles that arrived
+        if (gTerrain.IsOpen())
+            gTerrain.Update(gCamera.Position, UGetProjection() * gCamera.GetViewMatrix());
+        if (gStreamer.Loads + gTerrain.Loads != resourceLoads)
+            gRedraw.MarkChanged();
+        gHud.EndCpuPhase(HUD_CPU_UPDATE);
+        gRedraw.Report(cout, gResolution.GpuMsTotal);
+
+        // On demand, nothing is drawn while nothing changed; a window that lost its contents gets the last frame again
+        if (!gRedraw.NeedsDraw())
+        {
+            if (gRedraw.NeedsPresent())
+            {
+                UPresentLastFrame();
+                gRedraw.FrameShownAgain();
+            }
+            else
+            {
+                gRedraw.FrameSkipped();
+            }
+            continue;
+        }
+
+        // Render this frame
+        gResolution.BeginFrame();
+        UUploadObjectData();
+        gHud.BeginGpuFrame();
+        URenderShadows();
+        gHud.EndGpuPhase(HUD_GPU_SHADOWS);
+        gResolution.BeginScene();
+        USortFrontToBack();
+        UBeginScenePass();
+        if (gCullMode == CULL_NONE)
+        {
+            if (gDepthOrder == DEPTH_ORDER_PREPASS)
+            {
+                UBeginDepthPrepass();
+                for (int i = 0; i < NUM_SCENE_OBJECTS; ++i)
+                {
+                    const GLSceneObject& object = gSceneObjects[i];
+                    glBindVertexArray(object.vao);
+                    if (object.nIndices > 0)
+                        glDrawElementsInstancedBaseInstance(GL_TRIANGLES, object.nIndices, GL_UNSIGNED_INT, NULL, 1, i);
+                    else
+                        glDrawArraysInstancedBaseInstance(GL_TRIANGLES, 0, object.nVertices, 1, i);
+                    ++RenderCounters().StateChanges;
+                    ++RenderCounters().DrawCalls;
+                }
+                UBeginColorPass();
+            }
+
+            void (*const renderers[NUM_SCENE_OBJECTS])() = { URenderPlane, URenderPyr, URenderCube, URenderRec, URenderRec2, URenderRec3 };
+            for (int i = 0; i < NUM_SCENE_OBJECTS; ++i)
+                renderers[gDrawOrder[i]]();
+            UEndColorPass();
+        }
+        else
+        {
+            URenderCulled();
+        }
+        if (gStreaming)
+            URenderStreamedCells();
+        if (gTerrain.IsOpen())
+            URenderTerrain();
+        if (gParticlesOn)
+            URenderParticles();
+        UEndScenePass();
+        // Darken the occluded parts of the shaded scene before it is stretched over the window
+        if (gAmbientOcclusion.IsCreated())
+            gAmbientOcclusion.Apply(gResolution.GetColorTexture(), gResolution.GetDepthTexture(), gResolution.RenderWidth, gResolution.RenderHeight, UGetProjection());
+        gHud.EndGpuPhase(HUD_GPU_SCENE);
+        UPresentFrame();
+        gRedraw.FrameDrawn();
+        UReportFrameStats();
+
+        if (!gStartup.Reported())
+        {
+            gStartup.Mark("first full frame");
+            gStartup.Report(cout);
+            cout << "INFO: Startup drew " << previewFrames << " preview frames";
+            // completion is polled once per preview frame, so these are upper bounds
+            if (gShaders.Parallel())
+            {
+                cout << "; programs ready after";
+                for (int p = 0; p < gShaders.Size(); ++p)
+                    cout << (p > 0 ? ", " : " ") << gShaders.Label(p) << " " << gShaders.ReadyMs(p) << " ms";
+            }
+            cout << endl;
+        }
+
+        // every allocation the frame made, its worker jobs and the I/O threads included
+        if (gCheckAllocFrames > 0 && gLastFrame > checkStart)
+        {
+            const unsigned long long allocations = gHeapAllocations.load(std::memory_order_relaxed) - frameAllocations;
+            checkedAllocations += allocations;
+            worstFrameAllocations = max(worstFrameAllocations, allocations);
+            if (++checkedFrames >= gCheckAllocFrames)
+                glfwSetWindowShouldClose(gWindow, true);
+        }
+    }
+
+    // Release mesh data
+    UDestroyMeshPlane(gMeshPlane);
+    UDestroyMeshPyr(gMeshPyr);
+    UDestroyMeshCube(gMeshCube);
+    UDestroyMeshRec(gMeshRec);
+    UDestroyMeshRec2(gMeshRec2);
+    UDestroyMeshRec3(gMeshRec3);
+    gGeometryCache.Destroy();
+    GpuResources().DeleteBuffer(gObjectIndexBuffer);
+    gObjectRing.Destroy();
+    gMeshPool.Destroy();
+    gCuller.Destroy();
+    gResolution.Destroy();
+    gOverdraw.Destroy();
+    gHud.Destroy();
+    gAmbientOcclusion.Destroy();
+    gStreamer.Close();
+    gTerrain.Close();
+    gTextures.Destroy();
+    if (maxParticles > 0)
+    {
+        gParticleRing.Destroy();
+        GpuResources().DeleteVertexArray(gParticleVao);
+    }
+    gJobs.Stop();
+
+    // Release shadow maps
+    gShadows.Destroy();
+
+    // Release shader program
+    UDestroyShaderProgram(gPreviewProgramId);
+    UDestroyShaderProgram(gProgramId);
+    UDestroyShaderProgram(gShadowProgramId);
+    UDestroyShaderProgram(gCullProgramId);
+    UDestroyShaderProgram(gDepthPyramidProgramId);
+    UDestroyShaderProgram(gUpscaleProgramId);
+    UDestroyShaderProgram(gPrepassProgramId);
+    UDestroyShaderProgram(gTerrainProgramId);
+    UDestroyShaderProgram(gParticleProgramId);
+    UDestroyShaderProgram(gHudProgramId);
+    UDestroyShaderProgram(gSsaoPrepareProgramId);
+    UDestroyShaderProgram(gSsaoProgramId);
+    UDestroyShaderProgram(gSsaoBlurProgramId);
+    UDestroyShaderProgram(gSsaoUpsampleProgramId);
+
+    // Anything still registered here was never released
+    GpuResources().ReportLeaks(cout);
+
+    if (gCheckAllocFrames > 0)
+    {
+        cout << "INFO: Heap allocations: " << checkedAllocations << " in " << checkedFrames << " frames after "
+            << ALLOC_CHECK_WARMUP_SECONDS << " s of warm-up, at most " << worstFrameAllocations << " in one frame" << endl;
+        if (checkedAllocations > 0 || checkedFrames < gCheckAllocFrames)
+        {
+            cerr << "ERROR: the frame loop allocated from the heap or stopped before " << gCheckAllocFrames << " frames" << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    exit(EXIT_SUCCESS); // Terminates the program successfully
+}
+
+
+// Initialize GLFW, GLEW, and create a window
+bool UInitialize(int argc, char* argv[], GLFWwindow** window)
+{
+    // GLFW: initialize and configure
+    // ------------------------------
+    glfwInit();
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 4);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+#ifdef __APPLE__
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+
+    // the render service only needs the context, its window is never shown
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--serve") == 0)
+            glfwWindowHint(GLFW_VISIBLE, false);
+    }
+
+    // GLFW: window creation
+    // ---------------------
+    * window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, WINDOW_TITLE, NULL, NULL);
+    if (*window == NULL)
+    {
+        std::cout << "Failed to create GLFW window" << std::endl;
+        glfwTerminate();
+        return false;
+    }
+    glfwMakeContextCurrent(*window);
+    glfwSetFramebufferSizeCallback(*window, UResizeWindow);
+    glfwSetCursorPosCallback(*window, UMousePositionCallback);
+    glfwSetScrollCallback(*window, UMouseScrollCallback);
+    glfwSetMouseButtonCallback(*window, UMouseButtonCallback);
+    glfwSetWindowRefreshCallback(*window, UWindowRefreshCallback);
+
+    // tell GLFW to capture our mouse
+    glfwSetInputMode(*window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+
+    // GLEW: initialize
+    // ----------------
+    // Note: if using GLEW version 1.13 or earlier
+    glewExperimental = GL_TRUE;
+    GLenum GlewInitResult = glewInit();
+
+    if (GLEW_OK != GlewInitResult)
+    {
+        std::cerr << glewGetErrorString(GlewInitResult) << std::endl;
+        return false;
+    }
+
+    // Displays GPU OpenGL version
+    cout << "INFO: OpenGL Version: " << glGetString(GL_VERSION) << endl;
+
+    return true;
+}
+
+
+// Shadow cascades
+// ---------------
+void URenderShadows()
+{
+    const GLfloat aspect = UViewAspect();
+
+    gShadows.SetLightDirection(gLightDirection);
+    gShadows.SetSceneBounds(gSceneBoundsMin, gSceneBoundsMax);
+    gShadows.Begin(gCamera, aspect, 0.1f);
+
+    // Static objects are only redrawn into the cascades whose cached layer is stale
+    for (int cascade = 0; cascade < SHADOW_CASCADES; ++cascade)
+    {
+        if (!gShadows.NeedsStaticLayer(cascade))
+            continue;
+
+        gShadows.BeginStaticLayer(cascade);
+        for (int i = 0; i < NUM_SCENE_OBJECTS; ++i)
+        {
+            if (gSceneObjects[i].isStatic)
+                gShadows.DrawCaster(gSceneObjects[i].vao, gSceneObjects[i].nVertices, gSceneObjects[i].nIndices, i);
+        }
+    }
+
+    // Dynamic objects are drawn on top of a copy of the cache every frame
+    bool hasDynamic = false;
+    for (int i = 0; i < NUM_SCENE_OBJECTS; ++i)
+        hasDynamic = hasDynamic || !gSceneObjects[i].isStatic;
+
+    if (hasDynamic)
+    {
+        gShadows.BeginDynamicLayers();
+        for (int cascade = 0; cascade < SHADOW_CASCADES; ++cascade)
+        {
+            gShadows.BeginDynamicLayer(cascade);
+            for (int i = 0; i < NUM_SCENE_OBJECTS; ++i)
+            {
+                if (!gSceneObjects[i].isStatic)
+                    gShadows.DrawCaster(gSceneObjects[i].vao, gSceneObjects[i].nVertices, gSceneObjects[i].nIndices, i);
+            }
+        }
+    }
+
+    int width, height;
+    glfwGetFramebufferSize(gWindow, &width, &height);
+    gShadows.End(width, height);
+
+    // Hands the cascades to the scene shader, and to the terrain which shades with it
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, gShadows.GetShadowTexture());
+    const GLuint shadedPrograms[2] = { gProgramId, gTerrainProgramId };
+    for (int p = 0; p < 2 && shadedPrograms[p]; ++p)
+    {
+        glUseProgram(shadedPrograms[p]);
+        ++RenderCounters().StateChanges;
+        glUniform1i(glGetUniformLocation(shadedPrograms[p], "shadowMap"), 0);
+        glUniformMatrix4fv(glGetUniformLocation(shadedPrograms[p], "lightSpaceMatrices"), SHADOW_CASCADES, GL_FALSE, glm::value_ptr(gShadows.LightSpace[0]));
+        glUniform3f(glGetUniformLocation(shadedPrograms[p], "cascadeSplits"), gShadows.SplitDepth[0], gShadows.SplitDepth[1], gShadows.SplitDepth[2]);
+    }
+    glUseProgram(gProgramId);
+    ++RenderCounters().StateChanges;
+
+    gShadowFrames++;
+    gShadowRebuilds += gShadows.Stats.staticRebuilds;
+    gShadowCpuMs += gShadows.Stats.cpuMs;
+}
+
+
+// Writes every object's transform and material into this frame's ring region, once the ring frame has begun
+// -----------------------------------------------------------------------------------------------------------
+void UUploadObjectData()
+{
+    RingSlice slice = gObjectRing.Allocate(sizeof(GLObjectData) * NUM_OBJECT_SLOTS);
+    if (slice.data == NULL)
+        return;
+
+    GLObjectData* objects = (GLObjectData*)slice.data;
+    for (int i = 0; i < NUM_SCENE_OBJECTS; ++i)
+    {
+        objects[i].model = gSceneObjects[i].model;
+        objects[i].material = gSceneObjects[i].material;
+        if (i == gSelectedObject)
+            objects[i].material = glm::vec4(1.0f, 0.75f, 0.3f, gSceneObjects[i].material.a); // highlight the selection
+
+        // The texture is stretched over the object's extent in x and z
+        const GLSceneObject& object = gSceneObjects[i];
+        glm::vec3 extent = glm::max(object.boundsMax - object.boundsMin, glm::vec3(1e-4f));
+        TextureSlot slot = gTextures.Slot(object.texture);
+        objects[i].uvProjection = glm::vec4(1.0f / extent.x, 1.0f / extent.z, -object.boundsMin.x / extent.x, -object.boundsMin.z / extent.z);
+        objects[i].uvRect = slot.uvRect;
+        objects[i].layer = slot.layer;
+    }
+    objects[OBJ_STREAMED_WORLD].model = glm::mat4(1.0f);
+    objects[OBJ_STREAMED_WORLD].material = glm::vec4(1.0f, 1.0f, 1.0f, 0.4f);
+    objects[OBJ_STREAMED_WORLD].layer = -1;
+    gObjectRing.BindRange(GL_SHADER_STORAGE_BUFFER, OBJECT_DATA_BINDING, slice);
+
+    USetCameraUniforms();
+
+    // One bind of the texture array serves every object of the frame
+    gTextures.Bind(GL_TEXTURE2);
+    glUniform1i(glGetUniformLocation(gProgramId, "surfaceTextures"), 2);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+
+// Camera/view transformation and perspective projection, shared by every object
+void USetCameraUniforms()
+{
+    glm::mat4 view = gCamera.GetViewMatrix();
+    glm::mat4 projection = UGetProjection();
+
+    glUseProgram(gProgramId);
+    glUniformMatrix4fv(glGetUniformLocation(gProgramId, "view"), 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(glGetUniformLocation(gProgramId, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    ++RenderCounters().StateChanges;
+    if (gDepthOrder == DEPTH_ORDER_PREPASS)
+    {
+        glUseProgram(gPrepassProgramId);
+        glUniformMatrix4fv(glGetUniformLocation(gPrepassProgramId, "view"), 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(glGetUniformLocation(gPrepassProgramId, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        glUseProgram(gProgramId);
+        RenderCounters().StateChanges += 2;
+    }
+}
+
+
+void URenderPlane()
+{
+    // Enable z-depth
+    glEnable(GL_DEPTH_TEST);
+
+    // Set the shader to be used; the transform comes from the upload ring
+    glUseProgram(gProgramId);
+
+    // Activate the VBOs contained within the mesh's VAO
+    glBindVertexArray(gMeshPlane.vaoPlane);
+
+    // Draws the triangles, the base instance selects this object's data
+    glDrawElementsInstancedBaseInstance(GL_TRIANGLES, gMeshPlane.nIndices, GL_UNSIGNED_INT, NULL, 1, OBJ_PLANE);
+    RenderCounters().StateChanges += 2;
+    ++RenderCounters().DrawCalls;
+
+}
+
+// Pencil Tip
+// ----------
+void URenderPyr()
+{
+    // Enable z-depth
+    glEnable(GL_DEPTH_TEST);
+
+    // Set the shader to be used; the transform comes from the upload ring
+    glUseProgram(gProgramId);
+
+    // Activate the VBOs contained within the mesh's VAO
+    glBindVertexArray(gMeshPyr.vaoPyr);
+
+    // Draws the triangles, the base instance selects this object's data
+    glDrawElementsInstancedBaseInstance(GL_TRIANGLES, gMeshPyr.nIndices, GL_UNSIGNED_INT, NULL, 1, OBJ_PYR);
+    RenderCounters().StateChanges += 2;
+    ++RenderCounters().DrawCalls;
+
+}
+
+// Rubix Cube
+// ----------
+void URenderCube()
+{
+    // Enable z-depth
+    glEnable(GL_DEPTH_TEST);
+
+    // Set the shader to be used; the transform comes from the upload ring
+    glUseProgram(gProgramId);
+
+    // Activate the VBOs contained within the mesh's VAO
+    glBindVertexArray(gMeshCube.vaoCube);
+
+    // Draws the triangles, the base instance selects this object's data
+    glDrawElementsInstancedBaseInstance(GL_TRIANGLES, gMeshCube.nIndices, GL_UNSIGNED_INT, NULL, 1, OBJ_CUBE);
+    RenderCounters().StateChanges += 2;
+    ++RenderCounters().DrawCalls;
+}
+
+// IPad
+// ----
+void URenderRec()
+{
+    // Enable z-depth
+    glEnable(GL_DEPTH_TEST);
+
+    // Set the shader to be used; the transform comes from the upload ring
+    glUseProgram(gProgramId);
+
+    // Activate the VBOs contained within the mesh's VAO
+    glBindVertexArray(gMeshRec.vaoRec);
+
+    // Draws the triangles, the base instance selects this object's data
+    glDrawElementsInstancedBaseInstance(GL_TRIANGLES, gMeshRec.nIndices, GL_UNSIGNED_INT, NULL, 1, OBJ_REC);
+    RenderCounters().StateChanges += 2;
+    ++RenderCounters().DrawCalls;
+}
+
+// Pencil body
+// -----------
+void URenderRec2()
+{
+    // Enable z-depth
+    glEnable(GL_DEPTH_TEST);
+
+    // Set the shader to be used; the transform comes from the upload ring
+    glUseProgram(gProgramId);
+
+    // Activate the VBOs contained within the mesh's VAO
+    glBindVertexArray(gMeshRec2.vaoRec2);
+
+    // Draws the triangles, the base instance selects this object's data
+    glDrawElementsInstancedBaseInstance(GL_TRIANGLES, gMeshRec2.nIndices, GL_UNSIGNED_INT, NULL, 1, OBJ_REC2);
+    RenderCounters().StateChanges += 2;
+    ++RenderCounters().DrawCalls;
+}
+
+// Airpods
+// -------
+void URenderRec3()
+{
+    // Enable z-depth
+    glEnable(GL_DEPTH_TEST);
+
+    // Set the shader to be used; the transform comes from the upload ring
+    glUseProgram(gProgramId);
+
+    // Activate the VBOs contained within the mesh's VAO
+    glBindVertexArray(gMeshRec3.vaoRec3);
+
+    // Draws the triangles, the base instance selects this object's data
+    glDrawElementsInstancedBaseInstance(GL_TRIANGLES, gMeshRec3.nIndices, GL_UNSIGNED_INT, NULL, 1, OBJ_REC3);
+    RenderCounters().StateChanges += 2;
+    ++RenderCounters().DrawCalls;
+}
+
+
+// Whole scene through the mesh pool, culled on the CPU or the GPU
+// ----------------------------------------------------------------
+void URenderCulled()
+{
+    // Enable z-depth
+    glEnable(GL_DEPTH_TEST);
+
+    glm::mat4 viewProjection = UGetProjection() * gCamera.GetViewMatrix();
+
+    if (gCullMode == CULL_GPU)
+    {
+        gCuller.Dispatch(viewProjection);
+
+        glBindVertexArray(gMeshPool.GetVertexArray());
+        if (gDepthOrder == DEPTH_ORDER_PREPASS)
+        {
+            UBeginDepthPrepass();
+            gCuller.Draw();
+            UBeginColorPass();
+        }
+        glUseProgram(gProgramId);
+        RenderCounters().StateChanges += 2;
+        gCuller.Draw();
+        UEndColorPass();
+
+        // This frame's depth becomes the occluder set of the next one
+        gCuller.BuildDepthPyramid(gResolution.GetDepthTexture(), gResolution.RenderWidth, gResolution.RenderHeight, viewProjection);
+    }
+    else
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        glm::mat4 models[NUM_SCENE_OBJECTS];
+        for (int i = 0; i < NUM_SCENE_OBJECTS; ++i)
+            models[i] = gSceneObjects[i].model;
+        CullObjectsCpu(gCullObjects, models, viewProjection, gCpuCommands);
+
+        // Commands go through the ring like the object data
+        RingSlice slice = gObjectRing.Allocate(gCpuCommands.size() * sizeof(DrawElementsIndirectCommand), sizeof(GLuint));
+        if (slice.data != NULL && !gCpuCommands.empty())
+        {
+            memcpy(slice.data, gCpuCommands.data(), slice.size);
+
+            glBindVertexArray(gMeshPool.GetVertexArray());
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, gObjectRing.GetBuffer());
+            if (gDepthOrder == DEPTH_ORDER_PREPASS)
+            {
+                UBeginDepthPrepass();
+                glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const void*)slice.offset, (GLsizei)gCpuCommands.size(), 0);
+                ++RenderCounters().DrawCalls;
+                UBeginColorPass();
+            }
+            glUseProgram(gProgramId);
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (const void*)slice.offset, (GLsizei)gCpuCommands.size(), 0);
+            RenderCounters().StateChanges += 2;
+            ++RenderCounters().DrawCalls;
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            UEndColorPass();
+        }
+
+        gCullCpuMs += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        gCullVisible += (unsigned int)gCpuCommands.size();
+    }
+    gCullFrames++;
+}
+
+
+// Orders the scene nearest first by the view depth of each world box center, for the front-to-back mode;
+// the cull list follows the same order, the GPU culler gets it again only when it changed
+// ----------------------------------------------------------------------------------------------------
+void USortFrontToBack()
+{
+    if (gDepthOrder != DEPTH_ORDER_FRONT_TO_BACK)
+        return;
+
+    glm::mat4 models[NUM_SCENE_OBJECTS];
+    glm::vec3 boundsMin[NUM_SCENE_OBJECTS], boundsMax[NUM_SCENE_OBJECTS], worldMin[NUM_SCENE_OBJECTS], worldMax[NUM_SCENE_OBJECTS];
+    for (int i = 0; i < NUM_SCENE_OBJECTS; ++i)
+    {
+        models[i] = gSceneObjects[i].model;
+        boundsMin[i] = gSceneObjects[i].boundsMin;
+        boundsMax[i] = gSceneObjects[i].boundsMax;
+    }
+    SimdMath().TransformAabbs(models, boundsMin, boundsMax, worldMin, worldMax, NUM_SCENE_OBJECTS);
+
+    float depth[NUM_SCENE_OBJECTS];
+    for (int i = 0; i < NUM_SCENE_OBJECTS; ++i)
+        depth[i] = glm::dot((worldMin[i] + worldMax[i]) * 0.5f - gCamera.Position, gCamera.Front);
+
+    // std::stable_sort would take a heap buffer every frame; equal depths keep their last order through
+    // each object's position instead, both lists built in the frame arena
+    int* drawPosition = gFrameArena.AllocateArray<int>(NUM_SCENE_OBJECTS);
+    for (int i = 0; i < NUM_SCENE_OBJECTS; ++i)
+        drawPosition[gDrawOrder[i]] = i;
+    std::sort(gDrawOrder, gDrawOrder + NUM_SCENE_OBJECTS,
+        [&](int a, int b) { return depth[a] < depth[b] || (depth[a] == depth[b] && drawPosition[a] < drawPosition[b]); });
+
+    GLuint* previous = gFrameArena.AllocateArray<GLuint>(gCullObjects.size());
+    int* cullPosition = gFrameArena.AllocateArray<int>(NUM_SCENE_OBJECTS);
+    for (size_t i = 0; i < gCullObjects.size(); ++i)
+    {
+        previous[i] = gCullObjects[i].objectIndex;
+        cullPosition[previous[i]] = (int)i;
+    }
+    std::sort(gCullObjects.begin(), gCullObjects.end(), [&](const CullObject& a, const CullObject& b) {
+        return depth[a.objectIndex] < depth[b.objectIndex]
+            || (depth[a.objectIndex] == depth[b.objectIndex] && cullPosition[a.objectIndex] < cullPosition[b.objectIndex]);
+    });
+
+    bool changed = false;
+    for (size_t i = 0; i < gCullObjects.size(); ++i)
+        changed = changed || gCullObjects[i].objectIndex != previous[i];
+    if (changed && gCullProgramId && gDepthPyramidProgramId)
+        gCuller.SetObjects(gCullObjects);
+}
+
+
+// Clears the scene target and starts counting the fragments the scene shades
+// ---------------------------------------------------------------------------
+void UBeginScenePass()
+{
+    // Enable z-depth
+    glEnable(GL_DEPTH_TEST);
+
+    // Clear the frame and z buffers
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    bool counting = gCountOverdraw && gOverdraw.Begin(gResolution.RenderWidth * gResolution.RenderHeight);
+    if (gTerrainProgramId)
+    {
+        glUseProgram(gTerrainProgramId);
+        glUniform1i(glGetUniformLocation(gTerrainProgramId, "countOverdraw"), counting);
+        ++RenderCounters().StateChanges;
+    }
+    glUseProgram(gProgramId);
+    glUniform1i(glGetUniformLocation(gProgramId, "countOverdraw"), counting);
+    ++RenderCounters().StateChanges;
+}
+
+
+// Depth only: no color writes and a program that only transforms positions
+void UBeginDepthPrepass()
+{
+    gOverdraw.PrepassTimer.Begin();
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glUseProgram(gPrepassProgramId);
+    ++RenderCounters().StateChanges;
+}
+
+
+// Shades only the fragments that won the prepass; depth is already final, so it is not written again
+void UBeginColorPass()
+{
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    gOverdraw.PrepassTimer.End();
+    glDepthFunc(GL_EQUAL);
+    glDepthMask(GL_FALSE);
+    glUseProgram(gProgramId);
+    ++RenderCounters().StateChanges;
+}
+
+
+void UEndColorPass()
+{
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+}
+
+
+void UEndScenePass()
+{
+    gOverdraw.End();
+}
+
+
+// Streamed world cells in view, after the scene objects
+// -----------------------------------------------------
+void URenderStreamedCells()
+{
+    glEnable(GL_DEPTH_TEST);
+    glUseProgram(gProgramId);
+    ++RenderCounters().StateChanges;
+    gStreamer.Draw(UGetProjection() * gCamera.GetViewMatrix(), OBJ_STREAMED_WORLD);
+}
+
+
+// Whether path names a file that can be read
+bool UFileExists(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return false;
+    fclose(file);
+    return true;
+}
+
+
+// Opens the streamed world, generating the pack file on first use; an existing file that does not open is
+// reported and left alone
+bool UOpenStreamedWorld(const char* path)
+{
+    if (!gStreamer.Open(path, gObjectIndexBuffer))
+    {
+        if (UFileExists(path))
+        {
+            cout << "ERROR: " << path << " is not a streamed world pack of this version" << endl;
+            return false;
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if (!WriteStreamWorld(path, STREAM_WORLD_CELLS) || !gStreamer.Open(path, gObjectIndexBuffer))
+        {
+            cout << "ERROR: could not create the streamed world " << path << endl;
+            return false;
+        }
+        cout << "INFO: Generated " << STREAM_WORLD_CELLS * STREAM_WORLD_CELLS << " world cells into " << path << " in "
+            << std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms" << endl;
+    }
+
+    gStreaming = true;
+    return true;
+}
+
+
+// Terrain nodes picked by this frame's update, after the scene objects; they only cover the floor, so
+// there is no prepass for them and they test depth as usual
+// -----------------------------------------------------------------------------------------------------
+void URenderTerrain()
+{
+    glEnable(GL_DEPTH_TEST);
+    glUseProgram(gTerrainProgramId);
+    ++RenderCounters().StateChanges;
+    glUniformMatrix4fv(glGetUniformLocation(gTerrainProgramId, "view"), 1, GL_FALSE, glm::value_ptr(gCamera.GetViewMatrix()));
+    glUniformMatrix4fv(glGetUniformLocation(gTerrainProgramId, "projection"), 1, GL_FALSE, glm::value_ptr(UGetProjection()));
+    glm::vec3 light = glm::normalize(gLightDirection);
+    glUniform3f(glGetUniformLocation(gTerrainProgramId, "lightDirection"), light.x, light.y, light.z);
+    // unused by the terrain, but every sampler needs a unit of its own type
+    glUniform1i(glGetUniformLocation(gTerrainProgramId, "surfaceTextures"), 2);
+    gTerrain.Draw(gTerrainProgramId, gCamera.Position);
+}
+
+
+// Opens the terrain heightfield, generating a raw one on first use; an existing file that does not open is
+// reported and left alone, and a missing .png is not generated, the generator only writes raw heights
+bool UOpenTerrain(const char* path)
+{
+    if (!gTerrain.Open(path, TERRAIN_SAMPLE_SPACING, TERRAIN_HEIGHT_SCALE, TERRAIN_CENTER_HEIGHT))
+    {
+        const size_t length = strlen(path);
+        if (UFileExists(path))
+        {
+            cout << "ERROR: could not read the terrain heightfield " << path << ", it must be a square 16-bit raw file or a png" << endl;
+            return false;
+        }
+        if (length > 4 && (strcmp(path + length - 4, ".png") == 0 || strcmp(path + length - 4, ".PNG") == 0))
+        {
+            cout << "ERROR: the terrain heightfield " << path << " does not exist, only raw heightfields are generated" << endl;
+            return false;
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if (!WriteTerrainHeights(path, TERRAIN_GENERATED_SAMPLES) || !gTerrain.Open(path, TERRAIN_SAMPLE_SPACING, TERRAIN_HEIGHT_SCALE, TERRAIN_CENTER_HEIGHT))
+        {
+            cout << "ERROR: could not open or create the terrain heightfield " << path << endl;
+            return false;
+        }
+        cout << "INFO: Generated a " << TERRAIN_GENERATED_SAMPLES << "x" << TERRAIN_GENERATED_SAMPLES << " heightfield into " << path << " in "
+            << std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms" << endl;
+    }
+
+    cout << "INFO: Terrain: " << gTerrain.Width() << "x" << gTerrain.Height() << " samples, " << gTerrain.Levels() << " levels of "
+        << TERRAIN_TILE_QUADS << "x" << TERRAIN_TILE_QUADS << " quad nodes" << endl;
+    return true;
+}
+
+
+// Dust hanging over the desk and sparks thrown up from a point, rates set so both fill about half the capacity
+void UAddParticleEmitters(ParticleSystem& particles, const glm::vec3& sparkSource)
+{
+    const float capacity = (float)particles.Capacity();
+
+    ParticleEmitter dust;
+    dust.position = glm::vec3(0.0f, -2.0f, 0.0f);
+    dust.positionSpread = glm::vec3(4.0f, 2.0f, 4.0f);
+    dust.velocity = glm::vec3(0.0f, 0.02f, 0.0f);
+    dust.velocitySpread = glm::vec3(0.08f, 0.04f, 0.08f);
+    dust.color = glm::vec4(0.8f, 0.75f, 0.6f, 0.15f);
+    dust.gravity = -0.01f;
+    dust.life = 6.0f;
+    dust.lifeSpread = 2.0f;
+    dust.rate = capacity * 0.45f / dust.life;
+    particles.AddEmitter(dust);
+
+    ParticleEmitter sparks;
+    sparks.position = sparkSource;
+    sparks.positionSpread = glm::vec3(0.05f);
+    sparks.velocity = glm::vec3(0.0f, 3.0f, 0.0f);
+    sparks.velocitySpread = glm::vec3(1.5f, 1.0f, 1.5f);
+    sparks.color = glm::vec4(1.0f, 0.55f, 0.15f, 1.0f);
+    sparks.gravity = -9.8f;
+    sparks.life = 1.5f;
+    sparks.lifeSpread = 0.5f;
+    sparks.rate = capacity * 0.45f / sparks.life;
+    particles.AddEmitter(sparks);
+}
+
+
+// Creates the particle storage, its upload ring and the vertex array reading particles per instance
+void UCreateParticles(int maxParticles)
+{
+    gParticles.Create(maxParticles, PARTICLE_FLOOR);
+
+    glm::vec3 tipMin, tipMax;
+    UComputeWorldBounds(gSceneObjects[OBJ_PYR], tipMin, tipMax);
+    UAddParticleEmitters(gParticles, (tipMin + tipMax) * 0.5f);
+
+    gParticleRing.Create(gParticles.Capacity() * sizeof(ParticleVertex));
+
+    // position and color come from the same buffer as a scene vertex, one particle per instance;
+    // the buffer offset moves every frame, so it is set per draw with glBindVertexBuffer
+    gParticleVao = GpuResources().GenVertexArray("particle vao");
+    glBindVertexArray(gParticleVao);
+    glVertexAttribFormat(0, 3, GL_FLOAT, GL_FALSE, offsetof(ParticleVertex, position));
+    glVertexAttribBinding(0, 0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribFormat(1, 4, GL_FLOAT, GL_FALSE, offsetof(ParticleVertex, color));
+    glVertexAttribBinding(1, 0);
+    glEnableVertexAttribArray(1);
+    glVertexBindingDivisor(0, 1);
+    glBindVertexArray(0);
+
+    gParticlesOn = true;
+    cout << "INFO: Particles: room for " << gParticles.Capacity() << " in chunks of " << PARTICLE_CHUNK << ", "
+        << gJobs.Threads() << " threads" << endl;
+}
+
+
+// Waits for the GPU to release this frame's ring region, then simulates and writes straight into it
+void USimulateParticles()
+{
+    gParticleRing.BeginFrame();
+    gParticles.Update(gDeltaTime, gJobs);
+
+    gParticleCount = 0;
+    RingSlice slice = gParticleRing.Allocate(gParticles.Live() * sizeof(ParticleVertex), sizeof(float));
+    if (slice.data == NULL)
+        return;
+
+    gParticleCount = gParticles.Write((ParticleVertex*)slice.data, gParticles.Live(), gJobs);
+    gParticleOffset = slice.offset;
+}
+
+
+// Every live particle in one instanced draw, blended additively over the scene without writing depth
+void URenderParticles()
+{
+    if (gParticleCount == 0)
+        return;
+
+    glUseProgram(gParticleProgramId);
+    glUniformMatrix4fv(glGetUniformLocation(gParticleProgramId, "view"), 1, GL_FALSE, glm::value_ptr(gCamera.GetViewMatrix()));
+    glUniformMatrix4fv(glGetUniformLocation(gParticleProgramId, "projection"), 1, GL_FALSE, glm::value_ptr(UGetProjection()));
+    glUniform1f(glGetUniformLocation(gParticleProgramId, "particleSize"), PARTICLE_SIZE);
+
+    glEnable(GL_DEPTH_TEST);
+    glDepthMask(GL_FALSE);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+
+    glBindVertexArray(gParticleVao);
+    glBindVertexBuffer(0, gParticleRing.GetBuffer(), gParticleOffset, sizeof(ParticleVertex));
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 6, gParticleCount);
+    glBindVertexArray(0);
+    RenderCounters().StateChanges += 3;
+    ++RenderCounters().DrawCalls;
+
+    glDisable(GL_BLEND);
+    glDepthMask(GL_TRUE);
+}
+
+
+// Ends the frame and shows it
+// ---------------------------
+void UPresentFrame()
+{
+    // Deactivate the Vertex Array Object
+    glBindVertexArray(0);
+    ++RenderCounters().StateChanges;
+
+    // Stretch the scaled scene over the window
+    gResolution.Present();
+    gHud.EndGpuPhase(HUD_GPU_PRESENT);
+    gHud.EndCpuPhase(HUD_CPU_RENDER);
+
+    // The overlay goes on top at the window's resolution
+    int width, height;
+    glfwGetFramebufferSize(gWindow, &width, &height);
+    gHud.Draw(width, height);
+
+    // The GPU may reuse this frame's ring region once everything above has executed
+    gObjectRing.EndFrame();
+    if (gParticlesOn)
+        gParticleRing.EndFrame();
+
+    // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
+    glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
+    gPacer.Presented();
+    gHud.EndCpuPhase(HUD_CPU_PRESENT);
+}
+
+
+// Shows the last drawn scene again, with a fresh overlay, when the window lost its contents but nothing changed
+void UPresentLastFrame()
+{
+    gResolution.PresentAgain();
+    int width, height;
+    glfwGetFramebufferSize(gWindow, &width, &height);
+    gHud.Draw(width, height);
+    glfwSwapBuffers(gWindow);
+}
+
+
+// Startup frame: the objects in their vertex colors, straight to the window, while the full pipeline compiles
+// ---------------------------
+void URenderPreview()
+{
+    int width, height;
+    glfwGetFramebufferSize(gWindow, &width, &height);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, width, height);
+    glEnable(GL_DEPTH_TEST);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    // the scene target does not exist yet, so the aspect comes from the framebuffer
+    glm::mat4 projection = glm::perspective(glm::radians(gCamera.Zoom), height > 0 ? (float)width / (float)height : 1.0f, 0.1f, 100.0f);
+    glm::mat4 view = gCamera.GetViewMatrix();
+
+    glUseProgram(gPreviewProgramId);
+    glUniformMatrix4fv(glGetUniformLocation(gPreviewProgramId, "view"), 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(glGetUniformLocation(gPreviewProgramId, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+    GLint modelLoc = glGetUniformLocation(gPreviewProgramId, "model");
+    GLint tintLoc = glGetUniformLocation(gPreviewProgramId, "tint");
+    for (int i = 0; i < NUM_SCENE_OBJECTS; ++i)
+    {
+        const GLSceneObject& object = gSceneObjects[i];
+        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(object.model));
+        glUniform3fv(tintLoc, 1, glm::value_ptr(object.material));
+        glBindVertexArray(object.vao);
+        if (object.nIndices > 0)
+            glDrawElements(GL_TRIANGLES, object.nIndices, GL_UNSIGNED_INT, NULL);
+        else
+            glDrawArrays(GL_TRIANGLES, 0, object.nVertices);
+    }
+    glBindVertexArray(0);
+}
+
+
+// Perspective projection of the camera; the aspect comes from the window, not the scaled scene target
+glm::mat4 UGetProjection()
+{
+    return glm::perspective(glm::radians(gCamera.Zoom), UViewAspect(), 0.1f, 100.0f);
+}
+
+
+// Width over height of the image being drawn: the window's, or a service request's while one is drawn
+GLfloat UViewAspect()
+{
+    return gViewAspect > 0.0f ? gViewAspect : gResolution.Aspect();
+}
+
+
+// Render service
+// --------------
+// Serves requests until stopped; the context, meshes, textures and programs stay resident between them.
+// Each batch uploads the objects once, then every distinct view gets its shadows and scene drawn off-screen.
+bool UServe(const char* socketPath)
+{
+    if (!gService.Open(socketPath))
+        return false;
+    cout << "INFO: Render service listening on " << socketPath << endl;
+
+    while (!gService.StopRequested())
+    {
+        const int requests = gService.WaitForBatch(SERVICE_IDLE_WAIT_MS);
+        gService.Report(cout);
+        if (requests == 0)
+            continue;
+
+        RenderCounters() = FrameCounters();
+        gObjectRing.BeginFrame();
+        UUploadObjectData();
+        for (int i = 0; i < requests; ++i)
+        {
+            if (gService.SharesView(i))
+                continue;
+            UPoseServiceCamera(gService.Request(i));
+            URenderShadows();
+            gService.BeginView(i);
+            URenderServiceView();
+            gService.EndView(i);
+        }
+        gObjectRing.EndFrame();
+        gService.FinishBatch();
+    }
+
+    gViewAspect = 0.0f;
+    gService.Close(cout);
+    glfwSetWindowShouldClose(gWindow, true);
+    return true;
+}
+
+
+// Moves the camera to a request's pose, and picks the terrain nodes and streamed cells for it
+void UPoseServiceCamera(const ServiceRequest& request)
+{
+    gCamera = Camera(glm::vec3(request.position[0], request.position[1], request.position[2]), glm::vec3(0.0f, 1.0f, 0.0f), request.yaw, request.pitch);
+    gCamera.Zoom = request.fov;
+    gViewAspect = (GLfloat)request.width / (GLfloat)request.height;
+    // every request is a camera cut, the last view's depth says nothing about this one
+    gCuller.InvalidateDepthPyramid();
+
+    if (gStreaming)
+        gStreamer.Update(gCamera.Position, gCamera.Front);
+    if (gTerrain.IsOpen())
+        gTerrain.Update(gCamera.Position, UGetProjection() * gCamera.GetViewMatrix());
+}
+
+
+// The scene for the posed camera into the bound service target, in the fixed draw order
+void URenderServiceView()
+{
+    USetCameraUniforms();
+    UBeginScenePass();
+    void (*const renderers[NUM_SCENE_OBJECTS])() = { URenderPlane, URenderPyr, URenderCube, URenderRec, URenderRec2, URenderRec3 };
+    for (int i = 0; i < NUM_SCENE_OBJECTS; ++i)
+        renderers[i]();
+    if (gStreaming)
+        URenderStreamedCells();
+    if (gTerrain.IsOpen())
+        URenderTerrain();
+    UEndScenePass();
+    glBindVertexArray(0);
+}
+
+
+// Prints the cost of the shadow pass every two seconds so it can be budgeted separately
+void UReportFrameStats()
+{
+    if (gLastFrame - gLastReport < 2.0f || gShadowFrames == 0)
+        return;
+
+    const ShadowStats& stats = gShadows.Stats;
+    cout << "INFO: Shadow pass: " << gShadowRebuilds << " static layer rebuilds, "
+        << stats.staticGpuMs << " ms GPU last rebuild, "
+        << stats.dynamicGpuMs << " ms GPU dynamic (" << stats.dynamicCasters << " casters), "
+        << gShadowCpuMs / gShadowFrames << " ms CPU per frame" << endl;
+    GpuResources().Report(cout);
+    cout << "INFO: Upload ring: " << gObjectRing.LastFrameBytes << " bytes per frame, "
+        << gObjectRing.Stalls << " stalls, " << gObjectRing.Overflows << " overflows" << endl;
+    if (gCullMode == CULL_GPU)
+        cout << "INFO: GPU culling: " << gCuller.Timer.AverageMs << " ms GPU per dispatch" << endl;
+    else if (gCullMode == CULL_CPU && gCullFrames > 0)
+        cout << "INFO: CPU culling: " << gCullVisible / gCullFrames << " of " << gCullObjects.size() << " objects visible, "
+            << gCullCpuMs / gCullFrames << " ms CPU per frame" << endl;
+    cout << "INFO: Dynamic resolution: " << gResolution.RenderWidth << "x" << gResolution.RenderHeight << " ("
+        << (int)(gResolution.Scale * 100.0f + 0.5f) << "%), " << gResolution.GpuMs << " ms GPU per frame of "
+        << gResolution.Budget() << " ms budget, " << gResolution.Changes << " scale changes" << endl;
+    gPacer.Report(cout);
+    if (gAmbientOcclusion.IsCreated())
+    {
+        gAmbientOcclusion.Timer.Collect();
+        cout << "INFO: Ambient occlusion: " << gAmbientOcclusion.QualityName() << " preset, " << gAmbientOcclusion.Timer.AverageMs
+            << " ms GPU of " << gAmbientOcclusion.Budget() << " ms budget, measured";
+        for (int q = 0; q < NUM_SSAO_QUALITIES; ++q)
+        {
+            cout << (q > 0 ? ", " : " ") << ssao_detail::PRESETS[q].name << " ";
+            if (gAmbientOcclusion.PresetMs[q] > 0.0f)
+                cout << gAmbientOcclusion.PresetMs[q] << " ms";
+            else
+                cout << "-";
+        }
+        cout << ", " << gAmbientOcclusion.Changes << " preset changes" << endl;
+    }
+    if (gCountOverdraw || gDepthOrder == DEPTH_ORDER_PREPASS)
+    {
+        gOverdraw.PrepassTimer.Collect();
+        cout << "INFO: Depth order: " << DepthOrderName(gDepthOrder);
+        if (gCountOverdraw)
+            cout << ", " << gOverdraw.AverageRatio << " shaded fragments per pixel";
+        if (gDepthOrder == DEPTH_ORDER_PREPASS)
+            cout << ", prepass " << gOverdraw.PrepassTimer.AverageMs << " ms GPU";
+        cout << endl;
+    }
+    if (gStreaming)
+        cout << "INFO: Streaming: " << gStreamer.ResidentCells() << " cells resident, " << gStreamer.ResidentBytes() / 1024 << " of "
+            << gStreamer.Budget() / 1024 << " KB, " << gStreamer.Hits << " hits, " << gStreamer.Misses << " misses, "
+            << gStreamer.IoStalls << " I/O stall frames, " << gStreamer.LockMisses << " lock misses, " << gStreamer.Loads << " loads, "
+            << gStreamer.Evictions << " evictions, " << gStreamer.BytesRead / 1024 << " KB read in " << gStreamer.IoMs << " ms" << endl;
+    if (gParticlesOn)
+        cout << "INFO: Particles: " << gParticleCount << " of " << gParticles.Capacity() << " live, " << gParticles.Dropped << " dropped, emit "
+            << gParticles.Times.emitMs << " ms, simulate " << gParticles.Times.simulateMs << " ms, write " << gParticles.Times.writeMs
+            << " ms CPU per frame on " << gJobs.Threads() << " threads" << endl;
+    if (gAnimating)
+        cout << "INFO: Animation: " << gAnimations.Instances() << " instances of " << gAnimations.Tracks() << " tracks, "
+            << gAnimations.DirtyCount() << " moved last frame, " << gAnimations.UpdateMs << " ms CPU per frame on "
+            << gJobs.Threads() << " threads" << endl;
+    if (gCollide && gCollisionFrames > 0)
+        cout << "INFO: Collision: " << gBroadphase.Size() << " boxes, " << gBroadphase.Pairs() << " pairs, broadphase "
+            << gBroadphaseMs / gCollisionFrames << " ms and " << (float)gBroadphase.Swaps / gCollisionFrames << " swaps per frame, narrowphase "
+            << gNarrowphaseMs / gCollisionFrames << " ms and " << gCollisionTriangles / gCollisionFrames << " triangles per frame, "
+            << gCollisionHits << " hits" << endl;
+    if (gTerrain.IsOpen())
+        cout << "INFO: Terrain: " << gTerrain.NodesDrawn << " nodes, " << gTerrain.Triangles << " triangles, " << gTerrain.ResidentTiles() << " of "
+            << TERRAIN_CACHE_TILES << " tiles resident, " << gTerrain.Loads << " loads, " << gTerrain.Evictions << " evictions, "
+            << gTerrain.Misses << " nodes drawn coarse while streaming, " << gTerrain.LockMisses << " lock misses, "
+            << gTerrain.BytesRead / 1024 << " KB read in " << gTerrain.IoMs << " ms" << endl;
+
+    // time each worker spent in jobs, the main thread's share included
+    unsigned int jobCount = 0, stealCount = 0;
+    cout << "INFO: Jobs: " << gJobs.Threads() << " threads busy";
+    for (int w = 0; w < gJobs.Threads(); ++w)
+    {
+        const JobWorkerStats stats = gJobs.WorkerStats(w);
+        cout << (w > 0 ? ", " : " ") << stats.busyMs / gShadowFrames;
+        jobCount += stats.jobs;
+        stealCount += stats.steals;
+    }
+    cout << " ms per frame, " << jobCount / gShadowFrames << " jobs and " << stealCount / gShadowFrames << " steals per frame" << endl;
+    gJobs.ResetStats();
+
+    size_t scratchHighWater = 0;
+    for (int w = 0; w < gJobs.Threads(); ++w)
+        scratchHighWater = max(scratchHighWater, gJobs.ScratchHighWater(w));
+    cout << "INFO: Memory: ";
+#if MEMORY_COUNT_ALLOCATIONS
+    const unsigned long long allocations = gHeapAllocations.load(std::memory_order_relaxed);
+    cout << (float)(allocations - gReportAllocations) / gShadowFrames << " heap allocations per frame, ";
+    gReportAllocations = allocations;
+#endif
+    cout << "frame arena " << gFrameArena.HighWater() / 1024 << " of " << gFrameArena.Capacity() / 1024 << " KB high water (" << gFrameArena.Spills
+        << " spills), job scratch " << scratchHighWater / 1024 << " KB high water, job pool " << gJobs.JobPoolHighWater() << " of "
+        << gJobs.JobPoolSize() << " high water" << endl;
+
+    gLastReport = gLastFrame;
+    gShadowFrames = 0;
+    gShadowRebuilds = 0;
+    gShadowCpuMs = 0.0f;
+    gCullFrames = 0;
+    gCullVisible = 0;
+    gCullCpuMs = 0.0f;
+    gCollisionFrames = 0;
+    gCollisionHits = 0;
+    gCollisionTriangles = 0;
+    gBroadphaseMs = 0.0f;
+    gNarrowphaseMs = 0.0f;
+    gBroadphase.ResetStats();
+}
+
+
+void UCreateMeshPlane(GLMesh& meshPlane)
+{
+    // Wooden desk top
+    UUsePrimitive(DESK_MESH.Data(), "plane", meshPlane.vaoPlane, meshPlane.vboPlane, meshPlane);
+}
+
+// Implements the UCreateMesh function
+// Pencil Tip
+// -----------------------------------
+void UCreateMeshPyr(GLMesh& meshPyr)
+{
+    // Cone with its base against the pencil body
+    UUseGeometry(PENCIL_TIP_SHAPE, meshPyr.vaoPyr, meshPyr.vboPyr, meshPyr);
+}
+
+// Implements the UCreateMesh function
+// Rubix Cube
+// -----------------------------------
+void UCreateMeshCube(GLMesh& meshCube)
+{
+    // Six colored faces
+    UUsePrimitive(RUBIX_CUBE_MESH.Data(), "cube", meshCube.vaoCube, meshCube.vboCube, meshCube);
+}
 
-    // camera/view transformation
-    glm::mat4 view = gCamera.GetViewMatrix();
+// Implements the UCreateMesh function
+// Ipad
+// -----------------------------------
+void UCreateMeshRec(GLMesh& meshRec)
+{
+    // Gray case with a black screen on top
+    UUsePrimitive(IPAD_MESH.Data(), "ipad", meshRec.vaoRec, meshRec.vboRec, meshRec);
+}
 
-    // Creates a perspective projection
-    glm::mat4 projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
 
-    // Set the shader to be used
-    glUseProgram(gProgramId);
+// Implements the UCreateMesh function
+// Pencil Body
+// -----------------------------------
+void UCreateMeshRec2(GLMesh& meshRec2)
+{
+    // Six sided cylinder, like a real pencil
+    UUseGeometry(PENCIL_BODY_SHAPE, meshRec2.vaoRec2, meshRec2.vboRec2, meshRec2);
+}
 
-    // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(gProgramId, "model");
-    GLint viewLoc = glGetUniformLocation(gProgramId, "view");
-    GLint projLoc = glGetUniformLocation(gProgramId, "projection");
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+// Implements the UCreateMesh function
+// Airpods
+// -----------------------------------
+void UCreateMeshRec3(GLMesh& meshRec3)
+{
+    // Box with rounded edges and corners
+    UUseGeometry(AIRPODS_SHAPE, meshRec3.vaoRec3, meshRec3.vboRec3, meshRec3);
+}
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(gMeshCube.vaoCube);
 
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, gMeshCube.nVertices);
+// Fills a mesh from the geometry cache, generating the shape on first use
+void UUseGeometry(const GeometryDesc& desc, GLuint& vao, GLuint& vbo, GLMesh& mesh)
+{
+    const GeometryMesh& shape = gGeometryCache.Acquire(desc);
+
+    vao = shape.vao;
+    vbo = shape.vbo;
+    mesh.ebo = shape.ebo;
+    mesh.nVertices = shape.nVertices;
+    mesh.nIndices = shape.nIndices;
+    mesh.boundsMin = shape.boundsMin;
+    mesh.boundsMax = shape.boundsMax;
 }
 
-// IPad
-// ----
-void URenderRec()
+// Fills a mesh from a compile-time generated primitive, uploading it into buffers of its own
+void UUsePrimitive(const PrimitiveData& primitive, const char* name, GLuint& vao, GLuint& vbo, GLMesh& mesh)
 {
-    // Enable z-depth
-    glEnable(GL_DEPTH_TEST);
+    UploadPrimitive(primitive, name, vao, vbo, mesh.ebo);
 
-    // 1. Scales the object by 2
-    glm::mat4 scale = glm::scale(glm::vec3(3.0f, 0.5f, 5.0f));
-    // 2. Rotates shape by 15 degrees in the y axis
-    glm::mat4 rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-    // 3. Place object at the origin
-    glm::mat4 translation = glm::translate(glm::vec3(0.0f, -3.9f, 0.0f));
-    // Model matrix: transformations are applied right-to-left order
-    glm::mat4 model = translation * rotation * scale;
+    mesh.nVertices = primitive.nVertices;
+    mesh.nIndices = primitive.nIndices;
+    mesh.boundsMin = glm::vec3(primitive.boundsMin[0], primitive.boundsMin[1], primitive.boundsMin[2]);
+    mesh.boundsMax = glm::vec3(primitive.boundsMax[0], primitive.boundsMax[1], primitive.boundsMax[2]);
+}
 
-    // camera/view transformation
-    glm::mat4 view = gCamera.GetViewMatrix();
 
-    // Creates a perspective projection
-    glm::mat4 projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+// Places every mesh in the world and computes the bounds of the scene
+void UCreateSceneObjects()
+{
+    GLMesh* meshes[NUM_SCENE_OBJECTS] = { &gMeshPlane, &gMeshPyr, &gMeshCube, &gMeshRec, &gMeshRec2, &gMeshRec3 };
+    GLuint vaos[NUM_SCENE_OBJECTS] = { gMeshPlane.vaoPlane, gMeshPyr.vaoPyr, gMeshCube.vaoCube, gMeshRec.vaoRec, gMeshRec2.vaoRec2, gMeshRec3.vaoRec3 };
+    GLuint vbos[NUM_SCENE_OBJECTS] = { gMeshPlane.vboPlane, gMeshPyr.vboPyr, gMeshCube.vboCube, gMeshRec.vboRec, gMeshRec2.vboRec2, gMeshRec3.vboRec3 };
 
-    // Set the shader to be used
-    glUseProgram(gProgramId);
+    // Desk plane
+    {
+        // 1. Scales the object by 2
+        glm::mat4 scale = glm::scale(glm::vec3(2.0f, 2.0f, 2.0f));
+        // 2. Rotates shape by 15 degrees in the x axis
+        glm::mat4 rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
+        // 3. Place object at the origin
+        glm::mat4 translation = glm::translate(glm::vec3(0.0f, 0.0f, 0.0f));
+        // Model matrix: transformations are applied right-to-left order
+        gSceneObjects[OBJ_PLANE].model = translation * rotation * scale;
+    }
 
-    // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(gProgramId, "model");
-    GLint viewLoc = glGetUniformLocation(gProgramId, "view");
-    GLint projLoc = glGetUniformLocation(gProgramId, "projection");
+    // Pencil Tip
+    {
+        // 1. Scales the cone to the width of the pencil body
+        glm::mat4 scale = glm::scale(glm::vec3(0.25f, 0.5f,0.25f));
+        // 2. Lays the cone along the z axis, pointing away from the body
+        glm::mat4 rotation = glm::rotate(glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+        // 3. Place object at the end of the pencil body
+        glm::mat4 translation = glm::translate(glm::vec3(-2.5f, -3.88f, 2.0f));
+        // Model matrix: transformations are applied right-to-left order
+        gSceneObjects[OBJ_PYR].model = translation * rotation * scale;
+    }
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    // Rubix Cube
+    {
+        // 1. Scales the object by 2
+        glm::mat4 scale = glm::scale(glm::vec3(1.0f, 1.0f, 1.0f));
+        // 2. Rotates shape by 15 degrees in the y axis
+        glm::mat4 rotation = glm::rotate(10.0f, glm::vec3(0.0, 1.0f, 0.0f));
+        // 3. Place object at the origin
+        glm::mat4 translation = glm::translate(glm::vec3(2.5f, -3.5f, -1.0f));
+        // Model matrix: transformations are applied right-to-left order
+        gSceneObjects[OBJ_CUBE].model = translation * rotation * scale;
+    }
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(gMeshRec.vaoRec);
+    // IPad
+    {
+        // 1. Scales the object by 2
+        glm::mat4 scale = glm::scale(glm::vec3(3.0f, 0.5f, 5.0f));
+        // 2. Rotates shape by 15 degrees in the y axis
+        glm::mat4 rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
+        // 3. Place object at the origin
+        glm::mat4 translation = glm::translate(glm::vec3(0.0f, -3.9f, 0.0f));
+        // Model matrix: transformations are applied right-to-left order
+        gSceneObjects[OBJ_REC].model = translation * rotation * scale;
+    }
 
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, gMeshRec.nVertices);
-}
+    // Pencil body
+    {
+        // 1. Scales the cylinder to the pencil's width and length
+        glm::mat4 scale = glm::scale(glm::vec3(0.25f, 3.0f, 0.25f));
+        // 2. Lays the cylinder along the z axis
+        glm::mat4 rotation = glm::rotate(glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+        // 3. Place object at the origin
+        glm::mat4 translation = glm::translate(glm::vec3(-2.5f, -3.88f, 0.25f));
+        // Model matrix: transformations are applied right-to-left order
+        gSceneObjects[OBJ_REC2].model = translation * rotation * scale;
+    }
 
-// Pencil body
-// -----------
-void URenderRec2()
-{
-    // Enable z-depth
-    glEnable(GL_DEPTH_TEST);
+    // Airpods
+    {
+        // 1. Scales the object by 2
+        glm::mat4 scale = glm::scale(glm::vec3(0.65f, 0.65f, 1.2f));
+        // 2. Rotates shape by 15 degrees in the y axis
+        glm::mat4 rotation = glm::rotate(10.0f, glm::vec3(0.0, 1.0f, 0.0f));
+        // 3. Place object at the origin
+        glm::mat4 translation = glm::translate(glm::vec3(2.5f, -3.84f, 0.78f));
+        // Model matrix: transformations are applied right-to-left order
+        gSceneObjects[OBJ_REC3].model = translation * rotation * scale;
+    }
 
-    // 1. Scales the object by 2
-    glm::mat4 scale = glm::scale(glm::vec3(0.25f, 0.5f, 3.0f));
-    // 2. Rotates shape by 15 degrees in the y axis
-    glm::mat4 rotation = glm::rotate(0.0f, glm::vec3(1.0, 1.0f, 1.0f));
-    // 3. Place object at the origin
-    glm::mat4 translation = glm::translate(glm::vec3(-2.5f, -3.88f, 0.25f));
-    // Model matrix: transformations are applied right-to-left order
-    glm::mat4 model = translation * rotation * scale;
+    gSceneBoundsMin = glm::vec3(1e30f);
+    gSceneBoundsMax = glm::vec3(-1e30f);
 
-    // camera/view transformation
-    glm::mat4 view = gCamera.GetViewMatrix();
+    for (int i = 0; i < NUM_SCENE_OBJECTS; ++i)
+    {
+        GLSceneObject& object = gSceneObjects[i];
+        object.vao = vaos[i];
+        object.vbo = vbos[i];
+        object.ebo = meshes[i]->ebo;
+        object.nVertices = meshes[i]->nVertices;
+        object.nIndices = meshes[i]->nIndices;
+        object.boundsMin = meshes[i]->boundsMin;
+        object.boundsMax = meshes[i]->boundsMax;
+        object.material = glm::vec4(1.0f, 1.0f, 1.0f, 0.4f);
+        object.isStatic = true;
+
+        // Draws of this object pass its index as base instance
+        BindObjectIndexAttribute(object.vao, gObjectIndexBuffer);
+
+        // Grow the scene bounds by the world box of the object
+        glm::vec3 worldMin, worldMax;
+        UComputeWorldBounds(object, worldMin, worldMax);
+        gSceneBoundsMin = glm::min(gSceneBoundsMin, worldMin);
+        gSceneBoundsMax = glm::max(gSceneBoundsMax, worldMax);
+    }
 
-    // Creates a perspective projection
-    glm::mat4 projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+    gShadows.InvalidateStatic();
+}
 
-    // Set the shader to be used
-    glUseProgram(gProgramId);
 
-    // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(gProgramId, "model");
-    GLint viewLoc = glGetUniformLocation(gProgramId, "view");
-    GLint projLoc = glGetUniformLocation(gProgramId, "projection");
+// Reads the surface textures into the array packer without touching GL, so startup runs it on a worker.
+// Returns the floor's handle; objects without a texture keep their vertex colors
+int ULoadTextures()
+{
+    // a cooked floor is used when present, otherwise the source image is decoded and mipmapped here
+    int floorTexture = -1;
+    if (FILE* cooked = fopen("floor.ktx2", "rb"))
+    {
+        fclose(cooked);
+        floorTexture = gTextures.AddKtx2File("floor.ktx2");
+    }
+    if (floorTexture < 0)
+        floorTexture = gTextures.AddFile("floor.jpg");
+    return floorTexture;
+}
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(gMeshRec2.vaoRec2);
+// Uploads the loaded textures and hands the objects their slots
+void UCreateTextures(int floorTexture)
+{
+    for (int i = 0; i < NUM_SCENE_OBJECTS; ++i)
+        gSceneObjects[i].texture = -1;
 
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, gMeshRec2.nVertices);
-}
+    // BPTC is core since 4.2 but S3TC is still an extension; a cooked floor the GPU cannot sample falls back to the source image
+    if (gTextures.Compressed() && gTextures.Format() != GL_COMPRESSED_RGBA_BPTC_UNORM && !GLEW_EXT_texture_compression_s3tc)
+    {
+        cout << "WARNING: S3TC textures are not supported, loading floor.jpg instead" << endl;
+        gTextures.Destroy();
+        floorTexture = gTextures.AddFile("floor.jpg");
+    }
+    gSceneObjects[OBJ_PLANE].texture = floorTexture;
 
-// Airpods
-// -------
-void URenderRec3()
-{
-    // Enable z-depth
-    glEnable(GL_DEPTH_TEST);
+    if (gTextures.Size() > 0 && gTextures.Build())
+    {
+        cout << "INFO: Texture array: " << gTextures.Size() << " textures in " << gTextures.Layers() << " layers"
+            << (gTextures.Compressed() ? ", block compressed" : "") << endl;
+        return;
+    }
 
-    // 1. Scales the object by 2
-    glm::mat4 scale = glm::scale(glm::vec3(0.65f, 0.65f, 1.2f));
-    // 2. Rotates shape by 15 degrees in the y axis
-    glm::mat4 rotation = glm::rotate(10.0f, glm::vec3(0.0, 1.0f, 0.0f));
-    // 3. Place object at the origin
-    glm::mat4 translation = glm::translate(glm::vec3(2.5f, -3.84f, 0.78f));
-    // Model matrix: transformations are applied right-to-left order
-    glm::mat4 model = translation * rotation * scale;
+    for (int i = 0; i < NUM_SCENE_OBJECTS; ++i)
+        gSceneObjects[i].texture = -1;
+}
 
-    // camera/view transformation
-    glm::mat4 view = gCamera.GetViewMatrix();
 
-    // Creates a perspective projection
-    glm::mat4 projection = glm::perspective(glm::radians(gCamera.Zoom), (GLfloat)WINDOW_WIDTH / (GLfloat)WINDOW_HEIGHT, 0.1f, 100.0f);
+// Decodes an image, builds its mips and writes them block compressed to a KTX2 file the scene loads directly
+int UCookTexture(int argc, char* argv[], int first)
+{
+    if (first + 1 >= argc)
+    {
+        cout << "ERROR: usage: --cook <image> <output.ktx2> [bc1|bc3|bc7] [--max-size <pixels>]" << endl;
+        return EXIT_FAILURE;
+    }
 
-    // Set the shader to be used
-    glUseProgram(gProgramId);
+    const char* input = argv[first];
+    const char* output = argv[first + 1];
+    Cooked_Format format = COOKED_BC7;
+    int maxSize = TEXCOOK_DEFAULT_MAX_SIZE;
+    for (int i = first + 2; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "bc1") == 0)
+            format = COOKED_BC1;
+        else if (strcmp(argv[i], "bc3") == 0)
+            format = COOKED_BC3;
+        else if (strcmp(argv[i], "bc7") == 0)
+            format = COOKED_BC7;
+        else if (strcmp(argv[i], "--max-size") == 0 && i + 1 < argc)
+            maxSize = max(1, atoi(argv[++i]));
+    }
 
-    // Retrieves and passes transform matrices to the Shader program
-    GLint modelLoc = glGetUniformLocation(gProgramId, "model");
-    GLint viewLoc = glGetUniformLocation(gProgramId, "view");
-    GLint projLoc = glGetUniformLocation(gProgramId, "projection");
+    // same orientation as the images the texture array decodes itself
+    CookImage source;
+    int channels;
+    stbi_set_flip_vertically_on_load(1);
+    unsigned char* pixels = stbi_load(input, &source.width, &source.height, &channels, 4);
+    if (!pixels)
+    {
+        cout << "ERROR: could not load " << input << ": " << stbi_failure_reason() << endl;
+        return EXIT_FAILURE;
+    }
+    source.pixels.assign(pixels, pixels + (size_t)source.width * source.height * 4);
+    stbi_image_free(pixels);
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    auto start = chrono::steady_clock::now();
+    CookedTexture cooked;
+    vector<CookImage> levels;
+    CookTexture(source, format, maxSize, cooked, levels);
+    double cookMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
 
-    // Activate the VBOs contained within the mesh's VAO
-    glBindVertexArray(gMeshRec3.vaoRec3);
+    if (!WriteKtx2(output, cooked))
+    {
+        cout << "ERROR: could not write " << output << endl;
+        return EXIT_FAILURE;
+    }
 
-    // Draws the triangles
-    glDrawArrays(GL_TRIANGLES, 0, gMeshRec3.nVertices);
+    size_t compressedBytes = 0, rawBytes = 0;
+    for (size_t level = 0; level < levels.size(); ++level)
+    {
+        compressedBytes += cooked.levels[level].size();
+        rawBytes += levels[level].pixels.size();
+    }
+    CookImage decoded;
+    DecodeLevel(cooked.levels[0], cooked.format, cooked.width, cooked.height, decoded);
+
+    cout << "INFO: Cooked " << input << " (" << source.width << "x" << source.height << ") to " << output << ": "
+        << CookedFormatName(cooked.format) << ", " << cooked.width << "x" << cooked.height << ", " << levels.size() << " levels, "
+        << compressedBytes / 1024 << " KB instead of " << rawBytes / 1024 << " KB as RGBA8, " << cookMs << " ms on "
+        << max(1u, thread::hardware_concurrency()) << " threads, level 0 PSNR " << ComputePsnr(levels[0], decoded, cooked.format != COOKED_BC1) << " dB" << endl;
+    return EXIT_SUCCESS;
+}
 
-    // Deactivate the Vertex Array Object
-    glBindVertexArray(0);
 
-    // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
-    glfwSwapBuffers(gWindow);    // Flips the the back buffer with the front buffer every frame.
+// World-space box around the transformed corners of the object's bounds
+void UComputeWorldBounds(const GLSceneObject& object, glm::vec3& worldMin, glm::vec3& worldMax)
+{
+    worldMin = glm::vec3(1e30f);
+    worldMax = glm::vec3(-1e30f);
+    for (int c = 0; c < 8; ++c)
+    {
+        glm::vec3 corner((c & 1) ? object.boundsMax.x : object.boundsMin.x,
+            (c & 2) ? object.boundsMax.y : object.boundsMin.y,
+            (c & 4) ? object.boundsMax.z : object.boundsMin.z);
+        glm::vec3 world = glm::vec3(object.model * glm::vec4(corner, 1.0f));
+        worldMin = glm::min(worldMin, world);
+        worldMax = glm::max(worldMax, world);
+    }
 }
 
 
-void UCreateMeshPlane(GLMesh& meshPlane)
+// Moves an object after creation, keeping the pick BVH and the cached shadows in step
+void UUpdateObjectTransform(int objectIndex, const glm::mat4& model)
 {
-    // Vertex data
-    GLfloat verts[] = {
-        // Vertex Positions    // Colors (r,g,b,a)
-        -2.0f, -2.0f, -2.0f,   0.59f, 0.29f, 0.0f, 1.0f,
-         2.0f, -2.0f, -2.0f,   0.59f, 0.29f, 0.0f, 1.0f,
-         2.0f, -2.0f,  2.0f,   0.59f, 0.29f, 0.0f, 1.0f,
+    GLSceneObject& object = gSceneObjects[objectIndex];
+    object.model = model;
 
-         2.0f, -2.0f,  2.0f,   0.59f, 0.29f, 0.0f, 1.0f,
-        -2.0f, -2.0f,  2.0f,   0.59f, 0.29f, 0.0f, 1.0f,
-        -2.0f, -2.0f, -2.0f,   0.59f, 0.29f, 0.0f, 1.0f,
+    glm::vec3 worldMin, worldMax;
+    UComputeWorldBounds(object, worldMin, worldMax);
+    gPickBvh.Update(objectIndex, worldMin, worldMax);
+    if (gCollide)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        gBroadphase.Move(objectIndex, worldMin, worldMax);
+        gBroadphaseMs += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
 
-    };
+    if (object.isStatic)
+        gShadows.InvalidateStatic();
+}
 
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerColor = 4;
 
-    meshPlane.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerColor));
+// Reads back every object's triangles for exact picking and builds the BVH over the world boxes
+void UBuildPickData()
+{
+    const GLsizei floatsPerVertex = FloatsPerVertex(VERTEX_POSITION_COLOR);
+    std::vector<glm::vec3> boundsMin(NUM_SCENE_OBJECTS), boundsMax(NUM_SCENE_OBJECTS);
+    std::vector<GLfloat> vertices;
 
-    glGenVertexArrays(1, &meshPlane.vaoPlane); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(meshPlane.vaoPlane);
+    for (int i = 0; i < NUM_SCENE_OBJECTS; ++i)
+    {
+        const GLSceneObject& object = gSceneObjects[i];
+        PickMesh& mesh = gPickMeshes[i];
+
+        vertices.resize((size_t)object.nVertices * floatsPerVertex);
+        glBindBuffer(GL_COPY_READ_BUFFER, object.vbo);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, vertices.size() * sizeof(GLfloat), vertices.data());
+        mesh.positions.resize(object.nVertices);
+        for (GLuint v = 0; v < object.nVertices; ++v)
+            mesh.positions[v] = glm::vec3(vertices[v * floatsPerVertex], vertices[v * floatsPerVertex + 1], vertices[v * floatsPerVertex + 2]);
+
+        // Meshes drawn as arrays list their triangles in order
+        if (object.nIndices > 0)
+        {
+            mesh.indices.resize(object.nIndices);
+            glBindBuffer(GL_COPY_READ_BUFFER, object.ebo);
+            glGetBufferSubData(GL_COPY_READ_BUFFER, 0, mesh.indices.size() * sizeof(GLuint), mesh.indices.data());
+        }
+        else
+        {
+            mesh.indices.resize(object.nVertices);
+            for (GLuint v = 0; v < object.nVertices; ++v)
+                mesh.indices[v] = v;
+        }
 
-    // Create VBO
-    glGenBuffers(1, &meshPlane.vboPlane);
-    glBindBuffer(GL_ARRAY_BUFFER, meshPlane.vboPlane); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+        UComputeWorldBounds(object, boundsMin[i], boundsMax[i]);
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
 
-    // Strides between vertex coordinates
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerColor);
+    gPickBvh.Build(boundsMin, boundsMax);
+}
 
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
 
-    glVertexAttribPointer(1, floatsPerColor, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
+// Casts a ray through the cursor (the screen center while the cursor is captured) and returns the closest object
+int UPickObject(GLFWwindow* window, float& distance)
+{
+    int width, height;
+    glfwGetWindowSize(window, &width, &height);
+    double x = width * 0.5, y = height * 0.5;
+    if (glfwGetInputMode(window, GLFW_CURSOR) != GLFW_CURSOR_DISABLED)
+        glfwGetCursorPos(window, &x, &y);
+
+    // Unproject the cursor on the near and far planes
+    glm::mat4 inverseViewProjection = glm::inverse(UGetProjection() * gCamera.GetViewMatrix());
+    float ndcX = 2.0f * (float)x / width - 1.0f;
+    float ndcY = 1.0f - 2.0f * (float)y / height;
+    glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+    glm::vec4 farPoint = inverseViewProjection * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+    glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+    glm::vec3 direction = glm::vec3(farPoint) / farPoint.w - origin;
+
+    // Box hits from the BVH are confirmed against the triangles; distance is along the unnormalized ray
+    float t;
+    int object = gPickBvh.Pick(origin, direction, 1.0f, [&](int i, float tMax, float& tHit) {
+        return RayPickMesh(gPickMeshes[i], glm::inverse(gSceneObjects[i].model), origin, direction, tMax, tHit);
+    }, t);
+
+    distance = t * glm::length(direction);
+    return object;
 }
 
-// Implements the UCreateMesh function
-// Pencil Tip
-// -----------------------------------
-void UCreateMeshPyr(GLMesh& meshPyr)
+
+// Puts every scene object's world box in the broadphase, proxy i for object i, and adds the camera's box
+void UBuildBroadphase()
 {
-    // Vertex data
-    GLfloat verts[] = {
-        // Vertex Positions    // Colors (r,g,b,a)
-        -0.5f, -0.5f, -0.5f,   1.0f, 1.0f, 1.0f, 1.0f,
-         0.5f, -0.5f, -0.5f,   1.0f, 1.0f, 1.0f, 1.0f,
-         0.0f,  0.5f,  0.0f,   1.0f, 1.0f, 1.0f, 1.0f,
+    std::vector<glm::vec3> boundsMin(NUM_SCENE_OBJECTS), boundsMax(NUM_SCENE_OBJECTS);
+    std::vector<bool> isStatic(NUM_SCENE_OBJECTS);
+    for (int i = 0; i < NUM_SCENE_OBJECTS; ++i)
+    {
+        UComputeWorldBounds(gSceneObjects[i], boundsMin[i], boundsMax[i]);
+        isStatic[i] = gSceneObjects[i].isStatic;
+    }
+    gBroadphase.Build(boundsMin, boundsMax, isStatic);
 
-        -0.5f, -0.5f,  0.5f,   1.0f, 1.0f, 1.0f, 1.0f,
-         0.5f, -0.5f,  0.5f,   1.0f, 1.0f, 1.0f, 1.0f,
-         0.0f,  0.5f,  0.0f,   1.0f, 1.0f, 1.0f, 1.0f,
+    const glm::vec3 reach(COLLISION_RADIUS);
+    gCameraProxy = gBroadphase.Add(gCamera.Position - reach, gCamera.Position + reach, false);
+    cout << "INFO: Collision: camera sphere of radius " << COLLISION_RADIUS << " against " << NUM_SCENE_OBJECTS << " objects" << endl;
+}
 
-        -0.5f, -0.5f, -0.5f,   1.0f, 1.0f, 1.0f, 1.0f,
-        -0.5f, -0.5f,  0.5f,   1.0f, 1.0f, 1.0f, 1.0f,
-         0.0f,  0.5f,  0.0f,   1.0f, 1.0f, 1.0f, 1.0f,
 
-         0.5f, -0.5f, -0.5f,   1.0f, 1.0f, 1.0f, 1.0f,
-         0.5f, -0.5f,  0.5f,   1.0f, 1.0f, 1.0f, 1.0f,
-         0.0f,  0.5f,  0.0f,   1.0f, 1.0f, 1.0f, 1.0f,
+// Moves a sphere from one camera position towards another, sliding along whatever it touches on the way.
+// The broadphase box covers every point the slides can reach, so the objects it overlaps are all that is tested.
+glm::vec3 UCollideCamera(const glm::vec3& from, const glm::vec3& to)
+{
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
 
-        -0.5f, -0.5f, -0.5f,   1.0f, 1.0f, 1.0f, 1.0f,
-         0.5f, -0.5f,  0.5f,   1.0f, 1.0f, 1.0f, 1.0f,
-        -0.5f, -0.5f,  0.5f,   1.0f, 1.0f, 1.0f, 1.0f,
+    glm::vec3 move = to - from;
+    const glm::vec3 reach(glm::length(move) + COLLISION_RADIUS);
+    gBroadphase.Move(gCameraProxy, from - reach, from + reach);
+    const std::vector<int>& candidates = gBroadphase.Overlaps(gCameraProxy);
+    Clock::time_point broadphaseDone = Clock::now();
 
-         0.5f, -0.5f, -0.5f,   1.0f, 1.0f, 1.0f, 1.0f,
-        -0.5f, -0.5f, -0.5f,   1.0f, 1.0f, 1.0f, 1.0f,
-         0.5f, -0.5f,  0.5f,   1.0f, 1.0f, 1.0f, 1.0f,
-    };
+    glm::vec3 position = from;
+    for (int iteration = 0; iteration < COLLISION_ITERATIONS; ++iteration)
+    {
+        const float length = glm::length(move);
+        if (length < 1e-6f)
+            break;
+
+        SweepHit hit;
+        hit.t = 1.0f;
+        bool found = false;
+        for (size_t c = 0; c < candidates.size(); ++c)
+        {
+            const int object = candidates[c];
+            gCollisionTriangles += SweepSphereMesh(gPickMeshes[object], gSceneObjects[object].model, position, COLLISION_RADIUS,
+                move, hit, found, gCollisionScratch);
+        }
+        if (!found)
+        {
+            position += move;
+            break;
+        }
+
+        // stop just short of the contact and send what is left of the move along the surface
+        ++gCollisionHits;
+        position += move * std::max(hit.t - COLLISION_SKIN / length, 0.0f);
+        const glm::vec3 rest = move * (1.0f - hit.t);
+        move = rest - hit.normal * glm::dot(rest, hit.normal);
+    }
 
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerColor = 4;
+    gBroadphaseMs += std::chrono::duration<float, std::milli>(broadphaseDone - start).count();
+    gNarrowphaseMs += std::chrono::duration<float, std::milli>(Clock::now() - broadphaseDone).count();
+    gCollisionFrames++;
+    return position;
+}
 
-    meshPyr.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerColor));
 
-    glGenVertexArrays(1, &meshPyr.vaoPyr); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(meshPyr.vaoPyr);
+// Moves a few hundred boxes among many static ones with the sweep and prune, reports its cost per frame
+// and checks its pairs against brute force; then checks swept spheres against a floor and a wall
+int UBenchmarkCollision()
+{
+    const int nStatic = 20000;
+    const int nMoving = 256;
+    const int nFrames = 600;
+    const float worldSize = 200.0f;
+
+    srand(1234);
+    auto random = []() { return (rand() % 10001) * 0.0001f; };
+    std::vector<glm::vec3> boundsMin(nStatic + nMoving), boundsMax(nStatic + nMoving), velocity(nStatic + nMoving);
+    std::vector<bool> isStatic(nStatic + nMoving);
+    for (int i = 0; i < nStatic + nMoving; ++i)
+    {
+        const glm::vec3 center = glm::vec3(random(), random() * 0.1f, random()) * worldSize;
+        const glm::vec3 extent = glm::vec3(0.5f) + glm::vec3(random(), random(), random()) * 1.5f;
+        boundsMin[i] = center - extent;
+        boundsMax[i] = center + extent;
+        isStatic[i] = i < nStatic;
+        // walking speed, per 60 Hz frame
+        velocity[i] = isStatic[i] ? glm::vec3(0.0f) : (glm::vec3(random(), 0.0f, random()) - glm::vec3(0.5f, 0.0f, 0.5f)) * 0.2f;
+    }
 
-    // Create VBO
-    glGenBuffers(1, &meshPyr.vboPyr);
-    glBindBuffer(GL_ARRAY_BUFFER, meshPyr.vboPyr); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+    SweepAndPrune broadphase;
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now();
+    broadphase.Build(boundsMin, boundsMax, isStatic);
+    const float buildMs = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
 
-    // Strides between vertex coordinates
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerColor);
+    broadphase.ResetStats();
+    start = Clock::now();
+    for (int frame = 0; frame < nFrames; ++frame)
+    {
+        for (int i = nStatic; i < nStatic + nMoving; ++i)
+        {
+            glm::vec3 center = (boundsMin[i] + boundsMax[i]) * 0.5f + velocity[i];
+            if (center.x < 0.0f || center.x > worldSize)
+                velocity[i].x = -velocity[i].x;
+            if (center.z < 0.0f || center.z > worldSize)
+                velocity[i].z = -velocity[i].z;
+            boundsMin[i] += velocity[i];
+            boundsMax[i] += velocity[i];
+            broadphase.Move(i, boundsMin[i], boundsMax[i]);
+        }
+    }
+    const float frameMs = std::chrono::duration<float, std::milli>(Clock::now() - start).count() / nFrames;
 
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
+    // every moving box's pairs against all boxes
+    int mismatches = 0;
+    for (int i = nStatic; i < nStatic + nMoving; ++i)
+    {
+        const std::vector<int>& pairs = broadphase.Overlaps(i);
+        int expected = 0;
+        for (int j = 0; j < nStatic + nMoving; ++j)
+        {
+            if (j == i || !(boundsMin[i].x <= boundsMax[j].x && boundsMin[j].x <= boundsMax[i].x && boundsMin[i].y <= boundsMax[j].y &&
+                boundsMin[j].y <= boundsMax[i].y && boundsMin[i].z <= boundsMax[j].z && boundsMin[j].z <= boundsMax[i].z))
+                continue;
+            ++expected;
+            if (std::find(pairs.begin(), pairs.end(), j) == pairs.end())
+                ++mismatches;
+        }
+        if ((int)pairs.size() != expected)
+            ++mismatches;
+    }
 
-    glVertexAttribPointer(1, floatsPerColor, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
+    cout << "INFO: Collision: " << nMoving << " moving boxes among " << nStatic << " static, build " << buildMs << " ms, "
+        << frameMs << " ms per frame (" << frameMs * 1000.0f / nMoving << " us per move), " << (float)broadphase.Swaps / nFrames
+        << " swaps and " << (float)(broadphase.PairsAdded + broadphase.PairsRemoved) / nFrames << " pair changes per frame, "
+        << broadphase.Pairs() << " pairs, " << mismatches << " differences from brute force" << endl;
+
+    // a sphere dropped onto a floor quad stops a radius above it, one moving along the floor is not held back
+    // and one running into a wall slides along it
+    PickMesh quad;
+    quad.positions.push_back(glm::vec3(-1.0f, 0.0f, -1.0f));
+    quad.positions.push_back(glm::vec3(1.0f, 0.0f, -1.0f));
+    quad.positions.push_back(glm::vec3(1.0f, 0.0f, 1.0f));
+    quad.positions.push_back(glm::vec3(-1.0f, 0.0f, 1.0f));
+    const unsigned int indices[6] = { 0, 1, 2, 0, 2, 3 };
+    quad.indices.assign(indices, indices + 6);
+    std::vector<glm::vec3> scratch;
+
+    SweepHit drop = { 1.0f, glm::vec3(0.0f) };
+    bool dropped = false;
+    SweepSphereMesh(quad, glm::mat4(1.0f), glm::vec3(0.3f, 1.0f, 0.2f), 0.2f, glm::vec3(0.0f, -2.0f, 0.0f), drop, dropped, scratch);
+    const bool floorOk = dropped && std::fabs(drop.t - 0.4f) < 1e-5f && drop.normal.y > 0.999f;
+
+    SweepHit glide = { 1.0f, glm::vec3(0.0f) };
+    bool glided = false;
+    SweepSphereMesh(quad, glm::mat4(1.0f), glm::vec3(-0.5f, 0.2f, 0.0f), 0.2f, glm::vec3(1.0f, 0.0f, 0.0f), glide, glided, scratch);
+
+    // the wall is the quad stood up in the plane x = 1, hit from the side at the corner of its edge
+    SweepHit wall = { 1.0f, glm::vec3(0.0f) };
+    bool walled = false;
+    const glm::mat4 standUp = glm::translate(glm::vec3(1.0f, 0.0f, 0.0f)) * glm::rotate(glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    SweepSphereMesh(quad, standUp, glm::vec3(0.0f, 0.5f, 1.1f), 0.2f, glm::vec3(2.0f, 0.0f, 0.0f), wall, walled, scratch);
+    const bool wallOk = walled && wall.t > 0.35f && wall.t < 0.45f && wall.normal.x < -0.5f;
+
+    cout << "INFO:   swept sphere: floor " << (floorOk ? "stops" : "FAILED") << " at t " << drop.t << ", gliding "
+        << (glided ? "FAILED, held back" : "passes") << ", wall edge " << (wallOk ? "stops" : "FAILED") << " at t " << wall.t << endl;
+
+    return mismatches == 0 && floorOk && !glided && wallOk ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-// Implements the UCreateMesh function
-// Rubix Cube
-// -----------------------------------
-void UCreateMeshCube(GLMesh& meshCube)
+
+// Picks along random rays through a million boxes with the BVH, checked against brute force
+int UBenchmarkPicking()
 {
-    // Vertex data
-    GLfloat verts[] = {
-        // Vertex Positions    // Colors (r,g,b,a)
-        //Back Face        
-        -0.5f, -0.5f, -0.5f,  0.0f, 1.0f, 0.0f, 1.0f, // green
-         0.5f, -0.5f, -0.5f,  0.0f, 1.0f, 0.0f, 1.0f,
-         0.5f,  0.5f, -0.5f,  0.0f, 1.0f, 0.0f, 1.0f,
-         0.5f,  0.5f, -0.5f,  0.0f, 1.0f, 0.0f, 1.0f,
-        -0.5f,  0.5f, -0.5f,  0.0f, 1.0f, 0.0f, 1.0f,
-        -0.5f, -0.5f, -0.5f,  0.0f, 1.0f, 0.0f, 1.0f,
-
-        //Front Face       
-        -0.5f, -0.5f,  0.5f,  0.0f, 0.0f, 1.0f, 1.0f, // blue
-         0.5f, -0.5f,  0.5f,  0.0f, 0.0f, 1.0f, 1.0f,
-         0.5f,  0.5f,  0.5f,  0.0f, 0.0f, 1.0f, 1.0f,
-         0.5f,  0.5f,  0.5f,  0.0f, 0.0f, 1.0f, 1.0f,
-        -0.5f,  0.5f,  0.5f,  0.0f, 0.0f, 1.0f, 1.0f,
-        -0.5f, -0.5f,  0.5f,  0.0f, 0.0f, 1.0f, 1.0f,
-
-        //Left Face        
-        -0.5f,  0.5f,  0.5f,  1.0f, 0.0f, 1.0f, 1.0f, // purple
-        -0.5f,  0.5f, -0.5f,  1.0f, 0.0f, 1.0f, 1.0f,
-        -0.5f, -0.5f, -0.5f,  1.0f, 0.0f, 1.0f, 1.0f,
-        -0.5f, -0.5f, -0.5f,  1.0f, 0.0f, 1.0f, 1.0f,
-        -0.5f, -0.5f,  0.5f,  1.0f, 0.0f, 1.0f, 1.0f,
-        -0.5f,  0.5f,  0.5f,  1.0f, 0.0f, 1.0f, 1.0f,
-
-        //Right Face       
-         0.5f,  0.5f,  0.5f,  1.0f, 0.0f, 0.0f, 1.0f, // red
-         0.5f,  0.5f, -0.5f,  1.0f, 0.0f, 0.0f, 1.0f,
-         0.5f, -0.5f, -0.5f,  1.0f, 0.0f, 0.0f, 1.0f,
-         0.5f, -0.5f, -0.5f,  1.0f, 0.0f, 0.0f, 1.0f,
-         0.5f, -0.5f,  0.5f,  1.0f, 0.0f, 0.0f, 1.0f,
-         0.5f,  0.5f,  0.5f,  1.0f, 0.0f, 0.0f, 1.0f,
-
-        //Bottom Face      
-        -0.5f, -0.5f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f, // white
-         0.5f, -0.5f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         0.5f, -0.5f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         0.5f, -0.5f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-        -0.5f, -0.5f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-        -0.5f, -0.5f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-
-        //Top Face         
-        -0.5f,  0.5f, -0.5f,  1.0f, 1.0f, 0.0f, 1.0f, // yellow
-         0.5f,  0.5f, -0.5f,  1.0f, 1.0f, 0.0f, 1.0f,
-         0.5f,  0.5f,  0.5f,  1.0f, 1.0f, 0.0f, 1.0f,
-         0.5f,  0.5f,  0.5f,  1.0f, 1.0f, 0.0f, 1.0f,
-        -0.5f,  0.5f,  0.5f,  1.0f, 1.0f, 0.0f, 1.0f,
-        -0.5f,  0.5f, -0.5f,  1.0f, 1.0f, 0.0f, 1.0f
+    const int nObjects = 1000000;
+    const int nRays = 10000;
+    const int nChecked = 100;
+    const int nUpdates = 100000;
+
+    // Every object is a unit cube, scaled and scattered through a 200 unit volume
+    PickMesh cube;
+    for (int c = 0; c < 8; ++c)
+        cube.positions.push_back(glm::vec3((c & 1) ? 0.5f : -0.5f, (c & 2) ? 0.5f : -0.5f, (c & 4) ? 0.5f : -0.5f));
+    const unsigned int faces[] = { 0,1,3, 0,3,2, 4,6,7, 4,7,5, 0,4,5, 0,5,1, 2,3,7, 2,7,6, 0,2,6, 0,6,4, 1,5,7, 1,7,3 };
+    cube.indices.assign(faces, faces + sizeof(faces) / sizeof(faces[0]));
+
+    srand(1234);
+    std::vector<glm::vec3> positions(nObjects), boundsMin(nObjects), boundsMax(nObjects);
+    std::vector<float> scales(nObjects);
+    for (int i = 0; i < nObjects; ++i)
+    {
+        positions[i] = glm::vec3(rand() % 20001 - 10000, rand() % 20001 - 10000, rand() % 20001 - 10000) * 0.01f;
+        scales[i] = 0.1f + (rand() % 100) * 0.005f;
+        boundsMin[i] = positions[i] - glm::vec3(scales[i] * 0.5f);
+        boundsMax[i] = positions[i] + glm::vec3(scales[i] * 0.5f);
+    }
 
-    };
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    Bvh4 bvh;
+    bvh.Build(boundsMin, boundsMax);
+    float buildMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
 
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerColor = 4;
+    glm::vec3 origin, direction;
+    auto hitTest = [&](int i, float tMax, float& t) {
+        glm::mat4 inverseModel = glm::scale(glm::vec3(1.0f / scales[i])) * glm::translate(-positions[i]);
+        return RayPickMesh(cube, inverseModel, origin, direction, tMax, t);
+    };
+    auto randomRay = [&]() {
+        origin = glm::vec3(rand() % 20001 - 10000, rand() % 20001 - 10000, rand() % 20001 - 10000) * 0.01f;
+        direction = glm::normalize(glm::vec3(rand() % 2001 - 1000, rand() % 2001 - 1000, rand() % 2001 - 1000) + glm::vec3(0.5f));
+    };
+    // the nearest distance must match, a miss included (both stay at the 1e30 limit); a different object
+    // only passes when it ties with the one brute force found
+    auto matchesBruteForce = [&](float t) {
+        float tExpected = 1e30f;
+        for (int i = 0; i < nObjects; ++i)
+        {
+            float tObject;
+            if (hitTest(i, tExpected, tObject))
+                tExpected = tObject;
+        }
+        return fabs(tExpected - t) <= 1e-4f;
+    };
 
-    meshCube.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerColor));
+    std::vector<float> latencies(nRays);
+    int mismatches = 0;
+    for (int r = 0; r < nRays; ++r)
+    {
+        randomRay();
+        float t;
+        start = std::chrono::steady_clock::now();
+        bvh.Pick(origin, direction, 1e30f, hitTest, t);
+        latencies[r] = std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+        if (r < nChecked && !matchesBruteForce(t))
+            ++mismatches;
+    }
 
-    glGenVertexArrays(1, &meshCube.vaoCube); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(meshCube.vaoCube);
+    start = std::chrono::steady_clock::now();
+    for (int u = 0; u < nUpdates; ++u)
+    {
+        int i = rand() % nObjects;
+        positions[i] = positions[i] + glm::vec3(rand() % 101 - 50, rand() % 101 - 50, rand() % 101 - 50) * 0.001f;
+        bvh.Update(i, positions[i] - glm::vec3(scales[i] * 0.5f), positions[i] + glm::vec3(scales[i] * 0.5f));
+    }
+    float updateUs = std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - start).count() / nUpdates;
 
-    // Create VBO
-    glGenBuffers(1, &meshCube.vboCube);
-    glBindBuffer(GL_ARRAY_BUFFER, meshCube.vboCube); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+    // the refit tree must still find the same nearest hits
+    for (int r = 0; r < nChecked; ++r)
+    {
+        randomRay();
+        float t;
+        bvh.Pick(origin, direction, 1e30f, hitTest, t);
+        if (!matchesBruteForce(t))
+            ++mismatches;
+    }
 
-    // Strides between vertex coordinates
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerColor);
+    // The first ray pays for cold caches, report the steady state
+    std::sort(latencies.begin() + 1, latencies.end());
+    float total = 0.0f;
+    for (int r = 1; r < nRays; ++r)
+        total += latencies[r];
 
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
+    cout << "INFO: BVH over " << nObjects << " objects: " << bvh.NodeCount() << " nodes built in " << buildMs << " ms" << endl;
+    cout << "INFO: Pick latency over " << nRays << " rays: average " << total / (nRays - 1) << " us, 99th percentile "
+        << latencies[1 + (nRays - 1) * 99 / 100] << " us, worst " << latencies[nRays - 1] << " us, first " << latencies[0] << " us" << endl;
+    cout << "INFO: Refit " << updateUs << " us per moved object, " << mismatches << " of " << 2 * nChecked << " picks differ from brute force, half of them after the refits" << endl;
 
-    glVertexAttribPointer(1, floatsPerColor, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
+    return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-// Implements the UCreateMesh function
-// Ipad
-// -----------------------------------
-void UCreateMeshRec(GLMesh& meshRec)
+
+// Runs every batched math kernel at every level the CPU has, checks each against the scalar glm level float for float
+// and reports its throughput
+int UBenchmarkMath()
 {
-    // Vertex data
-    GLfloat verts[] = {
-        // Vertex Positions    // Colors (r,g,b,a)
-        //Back Face        
-        -0.5f, -0.25f, -0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-         0.5f, -0.25f, -0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-         0.5f,  0.25f, -0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-         0.5f,  0.25f, -0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-        -0.5f,  0.25f, -0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-        -0.5f, -0.25f, -0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-
-        //Front Face       
-        -0.5f, -0.25f,  0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-         0.5f, -0.25f,  0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-         0.5f,  0.25f,  0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-         0.5f,  0.25f,  0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-        -0.5f,  0.25f,  0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-        -0.5f, -0.25f,  0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-
-        //Left Face        
-        -0.5f,  0.25f,  0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-        -0.5f,  0.25f, -0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-        -0.5f, -0.25f, -0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-        -0.5f, -0.25f, -0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-        -0.5f, -0.25f,  0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-        -0.5f,  0.25f,  0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-
-        //Right Face       
-         0.5f,  0.25f,  0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-         0.5f,  0.25f, -0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-         0.5f, -0.25f, -0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-         0.5f, -0.25f, -0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-         0.5f, -0.25f,  0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-         0.5f,  0.25f,  0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-
-         //Bottom Face      
-         -0.5f, -0.25f, -0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-          0.5f, -0.25f, -0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-          0.5f, -0.25f,  0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-          0.5f, -0.25f,  0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-         -0.5f, -0.25f,  0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-         -0.5f, -0.25f, -0.5f,  0.33f, 0.33f, 0.33f, 1.0f,
-
-         //Top Face         
-         -0.5f,  0.25f, -0.5f,  0.0f, 0.0f, 0.0f, 1.0f,
-          0.5f,  0.25f, -0.5f,  0.0f, 0.0f, 0.0f, 1.0f,
-          0.5f,  0.25f,  0.5f,  0.0f, 0.0f, 0.0f, 1.0f,
-          0.5f,  0.25f,  0.5f,  0.0f, 0.0f, 0.0f, 1.0f,
-         -0.5f,  0.25f,  0.5f,  0.0f, 0.0f, 0.0f, 1.0f,
-         -0.5f,  0.25f, -0.5f,  0.0f, 0.0f, 0.0f, 1.0f
+    const size_t nItems = 1 << 20;
+    const int nRuns = 5;
+
+    srand(1234);
+    auto random = []() { return (rand() % 20001 - 10000) * 0.01f; };
+    std::vector<glm::mat4> a(nItems), b(nItems);
+    std::vector<glm::vec3> translations(nItems), scales(nItems), points(nItems), boundsMin(nItems), boundsMax(nItems);
+    std::vector<glm::quat> rotations(nItems);
+    for (size_t i = 0; i < nItems; ++i)
+    {
+        for (int c = 0; c < 4; ++c)
+        {
+            a[i][c] = glm::vec4(random(), random(), random(), random());
+            b[i][c] = glm::vec4(random(), random(), random(), random());
+        }
+        translations[i] = glm::vec3(random(), random(), random());
+        scales[i] = glm::vec3(random(), random(), random()) * 0.01f;
+        rotations[i] = glm::normalize(glm::quat(random(), random(), random(), random()));
+        points[i] = glm::vec3(random(), random(), random());
+        glm::vec3 extent = glm::abs(glm::vec3(random(), random(), random())) * 0.05f;
+        boundsMin[i] = points[i] - extent;
+        boundsMax[i] = points[i] + extent;
+    }
+    glm::vec4 planes[6];
+    ExtractFrustumPlanes(glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 100.0f)
+        * glm::lookAt(glm::vec3(0.0f, 20.0f, 60.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f)), planes);
 
+    // one set of outputs from the scalar level to compare against, one for the level being measured
+    struct Outputs
+    {
+        std::vector<glm::mat4> products, shared, composed;
+        std::vector<glm::vec3> points, worldMin, worldMax;
+        std::vector<unsigned char> visible;
     };
+    Outputs reference, outputs;
+    Outputs* sets[2] = { &reference, &outputs };
+    for (int o = 0; o < 2; ++o)
+    {
+        sets[o]->products.resize(nItems);
+        sets[o]->shared.resize(nItems);
+        sets[o]->composed.resize(nItems);
+        sets[o]->points.resize(nItems);
+        sets[o]->worldMin.resize(nItems);
+        sets[o]->worldMax.resize(nItems);
+        sets[o]->visible.resize(nItems);
+    }
 
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerColor = 4;
+    const int nKernels = 6;
+    const char* kernelNames[nKernels] = { "mat4 * mat4", "shared mat4 * mat4", "TRS compose", "point transform", "AABB transform", "AABB planes test" };
+    auto run = [&](const SimdMathKernels& kernels, int kernel, Outputs& out) {
+        switch (kernel)
+        {
+        case 0: kernels.MultiplyMat4(a.data(), b.data(), out.products.data(), nItems); break;
+        case 1: kernels.MultiplyMat4Shared(a[0], b.data(), out.shared.data(), nItems); break;
+        case 2: kernels.ComposeTrs(translations.data(), rotations.data(), scales.data(), out.composed.data(), nItems); break;
+        case 3: kernels.TransformPoints(a[0], points.data(), out.points.data(), nItems); break;
+        case 4: kernels.TransformAabbs(a.data(), boundsMin.data(), boundsMax.data(), out.worldMin.data(), out.worldMax.data(), nItems); break;
+        default: kernels.TestAabbsPlanes(planes, boundsMin.data(), boundsMax.data(), out.visible.data(), nItems); break;
+        }
+    };
+    auto differences = [&](int kernel) {
+        size_t count = 0;
+        for (size_t i = 0; i < nItems; ++i)
+        {
+            switch (kernel)
+            {
+            case 0: count += reference.products[i] != outputs.products[i]; break;
+            case 1: count += reference.shared[i] != outputs.shared[i]; break;
+            case 2: count += reference.composed[i] != outputs.composed[i]; break;
+            case 3: count += reference.points[i] != outputs.points[i]; break;
+            case 4: count += reference.worldMin[i] != outputs.worldMin[i] || reference.worldMax[i] != outputs.worldMax[i]; break;
+            default: count += reference.visible[i] != outputs.visible[i]; break;
+            }
+        }
+        return count;
+    };
 
-    meshRec.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerColor));
+    const SimdMathKernels& scalar = *SimdMathLevel(SIMDMATH_SCALAR);
+    for (int kernel = 0; kernel < nKernels; ++kernel)
+        run(scalar, kernel, reference);
 
-    glGenVertexArrays(1, &meshRec.vaoRec); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(meshRec.vaoRec);
+    cout << "INFO: Batched math over " << nItems << " items, best of " << nRuns << " runs, CPU supports up to " << SimdMath().name << endl;
+    size_t mismatches = 0;
+    float scalarRate[nKernels];
+    for (int level = SIMDMATH_SCALAR; level < NUM_SIMDMATH_LEVELS; ++level)
+    {
+        const SimdMathKernels* kernels = SimdMathLevel((SimdMath_Level)level);
+        if (!kernels)
+            break;
+
+        for (int kernel = 0; kernel < nKernels; ++kernel)
+        {
+            float bestMs = 1e30f;
+            for (int r = 0; r < nRuns; ++r)
+            {
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                run(*kernels, kernel, outputs);
+                bestMs = std::min(bestMs, std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count());
+            }
+            size_t differing = differences(kernel);
+            mismatches += differing;
+
+            float rate = nItems / (bestMs * 1000.0f);
+            if (level == SIMDMATH_SCALAR)
+                scalarRate[kernel] = rate;
+            cout << "INFO:   " << kernels->name << " " << kernelNames[kernel] << ": " << rate << " M items/s, "
+                << rate / scalarRate[kernel] << "x scalar, " << differing << " results differ from glm" << endl;
+        }
+    }
 
-    // Create VBO
-    glGenBuffers(1, &meshRec.vboRec);
-    glBindBuffer(GL_ARRAY_BUFFER, meshRec.vboRec); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
+    return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
-    // Strides between vertex coordinates
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerColor);
 
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
+// Runs the particle stages on 1, 2, 4, ... threads up to the hardware count and prints how each one scales;
+// every thread count must write the same particles
+int UBenchmarkParticles()
+{
+    const int nParticles = 500000;
+    const int nWarmupFrames = 240;
+    const int nFrames = 240;
+    const float dt = 1.0f / 60.0f;
+
+    const int hardwareThreads = std::max(1, (int)std::thread::hardware_concurrency());
+    std::vector<int> threadCounts;
+    for (int threads = 1; threads < hardwareThreads; threads *= 2)
+        threadCounts.push_back(threads);
+    threadCounts.push_back(hardwareThreads);
+
+    cout << "INFO: Particles: " << nParticles << " capacity, " << nFrames << " frames after " << nWarmupFrames << " to fill, chunks of "
+        << PARTICLE_CHUNK << ", " << hardwareThreads << " hardware threads" << endl;
+
+    std::vector<ParticleVertex> vertices;
+    double referenceSum = 0.0;
+    float baseMs[3] = { 0.0f, 0.0f, 0.0f };
+    bool same = true;
+    for (size_t t = 0; t < threadCounts.size(); ++t)
+    {
+        JobSystem jobs;
+        jobs.Start(threadCounts[t]);
+        ParticleSystem particles;
+        particles.Create(nParticles, PARTICLE_FLOOR);
+        UAddParticleEmitters(particles, glm::vec3(1.0f, -3.5f, 0.0f));
+        vertices.resize(particles.Capacity());
+
+        for (int frame = 0; frame < nWarmupFrames; ++frame)
+        {
+            particles.Update(dt, jobs);
+            particles.Write(vertices.data(), (int)vertices.size(), jobs);
+        }
+
+        // stage times summed over the measured frames rather than smoothed
+        float stageMs[3] = { 0.0f, 0.0f, 0.0f };
+        int written = 0;
+        for (int frame = 0; frame < nFrames; ++frame)
+        {
+            particles.Times.emitMs = particles.Times.simulateMs = particles.Times.writeMs = 0.0f;
+            particles.Update(dt, jobs);
+            written = particles.Write(vertices.data(), (int)vertices.size(), jobs);
+            stageMs[0] += particles.Times.emitMs;
+            stageMs[1] += particles.Times.simulateMs;
+            stageMs[2] += particles.Times.writeMs;
+        }
+
+        double sum = 0.0;
+        for (int i = 0; i < written; ++i)
+            sum += vertices[i].position[0] + vertices[i].position[1] + vertices[i].position[2] + vertices[i].color[3];
+        if (t == 0)
+        {
+            referenceSum = sum;
+            for (int s = 0; s < 3; ++s)
+                baseMs[s] = stageMs[s];
+        }
+        same = same && sum == referenceSum;
+
+        cout << "INFO:   " << threadCounts[t] << " threads, " << written << " live: emit " << stageMs[0] / nFrames << " ms ("
+            << baseMs[0] / stageMs[0] << "x), simulate " << stageMs[1] / nFrames << " ms (" << baseMs[1] / stageMs[1] << "x), write "
+            << stageMs[2] / nFrames << " ms (" << baseMs[2] / stageMs[2] << "x)" << (sum == referenceSum ? "" : ", DIFFERENT particles") << endl;
+    }
 
-    glVertexAttribPointer(1, floatsPerColor, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
+    return same ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 
-// Implements the UCreateMesh function
-// Pencil Body
-// -----------------------------------
-void UCreateMeshRec2(GLMesh& meshRec2)
+// Keys of one product on a turntable: a full turn about y starting at angle radians, lifted at half turn
+AnimationTrackKeys UTurntableTrack(const glm::vec3& position, float angle, const glm::vec3& scale, float lift)
+{
+    AnimationTrackKeys track;
+    // quarter turns, so each slerp takes the intended way round
+    for (int k = 0; k <= 4; ++k)
+    {
+        AnimationQuatKey key = { TURNTABLE_SECONDS * k / 4.0f, glm::angleAxis(angle + glm::radians(90.0f) * k, glm::vec3(0.0f, 1.0f, 0.0f)) };
+        track.rotation.push_back(key);
+    }
+    for (int k = 0; k <= 2; ++k)
+    {
+        AnimationVec3Key key = { TURNTABLE_SECONDS * k / 2.0f, position + glm::vec3(0.0f, k == 1 ? lift : 0.0f, 0.0f) };
+        track.translation.push_back(key);
+    }
+    AnimationVec3Key scaleKey = { 0.0f, scale };
+    track.scale.push_back(scaleKey);
+    return track;
+}
+
+
+// Puts the cube and the airpods on turntables; moving objects are drawn into the dynamic shadow layer
+void UCreateAnimations()
 {
-    // Vertex data
-    GLfloat verts[] = {
-        // Vertex Positions    // Colors (r,g,b,a)
-        //Back Face        
-        -0.5f, -0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         0.5f, -0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         0.5f,  0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         0.5f,  0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-        -0.5f,  0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-        -0.5f, -0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-
-        //Front Face       
-        -0.5f, -0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         0.5f, -0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         0.5f,  0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         0.5f,  0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-        -0.5f,  0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-        -0.5f, -0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-
-        //Left Face        
-        -0.5f,  0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-        -0.5f,  0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-        -0.5f, -0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-        -0.5f, -0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-        -0.5f, -0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-        -0.5f,  0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-
-        //Right Face       
-         0.5f,  0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         0.5f,  0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         0.5f, -0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         0.5f, -0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         0.5f, -0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         0.5f,  0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-
-         //Bottom Face      
-         -0.5f, -0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-          0.5f, -0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-          0.5f, -0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-          0.5f, -0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         -0.5f, -0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         -0.5f, -0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-
-         //Top Face         
-         -0.5f,  0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-          0.5f,  0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-          0.5f,  0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-          0.5f,  0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         -0.5f,  0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         -0.5f,  0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f
+    // the same placement UCreateSceneObjects gives them, as the pose at the start of the turn
+    const int objects[] = { OBJ_CUBE, OBJ_REC3 };
+    std::vector<AnimationTrackKeys> tracks;
+    tracks.push_back(UTurntableTrack(glm::vec3(2.5f, -3.5f, -1.0f), 10.0f, glm::vec3(1.0f, 1.0f, 1.0f), 0.0f));
+    tracks.push_back(UTurntableTrack(glm::vec3(2.5f, -3.84f, 0.78f), 10.0f, glm::vec3(0.65f, 0.65f, 1.2f), 0.15f));
+
+    const int firstTrack = gAnimations.AddClip(tracks, TURNTABLE_SECONDS, true);
+    for (size_t i = 0; i < tracks.size(); ++i)
+    {
+        // the airpods turn the other way
+        const int instance = gAnimations.AddInstance(firstTrack + (int)i, 0.0f, i == 0 ? 1.0f : -1.0f);
+        gAnimatedObjects[instance] = objects[i];
+        gSceneObjects[objects[i]].isStatic = false;
+    }
+    gShadows.InvalidateStatic();
 
-    };
+    gAnimating = true;
+    cout << "INFO: Animation: " << gAnimations.Instances() << " turntables, " << TURNTABLE_SECONDS << " s per turn, "
+        << gJobs.Threads() << " threads" << endl;
+}
 
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerColor = 4;
 
-    meshRec2.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerColor));
+// Advances the animations and moves only the objects whose pose changed
+void UAnimateObjects()
+{
+    gAnimations.Update(gDeltaTime, gJobs);
 
-    glGenVertexArrays(1, &meshRec2.vaoRec2); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(meshRec2.vaoRec2);
+    const int* instances = gAnimations.DirtyInstances();
+    const glm::mat4* models = gAnimations.DirtyModels();
+    for (int i = 0; i < gAnimations.DirtyCount(); ++i)
+        UUpdateObjectTransform(gAnimatedObjects[instances[i]], models[i]);
+}
 
-    // Create VBO
-    glGenBuffers(1, &meshRec2.vboRec2);
-    glBindBuffer(GL_ARRAY_BUFFER, meshRec2.vboRec2); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
 
-    // Strides between vertex coordinates
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerColor);
+// Samples 100k animation instances per frame on every thread count, checks the batched poses against glm slerp and
+// lerp of the keys, and checks that paused instances are left out of the dirty list
+int UBenchmarkAnimation()
+{
+    const int nTracks = 1000;
+    const int nInstances = 100000;
+    const int nKeys = 9;
+    const float keySeconds = 0.5f;      // keys fall on baked samples, so the only difference left is nlerp against slerp
+    const int nFrames = 240;
+    const float dt = 1.0f / 60.0f;
+    const float duration = keySeconds * (nKeys - 1);
+
+    srand(1234);
+    auto random = []() { return (rand() % 20001 - 10000) * 0.0001f; };
+    std::vector<AnimationTrackKeys> tracks(nTracks);
+    for (int t = 0; t < nTracks; ++t)
+    {
+        const glm::vec3 axis = glm::normalize(glm::vec3(random(), random() + 1.5f, random()));
+        for (int k = 0; k < nKeys - 1; ++k)
+        {
+            AnimationVec3Key translation = { k * keySeconds, glm::vec3(random(), random(), random()) * 5.0f };
+            AnimationQuatKey rotation = { k * keySeconds, glm::angleAxis(glm::radians(80.0f) * random(), axis) };
+            AnimationVec3Key scale = { k * keySeconds, glm::vec3(1.0f) + glm::vec3(random(), random(), random()) * 0.5f };
+            tracks[t].translation.push_back(translation);
+            tracks[t].rotation.push_back(rotation);
+            tracks[t].scale.push_back(scale);
+        }
+        // the last keys repeat the first, so the clip loops without a jump
+        tracks[t].translation.push_back(tracks[t].translation[0]);
+        tracks[t].translation.back().time = duration;
+        tracks[t].rotation.push_back(tracks[t].rotation[0]);
+        tracks[t].rotation.back().time = duration;
+        tracks[t].scale.push_back(tracks[t].scale[0]);
+        tracks[t].scale.back().time = duration;
+    }
 
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
+    const int hardwareThreads = std::max(1, (int)std::thread::hardware_concurrency());
+    std::vector<int> threadCounts;
+    for (int threads = 1; threads < hardwareThreads; threads *= 2)
+        threadCounts.push_back(threads);
+    threadCounts.push_back(hardwareThreads);
 
-    glVertexAttribPointer(1, floatsPerColor, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
+    cout << "INFO: Animation: " << nInstances << " instances of " << nTracks << " tracks, " << nKeys << " keys per channel baked at "
+        << ANIMATION_SAMPLE_RATE << " Hz, " << nFrames << " frames, chunks of " << ANIMATION_CHUNK << endl;
+
+    float baseMs = 0.0f;
+    bool passed = true;
+    for (size_t c = 0; c < threadCounts.size(); ++c)
+    {
+        JobSystem jobs;
+        jobs.Start(threadCounts[c]);
+        AnimationSet animations;
+        const int firstTrack = animations.AddClip(tracks, duration, true);
+        srand(4321);
+        for (int i = 0; i < nInstances; ++i)
+            animations.AddInstance(firstTrack + i % nTracks, (rand() % 1000) * duration / 1000.0f, 0.5f + (rand() % 1000) / 1000.0f);
+
+        typedef std::chrono::steady_clock Clock;
+        Clock::time_point start = Clock::now();
+        for (int frame = 0; frame < nFrames; ++frame)
+            animations.Update(dt, jobs);
+        const float ms = std::chrono::duration<float, std::milli>(Clock::now() - start).count() / nFrames;
+        if (c == 0)
+            baseMs = ms;
+
+        // the last frame's matrices against the keys evaluated directly with glm
+        float maxError = 0.0f;
+        const int* instances = animations.DirtyInstances();
+        const glm::mat4* models = animations.DirtyModels();
+        for (int d = 0; d < animations.DirtyCount(); ++d)
+        {
+            const AnimationTrackKeys& keys = tracks[instances[d] % nTracks];
+            const float time = animations.Time(instances[d]);
+            const int k = std::min((int)(time / keySeconds), nKeys - 2);
+            const float alpha = (time - k * keySeconds) / keySeconds;
+            const glm::mat4 reference = glm::translate(glm::mix(keys.translation[k].value, keys.translation[k + 1].value, alpha))
+                * glm::mat4_cast(glm::slerp(keys.rotation[k].value, keys.rotation[k + 1].value, alpha))
+                * glm::scale(glm::mix(keys.scale[k].value, keys.scale[k + 1].value, alpha));
+            for (int col = 0; col < 4; ++col)
+                for (int row = 0; row < 4; ++row)
+                    maxError = std::max(maxError, std::fabs(models[d][col][row] - reference[col][row]));
+        }
+
+        // paused instances are not sampled and not reported
+        for (int i = 0; i < nInstances; i += 2)
+            animations.SetPlaying(i, false);
+        animations.Update(dt, jobs);
+        const bool pausedSkipped = animations.DirtyCount() == nInstances / 2;
+
+        const bool ok = animations.DirtyCount() > 0 && maxError < 1e-3f && pausedSkipped;
+        passed = passed && ok;
+        cout << "INFO:   " << threadCounts[c] << " threads: " << ms << " ms per frame (" << baseMs / ms << "x), "
+            << ms * 1e6f / nInstances << " ns per instance, max error " << maxError << " against slerp of the keys, "
+            << animations.DirtyCount() << " dirty with half paused" << (ok ? "" : ", FAILED") << endl;
+    }
+
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 
-// Implements the UCreateMesh function
-// Airpods
-// -----------------------------------
-void UCreateMeshRec3(GLMesh& meshRec3)
+// Puts a startup job on the timeline under the worker that ran it
+void URecordStartupJob(const JobTiming& timing, void*)
 {
-    // Vertex data
-    GLfloat verts[] = {
-        // Vertex Positions    // Colors (r,g,b,a)
-        //Back Face        
-        -0.5f, -0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         0.5f, -0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         0.5f,  0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         0.5f,  0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-        -0.5f,  0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-        -0.5f, -0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-
-        //Front Face       
-        -0.5f, -0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         0.5f, -0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         0.5f,  0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         0.5f,  0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-        -0.5f,  0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-        -0.5f, -0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-
-        //Left Face        
-        -0.5f,  0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-        -0.5f,  0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-        -0.5f, -0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-        -0.5f, -0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-        -0.5f, -0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-        -0.5f,  0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-
-        //Right Face       
-         0.5f,  0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         0.5f,  0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         0.5f, -0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         0.5f, -0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         0.5f, -0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         0.5f,  0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-
-         //Bottom Face      
-         -0.5f, -0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-          0.5f, -0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-          0.5f, -0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-          0.5f, -0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         -0.5f, -0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         -0.5f, -0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-
-         //Top Face         
-         -0.5f,  0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-          0.5f,  0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-          0.5f,  0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-          0.5f,  0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         -0.5f,  0.25f,  0.5f,  1.0f, 1.0f, 1.0f, 1.0f,
-         -0.5f,  0.25f, -0.5f,  1.0f, 1.0f, 1.0f, 1.0f
-
-    };
+    gStartup.Record(timing.name, timing.start, timing.end, timing.worker >= 0 ? gJobs.WorkerName(timing.worker) : "other thread");
+}
 
-    const GLuint floatsPerVertex = 3;
-    const GLuint floatsPerColor = 4;
 
-    meshRec3.nVertices = sizeof(verts) / (sizeof(verts[0]) * (floatsPerVertex + floatsPerColor));
+// Runs the same work on 1 to N workers: a parallel-for over independent items, and a graph of small jobs
+// where each stage starts once the stage before has finished. Every thread count must give the same sums.
+int UBenchmarkJobs()
+{
+    const int nItems = 1 << 22;
+    const int nRuns = 5;
+    const int nStages = 200;
+    const int nJobsPerStage = 64;
+    const int nJobIterations = 2000;
+
+    const int hardwareThreads = std::max(1, (int)std::thread::hardware_concurrency());
+    std::vector<int> threadCounts;
+    for (int threads = 1; threads < hardwareThreads; threads *= 2)
+        threadCounts.push_back(threads);
+    threadCounts.push_back(hardwareThreads);
+
+    cout << "INFO: Jobs: parallel-for over " << nItems << " items, " << nRuns << " runs; graph of " << nStages << " stages of "
+        << nJobsPerStage << " jobs, each stage after the last; " << hardwareThreads << " hardware threads" << endl;
+
+    std::vector<float> values(nItems);
+    std::vector<double> results(nStages * nJobsPerStage);
+    double referenceFor = 0.0, referenceGraph = 0.0;
+    float baseForMs = 0.0f, baseGraphMs = 0.0f;
+    bool same = true;
+    for (size_t t = 0; t < threadCounts.size(); ++t)
+    {
+        JobSystem jobs;
+        jobs.Start(threadCounts[t]);
+
+        typedef std::chrono::steady_clock Clock;
+        Clock::time_point start = Clock::now();
+        for (int run = 0; run < nRuns; ++run)
+        {
+            jobs.ParallelFor("bench items", nItems, [&values, run](int begin, int end) {
+                for (int i = begin; i < end; ++i)
+                    values[i] = std::sqrt((float)i) * 0.5f + std::sin(i * 0.001f + run);
+            }, 1024);
+        }
+        const float forMs = std::chrono::duration<float, std::milli>(Clock::now() - start).count() / nRuns;
+
+        // every stage's jobs are queued up front and held back by the counter of the stage before
+        std::unique_ptr<JobCounter[]> stages(new JobCounter[nStages]);
+        jobs.ResetStats();
+        start = Clock::now();
+        for (int stage = 0; stage < nStages; ++stage)
+        {
+            for (int j = 0; j < nJobsPerStage; ++j)
+            {
+                const int item = stage * nJobsPerStage + j;
+                std::function<void()> work = [&results, item]() {
+                    double sum = 0.0;
+                    for (int k = 0; k < nJobIterations; ++k)
+                        sum += std::sqrt((double)(item + k));
+                    results[item] = sum;
+                };
+                if (stage == 0)
+                    jobs.Run(work, &stages[0], "bench graph");
+                else
+                    jobs.RunAfter(stages[stage - 1], work, &stages[stage], "bench graph");
+            }
+        }
+        jobs.Wait(stages[nStages - 1]);
+        const float graphMs = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+
+        unsigned int steals = 0;
+        for (int w = 0; w < jobs.Threads(); ++w)
+            steals += jobs.WorkerStats(w).steals;
+
+        double sumFor = 0.0, sumGraph = 0.0;
+        for (int i = 0; i < nItems; ++i)
+            sumFor += values[i];
+        for (size_t i = 0; i < results.size(); ++i)
+            sumGraph += results[i];
+        if (t == 0)
+        {
+            referenceFor = sumFor;
+            referenceGraph = sumGraph;
+            baseForMs = forMs;
+            baseGraphMs = graphMs;
+        }
+        const bool matches = sumFor == referenceFor && sumGraph == referenceGraph;
+        same = same && matches;
+
+        cout << "INFO:   " << threadCounts[t] << " threads: parallel-for " << forMs << " ms (" << baseForMs / forMs << "x), graph "
+            << graphMs << " ms (" << baseGraphMs / graphMs << "x), " << nStages * nJobsPerStage / graphMs << " jobs per ms, "
+            << steals << " steals" << (matches ? "" : ", DIFFERENT results") << endl;
+    }
 
-    glGenVertexArrays(1, &meshRec3.vaoRec3); // we can also generate multiple VAOs or buffers at the same time
-    glBindVertexArray(meshRec3.vaoRec3);
+    return same ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
-    // Create VBO
-    glGenBuffers(1, &meshRec3.vboRec3);
-    glBindBuffer(GL_ARRAY_BUFFER, meshRec3.vboRec3); // Activates the buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW); // Sends vertex or coordinate data to the GPU
 
-    // Strides between vertex coordinates
-    GLint stride = sizeof(float) * (floatsPerVertex + floatsPerColor);
+// Packs every scene mesh into the pool and describes each object to the culling stage
+void UBuildDrawLists()
+{
+    const GLsizei floatsPerVertex = FloatsPerVertex(VERTEX_POSITION_COLOR);
+    GLuint pooledVaos[NUM_SCENE_OBJECTS];
+    MeshRange ranges[NUM_SCENE_OBJECTS];
+    int nPooled = 0;
 
-    // Create Vertex Attribute Pointers
-    glVertexAttribPointer(0, floatsPerVertex, GL_FLOAT, GL_FALSE, stride, 0);
-    glEnableVertexAttribArray(0);
+    gCullObjects.clear();
+    for (int i = 0; i < NUM_SCENE_OBJECTS; ++i)
+    {
+        const GLSceneObject& object = gSceneObjects[i];
+
+        // Objects drawn with the same mesh share its range of the pool
+        int mesh = 0;
+        while (mesh < nPooled && pooledVaos[mesh] != object.vao)
+            ++mesh;
+        if (mesh == nPooled)
+        {
+            pooledVaos[nPooled] = object.vao;
+            ranges[nPooled] = gMeshPool.Add(object.vbo, object.nVertices, object.ebo, object.nIndices, floatsPerVertex);
+            ++nPooled;
+        }
+
+        CullObject cull;
+        cull.boundsMin = glm::vec4(object.boundsMin, 0.0f);
+        cull.boundsMax = glm::vec4(object.boundsMax, 0.0f);
+        cull.firstIndex = ranges[mesh].firstIndex;
+        cull.indexCount = ranges[mesh].indexCount;
+        cull.baseVertex = ranges[mesh].baseVertex;
+        cull.objectIndex = i;
+        gCullObjects.push_back(cull);
+    }
 
-    glVertexAttribPointer(1, floatsPerColor, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(float) * floatsPerVertex));
-    glEnableVertexAttribArray(1);
+    gMeshPool.Build(floatsPerVertex);
+    BindObjectIndexAttribute(gMeshPool.GetVertexArray(), gObjectIndexBuffer);
 }
 
+
 void UDestroyMeshPlane(GLMesh& meshPlane)
 {
-    glDeleteVertexArrays(1, &meshPlane.vaoPlane);
-    glDeleteBuffers(1, &meshPlane.vboPlane);
+    GpuResources().DeleteVertexArray(meshPlane.vaoPlane);
+    GpuResources().DeleteBuffer(meshPlane.vboPlane);
+    GpuResources().DeleteBuffer(meshPlane.ebo);
 }
 
 void UDestroyMeshPyr(GLMesh& meshPyr)
 {
-    glDeleteVertexArrays(1, &meshPyr.vaoPyr);
-    glDeleteBuffers(1, &meshPyr.vboPyr);
+    gGeometryCache.Release(meshPyr.vaoPyr);
 }
 
 
 void UDestroyMeshCube(GLMesh& meshCube)
 {
-    glDeleteVertexArrays(1, &meshCube.vaoCube);
-    glDeleteBuffers(1, &meshCube.vboCube);
+    GpuResources().DeleteVertexArray(meshCube.vaoCube);
+    GpuResources().DeleteBuffer(meshCube.vboCube);
+    GpuResources().DeleteBuffer(meshCube.ebo);
 }
 
 void UDestroyMeshRec(GLMesh& meshRec)
 {
-    glDeleteVertexArrays(1, &meshRec.vaoRec);
-    glDeleteBuffers(1, &meshRec.vboRec);
+    GpuResources().DeleteVertexArray(meshRec.vaoRec);
+    GpuResources().DeleteBuffer(meshRec.vboRec);
+    GpuResources().DeleteBuffer(meshRec.ebo);
 }
 
 
 void UDestroyMeshRec2(GLMesh& meshRec2)
 {
-    glDeleteVertexArrays(1, &meshRec2.vaoRec2);
-    glDeleteBuffers(1, &meshRec2.vboRec2);
+    gGeometryCache.Release(meshRec2.vaoRec2);
 }
 
 void UDestroyMeshRec3(GLMesh& meshRec3)
 {
-    glDeleteVertexArrays(1, &meshRec3.vaoRec3);
-    glDeleteBuffers(1, &meshRec3.vboRec3);
+    gGeometryCache.Release(meshRec3.vaoRec3);
 }
 
-// Implements the UCreateShaders function
-bool UCreateShaderProgram(const char* vtxShaderSource, const char* fragShaderSource, GLuint& programId)
+// Times every generator at high tessellation with and without SIMD
+int UBenchmarkGeometry()
 {
-    // Compilation and linkage error reporting
-    int success = 0;
-    char infoLog[512];
-
-    // Create a Shader program object.
-    programId = glCreateProgram();
-
-    // Create the vertex and fragment shader objects
-    GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
-    GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
-
-    // Retrive the shader source
-    glShaderSource(vertexShaderId, 1, &vtxShaderSource, NULL);
-    glShaderSource(fragmentShaderId, 1, &fragShaderSource, NULL);
+    const glm::vec4 white(1.0f, 1.0f, 1.0f, 1.0f);
+    const int iterations = 10;
+    GeometryDesc shapes[] = {
+        GeometryDesc::Cylinder(0.5f, 1.0f, 4096, white, VERTEX_POSITION_COLOR_NORMAL),
+        GeometryDesc::Cone(0.5f, 1.0f, 4096, white, VERTEX_POSITION_COLOR_NORMAL),
+        GeometryDesc::Sphere(1.0f, 1024, 512, white, VERTEX_POSITION_COLOR_NORMAL),
+        GeometryDesc::Torus(1.0f, 0.25f, 1024, 512, white, VERTEX_POSITION_COLOR_NORMAL),
+        GeometryDesc::RoundedBox(glm::vec3(0.5f), 0.1f, 128, white, VERTEX_POSITION_COLOR_NORMAL),
+        GeometryDesc::Plane(1.0f, 1.0f, 1024, 512, white, VERTEX_POSITION_COLOR_NORMAL)
+    };
+    const char* names[] = { "cylinder", "cone", "sphere", "torus", "rounded box", "plane" };
 
-    // Compile the vertex shader, and print compilation errors (if any)
-    glCompileShader(vertexShaderId); // compile the vertex shader
-    // check for shader compile errors
-    glGetShaderiv(vertexShaderId, GL_COMPILE_STATUS, &success);
-    if (!success)
+    GeometryData data;
+    for (int i = 0; i < (int)(sizeof(shapes) / sizeof(shapes[0])); ++i)
     {
-        glGetShaderInfoLog(vertexShaderId, 512, NULL, infoLog);
-        std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
-
-        return false;
+        float ms[2];
+        for (int simd = 0; simd < 2; ++simd)
+        {
+            GenerateGeometry(shapes[i], data, simd == 1); // warm up
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (int k = 0; k < iterations; ++k)
+                GenerateGeometry(shapes[i], data, simd == 1);
+            ms[simd] = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+        }
+
+        size_t nVertices = data.vertices.size() / data.floatsPerVertex;
+        cout << "INFO: " << names[i] << ": " << nVertices << " vertices, " << data.indices.size() / 3 << " triangles, scalar "
+            << ms[0] << " ms, simd " << ms[1] << " ms (" << nVertices / (ms[1] * 1000.0f) << " M vertices/s)" << endl;
     }
 
-    glCompileShader(fragmentShaderId); // compile the fragment shader
-    // check for shader compile errors
-    glGetShaderiv(fragmentShaderId, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(fragmentShaderId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
+    return EXIT_SUCCESS;
+}
 
-        return false;
-    }
+// Culls growing numbers of randomly placed objects on the CPU and with the compute shader
+int UBenchmarkCulling()
+{
+    const int iterations = 20;
+    const GLuint counts[] = { 1024, 16384, 131072 };
 
-    // Attached compiled shaders to the shader program
-    glAttachShader(programId, vertexShaderId);
-    glAttachShader(programId, fragmentShaderId);
+    glm::mat4 viewProjection = UGetProjection() * gCamera.GetViewMatrix();
 
-    glLinkProgram(programId);   // links the shader program
-    // check for linking errors
-    glGetProgramiv(programId, GL_LINK_STATUS, &success);
-    if (!success)
+    srand(1234);
+    for (int c = 0; c < (int)(sizeof(counts) / sizeof(counts[0])); ++c)
     {
-        glGetProgramInfoLog(programId, sizeof(infoLog), NULL, infoLog);
-        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
-
-        return false;
+        const GLuint count = counts[c];
+        std::vector<CullObject> objects(count);
+        std::vector<GLObjectData> data(count);
+        std::vector<glm::mat4> models(count);
+
+        // Copies of the scene meshes scattered around the camera
+        for (GLuint i = 0; i < count; ++i)
+        {
+            glm::vec3 position(rand() % 2001 - 1000, rand() % 2001 - 1000, rand() % 2001 - 1000);
+            float scale = 0.5f + (rand() % 100) / 66.0f;
+            models[i] = glm::translate(position * 0.05f) * glm::scale(glm::vec3(scale));
+
+            objects[i] = gCullObjects[i % gCullObjects.size()];
+            objects[i].objectIndex = i;
+            data[i].model = models[i];
+            data[i].material = glm::vec4(1.0f);
+            data[i].layer = -1;
+        }
+
+        GLuint dataBuffer = GpuResources().GenBuffer("cull benchmark objects");
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, dataBuffer);
+        GpuResources().BufferData(GL_SHADER_STORAGE_BUFFER, dataBuffer, data.size() * sizeof(GLObjectData), data.data(), GL_STATIC_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OBJECT_DATA_BINDING, dataBuffer);
+        gCuller.SetObjects(objects);
+
+        std::vector<DrawElementsIndirectCommand> cpuCommands;
+        CullObjectsCpu(objects, models.data(), viewProjection, cpuCommands); // warm up
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int k = 0; k < iterations; ++k)
+            CullObjectsCpu(objects, models.data(), viewProjection, cpuCommands);
+        float cpuMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+        // GPU time includes waiting for the dispatch to finish
+        gCuller.Dispatch(viewProjection); // warm up
+        glFinish();
+        start = std::chrono::steady_clock::now();
+        for (int k = 0; k < iterations; ++k)
+        {
+            gCuller.Dispatch(viewProjection);
+            glFinish();
+        }
+        float gpuMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+        // Both paths must agree on which objects are visible
+        std::vector<DrawElementsIndirectCommand> gpuCommands;
+        gCuller.ReadCommands(gpuCommands);
+        std::vector<GLuint> cpuVisible, gpuVisible, differ;
+        for (size_t i = 0; i < cpuCommands.size(); ++i)
+            cpuVisible.push_back(cpuCommands[i].baseInstance);
+        for (size_t i = 0; i < gpuCommands.size(); ++i)
+            gpuVisible.push_back(gpuCommands[i].baseInstance);
+        std::sort(cpuVisible.begin(), cpuVisible.end());
+        std::sort(gpuVisible.begin(), gpuVisible.end());
+        std::set_symmetric_difference(cpuVisible.begin(), cpuVisible.end(), gpuVisible.begin(), gpuVisible.end(), std::back_inserter(differ));
+
+        cout << "INFO: " << count << " objects, " << cpuVisible.size() << " visible: CPU " << cpuMs << " ms, GPU "
+            << gpuMs << " ms, " << differ.size() << " results differ" << endl;
+
+        GpuResources().DeleteBuffer(dataBuffer);
     }
 
-    glUseProgram(programId);    // Uses the shader program
-
-    return true;
+    gCuller.SetObjects(gCullObjects);
+    return EXIT_SUCCESS;
 }
 
+
 // Implements destroy shader program
 void UDestroyShaderProgram(GLuint programId)
 {
-    glDeleteProgram(programId);
+    GpuResources().DeleteProgram(programId);
 }
 
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
 void UProcessInput(GLFWwindow* window)
 {
     static const float cameraSpeed = 2.5f;
+    const glm::vec3 start = gCamera.Position;
 
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
         glfwSetWindowShouldClose(window, true);
@@ -1049,6 +3982,61 @@ void UProcessInput(GLFWwindow* window)
     // If e key pressed camera down
     if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
         gCamera.ProcessKeyboard(DOWN, gDeltaTime);
+
+    // h shows or hides the performance overlay, once per press
+    const bool hudKey = glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS;
+    if (hudKey && !gHudKeyDown)
+    {
+        gHud.Visible = !gHud.Visible;
+        gRedraw.MarkChanged();
+    }
+    gHudKeyDown = hudKey;
+
+    // the keys say where the camera wants to go, collision decides how far it gets
+    if (gCollide)
+        gCamera.Position = UCollideCamera(start, gCamera.Position);
+    if (gCamera.Position != start)
+        gRedraw.MarkChanged();
+}
+
+
+// Polls window events and moves the camera; the pacer measures latency from here to the swap
+void USampleInput()
+{
+    // on demand, sleeps here until an event arrives while nothing has changed and nothing keeps changing
+    gRedraw.SetActive(USceneActive());
+    gRedraw.ProcessEvents(REDRAW_IDLE_SECONDS);
+
+    // per-frame timing; the first step after an idle wait is capped so the camera does not jump
+    float currentFrame = glfwGetTime();
+    gDeltaTime = currentFrame - gLastFrame;
+    if (gRedraw.OnDemand)
+        gDeltaTime = std::min(gDeltaTime, REDRAW_MAX_STEP_SECONDS);
+    gLastFrame = currentFrame;
+
+    UProcessInput(gWindow);
+    gPacer.InputSampled();
+}
+
+
+// Whether the scene goes on changing without further events: animations that move, particles that live or
+// are emitted, a movement key held down, or streamed cells and terrain tiles still arriving
+bool USceneActive()
+{
+    if (gAnimating && gAnimations.Moving())
+        return true;
+    if (gParticlesOn && (gParticleCount > 0 || gParticles.Emitting()))
+        return true;
+    if ((gStreaming && gStreamer.Pending()) || (gTerrain.IsOpen() && gTerrain.Pending()))
+        return true;
+
+    static const int movementKeys[] = { GLFW_KEY_W, GLFW_KEY_S, GLFW_KEY_A, GLFW_KEY_D, GLFW_KEY_Q, GLFW_KEY_E };
+    for (size_t i = 0; i < sizeof(movementKeys) / sizeof(movementKeys[0]); ++i)
+    {
+        if (glfwGetKey(gWindow, movementKeys[i]) == GLFW_PRESS)
+            return true;
+    }
+    return false;
 }
 
 
@@ -1056,6 +4044,17 @@ void UProcessInput(GLFWwindow* window)
 void UResizeWindow(GLFWwindow* window, int width, int height)
 {
     glViewport(0, 0, width, height);
+    gResolution.Resize(width, height);
+    gAmbientOcclusion.Resize(width, height);
+    gCuller.InvalidateDepthPyramid();
+    gRedraw.MarkChanged();
+}
+
+
+// glfw: the window lost its contents, uncovered or restored, and needs them back
+void UWindowRefreshCallback(GLFWwindow*)
+{
+    gRedraw.MarkExposed();
 }
 
 
@@ -1077,6 +4076,8 @@ void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos)
     gLastY = ypos;
 
     gCamera.ProcessMouseMovement(xoffset, yoffset);
+    if (xoffset != 0.0f || yoffset != 0.0f)
+        gRedraw.MarkChanged();
 }
 
 
@@ -1085,6 +4086,7 @@ void UMousePositionCallback(GLFWwindow* window, double xpos, double ypos)
 void UMouseScrollCallback(GLFWwindow* window, double xoffset, double yoffset)
 {
     gCamera.ProcessMouseScroll(yoffset);
+    gRedraw.MarkChanged();
 }
 
 // glfw: handle mouse button events
@@ -1096,9 +4098,19 @@ void UMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
     case GLFW_MOUSE_BUTTON_LEFT:
     {
         if (action == GLFW_PRESS)
-            cout << "Left mouse button pressed" << endl;
-        else
-            cout << "Left mouse button released" << endl;
+        {
+            // Selects the object under the cursor
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            float distance;
+            gSelectedObject = UPickObject(window, distance);
+            gRedraw.MarkChanged();
+            float pickMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            if (gSelectedObject >= 0)
+                cout << "INFO: Selected object " << gSelectedObject << " at distance " << distance << " (" << pickMs << " ms)" << endl;
+            else
+                cout << "INFO: Nothing selected (" << pickMs << " ms)" << endl;
+        }
     }
     break;
 
@@ -0,0 +1,401 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "simdmath.h" // ComposeTrs, SIMDMATH_X86 and the intrinsics headers
+#include "jobs.h" // Chunks run as jobs across the workers
+
+// Instances per chunk, the unit of work handed to the threads
+const int ANIMATION_CHUNK = 4096;
+// Samples per second clips are baked at unless the caller asks otherwise
+const float ANIMATION_SAMPLE_RATE = 30.0f;
+
+// Keys of one track; each channel has its own times, in seconds from the start of the clip
+struct AnimationVec3Key
+{
+    float time;
+    glm::vec3 value;
+};
+
+struct AnimationQuatKey
+{
+    float time;
+    glm::quat value;
+};
+
+// Keyframed translation, rotation and scale of one object; an empty channel stays at identity
+struct AnimationTrackKeys
+{
+    std::vector<AnimationVec3Key> translation;
+    std::vector<AnimationQuatKey> rotation;
+    std::vector<AnimationVec3Key> scale;
+};
+
+// One baked pose: translation, rotation (x, y, z, w) and scale, each padded to a 16 byte register
+struct AnimationSample
+{
+    float t[4];
+    float r[4];
+    float s[4];
+};
+
+namespace animation_detail
+{
+    inline glm::vec3 sampleVec3(const std::vector<AnimationVec3Key>& keys, float time, const glm::vec3& identity)
+    {
+        if (keys.empty())
+            return identity;
+        if (time <= keys.front().time)
+            return keys.front().value;
+        for (size_t k = 1; k < keys.size(); ++k)
+        {
+            if (time < keys[k].time)
+            {
+                const float a = (time - keys[k - 1].time) / (keys[k].time - keys[k - 1].time);
+                return glm::mix(keys[k - 1].value, keys[k].value, a);
+            }
+        }
+        return keys.back().value;
+    }
+
+    inline glm::quat sampleQuat(const std::vector<AnimationQuatKey>& keys, float time)
+    {
+        if (keys.empty())
+            return glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+        if (time <= keys.front().time)
+            return keys.front().value;
+        for (size_t k = 1; k < keys.size(); ++k)
+        {
+            if (time < keys[k].time)
+            {
+                const float a = (time - keys[k - 1].time) / (keys[k].time - keys[k - 1].time);
+                return glm::slerp(keys[k - 1].value, keys[k].value, a);
+            }
+        }
+        return keys.back().value;
+    }
+
+    inline void store3(float out[4], const glm::vec3& v)
+    {
+        out[0] = v.x; out[1] = v.y; out[2] = v.z; out[3] = 0.0f;
+    }
+
+#ifdef SIMDMATH_X86
+    // a + (b - a) * alpha over both samples of a pair, for the three registers of a pose
+    inline void interpolate(const AnimationSample& a, const AnimationSample& b, float alpha,
+        glm::vec3& t, glm::quat& r, glm::vec3& s)
+    {
+        const __m128 weight = _mm_set1_ps(alpha);
+        __m128 t0 = _mm_loadu_ps(a.t), r0 = _mm_loadu_ps(a.r), s0 = _mm_loadu_ps(a.s);
+        __m128 tv = _mm_add_ps(t0, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(b.t), t0), weight));
+        __m128 rv = _mm_add_ps(r0, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(b.r), r0), weight));
+        __m128 sv = _mm_add_ps(s0, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(b.s), s0), weight));
+
+        // length of the blended quaternion in every lane
+        __m128 squares = _mm_mul_ps(rv, rv);
+        squares = _mm_add_ps(squares, _mm_shuffle_ps(squares, squares, _MM_SHUFFLE(2, 3, 0, 1)));
+        squares = _mm_add_ps(squares, _mm_shuffle_ps(squares, squares, _MM_SHUFFLE(1, 0, 3, 2)));
+        rv = _mm_div_ps(rv, _mm_sqrt_ps(squares));
+
+        simdmath_detail::storePoint(t, tv);
+        _mm_storeu_ps(&r.x, rv);
+        simdmath_detail::storePoint(s, sv);
+    }
+#else
+    inline void interpolate(const AnimationSample& a, const AnimationSample& b, float alpha,
+        glm::vec3& t, glm::quat& r, glm::vec3& s)
+    {
+        float q[4], length = 0.0f;
+        for (int c = 0; c < 4; ++c)
+        {
+            q[c] = a.r[c] + (b.r[c] - a.r[c]) * alpha;
+            length += q[c] * q[c];
+        }
+        length = std::sqrt(length);
+        t = glm::vec3(a.t[0] + (b.t[0] - a.t[0]) * alpha, a.t[1] + (b.t[1] - a.t[1]) * alpha, a.t[2] + (b.t[2] - a.t[2]) * alpha);
+        r = glm::quat(q[3] / length, q[0] / length, q[1] / length, q[2] / length);
+        s = glm::vec3(a.s[0] + (b.s[0] - a.s[0]) * alpha, a.s[1] + (b.s[1] - a.s[1]) * alpha, a.s[2] + (b.s[2] - a.s[2]) * alpha);
+    }
+#endif
+}
+
+// Keyframed transforms for many objects, evaluated in batches.
+// A clip's tracks are baked once into poses at a fixed rate, each track one contiguous run of samples,
+// so playing one is two neighbouring 48 byte reads and a blend: a lerp of translation and scale and a
+// normalized lerp of the rotation. Baking used the full slerp between keys and keeps neighbouring
+// rotations in one hemisphere, so at the baked rate the two blends agree to float precision.
+// Instances are tracks being played, stored structure-of-arrays; each frame only the instances whose
+// pose can change (playing, moving in time, not constant) are evaluated, composed into matrices with
+// SimdMath().ComposeTrs and reported as dirty, chunk after chunk across the job workers.
+class AnimationSet
+{
+public:
+    // smoothed time of the last Update, sampling and composing
+    float UpdateMs;
+
+    AnimationSet() : UpdateMs(0.0f), dirtyCount(0)
+    {
+    }
+
+    // bakes the tracks of one clip lasting duration seconds; returns the index of its first track,
+    // the others follow in order
+    int AddClip(const std::vector<AnimationTrackKeys>& tracks, float duration, bool loop,
+        float sampleRate = ANIMATION_SAMPLE_RATE)
+    {
+        using namespace animation_detail;
+
+        Clip clip;
+        clip.frames = std::max(1, (int)std::ceil(duration * sampleRate - 0.001f));
+        clip.duration = std::max(duration, 1e-4f);
+        clip.rate = clip.frames / clip.duration;
+        clip.loop = loop;
+        clips.push_back(clip);
+
+        const int firstTrack = (int)trackFirstSample.size();
+        for (size_t i = 0; i < tracks.size(); ++i)
+        {
+            const size_t first = samples.size();
+            glm::quat previous(1.0f, 0.0f, 0.0f, 0.0f);
+            bool constant = true;
+            for (int f = 0; f <= clip.frames; ++f)
+            {
+                const float time = f / clip.rate;
+                glm::quat r = glm::normalize(sampleQuat(tracks[i].rotation, time));
+                if (f > 0 && glm::dot(previous, r) < 0.0f)
+                    r = glm::quat(-r.w, -r.x, -r.y, -r.z);
+                previous = r;
+
+                AnimationSample sample;
+                store3(sample.t, sampleVec3(tracks[i].translation, time, glm::vec3(0.0f)));
+                sample.r[0] = r.x; sample.r[1] = r.y; sample.r[2] = r.z; sample.r[3] = r.w;
+                store3(sample.s, sampleVec3(tracks[i].scale, time, glm::vec3(1.0f)));
+                samples.push_back(sample);
+
+                if (f > 0 && std::memcmp(&sample, &samples[first], sizeof(sample)) != 0)
+                    constant = false;
+            }
+            trackFirstSample.push_back(first);
+            trackClip.push_back((int)clips.size() - 1);
+            trackConstant.push_back(constant ? 1 : 0);
+        }
+        return firstTrack;
+    }
+
+    int Tracks() const { return (int)trackFirstSample.size(); }
+
+    // starts playing a track at time seconds into its clip, speed times real time; returns the instance
+    int AddInstance(int track, float time = 0.0f, float speed = 1.0f)
+    {
+        instanceTrack.push_back(track);
+        instanceTime.push_back(time);
+        instanceSpeed.push_back(speed);
+        // evaluated on the next update even when it never moves, so the first pose is reported
+        instancePlaying.push_back(1);
+        instanceFresh.push_back(1);
+        return (int)instanceTrack.size() - 1;
+    }
+
+    int Instances() const { return (int)instanceTrack.size(); }
+
+    void SetPlaying(int instance, bool playing)
+    {
+        instancePlaying[instance] = playing ? 1 : 0;
+    }
+
+    void SetSpeed(int instance, float speed)
+    {
+        instanceSpeed[instance] = speed;
+    }
+
+    // seconds into its clip, as of the last Update
+    float Time(int instance) const { return instanceTime[instance]; }
+
+    void Seek(int instance, float time)
+    {
+        instanceTime[instance] = time;
+        instanceFresh[instance] = 1;
+    }
+
+    // advances every playing instance by dt seconds and composes the changed ones
+    void Update(float dt, JobSystem& jobs)
+    {
+        typedef std::chrono::steady_clock Clock;
+        Clock::time_point start = Clock::now();
+
+        const int count = Instances();
+        const int chunks = (count + ANIMATION_CHUNK - 1) / ANIMATION_CHUNK;
+        if ((int)dirtyInstances.size() < count)
+        {
+            dirtyInstances.resize(count);
+            dirtyModels.resize(count);
+        }
+
+        // which instances change decides where each chunk writes, so the dirty list comes out packed
+        // and in instance order on any thread count
+        chunkFirst.assign(chunks + 1, 0);
+        for (int c = 0; c < chunks; ++c)
+        {
+            const int end = std::min(count, (c + 1) * ANIMATION_CHUNK);
+            int changed = 0;
+            for (int i = c * ANIMATION_CHUNK; i < end; ++i)
+                changed += changes(i, dt) ? 1 : 0;
+            chunkFirst[c + 1] = chunkFirst[c] + changed;
+        }
+        dirtyCount = chunkFirst[chunks];
+
+        jobs.ParallelFor("animation", chunks, [this, dt, count](int begin, int end) {
+            for (int chunk = begin; chunk < end; ++chunk)
+                evaluateChunk(chunk, dt, count);
+        });
+
+        const float ms = std::chrono::duration<float, std::milli>(Clock::now() - start).count();
+        UpdateMs = UpdateMs == 0.0f ? ms : UpdateMs * 0.9f + ms * 0.1f;
+    }
+
+    // whether the next Update will move any instance
+    bool Moving() const
+    {
+        for (int i = 0; i < Instances(); ++i)
+        {
+            if (changes(i, 1.0f))
+                return true;
+        }
+        return false;
+    }
+
+    // instances whose pose changed in the last Update, in order, and their new model matrices
+    int DirtyCount() const { return dirtyCount; }
+    const int* DirtyInstances() const { return dirtyInstances.data(); }
+    const glm::mat4* DirtyModels() const { return dirtyModels.data(); }
+
+    // pose of a track at a time in its clip, the way Update evaluates it
+    void Sample(int track, float time, glm::vec3& translation, glm::quat& rotation, glm::vec3& scale) const
+    {
+        const Clip& clip = clips[trackClip[track]];
+        int frame;
+        float alpha;
+        locate(clip, wrap(clip, time), frame, alpha);
+        const AnimationSample* pair = &samples[trackFirstSample[track] + frame];
+        animation_detail::interpolate(pair[0], pair[1], alpha, translation, rotation, scale);
+    }
+
+private:
+    struct Clip
+    {
+        float duration;
+        float rate;     // samples per second, so frames / duration exactly
+        int frames;     // intervals; each track stores frames + 1 samples
+        bool loop;
+    };
+
+    std::vector<Clip> clips;
+    std::vector<AnimationSample> samples;
+    std::vector<size_t> trackFirstSample;
+    std::vector<int> trackClip;
+    std::vector<unsigned char> trackConstant;
+
+    std::vector<int> instanceTrack;
+    std::vector<float> instanceTime;
+    std::vector<float> instanceSpeed;
+    std::vector<unsigned char> instancePlaying;
+    std::vector<unsigned char> instanceFresh;
+
+    std::vector<int> dirtyInstances;
+    std::vector<glm::mat4> dirtyModels;
+    std::vector<int> chunkFirst;
+    int dirtyCount;
+
+    bool changes(int i, float dt) const
+    {
+        if (instanceFresh[i])
+            return true;
+        return instancePlaying[i] && instanceSpeed[i] * dt != 0.0f && !trackConstant[instanceTrack[i]];
+    }
+
+    static float wrap(const Clip& clip, float time)
+    {
+        if (clip.loop)
+        {
+            // a frame rarely steps past more than one end, fmod only when it does
+            if (time >= clip.duration)
+                time -= clip.duration;
+            else if (time < 0.0f)
+                time += clip.duration;
+            if (time < 0.0f || time >= clip.duration)
+                time = std::fmod(time, clip.duration) + (time < 0.0f ? clip.duration : 0.0f);
+            return time < clip.duration ? time : 0.0f;
+        }
+        return std::min(std::max(time, 0.0f), clip.duration);
+    }
+
+    static void locate(const Clip& clip, float time, int& frame, float& alpha)
+    {
+        const float position = time * clip.rate;
+        frame = std::min((int)position, clip.frames - 1);
+        alpha = std::min(position - frame, 1.0f);
+    }
+
+    void evaluateChunk(int chunk, float dt, int count)
+    {
+        const int begin = chunk * ANIMATION_CHUNK;
+        const int end = std::min(count, begin + ANIMATION_CHUNK);
+        const int first = chunkFirst[chunk];
+        const int changed = chunkFirst[chunk + 1] - first;
+
+        // the chunk's samples and poses only live until they are composed into dirtyModels,
+        // so they come from the scratch arena of the worker running it
+        FrameArena& scratch = JobSystem::Scratch();
+        ArenaScope scope(scratch);
+        const AnimationSample** pairs = scratch.AllocateArray<const AnimationSample*>(changed);
+        float* alphas = scratch.AllocateArray<float>(changed);
+        glm::vec3* t = scratch.AllocateArray<glm::vec3>(changed);
+        glm::quat* r = scratch.AllocateArray<glm::quat>(changed);
+        glm::vec3* s = scratch.AllocateArray<glm::vec3>(changed);
+
+        int out = 0;
+        for (int i = begin; i < end; ++i)
+        {
+            if (!changes(i, dt))
+                continue;
+
+            const int track = instanceTrack[i];
+            const Clip& clip = clips[trackClip[track]];
+            float time = instanceTime[i];
+            if (instancePlaying[i] && !instanceFresh[i])
+            {
+                time = wrap(clip, time + instanceSpeed[i] * dt);
+                // a clip that does not loop stops once its end pose has been reported
+                if (!clip.loop && (time == 0.0f || time == clip.duration))
+                    instancePlaying[i] = 0;
+            }
+            else
+            {
+                time = wrap(clip, time);
+            }
+            instanceTime[i] = time;
+            instanceFresh[i] = 0;
+
+            int frame;
+            locate(clip, time, frame, alphas[out]);
+            pairs[out] = &samples[trackFirstSample[track] + frame];
+            dirtyInstances[first + out] = i;
+            ++out;
+        }
+
+        // blended in a second pass, so the sample reads of many instances are in flight at once
+        // instead of each waiting behind the bookkeeping of the one before
+        for (int d = 0; d < out; ++d)
+            animation_detail::interpolate(pairs[d][0], pairs[d][1], alphas[d], t[d], r[d], s[d]);
+        if (out > 0)
+            SimdMath().ComposeTrs(t, r, s, &dirtyModels[first], out);
+    }
+};
+#endif
@@ -0,0 +1,393 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BVH_SIMD 1
+#endif
+
+// Child slot that holds nothing
+const int BVH_EMPTY = INT_MIN;
+// Largest traversal depth; a median split BVH4 over 2^31 objects needs 16
+const int BVH_STACK_SIZE = 64;
+
+// Object-space triangles of a mesh, kept on the CPU for exact picking
+struct PickMesh
+{
+    std::vector<glm::vec3> positions;
+    std::vector<unsigned int> indices;
+};
+
+// Moller-Trumbore; returns true with the ray parameter of the hit when it is in (0, tMax)
+inline bool RayTriangle(const glm::vec3& origin, const glm::vec3& direction,
+    const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, float tMax, float& t)
+{
+    glm::vec3 edge1 = v1 - v0;
+    glm::vec3 edge2 = v2 - v0;
+    glm::vec3 p = glm::cross(direction, edge2);
+    float det = glm::dot(edge1, p);
+    if (det > -1e-12f && det < 1e-12f)
+        return false;
+
+    float invDet = 1.0f / det;
+    glm::vec3 s = origin - v0;
+    float u = glm::dot(s, p) * invDet;
+    if (u < 0.0f || u > 1.0f)
+        return false;
+
+    glm::vec3 q = glm::cross(s, edge1);
+    float v = glm::dot(direction, q) * invDet;
+    if (v < 0.0f || u + v > 1.0f)
+        return false;
+
+    t = glm::dot(edge2, q) * invDet;
+    return t > 0.0f && t < tMax;
+}
+
+// Closest hit of a world-space ray with a transformed mesh. The ray is moved into object
+// space without normalizing, so the returned parameter is valid along the world ray.
+inline bool RayPickMesh(const PickMesh& mesh, const glm::mat4& inverseModel, const glm::vec3& origin, const glm::vec3& direction, float tMax, float& t)
+{
+    glm::vec3 localOrigin = glm::vec3(inverseModel * glm::vec4(origin, 1.0f));
+    glm::vec3 localDirection = glm::vec3(inverseModel * glm::vec4(direction, 0.0f));
+
+    bool hit = false;
+    for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+    {
+        float tTriangle;
+        if (RayTriangle(localOrigin, localDirection, mesh.positions[mesh.indices[i]], mesh.positions[mesh.indices[i + 1]],
+            mesh.positions[mesh.indices[i + 2]], tMax, tTriangle))
+        {
+            tMax = tTriangle;
+            hit = true;
+        }
+    }
+    t = tMax;
+    return hit;
+}
+
+// Four children per node, boxes stored as structure of arrays so one SSE slab test covers the node
+struct BvhNode4
+{
+    float minX[4], minY[4], minZ[4];
+    float maxX[4], maxY[4], maxZ[4];
+    int child[4];       // >= 0 inner node, BVH_EMPTY, otherwise -1 - object index
+    int parent;         // -1 at the root
+    int parentSlot;     // slot of this node in its parent
+};
+
+// Four-wide bounding volume hierarchy over world-space object boxes for ray picking.
+// Boxes can be moved afterwards with Update, which refits only the path to the root.
+class Bvh4
+{
+public:
+    // nodes visited and exact tests run by the last Pick
+    unsigned int NodesVisited;
+    unsigned int ObjectsTested;
+
+    Bvh4() : NodesVisited(0), ObjectsTested(0)
+    {
+    }
+
+    // builds the tree over one box per object; median splits on the widest centroid axis
+    void Build(const std::vector<glm::vec3>& boundsMin, const std::vector<glm::vec3>& boundsMax)
+    {
+        const int count = (int)boundsMin.size();
+        boxMin = boundsMin;
+        boxMax = boundsMax;
+        nodes.clear();
+        nodes.reserve(count / 3 + 1);
+        objectNode.assign(count, -1);
+        objectSlot.assign(count, 0);
+
+        order.resize(count);
+        centroids.resize(count);
+        for (int i = 0; i < count; ++i)
+        {
+            order[i] = i;
+            centroids[i] = (boxMin[i] + boxMax[i]) * 0.5f;
+        }
+
+        if (count > 0)
+            build(0, count, -1, 0);
+
+        std::vector<int>().swap(order);
+        std::vector<glm::vec3>().swap(centroids);
+    }
+
+    // moves one object's box and refits its ancestors, stopping once a bound no longer changes
+    void Update(int object, const glm::vec3& newMin, const glm::vec3& newMax)
+    {
+        boxMin[object] = newMin;
+        boxMax[object] = newMax;
+
+        int node = objectNode[object];
+        int slot = objectSlot[object];
+        if (node < 0)
+            return;
+        setSlot(nodes[node], slot, newMin, newMax);
+
+        while (nodes[node].parent >= 0)
+        {
+            glm::vec3 unionMin, unionMax;
+            nodeBounds(nodes[node], unionMin, unionMax);
+
+            BvhNode4& parent = nodes[nodes[node].parent];
+            int parentSlot = nodes[node].parentSlot;
+            if (parent.minX[parentSlot] == unionMin.x && parent.minY[parentSlot] == unionMin.y && parent.minZ[parentSlot] == unionMin.z &&
+                parent.maxX[parentSlot] == unionMax.x && parent.maxY[parentSlot] == unionMax.y && parent.maxZ[parentSlot] == unionMax.z)
+                break;
+
+            setSlot(parent, parentSlot, unionMin, unionMax);
+            node = nodes[node].parent;
+        }
+    }
+
+    // Closest object along the ray. hitTest(object, tMax, t) runs the exact test and returns true
+    // with t when the object is hit closer than tMax. Returns -1 when nothing is hit.
+    template <typename HitTest>
+    int Pick(const glm::vec3& origin, const glm::vec3& direction, float tMax, HitTest hitTest, float& tHit)
+    {
+        NodesVisited = 0;
+        ObjectsTested = 0;
+        tHit = tMax;
+        if (nodes.empty())
+            return -1;
+
+        glm::vec3 inverse;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float d = direction[axis];
+            if (d > -1e-20f && d < 1e-20f)
+                d = d < 0.0f ? -1e-20f : 1e-20f;
+            inverse[axis] = 1.0f / d;
+        }
+
+        int stack[BVH_STACK_SIZE];
+        int top = 0;
+        int best = -1;
+        stack[top++] = 0;
+
+        while (top > 0)
+        {
+            const BvhNode4& node = nodes[stack[--top]];
+            ++NodesVisited;
+
+            float tEnter[4];
+            int mask = slabTest(node, origin, inverse, tHit, tEnter);
+            if (mask == 0)
+                continue;
+
+            // hit children sorted from farthest to nearest
+            int hits[4];
+            int nHits = 0;
+            for (int i = 0; i < 4; ++i)
+            {
+                if (!(mask & (1 << i)) || node.child[i] == BVH_EMPTY)
+                    continue;
+                int k = nHits++;
+                while (k > 0 && tEnter[hits[k - 1]] < tEnter[i])
+                {
+                    hits[k] = hits[k - 1];
+                    --k;
+                }
+                hits[k] = i;
+            }
+
+            // objects first, nearest to farthest, so the closer hits shrink tHit before nodes are pushed
+            for (int k = nHits - 1; k >= 0; --k)
+            {
+                int child = node.child[hits[k]];
+                if (child >= 0 || tEnter[hits[k]] > tHit)
+                    continue;
+
+                int object = -1 - child;
+                float t;
+                ++ObjectsTested;
+                if (hitTest(object, tHit, t))
+                {
+                    tHit = t;
+                    best = object;
+                }
+            }
+
+            // inner nodes farthest first so the nearest is popped next
+            for (int k = 0; k < nHits; ++k)
+            {
+                int child = node.child[hits[k]];
+                if (child >= 0 && tEnter[hits[k]] <= tHit && top < BVH_STACK_SIZE)
+                    stack[top++] = child;
+            }
+        }
+        return best;
+    }
+
+    int Size() const
+    {
+        return (int)objectNode.size();
+    }
+
+    size_t NodeCount() const
+    {
+        return nodes.size();
+    }
+
+private:
+    std::vector<BvhNode4> nodes;
+    std::vector<glm::vec3> boxMin;
+    std::vector<glm::vec3> boxMax;
+    std::vector<int> objectNode;
+    std::vector<int> objectSlot;
+    // build scratch
+    std::vector<int> order;
+    std::vector<glm::vec3> centroids;
+
+    static void setSlot(BvhNode4& node, int slot, const glm::vec3& bMin, const glm::vec3& bMax)
+    {
+        node.minX[slot] = bMin.x; node.minY[slot] = bMin.y; node.minZ[slot] = bMin.z;
+        node.maxX[slot] = bMax.x; node.maxY[slot] = bMax.y; node.maxZ[slot] = bMax.z;
+    }
+
+    static void nodeBounds(const BvhNode4& node, glm::vec3& bMin, glm::vec3& bMax)
+    {
+        bMin = glm::vec3(FLT_MAX);
+        bMax = glm::vec3(-FLT_MAX);
+        for (int i = 0; i < 4; ++i)
+        {
+            if (node.child[i] == BVH_EMPTY)
+                continue;
+            bMin = glm::min(bMin, glm::vec3(node.minX[i], node.minY[i], node.minZ[i]));
+            bMax = glm::max(bMax, glm::vec3(node.maxX[i], node.maxY[i], node.maxZ[i]));
+        }
+    }
+
+    void rangeBounds(int begin, int end, glm::vec3& bMin, glm::vec3& bMax) const
+    {
+        bMin = glm::vec3(FLT_MAX);
+        bMax = glm::vec3(-FLT_MAX);
+        for (int i = begin; i < end; ++i)
+        {
+            bMin = glm::min(bMin, boxMin[order[i]]);
+            bMax = glm::max(bMax, boxMax[order[i]]);
+        }
+    }
+
+    // splits [begin, end) at its median along the widest centroid axis, returns the split point
+    int split(int begin, int end)
+    {
+        glm::vec3 cMin(FLT_MAX), cMax(-FLT_MAX);
+        for (int i = begin; i < end; ++i)
+        {
+            cMin = glm::min(cMin, centroids[order[i]]);
+            cMax = glm::max(cMax, centroids[order[i]]);
+        }
+        glm::vec3 extent = cMax - cMin;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+        int middle = (begin + end) / 2;
+        const std::vector<glm::vec3>& c = centroids;
+        std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end,
+            [&c, axis](int a, int b) { return c[a][axis] < c[b][axis]; });
+        return middle;
+    }
+
+    int build(int begin, int end, int parent, int parentSlot)
+    {
+        int index = (int)nodes.size();
+        nodes.push_back(BvhNode4());
+        nodes[index].parent = parent;
+        nodes[index].parentSlot = parentSlot;
+
+        // up to four objects fit in the slots directly, otherwise split in four ranges
+        int ranges[5];
+        int nRanges;
+        if (end - begin <= 4)
+        {
+            nRanges = end - begin;
+            for (int i = 0; i <= nRanges; ++i)
+                ranges[i] = begin + i;
+        }
+        else
+        {
+            int middle = split(begin, end);
+            ranges[0] = begin;
+            ranges[1] = split(begin, middle);
+            ranges[2] = middle;
+            ranges[3] = split(middle, end);
+            ranges[4] = end;
+            nRanges = 4;
+        }
+
+        for (int slot = 0; slot < 4; ++slot)
+        {
+            if (slot >= nRanges)
+            {
+                nodes[index].child[slot] = BVH_EMPTY;
+                setSlot(nodes[index], slot, glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX));
+                continue;
+            }
+
+            glm::vec3 bMin, bMax;
+            rangeBounds(ranges[slot], ranges[slot + 1], bMin, bMax);
+            setSlot(nodes[index], slot, bMin, bMax);
+
+            if (ranges[slot + 1] - ranges[slot] == 1)
+            {
+                int object = order[ranges[slot]];
+                nodes[index].child[slot] = -1 - object;
+                objectNode[object] = index;
+                objectSlot[object] = slot;
+            }
+            else
+            {
+                int child = build(ranges[slot], ranges[slot + 1], index, slot);
+                nodes[index].child[slot] = child;   // nodes may have grown, index again
+            }
+        }
+        return index;
+    }
+
+    // returns a bit per child whose box the ray enters before tMax, with the entry distances
+    static int slabTest(const BvhNode4& node, const glm::vec3& origin, const glm::vec3& inverse, float tMax, float tEnter[4])
+    {
+#ifdef BVH_SIMD
+        const __m128 ox = _mm_set1_ps(origin.x), oy = _mm_set1_ps(origin.y), oz = _mm_set1_ps(origin.z);
+        const __m128 ix = _mm_set1_ps(inverse.x), iy = _mm_set1_ps(inverse.y), iz = _mm_set1_ps(inverse.z);
+
+        __m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minX), ox), ix);
+        __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxX), ox), ix);
+        __m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minY), oy), iy);
+        __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxY), oy), iy);
+        __m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.minZ), oz), iz);
+        __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.maxZ), oz), iz);
+
+        __m128 enter = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)), _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_setzero_ps()));
+        __m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)), _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_set1_ps(tMax)));
+
+        _mm_storeu_ps(tEnter, enter);
+        return _mm_movemask_ps(_mm_cmple_ps(enter, exit));
+#else
+        int mask = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            float t0x = (node.minX[i] - origin.x) * inverse.x, t1x = (node.maxX[i] - origin.x) * inverse.x;
+            float t0y = (node.minY[i] - origin.y) * inverse.y, t1y = (node.maxY[i] - origin.y) * inverse.y;
+            float t0z = (node.minZ[i] - origin.z) * inverse.z, t1z = (node.maxZ[i] - origin.z) * inverse.z;
+            float enter = std::max(std::max(std::min(t0x, t1x), std::min(t0y, t1y)), std::max(std::min(t0z, t1z), 0.0f));
+            float exit = std::min(std::min(std::max(t0x, t1x), std::max(t0y, t1y)), std::min(std::max(t0z, t1z), tMax));
+            tEnter[i] = enter;
+            if (enter <= exit)
+                mask |= 1 << i;
+        }
+        return mask;
+#endif
+    }
+};
+#endif
@@ -0,0 +1,392 @@
+#ifndef COLLISION_H
+#define COLLISION_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+#include "bvh.h" // PickMesh, the CPU copy of each object's triangles
+
+// Radius of the sphere the camera is kept out of the scene with, world units
+const float COLLISION_RADIUS = 0.2f;
+// Distance kept from a surface after a hit, so the next move does not start touching it
+const float COLLISION_SKIN = 0.002f;
+// Hits handled per move; each one slides the rest of the move along the surface
+const int COLLISION_ITERATIONS = 4;
+
+// One point a sweep first touched: the fraction of the move done and the surface normal facing the sphere
+struct SweepHit
+{
+    float t;
+    glm::vec3 normal;
+};
+
+namespace collision_detail
+{
+    // smallest root of a t^2 + b t + c in (0, tMax)
+    inline bool lowestRoot(float a, float b, float c, float tMax, float& root)
+    {
+        const float determinant = b * b - 4.0f * a * c;
+        if (determinant < 0.0f || a == 0.0f)
+            return false;
+
+        const float sqrtD = std::sqrt(determinant);
+        float r1 = (-b - sqrtD) / (2.0f * a);
+        float r2 = (-b + sqrtD) / (2.0f * a);
+        if (r1 > r2)
+            std::swap(r1, r2);
+        if (r1 > 0.0f && r1 < tMax)
+        {
+            root = r1;
+            return true;
+        }
+        if (r2 > 0.0f && r2 < tMax)
+        {
+            root = r2;
+            return true;
+        }
+        return false;
+    }
+
+    inline bool pointInTriangle(const glm::vec3& p, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2)
+    {
+        const glm::vec3 e0 = v1 - v0, e1 = v2 - v0, e2 = p - v0;
+        const float d00 = glm::dot(e0, e0), d01 = glm::dot(e0, e1), d11 = glm::dot(e1, e1);
+        const float d20 = glm::dot(e2, e0), d21 = glm::dot(e2, e1);
+        const float denominator = d00 * d11 - d01 * d01;
+        const float v = (d11 * d20 - d01 * d21) / denominator;
+        const float w = (d00 * d21 - d01 * d20) / denominator;
+        return v >= 0.0f && w >= 0.0f && v + w <= 1.0f;
+    }
+
+    // keeps the earlier of two hits, only when the sphere moves into the surface
+    inline void keep(const glm::vec3& center, const glm::vec3& move, float t, const glm::vec3& contact, SweepHit& hit, bool& found)
+    {
+        glm::vec3 normal = center + move * t - contact;
+        const float length = glm::length(normal);
+        if (length <= 0.0f)
+            return;
+        normal /= length;
+        if (glm::dot(normal, move) >= 0.0f || t >= hit.t)
+            return;
+        hit.t = t;
+        hit.normal = normal;
+        found = true;
+    }
+}
+
+// Sphere moving from center by move against one triangle, either side. A hit earlier than hit.t
+// replaces it: first the face, then, when the face point is outside the triangle, its three
+// corners and three edges. A sphere already overlapping the face and moving in stops at t = 0.
+inline bool SweepSphereTriangle(const glm::vec3& center, float radius, const glm::vec3& move,
+    const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2, SweepHit& hit)
+{
+    using namespace collision_detail;
+
+    glm::vec3 normal = glm::cross(v1 - v0, v2 - v0);
+    const float area = glm::length(normal);
+    if (area <= 1e-12f)
+        return false;
+    normal /= area;
+
+    float distance = glm::dot(normal, center - v0);
+    if (distance < 0.0f)
+    {
+        normal = -normal;
+        distance = -distance;
+    }
+    const float approach = glm::dot(normal, move);
+    // moving along or away from the plane never starts a contact worth stopping for
+    if (approach >= 0.0f || distance - radius > -approach)
+        return false;
+
+    const float tFace = std::max((radius - distance) / approach, 0.0f);
+    if (tFace >= hit.t)
+        return false;
+    if (pointInTriangle(center + move * tFace - normal * radius, v0, v1, v2))
+    {
+        hit.t = tFace;
+        hit.normal = normal;
+        return true;
+    }
+
+    bool found = false;
+    const float moveSq = glm::dot(move, move);
+    const glm::vec3* corners[3] = { &v0, &v1, &v2 };
+    for (int i = 0; i < 3; ++i)
+    {
+        const glm::vec3& p = *corners[i];
+        float t;
+        if (lowestRoot(moveSq, 2.0f * glm::dot(move, center - p), glm::dot(center - p, center - p) - radius * radius, hit.t, t))
+            keep(center, move, t, p, hit, found);
+    }
+    for (int i = 0; i < 3; ++i)
+    {
+        const glm::vec3& a = *corners[i];
+        const glm::vec3 edge = *corners[(i + 1) % 3] - a;
+        const glm::vec3 toStart = a - center;
+        const float edgeSq = glm::dot(edge, edge);
+        const float edgeMove = glm::dot(edge, move);
+        const float edgeStart = glm::dot(edge, toStart);
+        float t;
+        if (!lowestRoot(edgeSq * -moveSq + edgeMove * edgeMove,
+                edgeSq * 2.0f * glm::dot(move, toStart) - 2.0f * edgeMove * edgeStart,
+                edgeSq * (radius * radius - glm::dot(toStart, toStart)) + edgeStart * edgeStart, hit.t, t))
+            continue;
+        const float along = (edgeMove * t - edgeStart) / edgeSq;
+        if (along >= 0.0f && along <= 1.0f)
+            keep(center, move, t, a + edge * along, hit, found);
+    }
+    return found;
+}
+
+// Every triangle of a mesh placed by model; world is scratch for the transformed positions.
+// Returns how many triangles were tested.
+inline size_t SweepSphereMesh(const PickMesh& mesh, const glm::mat4& model, const glm::vec3& center, float radius,
+    const glm::vec3& move, SweepHit& hit, bool& found, std::vector<glm::vec3>& world)
+{
+    world.resize(mesh.positions.size());
+    for (size_t v = 0; v < mesh.positions.size(); ++v)
+        world[v] = glm::vec3(model * glm::vec4(mesh.positions[v], 1.0f));
+
+    for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+        found = SweepSphereTriangle(center, radius, move, world[mesh.indices[i]], world[mesh.indices[i + 1]],
+            world[mesh.indices[i + 2]], hit) || found;
+    return mesh.indices.size() / 3;
+}
+
+// Incremental sweep and prune over axis-aligned boxes.
+// Each axis keeps the min and max ends of every box sorted; moving a box shifts its ends a few places
+// to their new spots, and every end passed on the way is a pair starting or stopping to overlap.
+// Boxes move little from one frame to the next, so a move costs a handful of swaps however many boxes
+// stand still. Pairs of two static boxes are never kept, so a large static scene costs nothing per frame.
+class SweepAndPrune
+{
+public:
+    // ends swapped and pairs found and lost since ResetStats
+    unsigned int Swaps;
+    unsigned int PairsAdded;
+    unsigned int PairsRemoved;
+
+    SweepAndPrune() : Swaps(0), PairsAdded(0), PairsRemoved(0)
+    {
+    }
+
+    // sorts all boxes at once and finds their overlapping pairs with one sweep along x
+    void Build(const std::vector<glm::vec3>& boundsMin, const std::vector<glm::vec3>& boundsMax, const std::vector<bool>& isStatic)
+    {
+        const int count = (int)boundsMin.size();
+        boxMin = boundsMin;
+        boxMax = boundsMax;
+        proxyStatic.assign(isStatic.begin(), isStatic.end());
+        neighbours.assign(count, std::vector<int>());
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            std::vector<Endpoint>& ends = axes[axis];
+            ends.resize(2 * count);
+            for (int i = 0; i < count; ++i)
+            {
+                ends[2 * i] = makeEnd(i, false, boxMin[i][axis]);
+                ends[2 * i + 1] = makeEnd(i, true, boxMax[i][axis]);
+            }
+            std::sort(ends.begin(), ends.end(), before);
+            positions[axis].resize(2 * count);
+            for (int e = 0; e < 2 * count; ++e)
+                positions[axis][ends[e].id] = e;
+        }
+
+        std::vector<int> open;
+        for (size_t e = 0; e < axes[0].size(); ++e)
+        {
+            const int proxy = axes[0][e].id >> 1;
+            if (axes[0][e].id & 1)
+            {
+                open.erase(std::find(open.begin(), open.end(), proxy));
+                continue;
+            }
+            for (size_t k = 0; k < open.size(); ++k)
+                if (overlaps(proxy, open[k]))
+                    addPair(proxy, open[k]);
+            open.push_back(proxy);
+        }
+    }
+
+    // a new box, its ends walked in from past the largest end
+    int Add(const glm::vec3& bMin, const glm::vec3& bMax, bool isStatic)
+    {
+        const int proxy = (int)boxMin.size();
+        boxMin.push_back(glm::vec3(FLT_MAX));
+        boxMax.push_back(glm::vec3(FLT_MAX));
+        proxyStatic.push_back(isStatic);
+        neighbours.push_back(std::vector<int>());
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            positions[axis].push_back((int)axes[axis].size());
+            axes[axis].push_back(makeEnd(proxy, false, FLT_MAX));
+            positions[axis].push_back((int)axes[axis].size());
+            axes[axis].push_back(makeEnd(proxy, true, FLT_MAX));
+        }
+        Move(proxy, bMin, bMax);
+        return proxy;
+    }
+
+    // moves one box and updates its pairs
+    void Move(int proxy, const glm::vec3& bMin, const glm::vec3& bMax)
+    {
+        const glm::vec3 oldMax = boxMax[proxy];
+        boxMin[proxy] = bMin;
+        boxMax[proxy] = bMax;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            // the end moving right goes first when the box grows that way, so min never passes its own max
+            if (bMax[axis] > oldMax[axis])
+            {
+                shift(axis, 2 * proxy + 1, bMax[axis]);
+                shift(axis, 2 * proxy, bMin[axis]);
+            }
+            else
+            {
+                shift(axis, 2 * proxy, bMin[axis]);
+                shift(axis, 2 * proxy + 1, bMax[axis]);
+            }
+        }
+    }
+
+    // boxes overlapping proxy, except static ones when proxy is static too
+    const std::vector<int>& Overlaps(int proxy) const
+    {
+        return neighbours[proxy];
+    }
+
+    size_t Pairs() const
+    {
+        size_t total = 0;
+        for (size_t i = 0; i < neighbours.size(); ++i)
+            total += neighbours[i].size();
+        return total / 2;
+    }
+
+    int Size() const { return (int)boxMin.size(); }
+
+    void ResetStats()
+    {
+        Swaps = PairsAdded = PairsRemoved = 0;
+    }
+
+private:
+    struct Endpoint
+    {
+        float value;
+        int id;     // 2 * proxy, + 1 for the max end
+    };
+
+    std::vector<Endpoint> axes[3];
+    std::vector<int> positions[3];      // index of each end in its axis, by id
+    std::vector<glm::vec3> boxMin;
+    std::vector<glm::vec3> boxMax;
+    std::vector<unsigned char> proxyStatic;
+    std::vector<std::vector<int> > neighbours;
+
+    static Endpoint makeEnd(int proxy, bool isMax, float value)
+    {
+        Endpoint end = { value, 2 * proxy + (isMax ? 1 : 0) };
+        return end;
+    }
+
+    // min ends sort before max ends of the same value, so touching boxes overlap
+    static bool before(const Endpoint& a, const Endpoint& b)
+    {
+        return a.value < b.value || (a.value == b.value && (a.id & 1) < (b.id & 1));
+    }
+
+    bool overlaps(int a, int b) const
+    {
+        return boxMin[a].x <= boxMax[b].x && boxMin[b].x <= boxMax[a].x &&
+            boxMin[a].y <= boxMax[b].y && boxMin[b].y <= boxMax[a].y &&
+            boxMin[a].z <= boxMax[b].z && boxMin[b].z <= boxMax[a].z;
+    }
+
+    void addPair(int a, int b)
+    {
+        if (proxyStatic[a] && proxyStatic[b])
+            return;
+        std::vector<int>& list = neighbours[a];
+        if (std::find(list.begin(), list.end(), b) != list.end())
+            return;
+        list.push_back(b);
+        neighbours[b].push_back(a);
+        ++PairsAdded;
+    }
+
+    void removePair(int a, int b)
+    {
+        std::vector<int>& list = neighbours[a];
+        std::vector<int>::iterator found = std::find(list.begin(), list.end(), b);
+        if (found == list.end())
+            return;
+        *found = list.back();
+        list.pop_back();
+        std::vector<int>& other = neighbours[b];
+        *std::find(other.begin(), other.end(), a) = other.back();
+        other.pop_back();
+        ++PairsRemoved;
+    }
+
+    // insertion sort step for one end: a min passing a max to its left may start an overlap,
+    // a max passing a min to its left ends one; the mirror cases going right
+    void shift(int axis, int id, float value)
+    {
+        std::vector<Endpoint>& ends = axes[axis];
+        std::vector<int>& position = positions[axis];
+        int e = position[id];
+        ends[e].value = value;
+        const Endpoint moving = ends[e];
+        const int proxy = id >> 1;
+        const bool isMax = (id & 1) != 0;
+
+        while (e > 0 && before(moving, ends[e - 1]))
+        {
+            const Endpoint& passed = ends[e - 1];
+            const int other = passed.id >> 1;
+            if (other != proxy && (passed.id & 1) != (int)isMax)
+            {
+                if (isMax)
+                    removePair(proxy, other);
+                else if (overlaps(proxy, other))
+                    addPair(proxy, other);
+            }
+            ends[e] = passed;
+            position[passed.id] = e;
+            --e;
+            ++Swaps;
+        }
+        while (e + 1 < (int)ends.size() && before(ends[e + 1], moving))
+        {
+            const Endpoint& passed = ends[e + 1];
+            const int other = passed.id >> 1;
+            if (other != proxy && (passed.id & 1) != (int)isMax)
+            {
+                if (isMax)
+                {
+                    if (overlaps(proxy, other))
+                        addPair(proxy, other);
+                }
+                else
+                {
+                    removePair(proxy, other);
+                }
+            }
+            ends[e] = passed;
+            position[passed.id] = e;
+            ++e;
+            ++Swaps;
+        }
+        ends[e] = moving;
+        position[id] = e;
+    }
+};
+#endif
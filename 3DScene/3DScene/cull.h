@@ -0,0 +1,493 @@
+#ifndef CULL_H
+#define CULL_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <cmath>
+#include <vector>
+
+#include "gputimer.h"
+#include "resources.h"
+
+// Shader storage bindings used by the cull shader; binding 1 holds the per-object data of the upload ring
+const GLuint CULL_OBJECTS_BINDING = 2;
+const GLuint CULL_COMMANDS_BINDING = 3;
+const GLuint CULL_COUNT_BINDING = 4;
+// Invocations per work group, "local_size_x" in the cull shader
+const GLuint CULL_GROUP_SIZE = 64;
+
+// Layout glMultiDrawElementsIndirect reads
+struct DrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// What the cull shader knows about one object, matches the std430 CullObject struct
+struct CullObject
+{
+    glm::vec4 boundsMin;    // object-space box, w unused
+    glm::vec4 boundsMax;
+    GLuint firstIndex;      // index range of the mesh in the pool
+    GLuint indexCount;
+    GLint baseVertex;
+    GLuint objectIndex;     // slot in the per-object data, drawn as base instance
+};
+
+// Where a mesh landed in the pool
+struct MeshRange
+{
+    GLuint firstIndex;
+    GLuint indexCount;
+    GLint baseVertex;
+};
+
+// Gribb-Hartmann planes of a view-projection matrix, normalized, pointing inwards
+inline void ExtractFrustumPlanes(const glm::mat4& m, glm::vec4 planes[6])
+{
+    glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    planes[0] = row3 + row0;    // left
+    planes[1] = row3 - row0;    // right
+    planes[2] = row3 + row1;    // bottom
+    planes[3] = row3 - row1;    // top
+    planes[4] = row3 + row2;    // near
+    planes[5] = row3 - row2;    // far
+
+    for (int i = 0; i < 6; ++i)
+        planes[i] /= glm::length(glm::vec3(planes[i]));
+}
+
+// Tests the world-space box of a transformed object-space box against the planes
+inline bool BoxInFrustum(const glm::vec4 planes[6], const glm::mat4& model, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+    glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+    glm::vec3 extent = (boundsMax - boundsMin) * 0.5f;
+
+    glm::vec3 worldCenter = glm::vec3(model * glm::vec4(center, 1.0f));
+    glm::vec3 worldExtent = glm::abs(glm::vec3(model[0])) * extent.x
+        + glm::abs(glm::vec3(model[1])) * extent.y
+        + glm::abs(glm::vec3(model[2])) * extent.z;
+
+    for (int i = 0; i < 6; ++i)
+    {
+        glm::vec3 normal(planes[i]);
+        float radius = glm::dot(worldExtent, glm::abs(normal));
+        if (glm::dot(normal, worldCenter) + planes[i].w < -radius)
+            return false;
+    }
+    return true;
+}
+
+// CPU reference of the cull shader: appends a command for every visible object
+inline void CullObjectsCpu(const std::vector<CullObject>& objects, const glm::mat4* models, const glm::mat4& viewProjection,
+    std::vector<DrawElementsIndirectCommand>& commands)
+{
+    glm::vec4 planes[6];
+    ExtractFrustumPlanes(viewProjection, planes);
+
+    commands.clear();
+    for (size_t i = 0; i < objects.size(); ++i)
+    {
+        const CullObject& object = objects[i];
+        if (!BoxInFrustum(planes, models[object.objectIndex], glm::vec3(object.boundsMin), glm::vec3(object.boundsMax)))
+            continue;
+
+        DrawElementsIndirectCommand command;
+        command.count = object.indexCount;
+        command.instanceCount = 1;
+        command.firstIndex = object.firstIndex;
+        command.baseVertex = object.baseVertex;
+        command.baseInstance = object.objectIndex;
+        commands.push_back(command);
+    }
+}
+
+// Packs the vertices and indices of many meshes into one vertex array so a single
+// multi-draw can render all of them. Data is copied on the GPU from the source buffers.
+class MeshPool
+{
+public:
+    MeshPool() : vao(0), vbo(0), ebo(0), vertexBytes(0), indexCount(0)
+    {
+    }
+
+    // queues a mesh; ebo 0 means the mesh is drawn as arrays and gets sequential indices
+    MeshRange Add(GLuint sourceVbo, GLsizei nVertices, GLuint sourceEbo, GLsizei nIndices, GLsizei floatsPerVertex)
+    {
+        Source source;
+        source.vbo = sourceVbo;
+        source.ebo = sourceEbo;
+        source.vertexBytes = (GLsizeiptr)nVertices * floatsPerVertex * sizeof(GLfloat);
+        source.nIndices = sourceEbo ? nIndices : nVertices;
+        source.vertexOffset = vertexBytes;
+        source.indexOffset = indexCount;
+        sources.push_back(source);
+
+        MeshRange range;
+        range.firstIndex = (GLuint)indexCount;
+        range.indexCount = (GLuint)source.nIndices;
+        range.baseVertex = (GLint)(vertexBytes / (floatsPerVertex * sizeof(GLfloat)));
+
+        vertexBytes += source.vertexBytes;
+        indexCount += source.nIndices;
+        return range;
+    }
+
+    // allocates the pool, copies every queued mesh and sets up position (0) and color (1)
+    void Build(GLsizei floatsPerVertex)
+    {
+        vao = GpuResources().GenVertexArray("mesh pool vao");
+        glBindVertexArray(vao);
+
+        vbo = GpuResources().GenBuffer("mesh pool vbo");
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        GpuResources().BufferData(GL_ARRAY_BUFFER, vbo, vertexBytes, NULL, GL_STATIC_DRAW);
+
+        ebo = GpuResources().GenBuffer("mesh pool ebo");
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        GpuResources().BufferData(GL_ELEMENT_ARRAY_BUFFER, ebo, indexCount * sizeof(GLuint), NULL, GL_STATIC_DRAW);
+
+        std::vector<GLuint> sequential;
+        for (size_t i = 0; i < sources.size(); ++i)
+        {
+            const Source& source = sources[i];
+            glBindBuffer(GL_COPY_READ_BUFFER, source.vbo);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_ARRAY_BUFFER, 0, source.vertexOffset, source.vertexBytes);
+
+            if (source.ebo)
+            {
+                glBindBuffer(GL_COPY_READ_BUFFER, source.ebo);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_ELEMENT_ARRAY_BUFFER, 0, source.indexOffset * sizeof(GLuint), source.nIndices * sizeof(GLuint));
+            }
+            else
+            {
+                sequential.resize(source.nIndices);
+                for (GLsizei k = 0; k < source.nIndices; ++k)
+                    sequential[k] = (GLuint)k;
+                glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, source.indexOffset * sizeof(GLuint), source.nIndices * sizeof(GLuint), sequential.data());
+            }
+        }
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+        const GLint stride = sizeof(GLfloat) * floatsPerVertex;
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, 0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(GLfloat) * 3));
+        glEnableVertexAttribArray(1);
+
+        glBindVertexArray(0);
+        sources.clear();
+    }
+
+    void Destroy()
+    {
+        if (vao)
+        {
+            GpuResources().DeleteVertexArray(vao);
+            GpuResources().DeleteBuffer(vbo);
+            GpuResources().DeleteBuffer(ebo);
+        }
+    }
+
+    GLuint GetVertexArray() const
+    {
+        return vao;
+    }
+
+private:
+    struct Source
+    {
+        GLuint vbo;
+        GLuint ebo;
+        GLsizeiptr vertexBytes;
+        GLsizei nIndices;
+        GLsizeiptr vertexOffset;
+        GLsizei indexOffset;
+    };
+
+    std::vector<Source> sources;
+    GLuint vao;
+    GLuint vbo;
+    GLuint ebo;
+    GLsizeiptr vertexBytes;
+    GLsizei indexCount;
+};
+
+// Frustum (and optionally occlusion) culling in a compute shader that writes the
+// indirect commands and draw count consumed by glMultiDrawElementsIndirectCount.
+// Without ARB_indirect_parameters (older Mesa) every object keeps its command slot
+// and culled ones get an instance count of zero instead of being compacted; the same
+// layout is used when the draws must follow the order of the objects.
+class GpuCuller
+{
+public:
+    // GPU time of the cull dispatch
+    GpuTimer Timer;
+
+    GpuCuller() : cullProgram(0), pyramidProgram(0), objectBuffer(0), commandBuffer(0), countBuffer(0), pyramid(0),
+        objectCount(0), capacity(0), pyramidLevels(0), pyramidWidth(0), pyramidHeight(0), hasDrawCount(false), coreDrawCount(false), keepOrder(false), pyramidValid(false)
+    {
+    }
+
+    // cull is the compute program culling objects, pyramid builds the depth pyramid (0 disables occlusion)
+    void Create(GLuint cull, GLuint pyramidReduce)
+    {
+        cullProgram = cull;
+        pyramidProgram = pyramidReduce;
+        // GL 4.6 has the draw count in core; the ARB entry point is only loaded when the extension is listed
+        coreDrawCount = GLEW_VERSION_4_6 != 0;
+        hasDrawCount = coreDrawCount || GLEW_ARB_indirect_parameters;
+
+        countBuffer = GpuResources().GenBuffer("cull draw count");
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, countBuffer);
+        GpuResources().BufferData(GL_SHADER_STORAGE_BUFFER, countBuffer, sizeof(GLuint), NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        Timer.Create();
+    }
+
+    void Destroy()
+    {
+        if (objectBuffer)
+        {
+            GpuResources().DeleteBuffer(objectBuffer);
+            GpuResources().DeleteBuffer(commandBuffer);
+        }
+        if (countBuffer)
+            GpuResources().DeleteBuffer(countBuffer);
+        if (pyramid)
+            GpuResources().DeleteTexture(pyramid);
+        Timer.Destroy();
+        capacity = 0;
+    }
+
+    // true when the draw count comes from the GPU rather than a fixed maximum
+    bool HasDrawCount() const
+    {
+        return hasDrawCount;
+    }
+
+    // the compacted list is appended in whatever order the invocations finish; keeping every
+    // slot instead draws the objects in the order SetObjects gave them
+    void SetKeepOrder(bool keep)
+    {
+        keepOrder = keep;
+    }
+
+    // uploads the cullable objects, call again whenever meshes or bounds change
+    void SetObjects(const std::vector<CullObject>& objects)
+    {
+        objectCount = (GLuint)objects.size();
+        if (objectCount > capacity)
+        {
+            if (objectBuffer)
+            {
+                GpuResources().DeleteBuffer(objectBuffer);
+                GpuResources().DeleteBuffer(commandBuffer);
+            }
+            capacity = objectCount;
+
+            objectBuffer = GpuResources().GenBuffer("cull objects");
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, objectBuffer);
+            GpuResources().BufferData(GL_SHADER_STORAGE_BUFFER, objectBuffer, capacity * sizeof(CullObject), NULL, GL_DYNAMIC_DRAW);
+
+            commandBuffer = GpuResources().GenBuffer("cull commands");
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+            GpuResources().BufferData(GL_SHADER_STORAGE_BUFFER, commandBuffer, capacity * sizeof(DrawElementsIndirectCommand), NULL, GL_DYNAMIC_COPY);
+        }
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, objectBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, objectCount * sizeof(CullObject), objects.data());
+        RenderCounters().UploadedBytes += objectCount * sizeof(CullObject);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    // Builds a max-depth pyramid from a sampleable depth texture for the next frame's occlusion test.
+    // viewProjection is the matrix the depth was rendered with.
+    void BuildDepthPyramid(GLuint depthTexture, int width, int height, const glm::mat4& viewProjection)
+    {
+        if (!pyramidProgram || width <= 0 || height <= 0)
+            return;
+
+        if (!pyramid || width != pyramidWidth || height != pyramidHeight)
+        {
+            if (pyramid)
+                GpuResources().DeleteTexture(pyramid);
+
+            pyramidWidth = width;
+            pyramidHeight = height;
+            pyramidLevels = 1;
+            while ((width >> pyramidLevels) > 0 || (height >> pyramidLevels) > 0)
+                ++pyramidLevels;
+
+            pyramid = GpuResources().GenTexture("depth pyramid");
+            glBindTexture(GL_TEXTURE_2D, pyramid);
+            GpuResources().TexStorage2D(GL_TEXTURE_2D, pyramid, pyramidLevels, GL_R32F, width, height);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+
+        glUseProgram(pyramidProgram);
+        ++RenderCounters().StateChanges;
+        glActiveTexture(GL_TEXTURE0);
+        glUniform1i(glGetUniformLocation(pyramidProgram, "source"), 0);
+
+        int levelWidth = pyramidWidth;
+        int levelHeight = pyramidHeight;
+        for (int level = 0; level < pyramidLevels; ++level)
+        {
+            // level 0 copies the depth buffer, every other level keeps the farthest of the texels it covers
+            glBindTexture(GL_TEXTURE_2D, level == 0 ? depthTexture : pyramid);
+            glUniform1i(glGetUniformLocation(pyramidProgram, "sourceLevel"), level == 0 ? 0 : level - 1);
+            glUniform1i(glGetUniformLocation(pyramidProgram, "copyLevel"), level == 0);
+            glBindImageTexture(0, pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+            glDispatchCompute((levelWidth + 7) / 8, (levelHeight + 7) / 8, 1);
+            ++RenderCounters().Dispatches;
+            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+            levelWidth = levelWidth > 1 ? levelWidth / 2 : 1;
+            levelHeight = levelHeight > 1 ? levelHeight / 2 : 1;
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        pyramidViewProjection = viewProjection;
+        pyramidValid = true;
+    }
+
+    // forgets the pyramid, e.g. after a camera cut when last frame's depth no longer applies
+    void InvalidateDepthPyramid()
+    {
+        pyramidValid = false;
+    }
+
+    // culls every object against the frustum; the per-object data must be bound at binding 1
+    void Dispatch(const glm::mat4& viewProjection)
+    {
+        if (objectCount == 0)
+            return;
+
+        glm::vec4 planes[6];
+        ExtractFrustumPlanes(viewProjection, planes);
+
+        Timer.Begin();
+
+        const GLuint zero = 0;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, countBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &zero);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        glUseProgram(cullProgram);
+        ++RenderCounters().StateChanges;
+        glUniform4fv(glGetUniformLocation(cullProgram, "frustumPlanes"), 6, glm::value_ptr(planes[0]));
+        glUniform1ui(glGetUniformLocation(cullProgram, "objectCount"), objectCount);
+        glUniform1i(glGetUniformLocation(cullProgram, "compact"), compacted());
+
+        const bool occlusion = pyramidValid && pyramid != 0;
+        glUniform1i(glGetUniformLocation(cullProgram, "useDepthPyramid"), occlusion);
+        if (occlusion)
+        {
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, pyramid);
+            glUniform1i(glGetUniformLocation(cullProgram, "depthPyramid"), 1);
+            glUniform1i(glGetUniformLocation(cullProgram, "pyramidLevels"), pyramidLevels);
+            glUniform2f(glGetUniformLocation(cullProgram, "pyramidSize"), (float)pyramidWidth, (float)pyramidHeight);
+            glUniformMatrix4fv(glGetUniformLocation(cullProgram, "previousViewProjection"), 1, GL_FALSE, glm::value_ptr(pyramidViewProjection));
+            glActiveTexture(GL_TEXTURE0);
+        }
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_OBJECTS_BINDING, objectBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_COMMANDS_BINDING, commandBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_COUNT_BINDING, countBuffer);
+        glDispatchCompute((objectCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+        ++RenderCounters().Dispatches;
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+        Timer.End();
+    }
+
+    // issues the draws the last dispatch generated; the pool vertex array must be bound
+    void Draw() const
+    {
+        if (objectCount == 0)
+            return;
+
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        if (compacted())
+        {
+            glBindBuffer(GL_PARAMETER_BUFFER, countBuffer);
+            if (coreDrawCount)
+                glMultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, 0, 0, objectCount, 0);
+            else
+                glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, GL_UNSIGNED_INT, 0, 0, objectCount, 0);
+            glBindBuffer(GL_PARAMETER_BUFFER, 0);
+        }
+        else
+        {
+            glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0, objectCount, 0);
+        }
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        ++RenderCounters().DrawCalls;
+    }
+
+    // Reads back the commands of the last dispatch, visible ones only; stalls, for tests and benchmarks
+    void ReadCommands(std::vector<DrawElementsIndirectCommand>& commands) const
+    {
+        commands.clear();
+        if (objectCount == 0)
+            return;
+
+        GLuint count = objectCount;
+        if (compacted())
+        {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, countBuffer);
+            glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &count);
+        }
+
+        std::vector<DrawElementsIndirectCommand> all(count);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(DrawElementsIndirectCommand), all.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        for (GLuint i = 0; i < count; ++i)
+        {
+            if (all[i].instanceCount > 0)
+                commands.push_back(all[i]);
+        }
+    }
+
+private:
+    GLuint cullProgram;
+    GLuint pyramidProgram;
+    GLuint objectBuffer;
+    GLuint commandBuffer;
+    GLuint countBuffer;
+    GLuint pyramid;
+    GLuint objectCount;
+    GLuint capacity;
+    int pyramidLevels;
+    int pyramidWidth;
+    int pyramidHeight;
+    bool hasDrawCount;
+    bool coreDrawCount;     // draw count through the GL 4.6 entry point rather than the ARB one
+    bool keepOrder;
+    bool pyramidValid;
+    glm::mat4 pyramidViewProjection;
+
+    bool compacted() const
+    {
+        return hasDrawCount && !keepOrder;
+    }
+};
+#endif
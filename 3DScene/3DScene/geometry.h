@@ -0,0 +1,732 @@
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "resources.h" // GPU resource tracking
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <utility>
+#include <vector>
+
+// SSE2 is the baseline on every target this project builds for; the scalar path stays for comparison and other CPUs
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define GEOMETRY_SIMD 1
+#endif
+
+// Shapes the generator can build
+enum Geometry_Shape {
+    GEOMETRY_CYLINDER,
+    GEOMETRY_CONE,
+    GEOMETRY_SPHERE,
+    GEOMETRY_TORUS,
+    GEOMETRY_ROUNDED_BOX,
+    GEOMETRY_PLANE
+};
+
+// Interleaved vertex layouts: position (location 0), color (location 1) and optionally normal (location 2)
+enum Vertex_Format {
+    VERTEX_POSITION_COLOR,
+    VERTEX_POSITION_COLOR_NORMAL
+};
+
+constexpr int FloatsPerVertex(Vertex_Format format)
+{
+    return format == VERTEX_POSITION_COLOR ? 7 : 10;
+}
+
+// Describes one generated shape; identical descriptions share one cache entry.
+// Every shape is centered on the origin with Y as its axis.
+struct GeometryDesc
+{
+    Geometry_Shape shape;
+    Vertex_Format format;
+    glm::vec3 size;     // cylinder/cone: (radius, height, -), sphere: (radius, -, -), torus: (major radius, minor radius, -),
+                        // rounded box: half extents, plane: (half width, -, half depth)
+    float radius;       // corner radius of rounded boxes
+    int segments;       // subdivisions around the axis (per corner for rounded boxes, along X for planes)
+    int rings;          // subdivisions along the axis (along Z for planes)
+    glm::vec4 color;
+
+    static GeometryDesc Cylinder(float radius, float height, int segments, const glm::vec4& color, Vertex_Format format = VERTEX_POSITION_COLOR)
+    {
+        return make(GEOMETRY_CYLINDER, format, glm::vec3(radius, height, 0.0f), 0.0f, segments, 1, color);
+    }
+
+    static GeometryDesc Cone(float radius, float height, int segments, const glm::vec4& color, Vertex_Format format = VERTEX_POSITION_COLOR)
+    {
+        return make(GEOMETRY_CONE, format, glm::vec3(radius, height, 0.0f), 0.0f, segments, 1, color);
+    }
+
+    static GeometryDesc Sphere(float radius, int segments, int rings, const glm::vec4& color, Vertex_Format format = VERTEX_POSITION_COLOR)
+    {
+        return make(GEOMETRY_SPHERE, format, glm::vec3(radius, 0.0f, 0.0f), 0.0f, segments, rings, color);
+    }
+
+    static GeometryDesc Torus(float majorRadius, float minorRadius, int segments, int rings, const glm::vec4& color, Vertex_Format format = VERTEX_POSITION_COLOR)
+    {
+        return make(GEOMETRY_TORUS, format, glm::vec3(majorRadius, minorRadius, 0.0f), 0.0f, segments, rings, color);
+    }
+
+    static GeometryDesc RoundedBox(const glm::vec3& halfExtents, float cornerRadius, int segments, const glm::vec4& color, Vertex_Format format = VERTEX_POSITION_COLOR)
+    {
+        return make(GEOMETRY_ROUNDED_BOX, format, halfExtents, cornerRadius, segments, 1, color);
+    }
+
+    static GeometryDesc Plane(float halfWidth, float halfDepth, int segmentsX, int segmentsZ, const glm::vec4& color, Vertex_Format format = VERTEX_POSITION_COLOR)
+    {
+        return make(GEOMETRY_PLANE, format, glm::vec3(halfWidth, 0.0f, halfDepth), 0.0f, segmentsX, segmentsZ, color);
+    }
+
+    // orders descriptions by every parameter so they can key a map
+    bool operator<(const GeometryDesc& other) const
+    {
+        float a[12], b[12];
+        key(a);
+        other.key(b);
+        return std::lexicographical_compare(a, a + 12, b, b + 12);
+    }
+
+private:
+    static GeometryDesc make(Geometry_Shape shape, Vertex_Format format, const glm::vec3& size, float radius, int segments, int rings, const glm::vec4& color)
+    {
+        GeometryDesc desc;
+        desc.shape = shape;
+        desc.format = format;
+        desc.size = size;
+        desc.radius = radius;
+        desc.segments = std::max(segments, 1);
+        desc.rings = std::max(rings, 1);
+        desc.color = color;
+        return desc;
+    }
+
+    void key(float* out) const
+    {
+        out[0] = (float)shape;
+        out[1] = (float)format;
+        out[2] = size.x;
+        out[3] = size.y;
+        out[4] = size.z;
+        out[5] = radius;
+        out[6] = (float)segments;
+        out[7] = (float)rings;
+        out[8] = color.r;
+        out[9] = color.g;
+        out[10] = color.b;
+        out[11] = color.a;
+    }
+};
+
+// CPU side result of a generator, ready to upload
+struct GeometryData
+{
+    std::vector<GLfloat> vertices;
+    std::vector<GLuint> indices;
+    int floatsPerVertex;
+    glm::vec3 boundsMin, boundsMax;
+};
+
+namespace geometry_detail
+{
+    // One row of a surface of revolution: radius and height of the row and the 2D normal of the profile there
+    struct ProfilePoint
+    {
+        float r, y;
+        float nr, ny;
+        bool connect;   // joins this row to the previous one with triangles
+    };
+
+    // Appends the triangles joining a grid of rows x columns vertices starting at base
+    inline void appendGridIndices(std::vector<GLuint>& indices, GLuint base, int rows, int columns, int firstRow)
+    {
+        for (int row = firstRow; row < rows; ++row)
+        {
+            for (int col = 0; col < columns - 1; ++col)
+            {
+                GLuint a = base + (row - 1) * columns + col;
+                GLuint b = a + 1;
+                GLuint c = a + columns;
+                GLuint d = c + 1;
+                indices.push_back(a);
+                indices.push_back(c);
+                indices.push_back(b);
+                indices.push_back(b);
+                indices.push_back(c);
+                indices.push_back(d);
+            }
+        }
+    }
+
+    // Writes one interleaved vertex
+    inline void writeVertex(GLfloat* out, float x, float y, float z, float nx, float ny, float nz, const glm::vec4& color, bool normals)
+    {
+        out[0] = x;
+        out[1] = y;
+        out[2] = z;
+        out[3] = color.r;
+        out[4] = color.g;
+        out[5] = color.b;
+        out[6] = color.a;
+        if (normals)
+        {
+            out[7] = nx;
+            out[8] = ny;
+            out[9] = nz;
+        }
+    }
+
+#ifdef GEOMETRY_SIMD
+    // Writes four interleaved vertices from SoA registers; the transpose keeps the stores in vector width
+    inline void writeVertices4(GLfloat* out, int stride, __m128 x, __m128 y, __m128 z, __m128 nx, __m128 ny, __m128 nz, const glm::vec4& color, bool normals, int count)
+    {
+        __m128 r = _mm_set1_ps(color.r);
+        __m128 rowA0 = x, rowA1 = y, rowA2 = z, rowA3 = r;
+        _MM_TRANSPOSE4_PS(rowA0, rowA1, rowA2, rowA3);
+        __m128 headers[4] = { rowA0, rowA1, rowA2, rowA3 };
+
+        if (normals)
+        {
+            __m128 rowB0 = _mm_set1_ps(color.g), rowB1 = _mm_set1_ps(color.b), rowB2 = _mm_set1_ps(color.a), rowB3 = nx;
+            _MM_TRANSPOSE4_PS(rowB0, rowB1, rowB2, rowB3);
+            __m128 middles[4] = { rowB0, rowB1, rowB2, rowB3 };
+
+            float tailY[4], tailZ[4];
+            _mm_storeu_ps(tailY, ny);
+            _mm_storeu_ps(tailZ, nz);
+            for (int i = 0; i < count; ++i)
+            {
+                GLfloat* v = out + i * stride;
+                _mm_storeu_ps(v, headers[i]);
+                _mm_storeu_ps(v + 4, middles[i]);
+                v[8] = tailY[i];
+                v[9] = tailZ[i];
+            }
+        }
+        else
+        {
+            for (int i = 0; i < count; ++i)
+            {
+                GLfloat* v = out + i * stride;
+                _mm_storeu_ps(v, headers[i]);
+                v[4] = color.g;
+                v[5] = color.b;
+                v[6] = color.a;
+            }
+        }
+    }
+#endif
+
+    // Sweeps a profile around the Y axis; trigonometry is computed once per column and reused by every row
+    inline void sweepProfile(const std::vector<ProfilePoint>& profile, int segments, const GeometryDesc& desc, GeometryData& data, bool useSimd)
+    {
+        const bool normals = desc.format == VERTEX_POSITION_COLOR_NORMAL;
+        const int stride = data.floatsPerVertex;
+        const int columns = segments + 1;   // the seam column is duplicated so it can carry its own normal
+        const int padded = (columns + 3) & ~3;
+        const float twoPi = 6.28318530718f;
+
+        std::vector<float> cosTable(padded, 1.0f), sinTable(padded, 0.0f);
+        for (int col = 0; col < columns; ++col)
+        {
+            float angle = twoPi * (float)(col % segments) / (float)segments;
+            cosTable[col] = std::cos(angle);
+            sinTable[col] = std::sin(angle);
+        }
+
+        const GLuint base = (GLuint)(data.vertices.size() / stride);
+        data.vertices.resize(data.vertices.size() + (size_t)profile.size() * columns * stride);
+        GLfloat* out = &data.vertices[base * stride];
+
+        for (size_t row = 0; row < profile.size(); ++row)
+        {
+            const ProfilePoint& p = profile[row];
+            GLfloat* rowOut = out + row * columns * stride;
+            int col = 0;
+
+#ifdef GEOMETRY_SIMD
+            if (useSimd)
+            {
+                __m128 r = _mm_set1_ps(p.r), y = _mm_set1_ps(p.y), nr = _mm_set1_ps(p.nr), ny = _mm_set1_ps(p.ny);
+                for (; col < columns; col += 4)
+                {
+                    __m128 c = _mm_loadu_ps(&cosTable[col]);
+                    __m128 s = _mm_loadu_ps(&sinTable[col]);
+                    writeVertices4(rowOut + col * stride, stride,
+                        _mm_mul_ps(r, c), y, _mm_mul_ps(r, s),
+                        _mm_mul_ps(nr, c), ny, _mm_mul_ps(nr, s),
+                        desc.color, normals, std::min(4, columns - col));
+                }
+            }
+#endif
+            for (; col < columns; ++col)
+            {
+                writeVertex(rowOut + col * stride, p.r * cosTable[col], p.y, p.r * sinTable[col],
+                    p.nr * cosTable[col], p.ny, p.nr * sinTable[col], desc.color, normals);
+            }
+        }
+
+        for (size_t row = 1; row < profile.size(); ++row)
+        {
+            if (profile[row].connect)
+                appendGridIndices(data.indices, base, (int)row + 1, columns, (int)row);
+        }
+    }
+
+    inline void appendDisc(std::vector<ProfilePoint>& profile, float radius, float y, float ny, bool centerFirst)
+    {
+        ProfilePoint center = { 0.0f, y, 0.0f, ny, false };
+        ProfilePoint rim = { radius, y, 0.0f, ny, false };
+        if (centerFirst)
+        {
+            profile.push_back(center);
+            rim.connect = true;
+            profile.push_back(rim);
+        }
+        else
+        {
+            profile.push_back(rim);
+            center.connect = true;
+            profile.push_back(center);
+        }
+    }
+
+    inline void generateCylinder(const GeometryDesc& desc, GeometryData& data, bool useSimd)
+    {
+        const float radius = desc.size.x, half = desc.size.y * 0.5f;
+        std::vector<ProfilePoint> profile;
+
+        appendDisc(profile, radius, -half, -1.0f, true);
+        for (int ring = 0; ring <= desc.rings; ++ring)
+        {
+            ProfilePoint side = { radius, -half + desc.size.y * ring / desc.rings, 1.0f, 0.0f, ring > 0 };
+            profile.push_back(side);
+        }
+        appendDisc(profile, radius, half, 1.0f, false);
+
+        sweepProfile(profile, desc.segments, desc, data, useSimd);
+    }
+
+    inline void generateCone(const GeometryDesc& desc, GeometryData& data, bool useSimd)
+    {
+        const float radius = desc.size.x, height = desc.size.y, half = height * 0.5f;
+        const float slant = std::sqrt(radius * radius + height * height);
+        std::vector<ProfilePoint> profile;
+
+        appendDisc(profile, radius, -half, -1.0f, true);
+        for (int ring = 0; ring <= desc.rings; ++ring)
+        {
+            float t = (float)ring / desc.rings;
+            ProfilePoint side = { radius * (1.0f - t), -half + height * t, height / slant, radius / slant, ring > 0 };
+            profile.push_back(side);
+        }
+
+        sweepProfile(profile, desc.segments, desc, data, useSimd);
+    }
+
+    inline void generateSphere(const GeometryDesc& desc, GeometryData& data, bool useSimd)
+    {
+        const float radius = desc.size.x, pi = 3.14159265359f;
+        std::vector<ProfilePoint> profile;
+
+        for (int ring = 0; ring <= desc.rings; ++ring)
+        {
+            float phi = -0.5f * pi + pi * ring / desc.rings;
+            float c = (ring == 0 || ring == desc.rings) ? 0.0f : std::cos(phi);   // poles collapse exactly onto the axis
+            ProfilePoint p = { radius * c, radius * std::sin(phi), c, std::sin(phi), ring > 0 };
+            profile.push_back(p);
+        }
+
+        sweepProfile(profile, desc.segments, desc, data, useSimd);
+    }
+
+    inline void generateTorus(const GeometryDesc& desc, GeometryData& data, bool useSimd)
+    {
+        const float majorRadius = desc.size.x, minorRadius = desc.size.y, twoPi = 6.28318530718f;
+        std::vector<ProfilePoint> profile;
+
+        for (int ring = 0; ring <= desc.rings; ++ring)
+        {
+            float theta = twoPi * (float)(ring % desc.rings) / desc.rings;
+            ProfilePoint p = { majorRadius + minorRadius * std::cos(theta), minorRadius * std::sin(theta), std::cos(theta), std::sin(theta), ring > 0 };
+            profile.push_back(p);
+        }
+
+        sweepProfile(profile, desc.segments, desc, data, useSimd);
+    }
+
+    // Coordinates along one face axis: a quarter arc at each end and a single flat span between them
+    inline std::vector<float> roundedBoxAxis(float half, float radius, int segments)
+    {
+        const float halfPi = 1.57079632679f;
+        std::vector<float> coords;
+        for (int i = 0; i <= segments; ++i)
+            coords.push_back(-(half - radius) - radius * std::cos(halfPi * i / segments));
+        for (int i = 0; i <= segments; ++i)
+            coords.push_back((half - radius) + radius * std::sin(halfPi * i / segments));
+        return coords;
+    }
+
+    // Projects points on the faces of the inner box out to the rounded surface, four points at a time
+    inline void projectRoundedBox(const float* px, const float* py, const float* pz, int count, const GeometryDesc& desc,
+        const glm::vec3& faceNormal, GLfloat* out, bool useSimd)
+    {
+        const bool normals = desc.format == VERTEX_POSITION_COLOR_NORMAL;
+        const int stride = FloatsPerVertex(desc.format);
+        const float radius = desc.radius;
+        const glm::vec3 inner = desc.size - glm::vec3(radius);
+        int i = 0;
+
+        if (radius <= 0.0f)
+        {
+            for (; i < count; ++i)
+                writeVertex(out + i * stride, px[i], py[i], pz[i], faceNormal.x, faceNormal.y, faceNormal.z, desc.color, normals);
+            return;
+        }
+
+#ifdef GEOMETRY_SIMD
+        if (useSimd)
+        {
+            const __m128 innerX = _mm_set1_ps(inner.x), innerY = _mm_set1_ps(inner.y), innerZ = _mm_set1_ps(inner.z);
+            const __m128 r = _mm_set1_ps(radius);
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128 x = _mm_loadu_ps(px + i), y = _mm_loadu_ps(py + i), z = _mm_loadu_ps(pz + i);
+                __m128 cx = _mm_min_ps(_mm_max_ps(x, _mm_sub_ps(_mm_setzero_ps(), innerX)), innerX);
+                __m128 cy = _mm_min_ps(_mm_max_ps(y, _mm_sub_ps(_mm_setzero_ps(), innerY)), innerY);
+                __m128 cz = _mm_min_ps(_mm_max_ps(z, _mm_sub_ps(_mm_setzero_ps(), innerZ)), innerZ);
+                __m128 dx = _mm_sub_ps(x, cx), dy = _mm_sub_ps(y, cy), dz = _mm_sub_ps(z, cz);
+                __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+                __m128 invLength = _mm_div_ps(_mm_set1_ps(1.0f), length);
+                dx = _mm_mul_ps(dx, invLength);
+                dy = _mm_mul_ps(dy, invLength);
+                dz = _mm_mul_ps(dz, invLength);
+                writeVertices4(out + i * stride, stride,
+                    _mm_add_ps(cx, _mm_mul_ps(dx, r)), _mm_add_ps(cy, _mm_mul_ps(dy, r)), _mm_add_ps(cz, _mm_mul_ps(dz, r)),
+                    dx, dy, dz, desc.color, normals, 4);
+            }
+        }
+#endif
+        for (; i < count; ++i)
+        {
+            glm::vec3 p(px[i], py[i], pz[i]);
+            glm::vec3 c = glm::min(glm::max(p, -inner), inner);
+            glm::vec3 n = glm::normalize(p - c);
+            glm::vec3 v = c + n * radius;
+            writeVertex(out + i * stride, v.x, v.y, v.z, n.x, n.y, n.z, desc.color, normals);
+        }
+    }
+
+    inline void generateRoundedBox(const GeometryDesc& desc, GeometryData& data, bool useSimd)
+    {
+        const int stride = data.floatsPerVertex;
+        GeometryDesc clamped = desc;
+        clamped.radius = std::min(desc.radius, std::min(desc.size.x, std::min(desc.size.y, desc.size.z)));
+
+        // each face is a grid over the two axes it spans, pushed out along the third
+        for (int face = 0; face < 6; ++face)
+        {
+            const int axis = face / 2;
+            const float sign = (face & 1) ? 1.0f : -1.0f;
+            const int u = (axis + 1) % 3, v = (axis + 2) % 3;
+
+            std::vector<float> us = roundedBoxAxis(desc.size[u], clamped.radius, desc.segments);
+            std::vector<float> vs = roundedBoxAxis(desc.size[v], clamped.radius, desc.segments);
+            const int columns = (int)us.size(), rows = (int)vs.size();
+
+            std::vector<float> coords[3];
+            for (int k = 0; k < 3; ++k)
+                coords[k].resize((size_t)rows * columns);
+            for (int row = 0; row < rows; ++row)
+            {
+                for (int col = 0; col < columns; ++col)
+                {
+                    size_t i = (size_t)row * columns + col;
+                    coords[axis][i] = sign * desc.size[axis];
+                    coords[u][i] = us[col];
+                    coords[v][i] = vs[row];
+                }
+            }
+
+            glm::vec3 faceNormal(0.0f);
+            faceNormal[axis] = sign;
+
+            const GLuint base = (GLuint)(data.vertices.size() / stride);
+            data.vertices.resize(data.vertices.size() + (size_t)rows * columns * stride);
+            projectRoundedBox(coords[0].data(), coords[1].data(), coords[2].data(), rows * columns, clamped, faceNormal,
+                &data.vertices[base * stride], useSimd);
+
+            // keep the winding counter-clockwise when seen from outside
+            const size_t first = data.indices.size();
+            appendGridIndices(data.indices, base, rows, columns, 1);
+            if (sign > 0.0f)
+            {
+                for (size_t i = first; i < data.indices.size(); i += 3)
+                    std::swap(data.indices[i + 1], data.indices[i + 2]);
+            }
+        }
+    }
+
+    inline void generatePlane(const GeometryDesc& desc, GeometryData& data, bool useSimd)
+    {
+        const bool normals = desc.format == VERTEX_POSITION_COLOR_NORMAL;
+        const int stride = data.floatsPerVertex;
+        const int columns = desc.segments + 1, rows = desc.rings + 1;
+
+        data.vertices.resize((size_t)rows * columns * stride);
+        for (int row = 0; row < rows; ++row)
+        {
+            float z = -desc.size.z + 2.0f * desc.size.z * row / desc.rings;
+            int col = 0;
+#ifdef GEOMETRY_SIMD
+            if (useSimd)
+            {
+                const __m128 step = _mm_set1_ps(2.0f * desc.size.x / desc.segments);
+                const __m128 lane = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+                for (; col < columns; col += 4)
+                {
+                    __m128 x = _mm_add_ps(_mm_set1_ps(-desc.size.x), _mm_mul_ps(_mm_add_ps(_mm_set1_ps((float)col), lane), step));
+                    writeVertices4(&data.vertices[((size_t)row * columns + col) * stride], stride,
+                        x, _mm_setzero_ps(), _mm_set1_ps(z), _mm_setzero_ps(), _mm_set1_ps(1.0f), _mm_setzero_ps(),
+                        desc.color, normals, std::min(4, columns - col));
+                }
+            }
+#endif
+            for (; col < columns; ++col)
+            {
+                float x = -desc.size.x + 2.0f * desc.size.x * col / desc.segments;
+                writeVertex(&data.vertices[((size_t)row * columns + col) * stride], x, 0.0f, z, 0.0f, 1.0f, 0.0f, desc.color, normals);
+            }
+        }
+
+        appendGridIndices(data.indices, 0, rows, columns, 1);
+    }
+}
+
+// Builds the vertex and index data of a shape; useSimd selects the SSE path where it is available
+inline void GenerateGeometry(const GeometryDesc& desc, GeometryData& data, bool useSimd = true)
+{
+    data.vertices.clear();
+    data.indices.clear();
+    data.floatsPerVertex = FloatsPerVertex(desc.format);
+
+    switch (desc.shape)
+    {
+    case GEOMETRY_CYLINDER:
+        geometry_detail::generateCylinder(desc, data, useSimd);
+        break;
+    case GEOMETRY_CONE:
+        geometry_detail::generateCone(desc, data, useSimd);
+        break;
+    case GEOMETRY_SPHERE:
+        geometry_detail::generateSphere(desc, data, useSimd);
+        break;
+    case GEOMETRY_TORUS:
+        geometry_detail::generateTorus(desc, data, useSimd);
+        break;
+    case GEOMETRY_ROUNDED_BOX:
+        geometry_detail::generateRoundedBox(desc, data, useSimd);
+        break;
+    case GEOMETRY_PLANE:
+        geometry_detail::generatePlane(desc, data, useSimd);
+        break;
+    }
+
+    data.boundsMin = glm::vec3(1e30f);
+    data.boundsMax = glm::vec3(-1e30f);
+    for (size_t i = 0; i < data.vertices.size(); i += data.floatsPerVertex)
+    {
+        glm::vec3 position(data.vertices[i], data.vertices[i + 1], data.vertices[i + 2]);
+        data.boundsMin = glm::min(data.boundsMin, position);
+        data.boundsMax = glm::max(data.boundsMax, position);
+    }
+}
+
+// GPU copy of a generated shape, shared by every user of the same description
+struct GeometryMesh
+{
+    GLuint vao;
+    GLuint vbo;
+    GLuint ebo;
+    GLsizei nVertices;
+    GLsizei nIndices;
+    glm::vec3 boundsMin, boundsMax;
+    int refCount;
+    unsigned int lastUse;   // acquire counter value when last handed out, for eviction order
+    size_t bytes;           // vertex and index buffer size
+    float generateMs;       // CPU time spent generating the data
+};
+
+// Generates each distinct shape once and hands out shared, reference counted GPU meshes.
+// Meshes nobody references stay resident for reuse until Evict needs their memory.
+class GeometryCache
+{
+public:
+    unsigned int Hits;
+    unsigned int Misses;
+    unsigned int Evicted;
+
+    GeometryCache() : Hits(0), Misses(0), Evicted(0), useCounter(0)
+    {
+    }
+
+    // returns the mesh for a description, generating and uploading it on first use
+    const GeometryMesh& Acquire(const GeometryDesc& desc)
+    {
+        std::map<GeometryDesc, GeometryMesh>::iterator found = meshes.find(desc);
+        if (found != meshes.end())
+        {
+            ++Hits;
+            ++found->second.refCount;
+            found->second.lastUse = ++useCounter;
+            return found->second;
+        }
+
+        ++Misses;
+        GeometryData data;
+        float generateMs = 0.0f;
+        std::map<GeometryDesc, PreparedData>::iterator ready = prepared.find(desc);
+        if (ready != prepared.end())
+        {
+            data = std::move(ready->second.data);
+            generateMs = ready->second.generateMs;
+            prepared.erase(ready);
+        }
+        else
+        {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            GenerateGeometry(desc, data);
+            generateMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        // referenced before uploading so an eviction triggered by the upload cannot free it
+        GeometryMesh& mesh = meshes[desc];
+        mesh.refCount = 1;
+        mesh.lastUse = ++useCounter;
+        mesh.generateMs = generateMs;
+        upload(desc.format, data, mesh);
+        return mesh;
+    }
+
+    // takes data generated ahead of time, e.g. on a worker thread before the GL context exists;
+    // the first Acquire of the description uploads it instead of generating it again
+    void Prepare(const GeometryDesc& desc, GeometryData& data, float generateMs)
+    {
+        if (meshes.find(desc) != meshes.end())
+            return;
+
+        PreparedData& entry = prepared[desc];
+        entry.data = std::move(data);
+        entry.generateMs = generateMs;
+    }
+
+    // drops one reference to the mesh using this vertex array; unreferenced meshes stay cached
+    void Release(GLuint vao)
+    {
+        for (std::map<GeometryDesc, GeometryMesh>::iterator it = meshes.begin(); it != meshes.end(); ++it)
+        {
+            if (it->second.vao != vao)
+                continue;
+
+            if (it->second.refCount > 0)
+                --it->second.refCount;
+            return;
+        }
+    }
+
+    // frees unreferenced meshes, least recently used first, until bytesWanted are released
+    size_t Evict(size_t bytesWanted)
+    {
+        size_t freed = 0;
+        while (freed < bytesWanted)
+        {
+            std::map<GeometryDesc, GeometryMesh>::iterator oldest = meshes.end();
+            for (std::map<GeometryDesc, GeometryMesh>::iterator it = meshes.begin(); it != meshes.end(); ++it)
+            {
+                if (it->second.refCount == 0 && (oldest == meshes.end() || it->second.lastUse < oldest->second.lastUse))
+                    oldest = it;
+            }
+            if (oldest == meshes.end())
+                break;
+
+            freed += oldest->second.bytes;
+            destroy(oldest->second);
+            meshes.erase(oldest);
+            ++Evicted;
+        }
+        return freed;
+    }
+
+    // frees every mesh regardless of references
+    void Destroy()
+    {
+        for (std::map<GeometryDesc, GeometryMesh>::iterator it = meshes.begin(); it != meshes.end(); ++it)
+            destroy(it->second);
+        meshes.clear();
+        prepared.clear();
+    }
+
+    size_t Size() const
+    {
+        return meshes.size();
+    }
+
+private:
+    struct PreparedData
+    {
+        GeometryData data;
+        float generateMs;
+    };
+
+    std::map<GeometryDesc, GeometryMesh> meshes;
+    std::map<GeometryDesc, PreparedData> prepared;
+    unsigned int useCounter;
+
+    static void upload(Vertex_Format format, const GeometryData& data, GeometryMesh& mesh)
+    {
+        const GLint stride = sizeof(GLfloat) * data.floatsPerVertex;
+
+        mesh.nVertices = (GLsizei)(data.vertices.size() / data.floatsPerVertex);
+        mesh.nIndices = (GLsizei)data.indices.size();
+        mesh.boundsMin = data.boundsMin;
+        mesh.boundsMax = data.boundsMax;
+
+        mesh.bytes = data.vertices.size() * sizeof(GLfloat) + data.indices.size() * sizeof(GLuint);
+
+        mesh.vao = GpuResources().GenVertexArray("geometry vao");
+        glBindVertexArray(mesh.vao);
+
+        mesh.vbo = GpuResources().GenBuffer("geometry vbo");
+        glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+        GpuResources().BufferData(GL_ARRAY_BUFFER, mesh.vbo, data.vertices.size() * sizeof(GLfloat), data.vertices.data(), GL_STATIC_DRAW);
+
+        mesh.ebo = GpuResources().GenBuffer("geometry ebo");
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.ebo);
+        GpuResources().BufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.ebo, data.indices.size() * sizeof(GLuint), data.indices.data(), GL_STATIC_DRAW);
+
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, 0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(GLfloat) * 3));
+        glEnableVertexAttribArray(1);
+        if (format == VERTEX_POSITION_COLOR_NORMAL)
+        {
+            glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(GLfloat) * 7));
+            glEnableVertexAttribArray(2);
+        }
+
+        glBindVertexArray(0);
+    }
+
+    static void destroy(GeometryMesh& mesh)
+    {
+        GpuResources().DeleteVertexArray(mesh.vao);
+        GpuResources().DeleteBuffer(mesh.vbo);
+        GpuResources().DeleteBuffer(mesh.ebo);
+    }
+};
+#endif
@@ -0,0 +1,256 @@
+#ifndef GPUTIMER_H
+#define GPUTIMER_H
+
+#include <GL/glew.h>
+
+#include "resources.h" // GPU resource tracking
+
+// Number of queries kept in flight so reading a result never stalls the pipeline
+const int GPU_TIMER_QUERIES = 4;
+
+// Measures GPU time of a block of GL commands with GL_TIME_ELAPSED queries.
+// Results are collected a few frames later, once the GPU reports them available.
+class GpuTimer
+{
+public:
+    // last measured and smoothed GPU time in milliseconds
+    float LastMs;
+    float AverageMs;
+    // number of results collected so far
+    unsigned int Samples;
+
+    GpuTimer() : LastMs(0.0f), AverageMs(0.0f), Samples(0), head(0), tail(0), inFlight(0), active(false)
+    {
+        for (int i = 0; i < GPU_TIMER_QUERIES; ++i)
+            queries[i] = 0;
+    }
+
+    void Create()
+    {
+        GpuResources().GenQueries(GPU_TIMER_QUERIES, queries, "gpu timer");
+    }
+
+    void Destroy()
+    {
+        GpuResources().DeleteQueries(GPU_TIMER_QUERIES, queries);
+    }
+
+    // starts timing; skipped when every query is still waiting on the GPU
+    void Begin()
+    {
+        Collect();
+        if (inFlight == GPU_TIMER_QUERIES)
+            return;
+
+        glBeginQuery(GL_TIME_ELAPSED, queries[head]);
+        active = true;
+    }
+
+    void End()
+    {
+        if (!active)
+            return;
+
+        glEndQuery(GL_TIME_ELAPSED);
+        head = (head + 1) % GPU_TIMER_QUERIES;
+        ++inFlight;
+        active = false;
+    }
+
+    // reads back every finished query without waiting for the others
+    void Collect()
+    {
+        while (inFlight > 0)
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(queries[tail], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                break;
+
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(queries[tail], GL_QUERY_RESULT, &elapsed);
+            LastMs = (float)(elapsed / 1.0e6);
+            AverageMs = Samples == 0 ? LastMs : AverageMs * 0.9f + LastMs * 0.1f;
+            ++Samples;
+
+            tail = (tail + 1) % GPU_TIMER_QUERIES;
+            --inFlight;
+        }
+    }
+
+private:
+    GLuint queries[GPU_TIMER_QUERIES];
+    int head;
+    int tail;
+    int inFlight;
+    bool active;
+};
+
+// Most phases a GpuPhaseTimer splits a frame into
+const int GPU_PHASE_MAX = 8;
+
+// Splits each frame's GPU work into consecutive phases with GL_TIMESTAMP queries at their boundaries.
+// Unlike GL_TIME_ELAPSED queries the timestamps do not nest, so a phase may hold blocks that a
+// GpuTimer measures on its own.
+class GpuPhaseTimer
+{
+public:
+    // smoothed GPU time of each phase in milliseconds
+    float PhaseMs[GPU_PHASE_MAX];
+    // number of frames collected so far
+    unsigned int Samples;
+
+    GpuPhaseTimer() : Samples(0), phases(0), head(0), tail(0), inFlight(0), next(-1)
+    {
+        for (int i = 0; i < GPU_PHASE_MAX; ++i)
+            PhaseMs[i] = 0.0f;
+        for (int f = 0; f < GPU_TIMER_QUERIES; ++f)
+            for (int i = 0; i <= GPU_PHASE_MAX; ++i)
+                queries[f][i] = 0;
+    }
+
+    void Create(int phaseCount, const char* label)
+    {
+        phases = phaseCount < GPU_PHASE_MAX ? phaseCount : GPU_PHASE_MAX;
+        GpuResources().GenQueries(GPU_TIMER_QUERIES * (GPU_PHASE_MAX + 1), queries[0], label);
+    }
+
+    void Destroy()
+    {
+        GpuResources().DeleteQueries(GPU_TIMER_QUERIES * (GPU_PHASE_MAX + 1), queries[0]);
+    }
+
+    // marks the start of the first phase; the frame is skipped when every query set is still in flight
+    void BeginFrame()
+    {
+        Collect();
+        next = -1;
+        if (inFlight == GPU_TIMER_QUERIES || phases == 0)
+            return;
+
+        glQueryCounter(queries[head][0], GL_TIMESTAMP);
+        next = 0;
+    }
+
+    // marks the end of a phase and the start of the one after it; phases end in order, none skipped
+    void EndPhase(int phase)
+    {
+        if (next < 0 || phase != next)
+            return;
+
+        glQueryCounter(queries[head][phase + 1], GL_TIMESTAMP);
+        if (++next == phases)
+        {
+            head = (head + 1) % GPU_TIMER_QUERIES;
+            ++inFlight;
+            next = -1;
+        }
+    }
+
+    // reads back every frame whose last timestamp has arrived
+    void Collect()
+    {
+        while (inFlight > 0)
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(queries[tail][phases], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                break;
+
+            GLuint64 start = 0;
+            glGetQueryObjectui64v(queries[tail][0], GL_QUERY_RESULT, &start);
+            for (int i = 0; i < phases; ++i)
+            {
+                GLuint64 end = 0;
+                glGetQueryObjectui64v(queries[tail][i + 1], GL_QUERY_RESULT, &end);
+                const float ms = (float)((end - start) / 1.0e6);
+                PhaseMs[i] = Samples == 0 ? ms : PhaseMs[i] * 0.9f + ms * 0.1f;
+                start = end;
+            }
+            ++Samples;
+
+            tail = (tail + 1) % GPU_TIMER_QUERIES;
+            --inFlight;
+        }
+    }
+
+private:
+    GLuint queries[GPU_TIMER_QUERIES][GPU_PHASE_MAX + 1];
+    int phases;
+    int head;
+    int tail;
+    int inFlight;
+    int next;       // phase being timed this frame, -1 when the frame is not timed
+};
+
+// Counts the primitives the GPU assembles for a block of GL commands with GL_PRIMITIVES_GENERATED
+// queries, so draws whose counts only the GPU knows are included. Results arrive like the timer's.
+class GpuPrimitiveCounter
+{
+public:
+    // primitives of the last collected block
+    GLuint64 Last;
+    unsigned int Samples;
+
+    GpuPrimitiveCounter() : Last(0), Samples(0), head(0), tail(0), inFlight(0), active(false)
+    {
+        for (int i = 0; i < GPU_TIMER_QUERIES; ++i)
+            queries[i] = 0;
+    }
+
+    void Create()
+    {
+        GpuResources().GenQueries(GPU_TIMER_QUERIES, queries, "primitive counter");
+    }
+
+    void Destroy()
+    {
+        GpuResources().DeleteQueries(GPU_TIMER_QUERIES, queries);
+    }
+
+    void Begin()
+    {
+        Collect();
+        if (inFlight == GPU_TIMER_QUERIES)
+            return;
+
+        glBeginQuery(GL_PRIMITIVES_GENERATED, queries[head]);
+        active = true;
+    }
+
+    void End()
+    {
+        if (!active)
+            return;
+
+        glEndQuery(GL_PRIMITIVES_GENERATED);
+        head = (head + 1) % GPU_TIMER_QUERIES;
+        ++inFlight;
+        active = false;
+    }
+
+    void Collect()
+    {
+        while (inFlight > 0)
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(queries[tail], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                break;
+
+            glGetQueryObjectui64v(queries[tail], GL_QUERY_RESULT, &Last);
+            ++Samples;
+
+            tail = (tail + 1) % GPU_TIMER_QUERIES;
+            --inFlight;
+        }
+    }
+
+private:
+    GLuint queries[GPU_TIMER_QUERIES];
+    int head;
+    int tail;
+    int inFlight;
+    bool active;
+};
+#endif
@@ -0,0 +1,417 @@
+#ifndef HUD_H
+#define HUD_H
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+
+#include "gputimer.h" // GPU phase times and the triangle count
+#include "resources.h" // GPU resource tracking and the frame counters
+#include "ring.h" // Persistently mapped vertex buffer
+
+// Frames shown by the frame time graph, one bar each, oldest on the left
+const int HUD_GRAPH_FRAMES = 120;
+// Most quads the overlay draws in a frame, glyphs, bars and the panel together
+const int HUD_MAX_QUADS = 2048;
+// Unit the font texture is bound to while the overlay draws
+const GLint HUD_FONT_TEXTURE_UNIT = 4;
+// Window pixels per font pixel
+const int HUD_TEXT_SCALE = 2;
+// Frame time at the top of the graph; the line below it marks 60 frames per second
+const float HUD_GRAPH_MAX_MS = 33.3f;
+const float HUD_GRAPH_TARGET_MS = 16.7f;
+
+// Parts the render loop splits the CPU time of a frame into, ended in this order
+enum Hud_Cpu_Phase {
+    HUD_CPU_WAIT,       // input, frame limiter and ring fences
+    HUD_CPU_UPDATE,     // animation, particles, streaming and terrain
+    HUD_CPU_RENDER,     // GL commands of the shadow, scene and present passes
+    HUD_CPU_PRESENT,    // the overlay and the buffer swap
+    NUM_HUD_CPU_PHASES
+};
+
+// and the GPU time, the overlay's own draw last
+enum Hud_Gpu_Phase {
+    HUD_GPU_SHADOWS,
+    HUD_GPU_SCENE,
+    HUD_GPU_PRESENT,
+    HUD_GPU_HUD,
+    NUM_HUD_GPU_PHASES
+};
+
+namespace hud_detail
+{
+    // 3x5 pixel glyphs from ' ' to 'Z', one row per byte from the top, bit 2 the left column
+    const int FONT_FIRST = ' ';
+    const int FONT_GLYPHS = 'Z' - ' ' + 1;
+    const int GLYPH_WIDTH = 3;
+    const int GLYPH_HEIGHT = 5;
+    const unsigned char FONT[FONT_GLYPHS][GLYPH_HEIGHT] = {
+        { 0, 0, 0, 0, 0 }, { 2, 2, 2, 0, 2 }, { 5, 5, 0, 0, 0 }, { 5, 7, 5, 7, 5 },     // space ! " #
+        { 3, 6, 2, 3, 6 }, { 5, 1, 2, 4, 5 }, { 2, 5, 2, 5, 3 }, { 2, 2, 0, 0, 0 },     // $ % & '
+        { 2, 4, 4, 4, 2 }, { 2, 1, 1, 1, 2 }, { 0, 5, 2, 5, 0 }, { 0, 2, 7, 2, 0 },     // ( ) * +
+        { 0, 0, 0, 2, 4 }, { 0, 0, 7, 0, 0 }, { 0, 0, 0, 0, 2 }, { 1, 1, 2, 4, 4 },     // , - . /
+        { 7, 5, 5, 5, 7 }, { 2, 6, 2, 2, 7 }, { 7, 1, 7, 4, 7 }, { 7, 1, 7, 1, 7 },     // 0 1 2 3
+        { 5, 5, 7, 1, 1 }, { 7, 4, 7, 1, 7 }, { 7, 4, 7, 5, 7 }, { 7, 1, 1, 1, 1 },     // 4 5 6 7
+        { 7, 5, 7, 5, 7 }, { 7, 5, 7, 1, 7 }, { 0, 2, 0, 2, 0 }, { 0, 2, 0, 2, 4 },     // 8 9 : ;
+        { 1, 2, 4, 2, 1 }, { 0, 7, 0, 7, 0 }, { 4, 2, 1, 2, 4 }, { 7, 1, 2, 0, 2 },     // < = > ?
+        { 7, 5, 7, 4, 3 }, { 2, 5, 7, 5, 5 }, { 6, 5, 6, 5, 6 }, { 3, 4, 4, 4, 3 },     // @ A B C
+        { 6, 5, 5, 5, 6 }, { 7, 4, 6, 4, 7 }, { 7, 4, 6, 4, 4 }, { 3, 4, 5, 5, 3 },     // D E F G
+        { 5, 5, 7, 5, 5 }, { 7, 2, 2, 2, 7 }, { 1, 1, 1, 5, 2 }, { 5, 5, 6, 5, 5 },     // H I J K
+        { 4, 4, 4, 4, 7 }, { 5, 7, 7, 5, 5 }, { 6, 5, 5, 5, 5 }, { 2, 5, 5, 5, 2 },     // L M N O
+        { 6, 5, 6, 4, 4 }, { 2, 5, 5, 6, 3 }, { 6, 5, 6, 5, 5 }, { 3, 4, 2, 1, 6 },     // P Q R S
+        { 7, 2, 2, 2, 2 }, { 5, 5, 5, 5, 7 }, { 5, 5, 5, 5, 2 }, { 5, 5, 7, 7, 5 },     // T U V W
+        { 5, 5, 2, 5, 5 }, { 5, 5, 2, 2, 2 }, { 7, 1, 2, 4, 7 }                         // X Y Z
+    };
+
+    // Each glyph sits in a cell of the font texture with a column and a row of padding;
+    // the cell after the last glyph is solid, so plain quads draw with the same texture
+    const int CELL_WIDTH = GLYPH_WIDTH + 1;
+    const int CELL_HEIGHT = GLYPH_HEIGHT + 1;
+    const int SOLID_CELL = FONT_GLYPHS;
+    const int FONT_TEXTURE_WIDTH = CELL_WIDTH * (FONT_GLYPHS + 1);
+
+    // lower case is drawn in capitals, anything else outside the font as '?'
+    inline int glyphIndex(char c)
+    {
+        if (c >= 'a' && c <= 'z')
+            c = (char)(c - 'a' + 'A');
+        if (c < FONT_FIRST || c >= FONT_FIRST + FONT_GLYPHS)
+            c = '?';
+        return c - FONT_FIRST;
+    }
+
+    struct HudVertex
+    {
+        GLfloat x, y;       // window pixels from the top left
+        GLfloat u, v;       // font texels, fetched without filtering
+        GLubyte color[4];
+    };
+
+    struct HudColor
+    {
+        GLubyte r, g, b, a;
+    };
+
+    const HudColor TEXT_COLOR = { 255, 255, 255, 255 };
+    const HudColor PANEL_COLOR = { 0, 0, 0, 160 };
+    const HudColor LINE_COLOR = { 255, 255, 255, 96 };
+    const HudColor FAST_COLOR = { 64, 220, 64, 255 };
+    const HudColor SLOW_COLOR = { 240, 200, 40, 255 };
+    const HudColor HITCH_COLOR = { 240, 60, 40, 255 };
+}
+
+// Performance overlay: frame time graph, CPU and GPU phase times and the frame's counters.
+// Everything it shows is written each frame as quads straight into a persistently mapped ring
+// and drawn with one call; text is built with snprintf into stack buffers, so it never allocates.
+class PerformanceHud
+{
+public:
+    bool Visible;
+    // CPU time of the overlay itself, building and submitting, smoothed
+    float CpuMs;
+
+    PerformanceHud() : Visible(false), CpuMs(0.0f), program(0), font(0), vao(0), screenSizeLoc(-1), fontLoc(-1),
+        graphHead(0), vertices(NULL), quads(0), cpuSamples(0)
+    {
+        for (int i = 0; i < HUD_GRAPH_FRAMES; ++i)
+            graph[i] = 0.0f;
+        for (int i = 0; i < NUM_HUD_CPU_PHASES; ++i)
+            cpuMs[i] = 0.0f;
+        frameStart = phaseStart = std::chrono::steady_clock::now();
+    }
+
+    void Create(GLuint hudProgram)
+    {
+        using namespace hud_detail;
+
+        program = hudProgram;
+        screenSizeLoc = glGetUniformLocation(program, "screenSize");
+        fontLoc = glGetUniformLocation(program, "font");
+
+        // every glyph and the solid cell in one row
+        GLubyte texels[FONT_TEXTURE_WIDTH * CELL_HEIGHT] = {};
+        for (int g = 0; g < FONT_GLYPHS; ++g)
+            for (int row = 0; row < GLYPH_HEIGHT; ++row)
+                for (int column = 0; column < GLYPH_WIDTH; ++column)
+                    if (FONT[g][row] & (4 >> column))
+                        texels[row * FONT_TEXTURE_WIDTH + g * CELL_WIDTH + column] = 255;
+        for (int row = 0; row < CELL_HEIGHT; ++row)
+            for (int column = 0; column < CELL_WIDTH; ++column)
+                texels[row * FONT_TEXTURE_WIDTH + SOLID_CELL * CELL_WIDTH + column] = 255;
+
+        font = GpuResources().GenTexture("hud font");
+        glBindTexture(GL_TEXTURE_2D, font);
+        GpuResources().TexStorage2D(GL_TEXTURE_2D, font, 1, GL_R8, FONT_TEXTURE_WIDTH, CELL_HEIGHT);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, FONT_TEXTURE_WIDTH, CELL_HEIGHT, GL_RED, GL_UNSIGNED_BYTE, texels);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        ring.Create(HUD_MAX_QUADS * 6 * sizeof(HudVertex));
+
+        // the buffer offset moves every frame, so it is set per draw with glBindVertexBuffer
+        vao = GpuResources().GenVertexArray("hud vao");
+        glBindVertexArray(vao);
+        glVertexAttribFormat(0, 2, GL_FLOAT, GL_FALSE, offsetof(HudVertex, x));
+        glVertexAttribBinding(0, 0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribFormat(1, 2, GL_FLOAT, GL_FALSE, offsetof(HudVertex, u));
+        glVertexAttribBinding(1, 0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribFormat(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, offsetof(HudVertex, color));
+        glVertexAttribBinding(2, 0);
+        glEnableVertexAttribArray(2);
+        glBindVertexArray(0);
+
+        gpuPhases.Create(NUM_HUD_GPU_PHASES, "hud phase timer");
+        primitives.Create();
+        frameStart = phaseStart = std::chrono::steady_clock::now();
+    }
+
+    void Destroy()
+    {
+        if (!program)
+            return;
+
+        primitives.Destroy();
+        gpuPhases.Destroy();
+        GpuResources().DeleteVertexArray(vao);
+        ring.Destroy();
+        GpuResources().DeleteTexture(font);
+        program = 0;
+    }
+
+    // call at the top of the frame: the time since the last call goes into the graph
+    void BeginFrame()
+    {
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        graph[graphHead] = std::chrono::duration<float, std::milli>(now - frameStart).count();
+        graphHead = (graphHead + 1) % HUD_GRAPH_FRAMES;
+        frameStart = phaseStart = now;
+    }
+
+    // the CPU phase that ran since the last phase ended, or since the frame began
+    void EndCpuPhase(Hud_Cpu_Phase phase)
+    {
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        const float ms = std::chrono::duration<float, std::milli>(now - phaseStart).count();
+        cpuMs[phase] = cpuSamples == 0 ? ms : cpuMs[phase] * 0.9f + ms * 0.1f;
+        phaseStart = now;
+        if (phase == NUM_HUD_CPU_PHASES - 1)
+            ++cpuSamples;
+    }
+
+    // before the first GL command of the frame's passes; the GPU is only queried while the overlay shows
+    void BeginGpuFrame()
+    {
+        if (!Visible || !program)
+            return;
+
+        gpuPhases.BeginFrame();
+        primitives.Begin();
+    }
+
+    // the triangle count covers the shadow and scene passes
+    void EndGpuPhase(Hud_Gpu_Phase phase)
+    {
+        if (phase == HUD_GPU_SCENE)
+            primitives.End();
+        gpuPhases.EndPhase(phase);
+    }
+
+    // draws over the window framebuffer, after the scene was presented into it
+    void Draw(int width, int height)
+    {
+        using namespace hud_detail;
+
+        if (!Visible || !program || width <= 0 || height <= 0)
+            return;
+
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        // taken before the overlay adds its own work
+        const FrameCounters counters = RenderCounters();
+
+        ring.BeginFrame();
+        RingSlice slice = ring.Allocate(HUD_MAX_QUADS * 6 * sizeof(HudVertex), sizeof(GLfloat));
+        if (slice.data == NULL)
+            return;
+        vertices = (HudVertex*)slice.data;
+        quads = 0;
+
+        const int margin = 8;
+        const int lineHeight = (GLYPH_HEIGHT + 2) * HUD_TEXT_SCALE;
+        const int x = margin * 2;
+        int y = margin * 2;
+        char line[160];
+
+        // the panel goes under everything, its height is known at the end
+        quad(0.0f, 0.0f, 0.0f, 0.0f, PANEL_COLOR);
+
+        float worst = 0.0f;
+        for (int i = 0; i < HUD_GRAPH_FRAMES; ++i)
+            worst = std::max(worst, graph[i]);
+        const float last = graph[(graphHead + HUD_GRAPH_FRAMES - 1) % HUD_GRAPH_FRAMES];
+        snprintf(line, sizeof(line), "FRAME %.2f MS  %.0f FPS  WORST %.2f MS", last, last > 0.0f ? 1000.0f / last : 0.0f, worst);
+        int textWidth = text(x, y, line, TEXT_COLOR);
+        y += lineHeight;
+
+        // a bar per frame, scaled so the top is HUD_GRAPH_MAX_MS
+        const int graphHeight = 64;
+        const int barWidth = 3;
+        const float graphBottom = (float)(y + graphHeight);
+        for (int i = 0; i < HUD_GRAPH_FRAMES; ++i)
+        {
+            const float ms = graph[(graphHead + i) % HUD_GRAPH_FRAMES];
+            const float barHeight = (ms < HUD_GRAPH_MAX_MS ? ms : HUD_GRAPH_MAX_MS) / HUD_GRAPH_MAX_MS * graphHeight;
+            const HudColor& color = ms <= HUD_GRAPH_TARGET_MS ? FAST_COLOR : ms <= HUD_GRAPH_MAX_MS ? SLOW_COLOR : HITCH_COLOR;
+            const float left = (float)(x + i * barWidth);
+            quad(left, graphBottom - barHeight, left + barWidth - 1, graphBottom, color);
+        }
+        const float targetY = graphBottom - HUD_GRAPH_TARGET_MS / HUD_GRAPH_MAX_MS * graphHeight;
+        quad((float)x, targetY, (float)(x + HUD_GRAPH_FRAMES * barWidth), targetY + 1.0f, LINE_COLOR);
+        text(x + HUD_GRAPH_FRAMES * barWidth + 4, (int)targetY - GLYPH_HEIGHT * HUD_TEXT_SCALE / 2, "16.7", TEXT_COLOR);
+        y += graphHeight + lineHeight / 2;
+
+        snprintf(line, sizeof(line), "CPU  WAIT %.2f  UPDATE %.2f  RENDER %.2f  PRESENT %.2f MS",
+            cpuMs[HUD_CPU_WAIT], cpuMs[HUD_CPU_UPDATE], cpuMs[HUD_CPU_RENDER], cpuMs[HUD_CPU_PRESENT]);
+        textWidth = std::max(textWidth, text(x, y, line, TEXT_COLOR));
+        y += lineHeight;
+
+        if (gpuPhases.Samples > 0)
+            snprintf(line, sizeof(line), "GPU  SHADOWS %.2f  SCENE %.2f  PRESENT %.2f MS",
+                gpuPhases.PhaseMs[HUD_GPU_SHADOWS], gpuPhases.PhaseMs[HUD_GPU_SCENE], gpuPhases.PhaseMs[HUD_GPU_PRESENT]);
+        else
+            snprintf(line, sizeof(line), "GPU  WAITING FOR TIMESTAMPS");
+        textWidth = std::max(textWidth, text(x, y, line, TEXT_COLOR));
+        y += lineHeight;
+
+        snprintf(line, sizeof(line), "DRAWS %u  DISPATCHES %u  STATE CHANGES %u", counters.DrawCalls, counters.Dispatches, counters.StateChanges);
+        textWidth = std::max(textWidth, text(x, y, line, TEXT_COLOR));
+        y += lineHeight;
+
+        snprintf(line, sizeof(line), "TRIANGLES %llu  UPLOADED %.1f KB", (unsigned long long)primitives.Last, counters.UploadedBytes / 1024.0f);
+        textWidth = std::max(textWidth, text(x, y, line, TEXT_COLOR));
+        y += lineHeight;
+
+        const ResourceTracker& resources = GpuResources();
+        if (resources.Budget() > 0)
+            snprintf(line, sizeof(line), "GPU MEMORY %.1f OF %.0f MB", resources.TotalBytes() / 1048576.0f, resources.Budget() / 1048576.0f);
+        else
+            snprintf(line, sizeof(line), "GPU MEMORY %.1f MB", resources.TotalBytes() / 1048576.0f);
+        textWidth = std::max(textWidth, text(x, y, line, TEXT_COLOR));
+        y += lineHeight;
+
+        snprintf(line, sizeof(line), "HUD %.3f MS CPU  %.3f MS GPU", CpuMs, gpuPhases.PhaseMs[HUD_GPU_HUD]);
+        textWidth = std::max(textWidth, text(x, y, line, TEXT_COLOR));
+        y += lineHeight;
+
+        const int panelWidth = std::max(textWidth, HUD_GRAPH_FRAMES * barWidth + 4 + 4 * CELL_WIDTH * HUD_TEXT_SCALE);
+        setQuad(0, (float)margin, (float)margin, (float)(x + panelWidth + margin), (float)(y + margin - lineHeight + GLYPH_HEIGHT * HUD_TEXT_SCALE), PANEL_COLOR);
+
+        glDisable(GL_DEPTH_TEST);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glUseProgram(program);
+        glUniform2f(screenSizeLoc, (float)width, (float)height);
+        glUniform1i(fontLoc, HUD_FONT_TEXTURE_UNIT);
+        glActiveTexture(GL_TEXTURE0 + HUD_FONT_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D, font);
+        glBindVertexArray(vao);
+        glBindVertexBuffer(0, ring.GetBuffer(), slice.offset, sizeof(HudVertex));
+        glDrawArrays(GL_TRIANGLES, 0, quads * 6);
+        glBindVertexArray(0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glActiveTexture(GL_TEXTURE0);
+        glDisable(GL_BLEND);
+        glEnable(GL_DEPTH_TEST);
+
+        ring.EndFrame();
+        gpuPhases.EndPhase(HUD_GPU_HUD);
+
+        const float ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        CpuMs = CpuMs == 0.0f ? ms : CpuMs * 0.9f + ms * 0.1f;
+    }
+
+private:
+    GLuint program;
+    GLuint font;
+    GLuint vao;
+    GLint screenSizeLoc;
+    GLint fontLoc;
+    UploadRing ring;
+    GpuPhaseTimer gpuPhases;
+    GpuPrimitiveCounter primitives;
+
+    float graph[HUD_GRAPH_FRAMES];  // frame times in milliseconds, graphHead is the oldest
+    int graphHead;
+    std::chrono::steady_clock::time_point frameStart;
+    std::chrono::steady_clock::time_point phaseStart;
+    float cpuMs[NUM_HUD_CPU_PHASES];
+
+    hud_detail::HudVertex* vertices;    // this frame's ring slice while Draw builds it
+    int quads;
+    unsigned int cpuSamples;
+
+    // writes the two triangles of quad index; u and v are the texels at the top left corner,
+    // uWidth and vHeight how many texels it covers
+    void setQuad(int index, float x0, float y0, float x1, float y1, const hud_detail::HudColor& color,
+        float u = -1.0f, float v = 0.0f, float uWidth = 0.0f, float vHeight = 0.0f)
+    {
+        using namespace hud_detail;
+
+        // plain quads fetch the middle of the solid cell
+        if (u < 0.0f)
+        {
+            u = SOLID_CELL * CELL_WIDTH + CELL_WIDTH * 0.5f;
+            v = CELL_HEIGHT * 0.5f;
+        }
+        const float corners[6][4] = {
+            { x0, y0, u, v }, { x1, y0, u + uWidth, v }, { x1, y1, u + uWidth, v + vHeight },
+            { x1, y1, u + uWidth, v + vHeight }, { x0, y1, u, v + vHeight }, { x0, y0, u, v }
+        };
+        HudVertex* out = vertices + index * 6;
+        for (int i = 0; i < 6; ++i)
+        {
+            out[i].x = corners[i][0];
+            out[i].y = corners[i][1];
+            out[i].u = corners[i][2];
+            out[i].v = corners[i][3];
+            out[i].color[0] = color.r;
+            out[i].color[1] = color.g;
+            out[i].color[2] = color.b;
+            out[i].color[3] = color.a;
+        }
+    }
+
+    // appends a quad, dropped once the ring slice is full
+    void quad(float x0, float y0, float x1, float y1, const hud_detail::HudColor& color,
+        float u = -1.0f, float v = 0.0f, float uWidth = 0.0f, float vHeight = 0.0f)
+    {
+        if (quads == HUD_MAX_QUADS)
+            return;
+        setQuad(quads++, x0, y0, x1, y1, color, u, v, uWidth, vHeight);
+    }
+
+    // one quad per visible glyph; returns the width in pixels
+    int text(int x, int y, const char* string, const hud_detail::HudColor& color)
+    {
+        using namespace hud_detail;
+
+        const int advance = CELL_WIDTH * HUD_TEXT_SCALE;
+        int left = x;
+        for (const char* c = string; *c; ++c, left += advance)
+        {
+            if (*c == ' ')
+                continue;
+            const float u = (float)(glyphIndex(*c) * CELL_WIDTH);
+            quad((float)left, (float)y, (float)(left + GLYPH_WIDTH * HUD_TEXT_SCALE), (float)(y + GLYPH_HEIGHT * HUD_TEXT_SCALE),
+                color, u, 0.0f, (float)GLYPH_WIDTH, (float)GLYPH_HEIGHT);
+        }
+        return left - x;
+    }
+};
+#endif
@@ -0,0 +1,528 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "memory.h" // Jobs come from a pool, each worker has a scratch arena
+
+// Jobs one worker's deque holds; a job pushed onto a full deque runs at once instead
+const int JOB_DEQUE_SIZE = 4096;
+// Batches ParallelFor aims for per thread, so a thread that finishes early has more to steal
+const int JOB_BATCHES_PER_THREAD = 4;
+// Empty looks for work before a worker goes to sleep
+const int JOB_SPINS = 64;
+// Jobs in flight at once before Run falls back to the heap
+const int JOB_POOL_SIZE = 16384;
+// Scratch arena of each worker; it grows past this if a frame needs more
+const size_t JOB_SCRATCH_BYTES = 1 << 20;
+
+struct Job;
+
+// Counts the jobs started with it that have not finished. Wait on it to help until they are done;
+// jobs added with RunAfter start once it reaches zero.
+class JobCounter
+{
+public:
+    JobCounter() : pending(0)
+    {
+    }
+
+    bool Done() const { return pending.load(std::memory_order_acquire) == 0; }
+
+private:
+    friend class JobSystem;
+    std::atomic<int> pending;
+    std::mutex mutex;               // taken by the last job to finish and by RunAfter
+    std::vector<Job*> waiting;      // jobs to start at zero
+
+    JobCounter(const JobCounter&);
+    JobCounter& operator=(const JobCounter&);
+};
+
+struct Job
+{
+    std::function<void()> work;
+    JobCounter* counter;
+    const char* name;
+};
+
+// One finished job, as the timing hook sees it
+struct JobTiming
+{
+    const char* name;
+    int worker;     // 0 is the thread that called Start
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point end;
+};
+
+typedef void (*JobTimingHook)(const JobTiming& timing, void* user);
+
+// Per-worker totals since ResetStats
+struct JobWorkerStats
+{
+    unsigned int jobs;
+    unsigned int steals;
+    float busyMs;
+};
+
+namespace jobs_detail
+{
+    // Chase-Lev deque of fixed size. The owning worker pushes and pops at the bottom, newest first,
+    // which keeps what it just split hot in its cache; other workers steal the oldest from the top.
+    // Only the last job and steals race, and they settle it with one compare-exchange on top.
+    class WorkStealingDeque
+    {
+    public:
+        WorkStealingDeque() : top(0), bottom(0)
+        {
+            for (int i = 0; i < JOB_DEQUE_SIZE; ++i)
+                slots[i].store(NULL, std::memory_order_relaxed);
+        }
+
+        bool Push(Job* job)
+        {
+            const long long b = bottom.load(std::memory_order_relaxed);
+            const long long t = top.load(std::memory_order_acquire);
+            if (b - t >= JOB_DEQUE_SIZE)
+                return false;
+            slots[b & (JOB_DEQUE_SIZE - 1)].store(job, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return true;
+        }
+
+        Job* Pop()
+        {
+            const long long b = bottom.load(std::memory_order_relaxed) - 1;
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            long long t = top.load(std::memory_order_relaxed);
+            if (t > b)
+            {
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return NULL;
+            }
+
+            Job* job = slots[b & (JOB_DEQUE_SIZE - 1)].load(std::memory_order_relaxed);
+            if (t == b)
+            {
+                // the last job: whoever moves top first has it
+                if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    job = NULL;
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
+            return job;
+        }
+
+        Job* Steal()
+        {
+            long long t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const long long b = bottom.load(std::memory_order_acquire);
+            if (t >= b)
+                return NULL;
+
+            Job* job = slots[t & (JOB_DEQUE_SIZE - 1)].load(std::memory_order_relaxed);
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                return NULL;
+            return job;
+        }
+
+    private:
+        // the owner writes bottom and thieves write top, so each has a cache line to itself
+        std::atomic<long long> top;
+        char padTop[64 - sizeof(std::atomic<long long>)];
+        std::atomic<long long> bottom;
+        char padBottom[64 - sizeof(std::atomic<long long>)];
+        std::atomic<Job*> slots[JOB_DEQUE_SIZE];
+    };
+
+    struct Worker
+    {
+        WorkStealingDeque deque;
+        std::atomic<unsigned int> jobs;
+        std::atomic<unsigned int> steals;
+        std::atomic<long long> busyNs;
+        std::atomic<size_t> scratchHighWater;
+        std::string name;
+    };
+
+    // which worker the calling thread is, -1 for threads the job system did not start
+    inline int& workerIndex()
+    {
+        static thread_local int index = -1;
+        return index;
+    }
+
+    inline FrameArena& threadScratch()
+    {
+        static thread_local FrameArena arena;
+        return arena;
+    }
+}
+
+// Work-stealing job scheduler, the thread backbone of every CPU stage.
+// Each worker owns a deque of jobs; it works through its own newest first and, when empty, steals the
+// oldest job of another worker. The thread that calls Start is worker 0: it pushes jobs like the
+// others and runs them whenever it waits on a counter, so a frame's work is never just handed off
+// and waited for. Threads the system did not start may add jobs too, through a shared locked queue.
+class JobSystem
+{
+public:
+    JobSystem() : workerCount(0), injectedFirst(0), injectedCount(0), injectedWaiting(0), queued(0), sleepers(0), stopping(false), hook(NULL), hookUser(NULL)
+    {
+    }
+
+    ~JobSystem()
+    {
+        Stop();
+    }
+
+    // threads includes the caller, so 1 runs every job on it; 0 uses one per hardware thread
+    void Start(int threads)
+    {
+        Stop();
+        if (threads <= 0)
+            threads = std::max(1, (int)std::thread::hardware_concurrency());
+
+        workers.reset(new jobs_detail::Worker[threads]);
+        workerCount = threads;
+        for (int i = 0; i < threads; ++i)
+            workers[i].name = i == 0 ? "main" : "worker " + std::to_string(i);
+        ResetStats();
+
+        jobPool.Create(JOB_POOL_SIZE);
+        {
+            std::lock_guard<std::mutex> lock(injectedMutex);
+            if (injected.empty())
+                injected.resize(JOB_DEQUE_SIZE);
+        }
+
+        stopping = false;
+        jobs_detail::workerIndex() = 0;
+        if (jobs_detail::threadScratch().Capacity() == 0)
+            jobs_detail::threadScratch().Create(JOB_SCRATCH_BYTES);
+        for (int i = 1; i < threads; ++i)
+            threadsRunning.push_back(std::thread(&JobSystem::workerThread, this, i));
+    }
+
+    // every job added must have finished
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t i = 0; i < threadsRunning.size(); ++i)
+            threadsRunning[i].join();
+        threadsRunning.clear();
+    }
+
+    int Threads() const { return std::max(workerCount, 1); }
+
+    const char* WorkerName(int worker) const { return workers[worker].name.c_str(); }
+
+    // called on the running thread after every job; NULL turns it off
+    void SetTimingHook(JobTimingHook timingHook, void* user)
+    {
+        hookUser = user;
+        hook.store(timingHook);
+    }
+
+    JobWorkerStats WorkerStats(int worker) const
+    {
+        JobWorkerStats stats;
+        stats.jobs = workers[worker].jobs.load(std::memory_order_relaxed);
+        stats.steals = workers[worker].steals.load(std::memory_order_relaxed);
+        stats.busyMs = workers[worker].busyNs.load(std::memory_order_relaxed) * 1e-6f;
+        return stats;
+    }
+
+    void ResetStats()
+    {
+        for (int i = 0; i < workerCount; ++i)
+        {
+            workers[i].jobs = 0;
+            workers[i].steals = 0;
+            workers[i].busyNs = 0;
+        }
+    }
+
+    // the calling thread's arena for memory one job needs only while it runs; take it with an ArenaScope.
+    // Threads the system did not start get one too, empty until their first frame has spilled into it
+    static FrameArena& Scratch() { return jobs_detail::threadScratch(); }
+
+    // most scratch bytes a worker had in use at once
+    size_t ScratchHighWater(int worker) const { return workers[worker].scratchHighWater.load(std::memory_order_relaxed); }
+
+    // jobs alive at once at most, of JobPoolSize; past that Run allocates them
+    int JobPoolHighWater()
+    {
+        std::lock_guard<std::mutex> lock(jobPoolMutex);
+        return jobPool.HighWater();
+    }
+
+    int JobPoolSize() const { return jobPool.Capacity(); }
+
+    // queues work, counted on counter when there is one
+    void Run(const std::function<void()>& work, JobCounter* counter, const char* name = "job")
+    {
+        push(makeJob(work, counter, name));
+    }
+
+    // queues work once dependency has reached zero
+    void RunAfter(JobCounter& dependency, const std::function<void()>& work, JobCounter* counter, const char* name = "job")
+    {
+        Job* job = makeJob(work, counter, name);
+        {
+            std::lock_guard<std::mutex> lock(dependency.mutex);
+            if (dependency.pending.load(std::memory_order_acquire) != 0)
+            {
+                dependency.waiting.push_back(job);
+                return;
+            }
+        }
+        push(job);
+    }
+
+    // runs jobs, this thread's own first, until counter reaches zero
+    void Wait(JobCounter& counter)
+    {
+        const int self = jobs_detail::workerIndex();
+        while (!counter.Done())
+        {
+            Job* job = findJob(self);
+            if (job)
+                execute(job, self);
+            else
+                std::this_thread::yield();
+        }
+        // the last job to finish may still hold the counter's lock; take it once so the caller can free it
+        std::lock_guard<std::mutex> lock(counter.mutex);
+    }
+
+    // body(begin, end) over [0, count) in batches of at least minBatch, sized so every thread gets a few;
+    // the caller runs the first batch and helps with the rest
+    void ParallelFor(const char* name, int count, const std::function<void(int, int)>& body, int minBatch = 1)
+    {
+        if (count <= 0)
+            return;
+
+        const int batches = Threads() * JOB_BATCHES_PER_THREAD;
+        const int batch = std::max(std::max(minBatch, 1), (count + batches - 1) / batches);
+        if (Threads() == 1 || batch >= count)
+        {
+            body(0, count);
+            return;
+        }
+
+        JobCounter counter;
+        for (int begin = batch; begin < count; begin += batch)
+        {
+            const int end = std::min(count, begin + batch);
+            Run([&body, begin, end]() { body(begin, end); }, &counter, name);
+        }
+        body(0, batch);
+        Wait(counter);
+    }
+
+private:
+    std::unique_ptr<jobs_detail::Worker[]> workers;
+    int workerCount;
+    std::vector<std::thread> threadsRunning;
+    std::mutex injectedMutex;
+    std::vector<Job*> injected;         // ring of jobs from threads that are not workers, size a power of two
+    size_t injectedFirst;
+    size_t injectedCount;
+    std::atomic<int> injectedWaiting;   // injectedCount, read without the lock so idle workers skip it when empty
+    std::atomic<int> queued;            // jobs pushed and not yet taken, for the sleepers
+    std::atomic<int> sleepers;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping;
+    std::atomic<JobTimingHook> hook;
+    void* hookUser;
+    std::mutex jobPoolMutex;
+    ObjectPool<Job> jobPool;
+
+    Job* makeJob(const std::function<void()>& work, JobCounter* counter, const char* name)
+    {
+        Job* job = NULL;
+        {
+            std::lock_guard<std::mutex> lock(jobPoolMutex);
+            job = jobPool.New();
+        }
+        if (!job)
+            job = new Job;
+        job->work = work;
+        job->counter = counter;
+        job->name = name;
+        if (counter)
+            counter->pending.fetch_add(1, std::memory_order_relaxed);
+        return job;
+    }
+
+    void push(Job* job)
+    {
+        const int self = jobs_detail::workerIndex();
+        if (self < 0 || self >= workerCount)
+        {
+            std::lock_guard<std::mutex> lock(injectedMutex);
+            if (injectedCount == injected.size())
+                growInjected();
+            injected[(injectedFirst + injectedCount) & (injected.size() - 1)] = job;
+            injectedWaiting.store((int)++injectedCount, std::memory_order_release);
+        }
+        else if (!workers[self].deque.Push(job))
+        {
+            execute(job, self);
+            return;
+        }
+
+        queued.fetch_add(1);
+        if (sleepers.load() > 0)
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            wake.notify_one();
+        }
+    }
+
+    Job* findJob(int self)
+    {
+        Job* job = NULL;
+        if (self >= 0 && self < workerCount)
+            job = workers[self].deque.Pop();
+
+        if (!job && injectedWaiting.load(std::memory_order_acquire) > 0)
+        {
+            std::lock_guard<std::mutex> lock(injectedMutex);
+            if (injectedCount > 0)
+            {
+                job = injected[injectedFirst];
+                injectedFirst = (injectedFirst + 1) & (injected.size() - 1);
+                injectedWaiting.store((int)--injectedCount, std::memory_order_release);
+            }
+        }
+
+        // steal starting after self, so thieves spread over the victims
+        for (int i = 1; !job && i <= workerCount; ++i)
+        {
+            const int victim = (std::max(self, 0) + i) % workerCount;
+            if (victim == self)
+                continue;
+            job = workers[victim].deque.Steal();
+            if (job && self >= 0)
+                workers[self].steals.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        if (job)
+            queued.fetch_sub(1);
+        return job;
+    }
+
+    // doubles the injected ring, oldest job first; injectedMutex is held
+    void growInjected()
+    {
+        std::vector<Job*> grown(std::max<size_t>(injected.size() * 2, JOB_DEQUE_SIZE));
+        for (size_t i = 0; i < injectedCount; ++i)
+            grown[i] = injected[(injectedFirst + i) & (injected.size() - 1)];
+        injected.swap(grown);
+        injectedFirst = 0;
+    }
+
+    void execute(Job* job, int self)
+    {
+        typedef std::chrono::steady_clock Clock;
+        const Clock::time_point start = Clock::now();
+        job->work();
+        const Clock::time_point end = Clock::now();
+
+        if (self >= 0 && self < workerCount)
+        {
+            workers[self].jobs.fetch_add(1, std::memory_order_relaxed);
+            workers[self].busyNs.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count(),
+                std::memory_order_relaxed);
+            workers[self].scratchHighWater.store(Scratch().HighWater(), std::memory_order_relaxed);
+        }
+        JobTimingHook timingHook = hook.load();
+        if (timingHook)
+        {
+            JobTiming timing = { job->name, self, start, end };
+            timingHook(timing, hookUser);
+        }
+
+        JobCounter* counter = job->counter;
+        freeJob(job);
+        if (counter)
+            finish(*counter);
+    }
+
+    void freeJob(Job* job)
+    {
+        std::lock_guard<std::mutex> lock(jobPoolMutex);
+        if (jobPool.Owns(job))
+            jobPool.Delete(job);
+        else
+            delete job;
+    }
+
+    // the last job of a counter starts the jobs waiting on it
+    void finish(JobCounter& counter)
+    {
+        int left = counter.pending.load(std::memory_order_relaxed);
+        while (left > 1)
+        {
+            if (counter.pending.compare_exchange_weak(left, left - 1, std::memory_order_acq_rel))
+                return;
+        }
+
+        std::vector<Job*> ready;
+        {
+            std::lock_guard<std::mutex> lock(counter.mutex);
+            if (counter.pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                ready.swap(counter.waiting);
+        }
+        for (size_t i = 0; i < ready.size(); ++i)
+            push(ready[i]);
+    }
+
+    void workerThread(int self)
+    {
+        jobs_detail::workerIndex() = self;
+        jobs_detail::threadScratch().Create(JOB_SCRATCH_BYTES);
+        for (;;)
+        {
+            Job* job = NULL;
+            for (int spin = 0; !job && spin < JOB_SPINS; ++spin)
+            {
+                job = findJob(self);
+                if (!job)
+                    std::this_thread::yield();
+            }
+            if (job)
+            {
+                execute(job, self);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            sleepers.fetch_add(1);
+            wake.wait(lock, [this] { return stopping || queued.load() > 0; });
+            sleepers.fetch_sub(1);
+            if (stopping)
+                return;
+        }
+    }
+};
+#endif
@@ -0,0 +1,222 @@
+#ifndef KTX2_H
+#define KTX2_H
+
+#include <GL/glew.h>
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// Block compressed formats the texture cooker writes
+enum Cooked_Format {
+    COOKED_BC1,     // RGB, 8 bytes per 4x4 block
+    COOKED_BC3,     // RGBA with separate alpha, 16 bytes per block
+    COOKED_BC7,     // RGBA, 16 bytes per block, best quality
+    NUM_COOKED_FORMATS
+};
+
+// Vulkan format numbers stored in the KTX2 header
+const unsigned int KTX2_VK_FORMAT_BC1_RGBA_UNORM = 133;
+const unsigned int KTX2_VK_FORMAT_BC3_UNORM = 137;
+const unsigned int KTX2_VK_FORMAT_BC7_UNORM = 145;
+
+inline unsigned int CookedBlockBytes(Cooked_Format format)
+{
+    return format == COOKED_BC1 ? 8 : 16;
+}
+
+inline GLenum CookedGLFormat(Cooked_Format format)
+{
+    switch (format)
+    {
+    case COOKED_BC1: return GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+    case COOKED_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    default: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+    }
+}
+
+inline const char* CookedFormatName(Cooked_Format format)
+{
+    static const char* const names[NUM_COOKED_FORMATS] = { "BC1", "BC3", "BC7" };
+    return names[format];
+}
+
+// Byte size of one mip level of a block compressed image
+inline size_t CookedLevelBytes(Cooked_Format format, int width, int height)
+{
+    return (size_t)((width + 3) / 4) * ((height + 3) / 4) * CookedBlockBytes(format);
+}
+
+// A cooked image: every mip level as GPU-ready blocks, level 0 first
+struct CookedTexture
+{
+    Cooked_Format format;
+    int width, height;
+    std::vector<std::vector<unsigned char> > levels;
+};
+
+namespace ktx2_detail
+{
+    const unsigned char IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+    // the 64-bit fields follow 13 words, so the header must not be padded to their alignment
+#pragma pack(push, 4)
+    struct Header
+    {
+        unsigned int vkFormat;
+        unsigned int typeSize;
+        unsigned int pixelWidth, pixelHeight, pixelDepth;
+        unsigned int layerCount, faceCount, levelCount;
+        unsigned int supercompressionScheme;
+        unsigned int dfdByteOffset, dfdByteLength;
+        unsigned int kvdByteOffset, kvdByteLength;
+        unsigned long long sgdByteOffset, sgdByteLength;
+    };
+#pragma pack(pop)
+
+    struct LevelIndex
+    {
+        unsigned long long byteOffset, byteLength, uncompressedByteLength;
+    };
+
+    inline unsigned int VkFormat(Cooked_Format format)
+    {
+        return format == COOKED_BC1 ? KTX2_VK_FORMAT_BC1_RGBA_UNORM : format == COOKED_BC3 ? KTX2_VK_FORMAT_BC3_UNORM : KTX2_VK_FORMAT_BC7_UNORM;
+    }
+
+    // Basic data format descriptor (Khronos Data Format 1.3) of a BC format, linear transfer, BT.709 primaries
+    inline void WriteDescriptor(Cooked_Format format, std::vector<unsigned int>& words)
+    {
+        const unsigned int colorModel = format == COOKED_BC1 ? 128 : format == COOKED_BC3 ? 130 : 134;
+        const unsigned int samples = format == COOKED_BC3 ? 2 : 1;
+        const unsigned int blockSize = 24 + 16 * samples;
+
+        words.push_back(4 + blockSize);                          // total size
+        words.push_back(0);                                      // vendor 0 (Khronos), descriptor type 0
+        words.push_back(2 | (blockSize << 16));                  // version 2, block size
+        words.push_back(colorModel | (1 << 8) | (1 << 16));      // model, BT.709, linear, no flags
+        words.push_back(3 | (3 << 8));                           // 4x4x1x1 texel blocks
+        words.push_back(CookedBlockBytes(format));               // bytes in plane 0
+        words.push_back(0);
+
+        // BC3 describes its alpha half first (channel 15), BC7 and BC1 are one color sample
+        for (unsigned int s = 0; s < samples; ++s)
+        {
+            const bool alpha = format == COOKED_BC3 && s == 0;
+            const unsigned int bitOffset = format == COOKED_BC3 && s == 1 ? 64 : 0;
+            const unsigned int bitLength = format == COOKED_BC7 ? 127 : 63;
+            words.push_back(bitOffset | (bitLength << 16) | ((alpha ? 15u : 0u) << 24));
+            words.push_back(0);
+            words.push_back(0);
+            words.push_back(0xFFFFFFFFu);
+        }
+    }
+}
+
+// Writes a KTX2 container; levels are laid out smallest first as the format asks, each aligned to its block size
+inline bool WriteKtx2(const char* path, const CookedTexture& texture)
+{
+    using namespace ktx2_detail;
+
+    FILE* file = fopen(path, "wb");
+    if (!file)
+        return false;
+
+    std::vector<unsigned int> descriptor;
+    WriteDescriptor(texture.format, descriptor);
+
+    const unsigned int levelCount = (unsigned int)texture.levels.size();
+    Header header;
+    memset(&header, 0, sizeof(header));
+    header.vkFormat = VkFormat(texture.format);
+    header.typeSize = 1;
+    header.pixelWidth = texture.width;
+    header.pixelHeight = texture.height;
+    header.faceCount = 1;
+    header.levelCount = levelCount;
+    header.dfdByteOffset = (unsigned int)(sizeof(IDENTIFIER) + sizeof(Header) + levelCount * sizeof(LevelIndex));
+    header.dfdByteLength = (unsigned int)(descriptor.size() * sizeof(unsigned int));
+
+    std::vector<LevelIndex> index(levelCount);
+    unsigned long long offset = header.dfdByteOffset + header.dfdByteLength;
+    const unsigned int alignment = CookedBlockBytes(texture.format);
+    for (int level = (int)levelCount - 1; level >= 0; --level)
+    {
+        offset = (offset + alignment - 1) / alignment * alignment;
+        index[level].byteOffset = offset;
+        index[level].byteLength = texture.levels[level].size();
+        index[level].uncompressedByteLength = texture.levels[level].size();
+        offset += texture.levels[level].size();
+    }
+
+    bool ok = fwrite(IDENTIFIER, sizeof(IDENTIFIER), 1, file) == 1
+        && fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(index.data(), sizeof(LevelIndex), levelCount, file) == levelCount
+        && fwrite(descriptor.data(), sizeof(unsigned int), descriptor.size(), file) == descriptor.size();
+
+    for (int level = (int)levelCount - 1; level >= 0 && ok; --level)
+    {
+        const unsigned char zeros[16] = { 0 };
+        long position = ftell(file);
+        ok = fwrite(zeros, 1, (size_t)(index[level].byteOffset - position), file) == (size_t)(index[level].byteOffset - position)
+            && fwrite(texture.levels[level].data(), 1, texture.levels[level].size(), file) == texture.levels[level].size();
+    }
+
+    return fclose(file) == 0 && ok;
+}
+
+// Reads a KTX2 container written by WriteKtx2, or any other 2D BC1/BC3/BC7 one without supercompression
+inline bool ReadKtx2(const char* path, CookedTexture& texture)
+{
+    using namespace ktx2_detail;
+
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return false;
+
+    unsigned char identifier[12];
+    Header header;
+    bool ok = fread(identifier, sizeof(identifier), 1, file) == 1 && memcmp(identifier, IDENTIFIER, sizeof(IDENTIFIER)) == 0
+        && fread(&header, sizeof(header), 1, file) == 1
+        && header.supercompressionScheme == 0 && header.pixelDepth == 0 && header.faceCount == 1 && header.layerCount <= 1;
+
+    if (ok)
+    {
+        if (header.vkFormat == KTX2_VK_FORMAT_BC1_RGBA_UNORM)
+            texture.format = COOKED_BC1;
+        else if (header.vkFormat == KTX2_VK_FORMAT_BC3_UNORM)
+            texture.format = COOKED_BC3;
+        else if (header.vkFormat == KTX2_VK_FORMAT_BC7_UNORM)
+            texture.format = COOKED_BC7;
+        else
+            ok = false;
+    }
+
+    std::vector<LevelIndex> index;
+    if (ok)
+    {
+        // a level count of 0 asks the loader to generate mips, which block formats cannot
+        index.resize(header.levelCount > 0 ? header.levelCount : 1);
+        ok = fread(index.data(), sizeof(LevelIndex), index.size(), file) == index.size();
+    }
+
+    if (ok)
+    {
+        texture.width = header.pixelWidth;
+        texture.height = header.pixelHeight;
+        texture.levels.resize(index.size());
+        for (size_t level = 0; level < index.size() && ok; ++level)
+        {
+            int width = texture.width >> level, height = texture.height >> level;
+            size_t expected = CookedLevelBytes(texture.format, width > 0 ? width : 1, height > 0 ? height : 1);
+            texture.levels[level].resize((size_t)index[level].byteLength);
+            ok = index[level].byteLength == expected
+                && fseek(file, (long)index[level].byteOffset, SEEK_SET) == 0
+                && fread(texture.levels[level].data(), 1, texture.levels[level].size(), file) == texture.levels[level].size();
+        }
+    }
+
+    fclose(file);
+    return ok;
+}
+#endif
@@ -0,0 +1,295 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Debug builds overwrite released memory with MEMORY_POISON_BYTE, so a pointer kept past its frame or its
+// pool slot reads garbage at once instead of stale data that still looks right; define MEMORY_POISON to choose
+#ifndef MEMORY_POISON
+#ifdef _DEBUG
+#define MEMORY_POISON 1
+#else
+#define MEMORY_POISON 0
+#endif
+#endif
+
+// Define MEMORY_COUNT_ALLOCATIONS to 1 to count every C++ heap allocation of the process, for "--check-allocs"
+// and the memory report; off by default, since the counter adds an atomic increment to every allocation
+#ifndef MEMORY_COUNT_ALLOCATIONS
+#define MEMORY_COUNT_ALLOCATIONS 0
+#endif
+
+const unsigned char MEMORY_POISON_BYTE = 0xDD;
+// Alignment of arena allocations unless asked otherwise, enough for SSE loads and glm types
+const size_t MEMORY_ALIGNMENT = 16;
+// Largest alignment an arena hands out, one cache line
+const size_t MEMORY_MAX_ALIGNMENT = 64;
+
+namespace memory_detail
+{
+    inline void poison(void* data, size_t bytes)
+    {
+#if MEMORY_POISON
+        std::memset(data, MEMORY_POISON_BYTE, bytes);
+#else
+        (void)data;
+        (void)bytes;
+#endif
+    }
+
+    inline size_t alignUp(size_t value, size_t alignment)
+    {
+        return (value + alignment - 1) & ~(alignment - 1);
+    }
+}
+
+// Where an arena stood, for FrameArena::Rewind: the bytes in use and the spills made so far
+struct ArenaMark
+{
+    size_t used;
+    size_t spills;
+    size_t spilledBytes;
+};
+
+// Linear allocator for data that lives for one frame, or one job: allocations bump a pointer and are
+// released all at once by Reset, or back to a Mark by Rewind. Nothing is destroyed, so only trivially
+// destructible types go in. Not thread safe; each thread gets its own.
+// An allocation that does not fit spills to the heap and is counted; the next Reset frees the spills and
+// grows the arena to the high-water mark, so a frame that overflowed once fits from then on.
+class FrameArena
+{
+public:
+    // allocations that did not fit and went to the heap
+    unsigned int Spills;
+
+    FrameArena() : Spills(0), block(NULL), base(NULL), capacity(0), used(0), spilledBytes(0), highWater(0), overflowed(false)
+    {
+    }
+
+    ~FrameArena()
+    {
+        Destroy();
+    }
+
+    void Create(size_t bytes)
+    {
+        Destroy();
+        capacity = memory_detail::alignUp(std::max<size_t>(bytes, MEMORY_MAX_ALIGNMENT), MEMORY_MAX_ALIGNMENT);
+        block = static_cast<char*>(::operator new(capacity + MEMORY_MAX_ALIGNMENT));
+        base = reinterpret_cast<char*>(memory_detail::alignUp(reinterpret_cast<uintptr_t>(block), MEMORY_MAX_ALIGNMENT));
+        memory_detail::poison(base, capacity);
+        used = 0;
+        overflowed = false;
+    }
+
+    void Destroy()
+    {
+        freeSpills();
+        ::operator delete(block);
+        block = NULL;
+        base = NULL;
+        capacity = 0;
+        used = 0;
+    }
+
+    // uninitialized bytes; alignment is a power of two up to MEMORY_MAX_ALIGNMENT
+    void* Allocate(size_t bytes, size_t alignment = MEMORY_ALIGNMENT)
+    {
+        const size_t offset = memory_detail::alignUp(used, alignment);
+        if (offset + bytes <= capacity)
+        {
+            used = offset + bytes;
+            highWater = std::max(highWater, used + spilledBytes);
+            return base + offset;
+        }
+
+        ++Spills;
+        overflowed = true;
+        spilledBytes += bytes + alignment;
+        highWater = std::max(highWater, used + spilledBytes);
+        char* spill = static_cast<char*>(::operator new(bytes + alignment));
+        spills.push_back(spill);
+        return reinterpret_cast<char*>(memory_detail::alignUp(reinterpret_cast<uintptr_t>(spill), alignment));
+    }
+
+    // uninitialized room for count objects of a trivially destructible type
+    template <typename T>
+    T* AllocateArray(size_t count)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "arena memory is released without destructors");
+        return static_cast<T*>(Allocate(count * sizeof(T), std::max(alignof(T), MEMORY_ALIGNMENT)));
+    }
+
+    // position to Rewind to; allocations made after it are released together
+    ArenaMark Mark() const
+    {
+        ArenaMark mark = { used, spills.size(), spilledBytes };
+        return mark;
+    }
+
+    // releases what was allocated after mark, spills included; marks taken later are no longer valid
+    void Rewind(const ArenaMark& mark)
+    {
+        if (used > mark.used)
+            memory_detail::poison(base + mark.used, used - mark.used);
+        used = mark.used;
+        for (size_t i = mark.spills; i < spills.size(); ++i)
+            ::operator delete(spills[i]);
+        spills.resize(std::min(spills.size(), mark.spills));
+        spilledBytes = mark.spilledBytes;
+
+        // once empty, an arena that ran out of room grows to the high-water mark
+        if (used == 0 && spills.empty() && overflowed)
+            Create(highWater + highWater / 4);
+    }
+
+    // call at frame start, once nothing from the last frame is in use
+    void Reset()
+    {
+        const ArenaMark empty = { 0, 0, 0 };
+        Rewind(empty);
+    }
+
+    size_t Used() const { return used; }
+    size_t Capacity() const { return capacity; }
+    // most bytes in use at once since Create, spills included
+    size_t HighWater() const { return highWater; }
+
+private:
+    char* block;
+    char* base;         // block aligned to MEMORY_MAX_ALIGNMENT
+    size_t capacity;
+    size_t used;
+    size_t spilledBytes;
+    size_t highWater;
+    bool overflowed;    // spilled since Create, so the next Reset grows the block
+    std::vector<char*> spills;
+
+    void freeSpills()
+    {
+        for (size_t i = 0; i < spills.size(); ++i)
+            ::operator delete(spills[i]);
+        spills.clear();
+        spilledBytes = 0;
+    }
+
+    FrameArena(const FrameArena&);
+    FrameArena& operator=(const FrameArena&);
+};
+
+// Releases everything allocated from an arena during its scope, for scratch memory inside a job
+class ArenaScope
+{
+public:
+    explicit ArenaScope(FrameArena& scopeArena) : arena(scopeArena), mark(scopeArena.Mark())
+    {
+    }
+
+    ~ArenaScope()
+    {
+        arena.Rewind(mark);
+    }
+
+private:
+    FrameArena& arena;
+    ArenaMark mark;
+
+    ArenaScope(const ArenaScope&);
+    ArenaScope& operator=(const ArenaScope&);
+};
+
+// Fixed number of slots for objects that are created and destroyed all the time; New and Delete reuse
+// the slots through a free list and never touch the heap. Not thread safe.
+template <typename T>
+class ObjectPool
+{
+public:
+    // New calls that found every slot taken and returned NULL
+    unsigned int Exhausted;
+
+    ObjectPool() : Exhausted(0), slots(NULL), capacity(0), highWater(0)
+    {
+    }
+
+    ~ObjectPool()
+    {
+        Destroy();
+    }
+
+    void Create(int slotCount)
+    {
+        Destroy();
+        capacity = std::max(slotCount, 0);
+        slots = new Slot[capacity];
+        memory_detail::poison(slots, sizeof(Slot) * capacity);
+        freeSlots.resize(capacity);
+        // handed out from the front, so a lightly used pool stays in the first few cache lines
+        for (int i = 0; i < capacity; ++i)
+            freeSlots[i] = capacity - 1 - i;
+    }
+
+    // every object must have been deleted
+    void Destroy()
+    {
+        delete[] slots;
+        slots = NULL;
+        capacity = 0;
+        freeSlots.clear();
+    }
+
+    // NULL when every slot is taken
+    template <typename... Args>
+    T* New(Args&&... args)
+    {
+        if (freeSlots.empty())
+        {
+            ++Exhausted;
+            return NULL;
+        }
+        const int slot = freeSlots.back();
+        freeSlots.pop_back();
+        highWater = std::max(highWater, Live());
+        return new (&slots[slot]) T(std::forward<Args>(args)...);
+    }
+
+    void Delete(T* object)
+    {
+        object->~T();
+        memory_detail::poison(object, sizeof(T));
+        freeSlots.push_back((int)(reinterpret_cast<Slot*>(object) - slots));
+    }
+
+    // whether object came from New, so callers with a heap fallback know how to free it
+    bool Owns(const T* object) const
+    {
+        const Slot* slot = reinterpret_cast<const Slot*>(object);
+        return slot >= slots && slot < slots + capacity;
+    }
+
+    int Live() const { return capacity - (int)freeSlots.size(); }
+    int Capacity() const { return capacity; }
+    // most objects alive at once since Create
+    int HighWater() const { return highWater; }
+
+private:
+    struct alignas(T) Slot
+    {
+        unsigned char bytes[sizeof(T)];
+    };
+
+    Slot* slots;
+    int capacity;
+    int highWater;
+    std::vector<int> freeSlots;     // reserved for every slot at Create, so Delete never grows it
+
+    ObjectPool(const ObjectPool&);
+    ObjectPool& operator=(const ObjectPool&);
+};
+#endif
@@ -0,0 +1,145 @@
+#ifndef OVERDRAW_H
+#define OVERDRAW_H
+
+#include <GL/glew.h>
+
+#include "gputimer.h" // GPU time of the depth prepass
+#include "resources.h" // GPU resource tracking
+
+// How the opaque scene is ordered against the depth buffer
+enum Depth_Order {
+    DEPTH_ORDER_FIXED,          // draw order as listed, every covered fragment may be shaded
+    DEPTH_ORDER_PREPASS,        // depth only first, then color with GL_EQUAL so each pixel is shaded once
+    DEPTH_ORDER_FRONT_TO_BACK   // nearest objects first, so farther fragments fail the early depth test
+};
+
+inline const char* DepthOrderName(Depth_Order order)
+{
+    switch (order)
+    {
+    case DEPTH_ORDER_PREPASS: return "depth prepass";
+    case DEPTH_ORDER_FRONT_TO_BACK: return "front to back";
+    default: return "fixed order";
+    }
+}
+
+// Atomic counter binding the scene fragment shader increments, "binding = 0" in the shader
+const GLuint OVERDRAW_COUNTER_BINDING = 0;
+// Counters kept in flight so reading one back never waits on the GPU
+const int OVERDRAW_COUNTERS = 4;
+
+// Counts the fragments the scene shader runs per frame; divided by the pixels of the target that is
+// the average number of times each pixel is shaded. The shader tests depth before it runs (early
+// fragment tests), so fragments hidden by what is already in the depth buffer are not counted.
+class OverdrawCounter
+{
+public:
+    // shaded fragments per pixel, last frame read back and smoothed
+    float LastRatio;
+    float AverageRatio;
+    unsigned int Samples;
+    // GPU time of the depth prepass, when there is one
+    GpuTimer PrepassTimer;
+
+    OverdrawCounter() : LastRatio(0.0f), AverageRatio(0.0f), Samples(0), head(0), tail(0), inFlight(0), active(false)
+    {
+        for (int i = 0; i < OVERDRAW_COUNTERS; ++i)
+        {
+            counters[i] = 0;
+            fences[i] = 0;
+            pixels[i] = 0;
+        }
+    }
+
+    void Create()
+    {
+        for (int i = 0; i < OVERDRAW_COUNTERS; ++i)
+        {
+            counters[i] = GpuResources().GenBuffer("overdraw counter");
+            glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, counters[i]);
+            GpuResources().BufferData(GL_ATOMIC_COUNTER_BUFFER, counters[i], sizeof(GLuint), NULL, GL_DYNAMIC_READ);
+        }
+        glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+        PrepassTimer.Create();
+    }
+
+    void Destroy()
+    {
+        for (int i = 0; i < OVERDRAW_COUNTERS; ++i)
+        {
+            if (fences[i])
+                glDeleteSync(fences[i]);
+            fences[i] = 0;
+            if (counters[i])
+                GpuResources().DeleteBuffer(counters[i]);
+        }
+        PrepassTimer.Destroy();
+        inFlight = 0;
+    }
+
+    // zeroes a counter and binds it for this frame's scene pass; false, and nothing bound,
+    // when every counter is still waiting on the GPU
+    bool Begin(GLsizei targetPixels)
+    {
+        Collect();
+        if (counters[head] == 0 || inFlight == OVERDRAW_COUNTERS)
+            return false;
+
+        const GLuint zero = 0;
+        glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, counters[head]);
+        glBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(GLuint), &zero);
+        glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+        glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, OVERDRAW_COUNTER_BINDING, counters[head]);
+        pixels[head] = targetPixels;
+        active = true;
+        return true;
+    }
+
+    void End()
+    {
+        if (!active)
+            return;
+
+        glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, OVERDRAW_COUNTER_BINDING, 0);
+        fences[head] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        head = (head + 1) % OVERDRAW_COUNTERS;
+        ++inFlight;
+        active = false;
+    }
+
+    // reads back every counter the GPU has finished with, oldest first
+    void Collect()
+    {
+        while (inFlight > 0)
+        {
+            GLenum result = glClientWaitSync(fences[tail], 0, 0);
+            if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+                break;
+
+            glDeleteSync(fences[tail]);
+            fences[tail] = 0;
+
+            GLuint shaded = 0;
+            glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, counters[tail]);
+            glGetBufferSubData(GL_ATOMIC_COUNTER_BUFFER, 0, sizeof(GLuint), &shaded);
+            glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+
+            LastRatio = pixels[tail] > 0 ? (float)shaded / pixels[tail] : 0.0f;
+            AverageRatio = Samples == 0 ? LastRatio : AverageRatio * 0.9f + LastRatio * 0.1f;
+            ++Samples;
+
+            tail = (tail + 1) % OVERDRAW_COUNTERS;
+            --inFlight;
+        }
+    }
+
+private:
+    GLuint counters[OVERDRAW_COUNTERS];
+    GLsync fences[OVERDRAW_COUNTERS];
+    GLsizei pixels[OVERDRAW_COUNTERS];
+    int head;
+    int tail;
+    int inFlight;
+    bool active;
+};
+#endif
@@ -0,0 +1,243 @@
+#ifndef PACING_H
+#define PACING_H
+
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// Time left to spin after sleeping; grows when the OS oversleeps and decays back when it does not
+const double PACING_MIN_SPIN_MS = 0.5;
+const double PACING_MAX_SPIN_MS = 4.0;
+// Latencies kept between reports without growing the list, a 2 second report at 8000 fps
+const size_t PACING_RESERVED_LATENCIES = 16384;
+// Longest event wait while nothing changes; streaming and terrain uploads are looked for this often
+const double REDRAW_IDLE_SECONDS = 0.25;
+// Longest camera step after an idle wait, so a key pressed after a long pause does not jump
+const float REDRAW_MAX_STEP_SECONDS = 0.05f;
+// Seconds between utilization reports
+const double REDRAW_REPORT_SECONDS = 2.0;
+
+// Controls how frames are paced and measures how old the input is when a frame is handed to the swap chain.
+// The limiter sleeps through most of the wait and spins the last part on the steady clock, because sleep
+// alone wakes up a scheduler tick late. With late latching the input is sampled after the wait instead of
+// before it, so the camera reflects the newest mouse and keyboard state the frame can still use.
+class FramePacer
+{
+public:
+    // sample input after the limiter and the upload ring wait rather than at the top of the frame
+    bool LateLatch;
+
+    FramePacer() : LateLatch(false), swapInterval(1), frameSeconds(0.0), spinMs(1.0), oversleeps(0), hasInput(false)
+    {
+        nextFrame = Clock::now();
+        latencies.reserve(PACING_RESERVED_LATENCIES);
+    }
+
+    // 0 presents immediately, 1 waits for vertical blank, -1 is adaptive vsync where the driver offers it
+    void SetSwapInterval(int interval)
+    {
+        swapInterval = interval;
+        glfwSwapInterval(interval);
+    }
+
+    int SwapInterval() const { return swapInterval; }
+
+    // 0 turns the limiter off
+    void SetTargetFps(double fps)
+    {
+        frameSeconds = fps > 0.0 ? 1.0 / fps : 0.0;
+        nextFrame = Clock::now();
+    }
+
+    double TargetFps() const { return frameSeconds > 0.0 ? 1.0 / frameSeconds : 0.0; }
+
+    // blocks until the next frame is due; a frame that ran late starts the schedule over instead of bursting
+    void WaitForFrame()
+    {
+        if (frameSeconds <= 0.0)
+            return;
+
+        nextFrame += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(frameSeconds));
+        Clock::time_point now = Clock::now();
+        if (nextFrame <= now)
+        {
+            nextFrame = now;
+            return;
+        }
+
+        Clock::time_point wake = nextFrame - std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(spinMs));
+        if (wake > now)
+        {
+            std::this_thread::sleep_until(wake);
+
+            double overshootMs = std::chrono::duration<double, std::milli>(Clock::now() - wake).count();
+            if (Clock::now() > nextFrame)
+                ++oversleeps;
+            spinMs = std::max(PACING_MIN_SPIN_MS, std::min(PACING_MAX_SPIN_MS, std::max(overshootMs * 1.25, spinMs * 0.98)));
+        }
+
+        while (Clock::now() < nextFrame)
+            std::this_thread::yield();
+    }
+
+    // call right after the camera input was applied
+    void InputSampled()
+    {
+        inputTime = Clock::now();
+        hasInput = true;
+    }
+
+    // call once the swap returns; records how long the sampled input waited to be shown
+    void Presented()
+    {
+        if (!hasInput)
+            return;
+
+        latencies.push_back(std::chrono::duration<float, std::milli>(Clock::now() - inputTime).count());
+        hasInput = false;
+    }
+
+    // prints the latency distribution since the last report and starts a new one
+    void Report(std::ostream& out)
+    {
+        if (latencies.empty())
+            return;
+
+        std::sort(latencies.begin(), latencies.end());
+        const size_t n = latencies.size();
+        float total = 0.0f;
+        for (size_t i = 0; i < n; ++i)
+            total += latencies[i];
+
+        out << "INFO: Input to swap latency over " << n << " frames: average " << total / n << " ms, median "
+            << latencies[n / 2] << " ms, 95th percentile " << latencies[n * 95 / 100] << " ms, 99th percentile "
+            << latencies[n * 99 / 100] << " ms, worst " << latencies[n - 1] << " ms (swap interval " << swapInterval;
+        if (frameSeconds > 0.0)
+            out << ", limited to " << TargetFps() << " fps, " << spinMs << " ms spin, " << oversleeps << " oversleeps";
+        out << (LateLatch ? ", late latched" : "") << ")" << std::endl;
+
+        latencies.clear();
+        oversleeps = 0;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    int swapInterval;
+    double frameSeconds;
+    double spinMs;
+    unsigned int oversleeps;
+    Clock::time_point nextFrame;
+    Clock::time_point inputTime;
+    bool hasInput;
+    std::vector<float> latencies;
+};
+
+// Decides which frames are drawn when rendering on demand, and measures how busy each mode keeps the render
+// thread and the GPU. One-off events (a click, a resize, an upload) mark the scene changed for one frame; work that
+// goes on by itself (playing animations, live particles, a held movement key, reads still coming in) keeps the
+// tracker active, which draws every frame until it stops. With neither the loop sleeps in the event wait instead
+// of polling, and a window that lost its contents only gets the last frame again.
+// Continuous rendering draws every frame whatever is marked, as the benchmarks expect.
+class RedrawTracker
+{
+public:
+    // draw only when something changed instead of every frame
+    bool OnDemand;
+
+    RedrawTracker() : OnDemand(false), changed(true), active(false), exposed(false), drawn(0), shownAgain(0), skipped(0), waitSeconds(0.0), lastGpuMs(0.0)
+    {
+        reportStart = Clock::now();
+    }
+
+    // the camera, an object's transform or a GPU resource changed, so the next frame must be drawn
+    void MarkChanged() { changed = true; }
+    // the window lost its contents and needs the last frame again
+    void MarkExposed() { exposed = true; }
+    // set before the events are processed, each loop: whether something keeps changing the scene without input
+    void SetActive(bool isActive) { active = isActive; }
+
+    // whether this frame is drawn; always in continuous mode
+    bool NeedsDraw() const { return !OnDemand || changed || active; }
+    bool NeedsPresent() const { return exposed; }
+
+    // Handles window events: polls when a frame is due anyway, otherwise sleeps until an event arrives or the timeout
+    void ProcessEvents(double timeoutSeconds)
+    {
+        if (NeedsDraw() || exposed)
+        {
+            glfwPollEvents();
+            return;
+        }
+
+        const Clock::time_point start = Clock::now();
+        glfwWaitEventsTimeout(timeoutSeconds);
+        waitSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    // the frame limiter's sleep is idle time too
+    void WaitForFrame(FramePacer& pacer)
+    {
+        const Clock::time_point start = Clock::now();
+        pacer.WaitForFrame();
+        waitSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    // once per loop, for what it did with the frame
+    void FrameDrawn()
+    {
+        ++drawn;
+        changed = false;
+        exposed = false;
+    }
+
+    void FrameShownAgain()
+    {
+        ++shownAgain;
+        exposed = false;
+    }
+
+    void FrameSkipped()
+    {
+        ++skipped;
+    }
+
+    // gpuMsTotal is the GPU time of every timed frame so far; prints the share of the wall clock the render
+    // thread spent outside the event wait and the frame limiter, and the share the GPU spent on frames
+    void Report(std::ostream& out, double gpuMsTotal)
+    {
+        const Clock::time_point now = Clock::now();
+        const double seconds = std::chrono::duration<double>(now - reportStart).count();
+        if (seconds < REDRAW_REPORT_SECONDS)
+            return;
+
+        out << "INFO: " << (OnDemand ? "On demand" : "Continuous") << " rendering: " << drawn << " frames drawn";
+        if (OnDemand)
+            out << ", " << shownAgain << " shown again, " << skipped << " idle wakeups";
+        out << " in " << seconds << " s; render thread busy " << 100.0 * std::max(0.0, 1.0 - waitSeconds / seconds)
+            << "%, GPU busy " << 100.0 * (gpuMsTotal - lastGpuMs) / (seconds * 1000.0) << "%" << std::endl;
+
+        drawn = shownAgain = skipped = 0;
+        waitSeconds = 0.0;
+        lastGpuMs = gpuMsTotal;
+        reportStart = now;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    bool changed;
+    bool active;
+    bool exposed;
+    unsigned int drawn;
+    unsigned int shownAgain;
+    unsigned int skipped;
+    double waitSeconds;
+    double lastGpuMs;
+    Clock::time_point reportStart;
+};
+#endif
@@ -0,0 +1,441 @@
+#ifndef PARTICLES_H
+#define PARTICLES_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "simdmath.h" // SIMDMATH_X86 and the intrinsics headers
+#include "jobs.h" // Chunks run as jobs across the workers
+
+// Particles per chunk; chunks are both the storage blocks and the unit of work handed to the threads
+const int PARTICLE_CHUNK = 4096;
+// Vertical speed kept after hitting the floor, and horizontal speed kept while sliding on it
+const float PARTICLE_BOUNCE = 0.35f;
+const float PARTICLE_FRICTION = 0.8f;
+
+// One live particle as the renderer reads it: the position and color attributes of VERTEX_POSITION_COLOR
+struct ParticleVertex
+{
+    float position[3];
+    float color[4];
+};
+
+// A source of particles: a box they start in, a velocity range and what they look like
+struct ParticleEmitter
+{
+    glm::vec3 position;
+    glm::vec3 positionSpread;   // half extents of the box around position
+    glm::vec3 velocity;
+    glm::vec3 velocitySpread;   // +- range around velocity
+    glm::vec4 color;            // alpha fades to 0 over the particle's life
+    float gravity;              // vertical acceleration, negative falls
+    float rate;                 // particles per second
+    float life, lifeSpread;     // seconds
+};
+
+// Every per-particle value, each in its own array
+enum Particle_Field {
+    PARTICLE_PX, PARTICLE_PY, PARTICLE_PZ,
+    PARTICLE_VX, PARTICLE_VY, PARTICLE_VZ,
+    PARTICLE_GRAVITY,
+    PARTICLE_AGE, PARTICLE_LIFE,
+    PARTICLE_R, PARTICLE_G, PARTICLE_B, PARTICLE_A,
+    NUM_PARTICLE_FIELDS
+};
+
+namespace particles_detail
+{
+    // Four floats at once: SSE on x86, a plain array elsewhere, so the kernels are written once
+#ifdef SIMDMATH_X86
+    typedef __m128 F4;
+    typedef __m128i U4;
+
+    inline F4 load(const float* p) { return _mm_loadu_ps(p); }
+    inline void store(float* p, F4 v) { _mm_storeu_ps(p, v); }
+    inline F4 set1(float v) { return _mm_set1_ps(v); }
+    inline F4 add(F4 a, F4 b) { return _mm_add_ps(a, b); }
+    inline F4 sub(F4 a, F4 b) { return _mm_sub_ps(a, b); }
+    inline F4 mul(F4 a, F4 b) { return _mm_mul_ps(a, b); }
+    inline F4 less(F4 a, F4 b) { return _mm_cmplt_ps(a, b); }
+    // b where mask is set, a elsewhere
+    inline F4 select(F4 mask, F4 a, F4 b) { return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a)); }
+    inline int bits(F4 mask) { return _mm_movemask_ps(mask); }
+
+    // xorshift32 in every lane, then 23 random mantissa bits make a float in [0, 1)
+    inline F4 random(U4& state)
+    {
+        state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+        state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+        state = _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+        U4 one = _mm_or_si128(_mm_srli_epi32(state, 9), _mm_set1_epi32(0x3F800000));
+        return _mm_sub_ps(_mm_castsi128_ps(one), _mm_set1_ps(1.0f));
+    }
+
+    inline U4 seed(unsigned int a, unsigned int b, unsigned int c, unsigned int d) { return _mm_setr_epi32((int)a, (int)b, (int)c, (int)d); }
+#else
+    struct F4 { float v[4]; };
+    struct U4 { unsigned int v[4]; };
+
+    inline F4 load(const float* p) { F4 r; memcpy(r.v, p, sizeof(r.v)); return r; }
+    inline void store(float* p, F4 v) { memcpy(p, v.v, sizeof(v.v)); }
+    inline F4 set1(float v) { F4 r = { { v, v, v, v } }; return r; }
+    inline F4 add(F4 a, F4 b) { for (int i = 0; i < 4; ++i) a.v[i] += b.v[i]; return a; }
+    inline F4 sub(F4 a, F4 b) { for (int i = 0; i < 4; ++i) a.v[i] -= b.v[i]; return a; }
+    inline F4 mul(F4 a, F4 b) { for (int i = 0; i < 4; ++i) a.v[i] *= b.v[i]; return a; }
+    // masks are 0 or 1 per lane here
+    inline F4 less(F4 a, F4 b) { F4 r; for (int i = 0; i < 4; ++i) r.v[i] = a.v[i] < b.v[i] ? 1.0f : 0.0f; return r; }
+    inline F4 select(F4 mask, F4 a, F4 b) { for (int i = 0; i < 4; ++i) a.v[i] = mask.v[i] != 0.0f ? b.v[i] : a.v[i]; return a; }
+    inline int bits(F4 mask) { int r = 0; for (int i = 0; i < 4; ++i) r |= (mask.v[i] != 0.0f) << i; return r; }
+
+    inline F4 random(U4& state)
+    {
+        F4 r;
+        for (int i = 0; i < 4; ++i)
+        {
+            unsigned int& x = state.v[i];
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            unsigned int one = (x >> 9) | 0x3F800000u;
+            memcpy(&r.v[i], &one, sizeof(float));
+            r.v[i] -= 1.0f;
+        }
+        return r;
+    }
+
+    inline U4 seed(unsigned int a, unsigned int b, unsigned int c, unsigned int d) { U4 r = { { a, b, c, d } }; return r; }
+#endif
+
+    // the first lanes of v only, for the last group of a run
+    inline void storeFirst(float* p, F4 v, int lanes)
+    {
+        if (lanes >= 4)
+        {
+            store(p, v);
+            return;
+        }
+        float all[4];
+        store(all, v);
+        memcpy(p, all, lanes * sizeof(float));
+    }
+
+    // value + (random * 2 - 1) * spread
+    inline F4 around(U4& state, float value, float spread)
+    {
+        return add(set1(value), mul(sub(add(random(state), random(state)), set1(1.0f)), set1(spread)));
+    }
+}
+
+// Per-frame time of each stage, smoothed
+struct ParticleTimes
+{
+    float emitMs;
+    float simulateMs;
+    float writeMs;
+};
+
+// Particles stored structure-of-arrays in fixed chunks.
+// Each frame new particles are handed out to chunks with room, then every chunk emits, integrates and
+// drops its dead particles four at a time on whichever worker takes it; live particles stay packed
+// at the front of their chunk. Write then copies the live particles of all chunks, back to back, into
+// the caller's buffer, usually persistently mapped memory the GPU draws from directly.
+// The random state depends on the chunk and frame only, so the result is the same on any thread count.
+class ParticleSystem
+{
+public:
+    ParticleTimes Times;
+    // particles the emitters wanted this frame but no chunk had room for
+    unsigned int Dropped;
+
+    ParticleSystem() : Dropped(0), floorHeight(-1e30f), frame(0)
+    {
+        Times.emitMs = Times.simulateMs = Times.writeMs = 0.0f;
+    }
+
+    // room for maxParticles, rounded up to whole chunks; particles bounce off the plane y = floor
+    void Create(int maxParticles, float floor)
+    {
+        const int chunks = std::max(1, (maxParticles + PARTICLE_CHUNK - 1) / PARTICLE_CHUNK);
+        for (int f = 0; f < NUM_PARTICLE_FIELDS; ++f)
+            fields[f].assign((size_t)chunks * PARTICLE_CHUNK, 0.0f);
+        live.assign(chunks, 0);
+        requests.assign(chunks, std::vector<EmitRequest>());
+        reserveRequests();
+        firstVertex.assign(chunks + 1, 0);
+        floorHeight = floor;
+    }
+
+    int AddEmitter(const ParticleEmitter& emitter)
+    {
+        emitters.push_back(emitter);
+        carry.push_back(0.0f);
+        reserveRequests();
+        return (int)emitters.size() - 1;
+    }
+
+    ParticleEmitter& Emitter(int index) { return emitters[index]; }
+
+    int Capacity() const { return (int)live.size() * PARTICLE_CHUNK; }
+
+    int Live() const
+    {
+        int total = 0;
+        for (size_t c = 0; c < live.size(); ++c)
+            total += live[c];
+        return total;
+    }
+
+    // whether any emitter adds particles over time
+    bool Emitting() const
+    {
+        for (size_t e = 0; e < emitters.size(); ++e)
+        {
+            if (emitters[e].rate > 0.0f)
+                return true;
+        }
+        return false;
+    }
+
+    // emits this frame's particles and advances every particle by dt seconds
+    void Update(float dt, JobSystem& jobs)
+    {
+        typedef std::chrono::steady_clock Clock;
+        Clock::time_point start = Clock::now();
+        ++frame;
+
+        // Hand out new particles to the first chunks with room; only counts, the chunks fill themselves
+        int cursor = 0;
+        for (size_t c = 0; c < requests.size(); ++c)
+            requests[c].clear();
+        for (size_t e = 0; e < emitters.size(); ++e)
+        {
+            carry[e] += emitters[e].rate * dt;
+            int wanted = (int)carry[e];
+            carry[e] -= wanted;
+
+            while (wanted > 0 && cursor < (int)live.size())
+            {
+                int room = PARTICLE_CHUNK - live[cursor] - requested(cursor);
+                if (room <= 0)
+                {
+                    ++cursor;
+                    continue;
+                }
+                EmitRequest request = { (int)e, std::min(room, wanted) };
+                requests[cursor].push_back(request);
+                wanted -= request.count;
+            }
+            Dropped += wanted;
+        }
+
+        jobs.ParallelFor("particle emit", (int)live.size(), [this](int begin, int end) {
+            for (int chunk = begin; chunk < end; ++chunk)
+                emitChunk(chunk);
+        });
+        Clock::time_point emitted = Clock::now();
+
+        jobs.ParallelFor("particle simulate", (int)live.size(), [this, dt](int begin, int end) {
+            for (int chunk = begin; chunk < end; ++chunk)
+                simulateChunk(chunk, dt);
+        });
+        Clock::time_point simulated = Clock::now();
+
+        smooth(Times.emitMs, std::chrono::duration<float, std::milli>(emitted - start).count());
+        smooth(Times.simulateMs, std::chrono::duration<float, std::milli>(simulated - emitted).count());
+    }
+
+    // copies up to capacity live particles into out, chunk after chunk; returns how many were written
+    int Write(ParticleVertex* out, int capacity, JobSystem& jobs)
+    {
+        typedef std::chrono::steady_clock Clock;
+        Clock::time_point start = Clock::now();
+
+        firstVertex[0] = 0;
+        for (size_t c = 0; c < live.size(); ++c)
+            firstVertex[c + 1] = std::min(firstVertex[c] + live[c], capacity);
+
+        jobs.ParallelFor("particle write", (int)live.size(), [this, out](int begin, int end) {
+            for (int chunk = begin; chunk < end; ++chunk)
+                writeChunk(chunk, out);
+        });
+
+        smooth(Times.writeMs, std::chrono::duration<float, std::milli>(Clock::now() - start).count());
+        return firstVertex[live.size()];
+    }
+
+private:
+    struct EmitRequest
+    {
+        int emitter;
+        int count;
+    };
+
+    std::vector<float> fields[NUM_PARTICLE_FIELDS];
+    std::vector<int> live;                          // live particles at the front of each chunk
+    std::vector<std::vector<EmitRequest> > requests;
+    std::vector<int> firstVertex;                   // where each chunk's particles start in the written buffer
+    std::vector<ParticleEmitter> emitters;
+    std::vector<float> carry;                       // fraction of a particle each emitter still owes
+    float floorHeight;
+    unsigned int frame;
+
+    static void smooth(float& average, float ms)
+    {
+        average = average == 0.0f ? ms : average * 0.9f + ms * 0.1f;
+    }
+
+    // a chunk gets at most one request per emitter a frame, so with room for that Update never allocates
+    void reserveRequests()
+    {
+        for (size_t c = 0; c < requests.size(); ++c)
+            requests[c].reserve(emitters.size());
+    }
+
+    int requested(int chunk) const
+    {
+        int total = 0;
+        for (size_t r = 0; r < requests[chunk].size(); ++r)
+            total += requests[chunk][r].count;
+        return total;
+    }
+
+    float* field(Particle_Field f, int chunk) { return fields[f].data() + (size_t)chunk * PARTICLE_CHUNK; }
+
+    void emitChunk(int chunk)
+    {
+        using namespace particles_detail;
+        if (requests[chunk].empty())
+            return;
+
+        float* p[NUM_PARTICLE_FIELDS];
+        for (int f = 0; f < NUM_PARTICLE_FIELDS; ++f)
+            p[f] = field((Particle_Field)f, chunk);
+
+        const unsigned int base = (unsigned int)chunk * 2654435761u ^ frame * 2246822519u;
+        U4 state = seed(base | 1u, (base + 0x9E3779B9u) | 1u, (base + 0x3C6EF372u) | 1u, (base + 0xDAA66D2Bu) | 1u);
+
+        for (size_t r = 0; r < requests[chunk].size(); ++r)
+        {
+            const ParticleEmitter& e = emitters[requests[chunk][r].emitter];
+            int at = live[chunk];
+            const int end = at + requests[chunk][r].count;
+
+            // four at a time; the run starts anywhere in the chunk, so its last group may be partial
+            for (; at < end; at += 4)
+            {
+                const int lanes = end - at;
+                storeFirst(p[PARTICLE_PX] + at, around(state, e.position.x, e.positionSpread.x), lanes);
+                storeFirst(p[PARTICLE_PY] + at, around(state, e.position.y, e.positionSpread.y), lanes);
+                storeFirst(p[PARTICLE_PZ] + at, around(state, e.position.z, e.positionSpread.z), lanes);
+                storeFirst(p[PARTICLE_VX] + at, around(state, e.velocity.x, e.velocitySpread.x), lanes);
+                storeFirst(p[PARTICLE_VY] + at, around(state, e.velocity.y, e.velocitySpread.y), lanes);
+                storeFirst(p[PARTICLE_VZ] + at, around(state, e.velocity.z, e.velocitySpread.z), lanes);
+                storeFirst(p[PARTICLE_GRAVITY] + at, set1(e.gravity), lanes);
+                storeFirst(p[PARTICLE_AGE] + at, set1(0.0f), lanes);
+                storeFirst(p[PARTICLE_LIFE] + at, around(state, e.life, e.lifeSpread), lanes);
+                storeFirst(p[PARTICLE_R] + at, set1(e.color.r), lanes);
+                storeFirst(p[PARTICLE_G] + at, set1(e.color.g), lanes);
+                storeFirst(p[PARTICLE_B] + at, set1(e.color.b), lanes);
+                storeFirst(p[PARTICLE_A] + at, set1(e.color.a), lanes);
+            }
+            live[chunk] = end;
+        }
+    }
+
+    // Integrates four particles at a time and moves the survivors down over the dead ones
+    void simulateChunk(int chunk, float dt)
+    {
+        using namespace particles_detail;
+        const int count = live[chunk];
+        if (count == 0)
+            return;
+
+        float* p[NUM_PARTICLE_FIELDS];
+        for (int f = 0; f < NUM_PARTICLE_FIELDS; ++f)
+            p[f] = field((Particle_Field)f, chunk);
+
+        const F4 step = set1(dt);
+        const F4 floor = set1(floorHeight);
+        const F4 bounce = set1(-PARTICLE_BOUNCE);
+        const F4 friction = set1(PARTICLE_FRICTION);
+        int kept = 0;
+
+        // the chunk size is a multiple of four, so the last group stays inside it
+        for (int at = 0; at < count; at += 4)
+        {
+            F4 vx = load(p[PARTICLE_VX] + at), vy = load(p[PARTICLE_VY] + at), vz = load(p[PARTICLE_VZ] + at);
+            vy = add(vy, mul(load(p[PARTICLE_GRAVITY] + at), step));
+            F4 px = add(load(p[PARTICLE_PX] + at), mul(vx, step));
+            F4 py = add(load(p[PARTICLE_PY] + at), mul(vy, step));
+            F4 pz = add(load(p[PARTICLE_PZ] + at), mul(vz, step));
+            F4 age = add(load(p[PARTICLE_AGE] + at), step);
+
+            // below the floor: back onto it, bounce and slow down
+            F4 below = less(py, floor);
+            py = select(below, py, floor);
+            vy = select(below, vy, mul(vy, bounce));
+            vx = select(below, vx, mul(vx, friction));
+            vz = select(below, vz, mul(vz, friction));
+
+            store(p[PARTICLE_PX] + at, px);
+            store(p[PARTICLE_PY] + at, py);
+            store(p[PARTICLE_PZ] + at, pz);
+            store(p[PARTICLE_VX] + at, vx);
+            store(p[PARTICLE_VY] + at, vy);
+            store(p[PARTICLE_VZ] + at, vz);
+            store(p[PARTICLE_AGE] + at, age);
+
+            int alive = bits(less(age, load(p[PARTICLE_LIFE] + at)));
+            if (count - at < 4)
+                alive &= (1 << (count - at)) - 1;
+
+            // whole groups move as four lanes, and not at all until something before them has died
+            if (alive == 0xF)
+            {
+                if (kept != at)
+                {
+                    for (int f = 0; f < NUM_PARTICLE_FIELDS; ++f)
+                        store(p[f] + kept, load(p[f] + at));
+                }
+                kept += 4;
+                continue;
+            }
+            for (int lane = 0; lane < 4; ++lane)
+            {
+                if (!(alive & (1 << lane)))
+                    continue;
+                for (int f = 0; f < NUM_PARTICLE_FIELDS; ++f)
+                    p[f][kept] = p[f][at + lane];
+                ++kept;
+            }
+        }
+        live[chunk] = kept;
+    }
+
+    void writeChunk(int chunk, ParticleVertex* out)
+    {
+        const int first = firstVertex[chunk];
+        const int count = firstVertex[chunk + 1] - first;
+        const float* p[NUM_PARTICLE_FIELDS];
+        for (int f = 0; f < NUM_PARTICLE_FIELDS; ++f)
+            p[f] = fields[f].data() + (size_t)chunk * PARTICLE_CHUNK;
+
+        ParticleVertex* vertex = out + first;
+        for (int i = 0; i < count; ++i, ++vertex)
+        {
+            vertex->position[0] = p[PARTICLE_PX][i];
+            vertex->position[1] = p[PARTICLE_PY][i];
+            vertex->position[2] = p[PARTICLE_PZ][i];
+            vertex->color[0] = p[PARTICLE_R][i];
+            vertex->color[1] = p[PARTICLE_G][i];
+            vertex->color[2] = p[PARTICLE_B][i];
+            vertex->color[3] = p[PARTICLE_A][i] * (1.0f - p[PARTICLE_AGE][i] / p[PARTICLE_LIFE][i]);
+        }
+    }
+};
+#endif
@@ -0,0 +1,339 @@
+#ifndef PRIMITIVES_H
+#define PRIMITIVES_H
+
+#include <GL/glew.h>
+
+#include <string>
+
+#include "geometry.h" // Vertex_Format and FloatsPerVertex
+#include "resources.h" // GPU resource tracking
+
+// Faces of generated boxes, in the order the hand-typed scene meshes listed them
+enum Box_Face {
+    BOX_BACK,       // -z
+    BOX_FRONT,      // +z
+    BOX_LEFT,       // -x
+    BOX_RIGHT,      // +x
+    BOX_BOTTOM,     // -y
+    BOX_TOP,        // +y
+    NUM_BOX_FACES
+};
+
+// Faces of generated pyramids: a side over each edge of the base, then the base
+enum Pyramid_Face {
+    PYRAMID_BACK,
+    PYRAMID_FRONT,
+    PYRAMID_LEFT,
+    PYRAMID_RIGHT,
+    PYRAMID_BASE,
+    NUM_PYRAMID_FACES
+};
+
+struct PrimitiveColor
+{
+    GLfloat r, g, b, a;
+};
+
+// A generated mesh as the uploader sees it, whatever its size and format
+struct PrimitiveData
+{
+    const GLfloat* vertices;
+    const GLuint* indices;
+    GLsizei nVertices;
+    GLsizei nIndices;
+    Vertex_Format format;
+    const GLfloat* boundsMin;
+    const GLfloat* boundsMax;
+};
+
+// Vertices and indices of a mesh built by the compiler. Declared constexpr, it is placed in read-only
+// data fully formed and uploaded from there; nothing runs to build it.
+template <Vertex_Format Format, int Vertices, int Indices>
+struct PrimitiveMesh
+{
+    enum {
+        VERTICES = Vertices,
+        INDICES = Indices,
+        FLOATS_PER_VERTEX = FloatsPerVertex(Format)
+    };
+
+    GLfloat vertices[Vertices * FLOATS_PER_VERTEX];     // interleaved in the layout of Format
+    GLuint indices[Indices];                            // triangle list
+    GLfloat boundsMin[3], boundsMax[3];                 // object-space bounding box
+
+    PrimitiveData Data() const
+    {
+        PrimitiveData data = { vertices, indices, Vertices, Indices, Format, boundsMin, boundsMax };
+        return data;
+    }
+};
+
+// Four corners and two triangles per face, so every face keeps its own color and normal
+template <Vertex_Format Format>
+using PrimitiveBoxMesh = PrimitiveMesh<Format, 4 * NUM_BOX_FACES, 6 * NUM_BOX_FACES>;
+template <Vertex_Format Format>
+using PrimitivePlaneMesh = PrimitiveMesh<Format, 4, 6>;
+template <Vertex_Format Format>
+using PrimitivePyramidMesh = PrimitiveMesh<Format, 3 * (NUM_PYRAMID_FACES - 1) + 4, 3 * (NUM_PYRAMID_FACES - 1) + 6>;
+
+namespace primitives_detail
+{
+    // corners of each box face in unit half extents, wound like the hand-typed meshes: triangles 0 1 2 and 2 3 0
+    constexpr signed char BOX_CORNERS[NUM_BOX_FACES][4][3] = {
+        { { -1, -1, -1 }, {  1, -1, -1 }, {  1,  1, -1 }, { -1,  1, -1 } },
+        { { -1, -1,  1 }, {  1, -1,  1 }, {  1,  1,  1 }, { -1,  1,  1 } },
+        { { -1,  1,  1 }, { -1,  1, -1 }, { -1, -1, -1 }, { -1, -1,  1 } },
+        { {  1,  1,  1 }, {  1,  1, -1 }, {  1, -1, -1 }, {  1, -1,  1 } },
+        { { -1, -1, -1 }, {  1, -1, -1 }, {  1, -1,  1 }, { -1, -1,  1 } },
+        { { -1,  1, -1 }, {  1,  1, -1 }, {  1,  1,  1 }, { -1,  1,  1 } }
+    };
+    constexpr signed char BOX_NORMALS[NUM_BOX_FACES][3] = {
+        { 0, 0, -1 }, { 0, 0, 1 }, { -1, 0, 0 }, { 1, 0, 0 }, { 0, -1, 0 }, { 0, 1, 0 }
+    };
+    // base corners under each pyramid side, in the order of Pyramid_Face
+    constexpr signed char PYRAMID_EDGES[NUM_PYRAMID_FACES - 1][2][2] = {
+        { { -1, -1 }, {  1, -1 } },
+        { {  1,  1 }, { -1,  1 } },
+        { { -1,  1 }, { -1, -1 } },
+        { {  1, -1 }, {  1,  1 } }
+    };
+
+    // std::sqrt is not constexpr; Newton's method converges in a handful of steps from above
+    constexpr float squareRoot(float x)
+    {
+        if (x <= 0.0f)
+            return 0.0f;
+        float root = x > 1.0f ? x : 1.0f;
+        for (int i = 0; i < 64; ++i)
+            root = 0.5f * (root + x / root);
+        return root;
+    }
+
+    // position, color and, for VERTEX_POSITION_COLOR_NORMAL, the normal
+    template <Vertex_Format Format>
+    constexpr void writeVertex(GLfloat* out, float x, float y, float z, const PrimitiveColor& color, float nx, float ny, float nz)
+    {
+        out[0] = x;
+        out[1] = y;
+        out[2] = z;
+        out[3] = color.r;
+        out[4] = color.g;
+        out[5] = color.b;
+        out[6] = color.a;
+        if (Format == VERTEX_POSITION_COLOR_NORMAL)
+        {
+            out[7] = nx;
+            out[8] = ny;
+            out[9] = nz;
+        }
+    }
+
+    template <typename Mesh>
+    constexpr void writeQuadIndices(Mesh& mesh, int index, GLuint first)
+    {
+        const GLuint quad[6] = { 0, 1, 2, 2, 3, 0 };
+        for (int i = 0; i < 6; ++i)
+            mesh.indices[index + i] = first + quad[i];
+    }
+
+    template <typename Mesh>
+    constexpr void setBounds(Mesh& mesh, float minX, float minY, float minZ, float maxX, float maxY, float maxZ)
+    {
+        mesh.boundsMin[0] = minX;
+        mesh.boundsMin[1] = minY;
+        mesh.boundsMin[2] = minZ;
+        mesh.boundsMax[0] = maxX;
+        mesh.boundsMax[1] = maxY;
+        mesh.boundsMax[2] = maxZ;
+    }
+
+    // Checks for the static_asserts below and for callers that declare their own meshes
+    template <typename Mesh>
+    constexpr bool indicesInRange(const Mesh& mesh)
+    {
+        for (int i = 0; i < Mesh::INDICES; ++i)
+        {
+            if (mesh.indices[i] >= (GLuint)Mesh::VERTICES)
+                return false;
+        }
+        return true;
+    }
+
+    template <typename Mesh>
+    constexpr bool insideBounds(const Mesh& mesh)
+    {
+        for (int v = 0; v < Mesh::VERTICES; ++v)
+        {
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                const GLfloat p = mesh.vertices[v * Mesh::FLOATS_PER_VERTEX + axis];
+                if (p < mesh.boundsMin[axis] || p > mesh.boundsMax[axis])
+                    return false;
+            }
+        }
+        return true;
+    }
+}
+
+// Box of the given half extents centered on the origin, one color per face in Box_Face order
+template <Vertex_Format Format>
+constexpr PrimitiveBoxMesh<Format> PrimitiveBox(float halfX, float halfY, float halfZ, const PrimitiveColor (&faceColors)[NUM_BOX_FACES])
+{
+    using namespace primitives_detail;
+
+    PrimitiveBoxMesh<Format> mesh{};
+    const float half[3] = { halfX, halfY, halfZ };
+    for (int face = 0; face < NUM_BOX_FACES; ++face)
+    {
+        for (int corner = 0; corner < 4; ++corner)
+        {
+            const signed char* c = BOX_CORNERS[face][corner];
+            writeVertex<Format>(&mesh.vertices[(face * 4 + corner) * PrimitiveBoxMesh<Format>::FLOATS_PER_VERTEX],
+                c[0] * half[0], c[1] * half[1], c[2] * half[2], faceColors[face],
+                BOX_NORMALS[face][0], BOX_NORMALS[face][1], BOX_NORMALS[face][2]);
+        }
+        writeQuadIndices(mesh, face * 6, face * 4);
+    }
+    setBounds(mesh, -halfX, -halfY, -halfZ, halfX, halfY, halfZ);
+    return mesh;
+}
+
+// Horizontal quad at height y facing up
+template <Vertex_Format Format>
+constexpr PrimitivePlaneMesh<Format> PrimitivePlane(float halfWidth, float halfDepth, float y, const PrimitiveColor& color)
+{
+    using namespace primitives_detail;
+
+    PrimitivePlaneMesh<Format> mesh{};
+    const float corners[4][2] = { { -halfWidth, -halfDepth }, { halfWidth, -halfDepth }, { halfWidth, halfDepth }, { -halfWidth, halfDepth } };
+    for (int corner = 0; corner < 4; ++corner)
+        writeVertex<Format>(&mesh.vertices[corner * PrimitivePlaneMesh<Format>::FLOATS_PER_VERTEX],
+            corners[corner][0], y, corners[corner][1], color, 0.0f, 1.0f, 0.0f);
+    writeQuadIndices(mesh, 0, 0);
+    setBounds(mesh, -halfWidth, y, -halfDepth, halfWidth, y, halfDepth);
+    return mesh;
+}
+
+// Four-sided pyramid of the given base half extents and height, centered on the origin with its apex up;
+// one color per face in Pyramid_Face order. Every triangle faces out.
+template <Vertex_Format Format>
+constexpr PrimitivePyramidMesh<Format> PrimitivePyramid(float halfWidth, float height, float halfDepth,
+    const PrimitiveColor (&faceColors)[NUM_PYRAMID_FACES])
+{
+    using namespace primitives_detail;
+    typedef PrimitivePyramidMesh<Format> Mesh;
+
+    Mesh mesh{};
+    const float top = height * 0.5f;
+    for (int side = 0; side < NUM_PYRAMID_FACES - 1; ++side)
+    {
+        const float ax = PYRAMID_EDGES[side][0][0] * halfWidth, az = PYRAMID_EDGES[side][0][1] * halfDepth;
+        const float bx = PYRAMID_EDGES[side][1][0] * halfWidth, bz = PYRAMID_EDGES[side][1][1] * halfDepth;
+
+        // a, apex, b is counter-clockwise seen from outside, so this normal points out
+        const float ux = -ax, uy = height, uz = -az;
+        const float vx = bx - ax, vz = bz - az;
+        const float nx = uy * vz, ny = uz * vx - ux * vz, nz = -uy * vx;
+        const float length = squareRoot(nx * nx + ny * ny + nz * nz);
+
+        const float positions[3][3] = { { ax, -top, az }, { 0.0f, top, 0.0f }, { bx, -top, bz } };
+        for (int corner = 0; corner < 3; ++corner)
+        {
+            writeVertex<Format>(&mesh.vertices[(side * 3 + corner) * Mesh::FLOATS_PER_VERTEX],
+                positions[corner][0], positions[corner][1], positions[corner][2], faceColors[side],
+                nx / length, ny / length, nz / length);
+            mesh.indices[side * 3 + corner] = side * 3 + corner;
+        }
+    }
+
+    // base, wound to face down
+    const int first = 3 * (NUM_PYRAMID_FACES - 1);
+    const float base[4][2] = { { -halfWidth, -halfDepth }, { halfWidth, -halfDepth }, { halfWidth, halfDepth }, { -halfWidth, halfDepth } };
+    for (int corner = 0; corner < 4; ++corner)
+        writeVertex<Format>(&mesh.vertices[(first + corner) * Mesh::FLOATS_PER_VERTEX],
+            base[corner][0], -top, base[corner][1], faceColors[PYRAMID_BASE], 0.0f, -1.0f, 0.0f);
+    writeQuadIndices(mesh, first, first);
+    setBounds(mesh, -halfWidth, -top, -halfDepth, halfWidth, top, halfDepth);
+    return mesh;
+}
+
+// Uploads a generated mesh into a new vertex array with position (0), color (1) and normal (2) attributes.
+// The labels are name followed by the kind of object, for the resource tracker.
+inline void UploadPrimitive(const PrimitiveData& primitive, const char* name, GLuint& vao, GLuint& vbo, GLuint& ebo)
+{
+    const GLint stride = sizeof(GLfloat) * FloatsPerVertex(primitive.format);
+
+    vao = GpuResources().GenVertexArray((std::string(name) + " vao").c_str());
+    glBindVertexArray(vao);
+
+    vbo = GpuResources().GenBuffer((std::string(name) + " vbo").c_str());
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    GpuResources().BufferData(GL_ARRAY_BUFFER, vbo, primitive.nVertices * stride, primitive.vertices, GL_STATIC_DRAW);
+
+    ebo = GpuResources().GenBuffer((std::string(name) + " ebo").c_str());
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    GpuResources().BufferData(GL_ELEMENT_ARRAY_BUFFER, ebo, primitive.nIndices * sizeof(GLuint), primitive.indices, GL_STATIC_DRAW);
+
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, 0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(GLfloat) * 3));
+    glEnableVertexAttribArray(1);
+    if (primitive.format == VERTEX_POSITION_COLOR_NORMAL)
+    {
+        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(GLfloat) * 7));
+        glEnableVertexAttribArray(2);
+    }
+
+    glBindVertexArray(0);
+}
+
+// Compile-time tests of the generators
+// ------------------------------------
+namespace primitives_detail
+{
+    constexpr PrimitiveColor TEST_COLORS[NUM_BOX_FACES] = {
+        { 1.0f, 0.0f, 0.0f, 1.0f }, { 0.0f, 1.0f, 0.0f, 1.0f }, { 0.0f, 0.0f, 1.0f, 1.0f },
+        { 1.0f, 1.0f, 0.0f, 1.0f }, { 0.0f, 1.0f, 1.0f, 1.0f }, { 1.0f, 0.0f, 1.0f, 0.5f }
+    };
+    constexpr PrimitiveColor TEST_PYRAMID_COLORS[NUM_PYRAMID_FACES] = {
+        TEST_COLORS[0], TEST_COLORS[1], TEST_COLORS[2], TEST_COLORS[3], TEST_COLORS[4]
+    };
+    constexpr PrimitiveBoxMesh<VERTEX_POSITION_COLOR> TEST_BOX = PrimitiveBox<VERTEX_POSITION_COLOR>(1.0f, 2.0f, 3.0f, TEST_COLORS);
+    constexpr PrimitiveBoxMesh<VERTEX_POSITION_COLOR_NORMAL> TEST_BOX_NORMALS =
+        PrimitiveBox<VERTEX_POSITION_COLOR_NORMAL>(1.0f, 2.0f, 3.0f, TEST_COLORS);
+    constexpr PrimitivePlaneMesh<VERTEX_POSITION_COLOR> TEST_PLANE = PrimitivePlane<VERTEX_POSITION_COLOR>(2.0f, 1.0f, -2.0f, TEST_COLORS[0]);
+    constexpr PrimitivePyramidMesh<VERTEX_POSITION_COLOR_NORMAL> TEST_PYRAMID =
+        PrimitivePyramid<VERTEX_POSITION_COLOR_NORMAL>(1.0f, 2.0f, 1.0f, TEST_PYRAMID_COLORS);
+}
+
+// counts and layout: tightly packed, so the arrays upload as they are
+static_assert(PrimitiveBoxMesh<VERTEX_POSITION_COLOR>::VERTICES == 24 && PrimitiveBoxMesh<VERTEX_POSITION_COLOR>::INDICES == 36,
+    "a box is 6 faces of 4 corners and 2 triangles");
+static_assert(PrimitivePlaneMesh<VERTEX_POSITION_COLOR>::VERTICES == 4 && PrimitivePlaneMesh<VERTEX_POSITION_COLOR>::INDICES == 6,
+    "a plane is one quad");
+static_assert(PrimitivePyramidMesh<VERTEX_POSITION_COLOR>::VERTICES == 16 && PrimitivePyramidMesh<VERTEX_POSITION_COLOR>::INDICES == 18,
+    "a pyramid is 4 triangles and a quad");
+static_assert(sizeof(PrimitiveBoxMesh<VERTEX_POSITION_COLOR>::vertices) == 24 * 7 * sizeof(GLfloat),
+    "position and color vertices are 7 floats");
+static_assert(sizeof(PrimitiveBoxMesh<VERTEX_POSITION_COLOR_NORMAL>::vertices) == 24 * 10 * sizeof(GLfloat),
+    "vertices with normals are 10 floats");
+static_assert(sizeof(PrimitiveBoxMesh<VERTEX_POSITION_COLOR>) ==
+    (24 * 7 + 6) * sizeof(GLfloat) + 36 * sizeof(GLuint), "no padding between the arrays");
+
+// contents
+static_assert(primitives_detail::indicesInRange(primitives_detail::TEST_BOX) && primitives_detail::insideBounds(primitives_detail::TEST_BOX),
+    "box indices and bounds");
+static_assert(primitives_detail::indicesInRange(primitives_detail::TEST_PLANE) && primitives_detail::insideBounds(primitives_detail::TEST_PLANE),
+    "plane indices and bounds");
+static_assert(primitives_detail::indicesInRange(primitives_detail::TEST_PYRAMID) && primitives_detail::insideBounds(primitives_detail::TEST_PYRAMID),
+    "pyramid indices and bounds");
+static_assert(primitives_detail::TEST_BOX.vertices[0] == -1.0f && primitives_detail::TEST_BOX.vertices[1] == -2.0f
+    && primitives_detail::TEST_BOX.vertices[2] == -3.0f, "first corner of the back face");
+static_assert(primitives_detail::TEST_BOX.vertices[BOX_TOP * 4 * 7 + 6] == 0.5f, "each face takes its own color");
+static_assert(primitives_detail::TEST_BOX_NORMALS.vertices[BOX_LEFT * 4 * 10 + 7] == -1.0f, "normals follow the color");
+static_assert(primitives_detail::TEST_PLANE.vertices[1] == -2.0f && primitives_detail::TEST_PLANE.boundsMax[1] == -2.0f,
+    "the plane lies at its height");
+static_assert(primitives_detail::TEST_PYRAMID.vertices[1 * 10 + 1] == 1.0f, "the apex is at half the height");
+static_assert(primitives_detail::TEST_PYRAMID.vertices[PYRAMID_BACK * 3 * 10 + 9] < 0.0f
+    && primitives_detail::TEST_PYRAMID.vertices[PYRAMID_RIGHT * 3 * 10 + 7] > 0.0f, "pyramid sides face out");
+#endif
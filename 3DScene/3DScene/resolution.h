@@ -0,0 +1,297 @@
+#ifndef RESOLUTION_H
+#define RESOLUTION_H
+
+#include <GL/glew.h>
+
+#include <cmath>
+#include <iostream>
+
+#include "resources.h" // GPU resource tracking
+
+// Range of the render scale, as a fraction of the window size on each axis
+const float DYNRES_MIN_SCALE = 0.5f;
+const float DYNRES_MAX_SCALE = 1.0f;
+// Scale changes are rounded to this step so the target and the depth pyramid do not change every frame
+const float DYNRES_SCALE_STEP = 1.0f / 32.0f;
+// GPU time a frame may take, 60 Hz minus room for the compositor
+const float DYNRES_DEFAULT_BUDGET_MS = 14.0f;
+// Frames of timestamp queries in flight so reading a result never stalls
+const int DYNRES_TIMER_FRAMES = 4;
+
+// How the scaled image is stretched to the window
+enum Upscale_Filter {
+    UPSCALE_BILINEAR,
+    UPSCALE_SHARPEN
+};
+
+// Off-screen scene target whose resolution follows the GPU frame time.
+// The color and depth textures are allocated at window size and the scene is rendered
+// into their lower left corner, so a scale change only moves the viewport.
+// GPU time is measured with timestamps around the whole frame, which keeps it clear of
+// the GL_TIME_ELAPSED queries the passes inside the frame use for their own timings.
+class DynamicResolution
+{
+public:
+    // current scale and the size the scene is rendered at
+    float Scale;
+    int RenderWidth;
+    int RenderHeight;
+    // smoothed GPU time of a whole frame in milliseconds, and the time of every timed frame added up
+    float GpuMs;
+    double GpuMsTotal;
+    // number of times the scale moved
+    unsigned int Changes;
+
+    DynamicResolution() : Scale(DYNRES_MAX_SCALE), RenderWidth(0), RenderHeight(0), GpuMs(0.0f), GpuMsTotal(0.0), Changes(0),
+        budgetMs(DYNRES_DEFAULT_BUDGET_MS), filter(UPSCALE_SHARPEN), program(0), framebuffer(0), colorTexture(0), depthTexture(0),
+        emptyVao(0), windowWidth(0), windowHeight(0), head(0), tail(0), inFlight(0), samples(0)
+    {
+        for (int i = 0; i < DYNRES_TIMER_FRAMES * 2; ++i)
+            queries[i] = 0;
+        for (int i = 0; i < DYNRES_TIMER_FRAMES; ++i)
+            frameScale[i] = DYNRES_MAX_SCALE;
+    }
+
+    // upscale is the full screen program; it expects "scene", "uvScale", "texelSize" and "sharpness"
+    void Create(GLuint upscale, int width, int height)
+    {
+        program = upscale;
+        framebuffer = GpuResources().GenFramebuffer("scene framebuffer");
+        emptyVao = GpuResources().GenVertexArray("full screen triangle");
+        GpuResources().GenQueries(DYNRES_TIMER_FRAMES * 2, queries, "frame timestamps");
+        Resize(width, height);
+    }
+
+    void Destroy()
+    {
+        if (colorTexture)
+            GpuResources().DeleteTexture(colorTexture);
+        if (depthTexture)
+            GpuResources().DeleteTexture(depthTexture);
+        if (framebuffer)
+            GpuResources().DeleteFramebuffer(framebuffer);
+        if (emptyVao)
+            GpuResources().DeleteVertexArray(emptyVao);
+        GpuResources().DeleteQueries(DYNRES_TIMER_FRAMES * 2, queries);
+    }
+
+    // budget in milliseconds of GPU time per frame, 0 pins the scale at full resolution
+    void SetBudget(float milliseconds)
+    {
+        budgetMs = milliseconds;
+        if (budgetMs <= 0.0f)
+            setScale(DYNRES_MAX_SCALE);
+    }
+
+    void SetFilter(Upscale_Filter upscaleFilter)
+    {
+        filter = upscaleFilter;
+    }
+
+    float Budget() const { return budgetMs; }
+
+    // reallocates the target for a new window size; a minimized window keeps the old one
+    void Resize(int width, int height)
+    {
+        if (!framebuffer || width <= 0 || height <= 0 || (width == windowWidth && height == windowHeight))
+            return;
+
+        windowWidth = width;
+        windowHeight = height;
+
+        if (colorTexture)
+            GpuResources().DeleteTexture(colorTexture);
+        if (depthTexture)
+            GpuResources().DeleteTexture(depthTexture);
+
+        colorTexture = GpuResources().GenTexture("scene color");
+        glBindTexture(GL_TEXTURE_2D, colorTexture);
+        GpuResources().TexStorage2D(GL_TEXTURE_2D, colorTexture, 1, GL_RGBA8, width, height);
+        setSampling(GL_LINEAR);
+
+        // depth stays sampleable for the depth pyramid
+        depthTexture = GpuResources().GenTexture("scene depth");
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        GpuResources().TexStorage2D(GL_TEXTURE_2D, depthTexture, 1, GL_DEPTH_COMPONENT32F, width, height);
+        setSampling(GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR: scene framebuffer is incomplete" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        updateRenderSize();
+    }
+
+    // width over height of the window, which the projection must use whatever the render scale
+    float Aspect() const
+    {
+        return windowHeight > 0 ? (float)windowWidth / (float)windowHeight : 1.0f;
+    }
+
+    // starts timing the frame and picks this frame's scale from the finished measurements
+    void BeginFrame()
+    {
+        collect();
+        if (inFlight < DYNRES_TIMER_FRAMES)
+        {
+            glQueryCounter(queries[head * 2], GL_TIMESTAMP);
+            frameScale[head] = Scale;
+        }
+    }
+
+    // binds the scaled target for the scene passes
+    void BeginScene()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(0, 0, RenderWidth, RenderHeight);
+        ++RenderCounters().StateChanges;
+    }
+
+    // stretches the scene over the window and ends the frame's timing
+    void Present()
+    {
+        blit();
+
+        if (inFlight < DYNRES_TIMER_FRAMES)
+        {
+            glQueryCounter(queries[head * 2 + 1], GL_TIMESTAMP);
+            head = (head + 1) % DYNRES_TIMER_FRAMES;
+            ++inFlight;
+        }
+    }
+
+    // stretches the last frame's scene over the window again, untimed, for a window that lost its contents
+    void PresentAgain()
+    {
+        blit();
+    }
+
+    GLuint GetColorTexture() const
+    {
+        return colorTexture;
+    }
+
+    GLuint GetDepthTexture() const
+    {
+        return depthTexture;
+    }
+
+private:
+    float budgetMs;
+    Upscale_Filter filter;
+    GLuint program;
+    GLuint framebuffer;
+    GLuint colorTexture;
+    GLuint depthTexture;
+    GLuint emptyVao;
+    int windowWidth;
+    int windowHeight;
+    GLuint queries[DYNRES_TIMER_FRAMES * 2]; // start and end timestamp of each frame
+    float frameScale[DYNRES_TIMER_FRAMES];   // scale each timed frame was rendered at
+    int head;
+    int tail;
+    int inFlight;
+    unsigned int samples;
+
+    void blit()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, windowWidth, windowHeight);
+        glDisable(GL_DEPTH_TEST);
+
+        glUseProgram(program);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, colorTexture);
+        glUniform1i(glGetUniformLocation(program, "scene"), 0);
+        glUniform2f(glGetUniformLocation(program, "uvScale"), (float)RenderWidth / windowWidth, (float)RenderHeight / windowHeight);
+        glUniform2f(glGetUniformLocation(program, "texelSize"), 1.0f / windowWidth, 1.0f / windowHeight);
+        // sharpening only makes up for the blur of an actual upscale
+        glUniform1f(glGetUniformLocation(program, "sharpness"), filter == UPSCALE_SHARPEN && Scale < DYNRES_MAX_SCALE ? 0.5f * (1.0f - Scale) / (1.0f - DYNRES_MIN_SCALE) + 0.1f : 0.0f);
+
+        glBindVertexArray(emptyVao);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glEnable(GL_DEPTH_TEST);
+        RenderCounters().StateChanges += 4;
+        ++RenderCounters().DrawCalls;
+    }
+
+    static void setSampling(GLint filterMode)
+    {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filterMode);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filterMode);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    // reads every finished frame and steers the scale toward the budget
+    void collect()
+    {
+        while (inFlight > 0)
+        {
+            GLint available = 0;
+            glGetQueryObjectiv(queries[tail * 2 + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                break;
+
+            GLuint64 start = 0, end = 0;
+            glGetQueryObjectui64v(queries[tail * 2], GL_QUERY_RESULT, &start);
+            glGetQueryObjectui64v(queries[tail * 2 + 1], GL_QUERY_RESULT, &end);
+            float frameMs = (float)((end - start) / 1.0e6);
+            GpuMs = samples == 0 ? frameMs : GpuMs * 0.8f + frameMs * 0.2f;
+            GpuMsTotal += frameMs;
+            ++samples;
+
+            // frames still in flight from before the last change say nothing about the current scale
+            if (budgetMs > 0.0f && frameScale[tail] == Scale)
+                control(frameMs);
+
+            tail = (tail + 1) % DYNRES_TIMER_FRAMES;
+            --inFlight;
+        }
+    }
+
+    // GPU cost grows with the pixel count, so the scale that fits the budget is scale * sqrt(budget / time).
+    // Going over the budget drops most of the way at once; spare time is taken back a step or two at
+    // a time so the scale does not oscillate, and a frame between 85% and 103% of the budget changes nothing.
+    void control(float frameMs)
+    {
+        if (frameMs <= 0.0f)
+            return;
+
+        float ideal = Scale * std::sqrt(budgetMs / frameMs);
+        float next = Scale;
+        if (frameMs > budgetMs * 1.03f)
+            next = Scale - std::fmax((Scale - ideal) * 0.75f, DYNRES_SCALE_STEP);
+        else if (frameMs < budgetMs * 0.85f && ideal > Scale + DYNRES_SCALE_STEP)
+            next = Scale + std::fmax(DYNRES_SCALE_STEP, std::fmin((ideal - Scale) * 0.25f, 2.0f * DYNRES_SCALE_STEP));
+
+        next = std::floor(next / DYNRES_SCALE_STEP + 0.5f) * DYNRES_SCALE_STEP;
+        setScale(next);
+    }
+
+    void setScale(float scale)
+    {
+        scale = std::fmax(DYNRES_MIN_SCALE, std::fmin(DYNRES_MAX_SCALE, scale));
+        if (scale == Scale)
+            return;
+
+        Scale = scale;
+        ++Changes;
+        updateRenderSize();
+    }
+
+    void updateRenderSize()
+    {
+        RenderWidth = (int)(windowWidth * Scale + 0.5f);
+        RenderHeight = (int)(windowHeight * Scale + 0.5f);
+        RenderWidth = RenderWidth > 0 ? RenderWidth : 1;
+        RenderHeight = RenderHeight > 0 ? RenderHeight : 1;
+    }
+};
+#endif
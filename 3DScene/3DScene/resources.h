@@ -0,0 +1,411 @@
+#ifndef RESOURCES_H
+#define RESOURCES_H
+
+#include <GL/glew.h>
+
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+// Kinds of GL objects the tracker knows about
+enum Resource_Type {
+    RESOURCE_BUFFER,
+    RESOURCE_VERTEX_ARRAY,
+    RESOURCE_TEXTURE,
+    RESOURCE_FRAMEBUFFER,
+    RESOURCE_SHADER,
+    RESOURCE_PROGRAM,
+    RESOURCE_QUERY,
+    NUM_RESOURCE_TYPES
+};
+
+// Default GPU memory budget in megabytes, 0 disables the limit
+const size_t RESOURCE_DEFAULT_BUDGET_MB = 512;
+
+inline const char* ResourceTypeName(Resource_Type type)
+{
+    static const char* const names[NUM_RESOURCE_TYPES] = {
+        "buffer", "vertex array", "texture", "framebuffer", "shader", "program", "query"
+    };
+    return names[type];
+}
+
+// Bytes per texel of the sized internal formats used by the scene
+inline size_t TextureFormatBytes(GLenum internalFormat)
+{
+    switch (internalFormat)
+    {
+    case GL_R8: return 1;
+    case GL_RG8: case GL_R16F: case GL_DEPTH_COMPONENT16: return 2;
+    case GL_RGB8: case GL_DEPTH_COMPONENT24: return 3;
+    case GL_RGBA8: case GL_SRGB8_ALPHA8: case GL_R32F: case GL_RG16F: case GL_R11F_G11F_B10F:
+    case GL_DEPTH_COMPONENT32F: case GL_DEPTH24_STENCIL8: return 4;
+    case GL_RGBA16F: case GL_RG32F: return 8;
+    case GL_RGBA32F: return 16;
+    default: return 4;
+    }
+}
+
+// Size of one mip level; block compressed formats round up to whole 4x4 blocks
+inline size_t TextureLevelBytes(GLenum internalFormat, GLsizei width, GLsizei height)
+{
+    switch (internalFormat)
+    {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+        return (size_t)((width + 3) / 4) * ((height + 3) / 4) * 8;
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: case GL_COMPRESSED_RGBA_BPTC_UNORM: case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+        return (size_t)((width + 3) / 4) * ((height + 3) / 4) * 16;
+    default:
+        return (size_t)width * height * TextureFormatBytes(internalFormat);
+    }
+}
+
+// Work the renderer hands to GL, counted where it is issued and cleared at the top of every frame.
+// State changes are the binds a driver validates again at the next draw: programs, vertex arrays
+// and render targets; buffer and texture binds are left out.
+struct FrameCounters
+{
+    unsigned int DrawCalls;     // an indirect multi-draw is one call, however many draws it makes
+    unsigned int Dispatches;
+    unsigned int StateChanges;
+    size_t UploadedBytes;       // written by the CPU into buffers and textures
+
+    FrameCounters() : DrawCalls(0), Dispatches(0), StateChanges(0), UploadedBytes(0)
+    {
+    }
+};
+
+// Counters of the frame being rendered, shared by every module like the tracker below
+inline FrameCounters& RenderCounters()
+{
+    static FrameCounters counters;
+    return counters;
+}
+
+// Registry of every live GL object with its approximate GPU memory.
+// Creation and deletion go through the wrappers below so the tracker can enforce
+// a memory budget, ask registered owners to evict cached data, and report leaks.
+class ResourceTracker
+{
+public:
+    // asked to free at least bytesOver bytes; returns the bytes actually released
+    typedef std::function<size_t(size_t bytesOver)> EvictionCallback;
+
+    ResourceTracker() : budget(RESOURCE_DEFAULT_BUDGET_MB << 20), totalBytes(0), peakBytes(0), evictions(0), evicting(false), overBudget(false)
+    {
+        for (int i = 0; i < NUM_RESOURCE_TYPES; ++i)
+        {
+            counts[i] = 0;
+            bytes[i] = 0;
+        }
+    }
+
+    // budget in bytes, 0 means unlimited; shrinking it evicts right away
+    void SetBudget(size_t budgetBytes)
+    {
+        budget = budgetBytes;
+        enforceBudget();
+    }
+
+    // callbacks run in registration order until usage is back under the budget
+    int AddEvictionCallback(const EvictionCallback& callback)
+    {
+        callbacks.push_back(callback);
+        return (int)callbacks.size() - 1;
+    }
+
+    void RemoveEvictionCallback(int handle)
+    {
+        if (handle >= 0 && handle < (int)callbacks.size())
+            callbacks[handle] = EvictionCallback();
+    }
+
+    // Object creation and deletion
+    // ----------------------------
+    GLuint GenBuffer(const char* label)
+    {
+        GLuint id = 0;
+        glGenBuffers(1, &id);
+        add(RESOURCE_BUFFER, id, label);
+        return id;
+    }
+
+    // uploads to the buffer bound at target and records its new size
+    void BufferData(GLenum target, GLuint buffer, GLsizeiptr size, const void* data, GLenum usage)
+    {
+        glBufferData(target, size, data, usage);
+        SetBytes(RESOURCE_BUFFER, buffer, (size_t)size);
+        if (data)
+            RenderCounters().UploadedBytes += (size_t)size;
+    }
+
+    void BufferStorage(GLenum target, GLuint buffer, GLsizeiptr size, const void* data, GLbitfield flags)
+    {
+        glBufferStorage(target, size, data, flags);
+        SetBytes(RESOURCE_BUFFER, buffer, (size_t)size);
+        if (data)
+            RenderCounters().UploadedBytes += (size_t)size;
+    }
+
+    void DeleteBuffer(GLuint& buffer)
+    {
+        remove(RESOURCE_BUFFER, buffer);
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+    }
+
+    GLuint GenVertexArray(const char* label)
+    {
+        GLuint id = 0;
+        glGenVertexArrays(1, &id);
+        add(RESOURCE_VERTEX_ARRAY, id, label);
+        return id;
+    }
+
+    void DeleteVertexArray(GLuint& vao)
+    {
+        remove(RESOURCE_VERTEX_ARRAY, vao);
+        glDeleteVertexArrays(1, &vao);
+        vao = 0;
+    }
+
+    GLuint GenTexture(const char* label)
+    {
+        GLuint id = 0;
+        glGenTextures(1, &id);
+        add(RESOURCE_TEXTURE, id, label);
+        return id;
+    }
+
+    // allocates storage for the texture bound at target, including every mip level
+    void TexStorage2D(GLenum target, GLuint texture, GLsizei levels, GLenum internalFormat, GLsizei width, GLsizei height)
+    {
+        glTexStorage2D(target, levels, internalFormat, width, height);
+        SetBytes(RESOURCE_TEXTURE, texture, mipChainBytes(levels, internalFormat, width, height, 1));
+    }
+
+    void TexStorage3D(GLenum target, GLuint texture, GLsizei levels, GLenum internalFormat, GLsizei width, GLsizei height, GLsizei depth)
+    {
+        glTexStorage3D(target, levels, internalFormat, width, height, depth);
+        SetBytes(RESOURCE_TEXTURE, texture, mipChainBytes(levels, internalFormat, width, height, depth));
+    }
+
+    void DeleteTexture(GLuint& texture)
+    {
+        remove(RESOURCE_TEXTURE, texture);
+        glDeleteTextures(1, &texture);
+        texture = 0;
+    }
+
+    GLuint GenFramebuffer(const char* label)
+    {
+        GLuint id = 0;
+        glGenFramebuffers(1, &id);
+        add(RESOURCE_FRAMEBUFFER, id, label);
+        return id;
+    }
+
+    void DeleteFramebuffer(GLuint& framebuffer)
+    {
+        remove(RESOURCE_FRAMEBUFFER, framebuffer);
+        glDeleteFramebuffers(1, &framebuffer);
+        framebuffer = 0;
+    }
+
+    GLuint CreateShader(GLenum type, const char* label)
+    {
+        GLuint id = glCreateShader(type);
+        add(RESOURCE_SHADER, id, label);
+        return id;
+    }
+
+    void DeleteShader(GLuint& shader)
+    {
+        remove(RESOURCE_SHADER, shader);
+        glDeleteShader(shader);
+        shader = 0;
+    }
+
+    GLuint CreateProgram(const char* label)
+    {
+        GLuint id = glCreateProgram();
+        add(RESOURCE_PROGRAM, id, label);
+        return id;
+    }
+
+    void DeleteProgram(GLuint& program)
+    {
+        remove(RESOURCE_PROGRAM, program);
+        glDeleteProgram(program);
+        program = 0;
+    }
+
+    void GenQueries(GLsizei n, GLuint* ids, const char* label)
+    {
+        glGenQueries(n, ids);
+        for (GLsizei i = 0; i < n; ++i)
+            add(RESOURCE_QUERY, ids[i], label);
+    }
+
+    void DeleteQueries(GLsizei n, GLuint* ids)
+    {
+        for (GLsizei i = 0; i < n; ++i)
+            remove(RESOURCE_QUERY, ids[i]);
+        glDeleteQueries(n, ids);
+        for (GLsizei i = 0; i < n; ++i)
+            ids[i] = 0;
+    }
+
+    // records the memory held by an object allocated outside the wrappers above
+    void SetBytes(Resource_Type type, GLuint id, size_t size)
+    {
+        std::map<GLuint, Entry>::iterator it = objects[type].find(id);
+        if (it == objects[type].end())
+            return;
+
+        bytes[type] += size - it->second.bytes;
+        totalBytes += size - it->second.bytes;
+        it->second.bytes = size;
+
+        if (totalBytes > peakBytes)
+            peakBytes = totalBytes;
+        enforceBudget();
+    }
+
+    // Live counters
+    // -------------
+    size_t Count(Resource_Type type) const { return counts[type]; }
+    size_t Bytes(Resource_Type type) const { return bytes[type]; }
+    size_t TotalBytes() const { return totalBytes; }
+    size_t PeakBytes() const { return peakBytes; }
+    size_t Budget() const { return budget; }
+    // number of times the callbacks were asked to free memory
+    size_t Evictions() const { return evictions; }
+
+    // one line summary of live objects and memory
+    void Report(std::ostream& out) const
+    {
+        out << "INFO: GPU resources: " << totalBytes / 1024 << " KB";
+        if (budget > 0)
+            out << " of " << budget / 1024 << " KB budget";
+        out << " (peak " << peakBytes / 1024 << " KB, " << evictions << " evictions)";
+        for (int i = 0; i < NUM_RESOURCE_TYPES; ++i)
+        {
+            if (counts[i] > 0)
+                out << ", " << counts[i] << " " << ResourceTypeName((Resource_Type)i) << (counts[i] > 1 ? "s" : "");
+        }
+        out << std::endl;
+    }
+
+    // lists every object still alive, call after all owners released theirs; returns the leak count
+    size_t ReportLeaks(std::ostream& out) const
+    {
+        size_t leaks = 0;
+        for (int i = 0; i < NUM_RESOURCE_TYPES; ++i)
+        {
+            for (std::map<GLuint, Entry>::const_iterator it = objects[i].begin(); it != objects[i].end(); ++it)
+            {
+                out << "WARNING: leaked " << ResourceTypeName((Resource_Type)i) << " " << it->first
+                    << " '" << it->second.label << "' (" << it->second.bytes << " bytes)" << std::endl;
+                ++leaks;
+            }
+        }
+
+        if (leaks == 0)
+            out << "INFO: GPU resources: no leaks, peak usage " << peakBytes / 1024 << " KB" << std::endl;
+        return leaks;
+    }
+
+private:
+    struct Entry
+    {
+        std::string label;
+        size_t bytes;
+    };
+
+    std::map<GLuint, Entry> objects[NUM_RESOURCE_TYPES];
+    size_t counts[NUM_RESOURCE_TYPES];
+    size_t bytes[NUM_RESOURCE_TYPES];
+    std::vector<EvictionCallback> callbacks;
+    size_t budget;
+    size_t totalBytes;
+    size_t peakBytes;
+    size_t evictions;
+    bool evicting;
+    bool overBudget;
+
+    void add(Resource_Type type, GLuint id, const char* label)
+    {
+        Entry entry;
+        entry.label = label ? label : "";
+        entry.bytes = 0;
+        objects[type][id] = entry;
+        counts[type] = objects[type].size();
+    }
+
+    void remove(Resource_Type type, GLuint id)
+    {
+        std::map<GLuint, Entry>::iterator it = objects[type].find(id);
+        if (it == objects[type].end())
+        {
+            if (id != 0)
+                std::cout << "WARNING: deleting untracked " << ResourceTypeName(type) << " " << id << std::endl;
+            return;
+        }
+
+        bytes[type] -= it->second.bytes;
+        totalBytes -= it->second.bytes;
+        objects[type].erase(it);
+        counts[type] = objects[type].size();
+    }
+
+    static size_t mipChainBytes(GLsizei levels, GLenum internalFormat, GLsizei width, GLsizei height, GLsizei depth)
+    {
+        size_t total = 0;
+        for (GLsizei level = 0; level < levels; ++level)
+        {
+            total += TextureLevelBytes(internalFormat, width, height) * depth;
+            width = width > 1 ? width / 2 : 1;
+            height = height > 1 ? height / 2 : 1;
+        }
+        return total;
+    }
+
+    // runs the eviction callbacks once usage passes the budget; callbacks may delete through the tracker
+    void enforceBudget()
+    {
+        if (budget == 0 || totalBytes <= budget || evicting)
+        {
+            if (totalBytes <= budget)
+                overBudget = false;
+            return;
+        }
+
+        evicting = true;
+        ++evictions;
+        for (size_t i = 0; i < callbacks.size() && totalBytes > budget; ++i)
+        {
+            if (callbacks[i])
+                callbacks[i](totalBytes - budget);
+        }
+        evicting = false;
+
+        // warn once per overflow when nothing else could be freed
+        if (totalBytes > budget && !overBudget)
+        {
+            std::cout << "WARNING: GPU memory " << totalBytes / 1024 << " KB is over the " << budget / 1024 << " KB budget" << std::endl;
+            overBudget = true;
+        }
+    }
+};
+
+// Tracker shared by every module of the renderer
+inline ResourceTracker& GpuResources()
+{
+    static ResourceTracker tracker;
+    return tracker;
+}
+#endif
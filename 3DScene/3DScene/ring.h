@@ -0,0 +1,183 @@
+#ifndef RING_H
+#define RING_H
+
+#include <GL/glew.h>
+
+#include <vector>
+
+#include "resources.h"
+
+// Frames the CPU may run ahead of the GPU; each gets its own region of the ring
+const int RING_FRAMES = 3;
+
+// Vertex attribute that carries the object index of a draw (base instance + instance id)
+const GLuint OBJECT_INDEX_ATTRIBUTE = 3;
+// Largest object index the identity buffer covers
+const GLuint MAX_RING_OBJECTS = 4096;
+
+// Part of the ring handed out for one frame's data
+struct RingSlice
+{
+    void* data;         // persistently mapped write pointer, NULL when the frame region is full
+    GLintptr offset;    // byte offset from the start of the buffer, for glBindBufferRange
+    GLsizeiptr size;
+};
+
+// Persistently mapped upload buffer split into one region per frame in flight.
+// Each region is guarded by a fence; slices are bump allocated from the current region
+// and written directly by the CPU, so per-object data costs no GL calls.
+class UploadRing
+{
+public:
+    // number of frames that had to wait for the GPU to release their region
+    unsigned int Stalls;
+    // allocations that did not fit in their frame region
+    unsigned int Overflows;
+    // bytes handed out in the last finished frame
+    GLsizeiptr LastFrameBytes;
+
+    UploadRing() : Stalls(0), Overflows(0), LastFrameBytes(0), buffer(0), mapped(NULL), regionSize(0), minAlignment(256), frame(0), head(0)
+    {
+        for (int i = 0; i < RING_FRAMES; ++i)
+            fences[i] = 0;
+    }
+
+    // regionBytes is the most one frame can allocate
+    void Create(GLsizeiptr regionBytes)
+    {
+        GLint alignment = 256;
+        glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        minAlignment = alignment > 0 ? alignment : 256;
+
+        regionSize = align(regionBytes, minAlignment);
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+        buffer = GpuResources().GenBuffer("upload ring");
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+        GpuResources().BufferStorage(GL_SHADER_STORAGE_BUFFER, buffer, regionSize * RING_FRAMES, NULL, flags);
+        mapped = (char*)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, regionSize * RING_FRAMES, flags);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    void Destroy()
+    {
+        for (int i = 0; i < RING_FRAMES; ++i)
+        {
+            if (fences[i])
+                glDeleteSync(fences[i]);
+            fences[i] = 0;
+        }
+
+        if (buffer)
+        {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+            glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+            GpuResources().DeleteBuffer(buffer);
+        }
+        mapped = NULL;
+    }
+
+    // waits until the GPU is done with this frame's region and rewinds the allocator
+    void BeginFrame()
+    {
+        GLsync fence = fences[frame];
+        if (fence)
+        {
+            GLenum result = glClientWaitSync(fence, 0, 0);
+            if (result == GL_TIMEOUT_EXPIRED)
+            {
+                ++Stalls;
+                do
+                {
+                    result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+                } while (result == GL_TIMEOUT_EXPIRED);
+            }
+            glDeleteSync(fence);
+            fences[frame] = 0;
+        }
+        head = 0;
+    }
+
+    // bump allocates size bytes; alignment 0 uses the storage buffer offset alignment
+    RingSlice Allocate(GLsizeiptr size, GLsizeiptr alignment = 0)
+    {
+        RingSlice slice;
+        GLsizeiptr start = align(head, alignment > 0 ? alignment : minAlignment);
+        if (!mapped || start + size > regionSize)
+        {
+            ++Overflows;
+            slice.data = NULL;
+            slice.offset = 0;
+            slice.size = 0;
+            return slice;
+        }
+
+        slice.offset = regionSize * frame + start;
+        slice.data = mapped + slice.offset;
+        slice.size = size;
+        head = start + size;
+        RenderCounters().UploadedBytes += (size_t)size;
+        return slice;
+    }
+
+    // binds a slice to an indexed buffer target such as a shader storage binding
+    void BindRange(GLenum target, GLuint index, const RingSlice& slice) const
+    {
+        glBindBufferRange(target, index, buffer, slice.offset, slice.size);
+    }
+
+    // fences this frame's region after its last draw and moves to the next one
+    void EndFrame()
+    {
+        fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        LastFrameBytes = head;
+        frame = (frame + 1) % RING_FRAMES;
+    }
+
+    GLuint GetBuffer() const
+    {
+        return buffer;
+    }
+
+private:
+    GLuint buffer;
+    char* mapped;
+    GLsizeiptr regionSize;
+    GLsizeiptr minAlignment;
+    GLsync fences[RING_FRAMES];
+    int frame;
+    GLsizeiptr head;
+
+    static GLsizeiptr align(GLsizeiptr value, GLsizeiptr alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+};
+
+// Buffer holding 0, 1, 2, ... so an instanced attribute reads back the draw's base instance
+inline GLuint CreateObjectIndexBuffer()
+{
+    std::vector<GLuint> indices(MAX_RING_OBJECTS);
+    for (GLuint i = 0; i < MAX_RING_OBJECTS; ++i)
+        indices[i] = i;
+
+    GLuint buffer = GpuResources().GenBuffer("object index");
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    GpuResources().BufferData(GL_ARRAY_BUFFER, buffer, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return buffer;
+}
+
+// Adds the object index attribute to a vertex array; draws then pass the object index as base instance
+inline void BindObjectIndexAttribute(GLuint vao, GLuint indexBuffer)
+{
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, indexBuffer);
+    glVertexAttribIPointer(OBJECT_INDEX_ATTRIBUTE, 1, GL_UNSIGNED_INT, sizeof(GLuint), 0);
+    glVertexAttribDivisor(OBJECT_INDEX_ATTRIBUTE, 1);
+    glEnableVertexAttribArray(OBJECT_INDEX_ATTRIBUTE);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+#endif
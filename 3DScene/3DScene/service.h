@@ -0,0 +1,609 @@
+#ifndef SERVICE_H
+#define SERVICE_H
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// The service listens on a Unix domain socket and hands images back through POSIX shared memory,
+// so it is only built where both exist; elsewhere Open reports that and fails
+#if defined(__unix__) || defined(__APPLE__)
+#define SERVICE_SUPPORTED 1
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#else
+#define SERVICE_SUPPORTED 0
+#endif
+
+#include "resources.h" // GPU resource tracking
+
+// Message header and version every request must carry
+const uint32_t SERVICE_MAGIC = 0x33445352;
+const uint32_t SERVICE_VERSION = 1;
+// Clients connected at once; more are turned away
+const int SERVICE_MAX_CLIENTS = 64;
+// Requests drawn in one batch, and how long the first one waits for others to join it
+const int SERVICE_MAX_BATCH = 16;
+const float SERVICE_BATCH_WINDOW_MS = 2.0f;
+// Largest image a request may ask for on either axis
+const uint32_t SERVICE_MAX_SIZE = 4096;
+// How long an idle wait blocks before returning, so a stop signal is noticed
+const int SERVICE_IDLE_WAIT_MS = 100;
+// Latency samples kept between two reports
+const int SERVICE_LATENCY_SAMPLES = 8192;
+const float SERVICE_REPORT_SECONDS = 2.0f;
+
+// Pixel layout of a returned image; rows run from the top, with no padding
+enum Service_Format {
+    SERVICE_FORMAT_RGBA8,
+    SERVICE_FORMAT_RGB8,
+    NUM_SERVICE_FORMATS
+};
+
+// Reply status, 0 when the image was written
+enum Service_Status {
+    SERVICE_OK = 0,
+    SERVICE_BAD_REQUEST = -1,   // wrong magic or version, or a size or format out of range
+    SERVICE_BAD_MEMORY = -2,    // the shared memory object is missing or smaller than the image
+    SERVICE_FAILED = -3         // the frame could not be read back
+};
+
+// Fixed size messages in native byte order, the client runs on the same machine.
+// The client creates the shared memory object (shm_open and ftruncate to at least
+// width * height * bytes per pixel), sends the request and reads the image after the reply.
+struct ServiceRequest
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t id;            // echoed in the reply
+    float position[3];      // camera pose, angles in degrees like the Camera
+    float yaw;
+    float pitch;
+    float fov;              // vertical field of view
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;        // Service_Format
+    char memory[64];        // shared memory object name, starting with '/'
+};
+
+struct ServiceReply
+{
+    uint32_t magic;
+    uint32_t id;
+    int32_t status;         // Service_Status
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytes;         // image bytes written to the shared memory object
+    float latencyMs;        // from the request arriving to this reply
+    uint32_t batchSize;     // requests drawn together with this one
+};
+
+namespace service_detail
+{
+    typedef std::chrono::steady_clock Clock;
+
+    inline volatile std::sig_atomic_t& stopFlag()
+    {
+        static volatile std::sig_atomic_t flag = 0;
+        return flag;
+    }
+
+    inline void onStopSignal(int)
+    {
+        stopFlag() = 1;
+    }
+
+    inline uint32_t bytesPerPixel(uint32_t format)
+    {
+        return format == SERVICE_FORMAT_RGB8 ? 3 : 4;
+    }
+
+    // requests with equal pose, size and format get the same image
+    inline bool sameView(const ServiceRequest& a, const ServiceRequest& b)
+    {
+        const size_t first = offsetof(ServiceRequest, position);
+        const size_t last = offsetof(ServiceRequest, format) + sizeof(uint32_t);
+        return std::memcmp((const char*)&a + first, (const char*)&b + first, last - first) == 0;
+    }
+
+    inline float percentile(const std::vector<float>& sorted, float fraction)
+    {
+        if (sorted.empty())
+            return 0.0f;
+        size_t index = (size_t)(fraction * (float)(sorted.size() - 1) + 0.5f);
+        return sorted[std::min(index, sorted.size() - 1)];
+    }
+}
+
+// Render daemon for other local processes. Requests arriving within a short window are drawn as one
+// batch: one object upload, every distinct view drawn into one off-screen target and read back into
+// one pixel buffer, then a single fence wait before the images are copied out and the replies sent.
+// Requests asking for the same view in a batch share its image. All calls are on the GL thread.
+// The socket is only open to the user running the service: a client names any shared memory object it
+// can open and the service writes into it, so a client has to be trusted as that user.
+class RenderService
+{
+public:
+    // replies sent with an image, and requests turned away
+    unsigned long long Served;
+    unsigned long long Rejected;
+    // batches drawn and the views in them after sharing
+    unsigned long long Batches;
+    unsigned long long Views;
+
+    RenderService() : Served(0), Rejected(0), Batches(0), Views(0), listener(-1), framebuffer(0), colorTexture(0),
+        depthTexture(0), packBuffer(0), targetWidth(0), targetHeight(0), packBytes(0), batchBytes(0), reportServed(0)
+    {
+        for (int i = 0; i < SERVICE_MAX_CLIENTS; ++i)
+            clients[i].socket = -1;
+    }
+
+    // Listens on path, replacing a socket left by an earlier run but no other kind of file; SIGINT and SIGTERM stop the service
+    bool Open(const char* path)
+    {
+#if SERVICE_SUPPORTED
+        sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (std::strlen(path) >= sizeof(address.sun_path))
+        {
+            std::cerr << "ERROR: socket path is too long: " << path << std::endl;
+            return false;
+        }
+        std::strcpy(address.sun_path, path);
+
+        struct stat existing;
+        if (lstat(path, &existing) == 0)
+        {
+            if (!S_ISSOCK(existing.st_mode))
+            {
+                std::cerr << "ERROR: " << path << " exists and is not a socket, it is left alone" << std::endl;
+                return false;
+            }
+            unlink(path);
+        }
+
+        // created owner only, so no other local user can connect between bind and listen or after
+        listener = socket(AF_UNIX, SOCK_STREAM, 0);
+        const mode_t mask = umask(0077);
+        const bool bound = listener >= 0 && bind(listener, (const sockaddr*)&address, sizeof(address)) == 0;
+        umask(mask);
+        if (!bound || listen(listener, SERVICE_MAX_CLIENTS) != 0)
+        {
+            std::cerr << "ERROR: cannot listen on " << path << ": " << std::strerror(errno) << std::endl;
+            closeSocket(listener);
+            return false;
+        }
+        fcntl(listener, F_SETFL, O_NONBLOCK);
+        socketPath = path;
+
+        // a client closing early must not end the service on the reply
+        std::signal(SIGPIPE, SIG_IGN);
+        std::signal(SIGINT, service_detail::onStopSignal);
+        std::signal(SIGTERM, service_detail::onStopSignal);
+
+        framebuffer = GpuResources().GenFramebuffer("service framebuffer");
+        packBuffer = GpuResources().GenBuffer("service readback");
+        batch.reserve(SERVICE_MAX_BATCH);
+        latencies.reserve(SERVICE_LATENCY_SAMPLES);
+        sorted.reserve(SERVICE_LATENCY_SAMPLES);
+        started = reportStart = service_detail::Clock::now();
+        return true;
+#else
+        (void)path;
+        std::cerr << "ERROR: the render service needs Unix domain sockets and POSIX shared memory, which this build does not have" << std::endl;
+        return false;
+#endif
+    }
+
+    // Closes every connection and prints the totals
+    void Close(std::ostream& out)
+    {
+#if SERVICE_SUPPORTED
+        for (int i = 0; i < SERVICE_MAX_CLIENTS; ++i)
+            closeSocket(clients[i].socket);
+        if (listener >= 0)
+        {
+            closeSocket(listener);
+            unlink(socketPath.c_str());
+        }
+#endif
+        if (colorTexture)
+            GpuResources().DeleteTexture(colorTexture);
+        if (depthTexture)
+            GpuResources().DeleteTexture(depthTexture);
+        if (framebuffer)
+            GpuResources().DeleteFramebuffer(framebuffer);
+        if (packBuffer)
+            GpuResources().DeleteBuffer(packBuffer);
+
+        const float seconds = std::chrono::duration<float>(service_detail::Clock::now() - started).count();
+        out << "INFO: Render service: " << Served << " images in " << seconds << " s, " << Views << " views drawn in "
+            << Batches << " batches, " << Rejected << " requests rejected" << std::endl;
+    }
+
+    bool StopRequested() const
+    {
+        return service_detail::stopFlag() != 0;
+    }
+
+    // Accepts connections and reads requests until a batch is ready, or timeoutMs passes with none.
+    // The first request holds the batch open for SERVICE_BATCH_WINDOW_MS; returns the number of requests.
+    int WaitForBatch(int timeoutMs)
+    {
+        batch.clear();
+#if SERVICE_SUPPORTED
+        service_detail::Clock::time_point deadline = service_detail::Clock::now() + std::chrono::milliseconds(timeoutMs);
+        bool collecting = false;
+        while (!StopRequested() && (int)batch.size() < SERVICE_MAX_BATCH)
+        {
+            const float remainingMs = std::chrono::duration<float, std::milli>(deadline - service_detail::Clock::now()).count();
+            if (remainingMs <= 0.0f)
+                break;
+
+            // a client with a request in this batch is not read again until its reply is sent
+            pollfd fds[SERVICE_MAX_CLIENTS + 1];
+            int slots[SERVICE_MAX_CLIENTS + 1];
+            int nfds = 0;
+            fds[nfds].fd = listener;
+            fds[nfds].events = POLLIN;
+            slots[nfds++] = -1;
+            for (int i = 0; i < SERVICE_MAX_CLIENTS; ++i)
+            {
+                if (clients[i].socket < 0 || clients[i].queued)
+                    continue;
+                fds[nfds].fd = clients[i].socket;
+                fds[nfds].events = POLLIN;
+                slots[nfds++] = i;
+            }
+
+            if (poll(fds, nfds, (int)std::ceil(remainingMs)) <= 0)
+                continue;
+            for (int f = 0; f < nfds; ++f)
+            {
+                if (fds[f].revents == 0)
+                    continue;
+                if (slots[f] < 0)
+                    acceptClients();
+                else
+                    readRequest(slots[f]);
+            }
+
+            if (!collecting && !batch.empty())
+            {
+                collecting = true;
+                deadline = service_detail::Clock::now() + std::chrono::microseconds((long long)(SERVICE_BATCH_WINDOW_MS * 1000.0f));
+            }
+        }
+#else
+        (void)timeoutMs;
+#endif
+        if (!batch.empty())
+            prepareBatch();
+        return (int)batch.size();
+    }
+
+    const ServiceRequest& Request(int i) const
+    {
+        return clients[batch[i].client].request;
+    }
+
+    // whether request i gets the image of an earlier request in the batch and needs no view of its own
+    bool SharesView(int i) const
+    {
+        return batch[i].view != i;
+    }
+
+    // Binds the target at request i's size; the scene is drawn between this and EndView
+    void BeginView(int i)
+    {
+        const ServiceRequest& request = Request(i);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(0, 0, (GLsizei)request.width, (GLsizei)request.height);
+        ++RenderCounters().StateChanges;
+    }
+
+    // Queues the readback of request i's view into its part of the pixel buffer; nothing waits here
+    void EndView(int i)
+    {
+        const ServiceRequest& request = Request(i);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, packBuffer);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, (GLsizei)request.width, (GLsizei)request.height, request.format == SERVICE_FORMAT_RGB8 ? GL_RGB : GL_RGBA,
+            GL_UNSIGNED_BYTE, (void*)(uintptr_t)batch[i].offset);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        RenderCounters().StateChanges += 2;
+        ++Views;
+    }
+
+    // Waits once for every view of the batch, copies the images out and replies to each request
+    void FinishBatch()
+    {
+        if (batch.empty())
+            return;
+
+        GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        GLenum result;
+        do
+        {
+            result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+        } while (result == GL_TIMEOUT_EXPIRED);
+        glDeleteSync(fence);
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, packBuffer);
+        const unsigned char* pixels = result == GL_WAIT_FAILED ? NULL :
+            (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)batchBytes, GL_MAP_READ_BIT);
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            const ServiceRequest& request = clients[batch[i].client].request;
+            const int32_t status = pixels ? writeImage(request, pixels + batch[batch[i].view].offset) : SERVICE_FAILED;
+            reply(batch[i].client, status, (uint32_t)batch.size());
+        }
+        if (pixels)
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        ++Batches;
+        batch.clear();
+    }
+
+    // Prints requests per second and latency percentiles every SERVICE_REPORT_SECONDS while requests come in
+    void Report(std::ostream& out)
+    {
+        const service_detail::Clock::time_point now = service_detail::Clock::now();
+        const float seconds = std::chrono::duration<float>(now - reportStart).count();
+        if (seconds < SERVICE_REPORT_SECONDS)
+            return;
+        if (!latencies.empty())
+        {
+            sorted.assign(latencies.begin(), latencies.end());
+            std::sort(sorted.begin(), sorted.end());
+            out << "INFO: Render service: " << (float)(Served - reportServed) / seconds << " requests/s, latency p50 "
+                << service_detail::percentile(sorted, 0.5f) << " ms, p95 " << service_detail::percentile(sorted, 0.95f)
+                << " ms, p99 " << service_detail::percentile(sorted, 0.99f) << " ms, max " << sorted.back() << " ms, "
+                << (Batches > 0 ? (float)Views / (float)Batches : 0.0f) << " views per batch" << std::endl;
+        }
+        latencies.clear();
+        reportServed = Served;
+        reportStart = now;
+    }
+
+private:
+    struct Client
+    {
+        int socket;
+        ServiceRequest request;
+        size_t received;        // bytes of request read so far
+        bool queued;            // request is in the current batch
+        service_detail::Clock::time_point arrived;
+    };
+
+    struct BatchEntry
+    {
+        int client;
+        int view;               // entry whose image this request gets, itself unless shared
+        size_t offset;          // where its view lands in the pixel buffer
+    };
+
+    int listener;
+    std::string socketPath;
+    Client clients[SERVICE_MAX_CLIENTS];
+    std::vector<BatchEntry> batch;
+    GLuint framebuffer;
+    GLuint colorTexture;
+    GLuint depthTexture;
+    GLuint packBuffer;
+    int targetWidth;
+    int targetHeight;
+    size_t packBytes;
+    size_t batchBytes;
+    std::vector<float> latencies;   // milliseconds, since the last report
+    std::vector<float> sorted;
+    unsigned long long reportServed;
+    service_detail::Clock::time_point started;
+    service_detail::Clock::time_point reportStart;
+
+    // Shares repeated views, then grows the target and the pixel buffer to fit the batch; both only grow
+    void prepareBatch()
+    {
+        batchBytes = 0;
+        int width = targetWidth, height = targetHeight;
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            const ServiceRequest& request = clients[batch[i].client].request;
+            batch[i].view = (int)i;
+            for (size_t j = 0; j < i; ++j)
+            {
+                if (batch[j].view == (int)j && service_detail::sameView(clients[batch[j].client].request, request))
+                {
+                    batch[i].view = (int)j;
+                    break;
+                }
+            }
+            if (batch[i].view != (int)i)
+                continue;
+            batch[i].offset = batchBytes;
+            batchBytes += (size_t)request.width * request.height * service_detail::bytesPerPixel(request.format);
+            width = std::max(width, (int)request.width);
+            height = std::max(height, (int)request.height);
+        }
+
+        if (width != targetWidth || height != targetHeight)
+            resizeTarget(width, height);
+        if (batchBytes > packBytes)
+        {
+            packBytes = batchBytes + batchBytes / 4;
+            GpuResources().BufferData(GL_PIXEL_PACK_BUFFER, packBuffer, (GLsizeiptr)packBytes, NULL, GL_STREAM_READ);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+    }
+
+    void resizeTarget(int width, int height)
+    {
+        targetWidth = width;
+        targetHeight = height;
+        if (colorTexture)
+            GpuResources().DeleteTexture(colorTexture);
+        if (depthTexture)
+            GpuResources().DeleteTexture(depthTexture);
+
+        colorTexture = GpuResources().GenTexture("service color");
+        glBindTexture(GL_TEXTURE_2D, colorTexture);
+        GpuResources().TexStorage2D(GL_TEXTURE_2D, colorTexture, 1, GL_RGBA8, width, height);
+        depthTexture = GpuResources().GenTexture("service depth");
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        GpuResources().TexStorage2D(GL_TEXTURE_2D, depthTexture, 1, GL_DEPTH_COMPONENT32F, width, height);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR: service framebuffer is incomplete" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+#if SERVICE_SUPPORTED
+    void closeSocket(int& socket)
+    {
+        if (socket >= 0)
+            close(socket);
+        socket = -1;
+    }
+
+    void acceptClients()
+    {
+        for (;;)
+        {
+            const int connection = accept(listener, NULL, NULL);
+            if (connection < 0)
+                return;
+            int slot = 0;
+            while (slot < SERVICE_MAX_CLIENTS && clients[slot].socket >= 0)
+                ++slot;
+            if (slot == SERVICE_MAX_CLIENTS)
+            {
+                close(connection);
+                ++Rejected;
+                continue;
+            }
+            fcntl(connection, F_SETFL, O_NONBLOCK);
+            clients[slot].socket = connection;
+            clients[slot].received = 0;
+            clients[slot].queued = false;
+        }
+    }
+
+    // Reads what has arrived of a client's request; a complete one joins the batch or is answered with an error
+    void readRequest(int slot)
+    {
+        Client& client = clients[slot];
+        const ssize_t bytes = recv(client.socket, (char*)&client.request + client.received, sizeof(ServiceRequest) - client.received, 0);
+        if (bytes <= 0)
+        {
+            if (bytes == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+                closeSocket(client.socket);
+            return;
+        }
+        client.received += (size_t)bytes;
+        if (client.received < sizeof(ServiceRequest))
+            return;
+
+        client.received = 0;
+        client.arrived = service_detail::Clock::now();
+        const ServiceRequest& request = client.request;
+        if (request.magic != SERVICE_MAGIC || request.version != SERVICE_VERSION || request.width == 0 || request.height == 0 ||
+            request.width > SERVICE_MAX_SIZE || request.height > SERVICE_MAX_SIZE || request.format >= NUM_SERVICE_FORMATS ||
+            request.memory[0] != '/' || std::memchr(request.memory, 0, sizeof(request.memory)) == NULL)
+        {
+            reply(slot, SERVICE_BAD_REQUEST, 0);
+            return;
+        }
+
+        client.queued = true;
+        BatchEntry entry = { slot, 0, 0 };
+        batch.push_back(entry);
+    }
+
+    // Copies an image into the client's shared memory object, flipping GL's bottom-up rows
+    int32_t writeImage(const ServiceRequest& request, const unsigned char* pixels)
+    {
+        const size_t rowBytes = (size_t)request.width * service_detail::bytesPerPixel(request.format);
+        const size_t bytes = rowBytes * request.height;
+        const int memory = shm_open(request.memory, O_RDWR, 0);
+        if (memory < 0)
+            return SERVICE_BAD_MEMORY;
+        struct stat info;
+        void* mapped = fstat(memory, &info) == 0 && (size_t)info.st_size >= bytes ? mmap(NULL, bytes, PROT_WRITE, MAP_SHARED, memory, 0) : MAP_FAILED;
+        close(memory);
+        if (mapped == MAP_FAILED)
+            return SERVICE_BAD_MEMORY;
+
+        unsigned char* image = (unsigned char*)mapped;
+        for (uint32_t y = 0; y < request.height; ++y)
+            std::memcpy(image + y * rowBytes, pixels + (request.height - 1 - y) * rowBytes, rowBytes);
+        munmap(mapped, bytes);
+        return SERVICE_OK;
+    }
+
+    void reply(int slot, int32_t status, uint32_t batchSize)
+    {
+        Client& client = clients[slot];
+        const ServiceRequest& request = client.request;
+        const float latencyMs = std::chrono::duration<float, std::milli>(service_detail::Clock::now() - client.arrived).count();
+        ServiceReply message;
+        message.magic = SERVICE_MAGIC;
+        message.id = request.id;
+        message.status = status;
+        message.width = status == SERVICE_OK ? request.width : 0;
+        message.height = status == SERVICE_OK ? request.height : 0;
+        message.bytes = status == SERVICE_OK ? request.width * request.height * service_detail::bytesPerPixel(request.format) : 0;
+        message.latencyMs = latencyMs;
+        message.batchSize = batchSize;
+        client.queued = false;
+
+        if (status == SERVICE_OK)
+        {
+            ++Served;
+            if ((int)latencies.size() < SERVICE_LATENCY_SAMPLES)
+                latencies.push_back(latencyMs);
+        }
+        else
+        {
+            ++Rejected;
+        }
+
+        // the reply is far smaller than the socket buffer; a client that cannot take it is dropped
+        if (client.socket >= 0 && send(client.socket, &message, sizeof(message), 0) != (ssize_t)sizeof(message))
+            closeSocket(client.socket);
+    }
+#else
+    int32_t writeImage(const ServiceRequest&, const unsigned char*)
+    {
+        return SERVICE_FAILED;
+    }
+
+    void reply(int, int32_t, uint32_t)
+    {
+    }
+#endif
+
+    RenderService(const RenderService&);
+    RenderService& operator=(const RenderService&);
+};
+#endif
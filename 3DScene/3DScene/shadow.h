@@ -0,0 +1,343 @@
+#ifndef SHADOW_H
+#define SHADOW_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <chrono>
+#include <cmath>
+
+#include "camera.h"
+#include "gputimer.h"
+#include "resources.h"
+
+// Default shadow values
+const int SHADOW_CASCADES = 3;
+const int SHADOW_MAP_SIZE = 2048;
+const float SHADOW_DISTANCE = 40.0f;     // shadows are not drawn past this view distance
+const float SHADOW_SPLIT_LAMBDA = 0.7f;  // blend between logarithmic (1) and uniform (0) splits
+const float SHADOW_CACHE_MARGIN = 1.5f;  // cascade extent relative to its slice, lets the camera move before the cache is rebuilt
+
+// Per-frame cost of the shadow pass, reported separately from the main pass
+struct ShadowStats
+{
+    unsigned int staticRebuilds;   // number of cascade layers re-rendered from static geometry
+    unsigned int dynamicCasters;   // casters drawn on top of the cached layers this frame
+    float staticGpuMs;             // GPU time of the last static rebuild
+    float dynamicGpuMs;            // GPU time of the per-frame dynamic composite
+    float cpuMs;                   // CPU time spent recording the shadow pass
+};
+
+// Cascaded shadow maps for a directional light, fitted to a camera frustum.
+// Static casters are rendered into a cached depth array that is only rebuilt when the light,
+// the static geometry or a cascade's snapped projection changes; dynamic casters are drawn on
+// top of a copy of that cache every frame.
+class ShadowCascades
+{
+public:
+    // cascade data the lit shader needs
+    glm::mat4 LightSpace[SHADOW_CASCADES];
+    float SplitDepth[SHADOW_CASCADES];
+    ShadowStats Stats;
+
+    ShadowCascades() : depthProgram(0), framebuffer(0), staticDepth(0), frameDepth(0), lightSpaceLoc(-1),
+        lightDirection(0.0f, -1.0f, 0.0f), sceneMin(-1.0f), sceneMax(1.0f), staticDirty(true), dynamicThisFrame(false)
+    {
+        for (int i = 0; i < SHADOW_CASCADES; ++i)
+        {
+            cached[i].valid = false;
+            SplitDepth[i] = 0.0f;
+        }
+        Stats = ShadowStats();
+    }
+
+    // creates the depth arrays; the program must output depth only, expose "lightSpace"
+    // and read each caster's model matrix by the object index passed as base instance
+    void Create(GLuint program)
+    {
+        depthProgram = program;
+        lightSpaceLoc = glGetUniformLocation(depthProgram, "lightSpace");
+
+        staticDepth = createDepthArray();
+        frameDepth = createDepthArray();
+
+        framebuffer = GpuResources().GenFramebuffer("shadow framebuffer");
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        staticTimer.Create();
+        dynamicTimer.Create();
+    }
+
+    void Destroy()
+    {
+        GpuResources().DeleteFramebuffer(framebuffer);
+        GpuResources().DeleteTexture(staticDepth);
+        GpuResources().DeleteTexture(frameDepth);
+        staticTimer.Destroy();
+        dynamicTimer.Destroy();
+    }
+
+    // marks the static layer stale, call whenever a static object is added, removed or moved
+    void InvalidateStatic()
+    {
+        staticDirty = true;
+    }
+
+    void SetLightDirection(const glm::vec3& direction)
+    {
+        glm::vec3 dir = glm::normalize(direction);
+        if (dir != lightDirection)
+        {
+            lightDirection = dir;
+            staticDirty = true;
+        }
+    }
+
+    // world-space bounds of every caster, used for the depth range of the light projection
+    void SetSceneBounds(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+    {
+        if (boundsMin != sceneMin || boundsMax != sceneMax)
+        {
+            sceneMin = boundsMin;
+            sceneMax = boundsMax;
+            staticDirty = true;
+        }
+    }
+
+    // fits the cascades to the camera and binds the shadow framebuffer
+    void Begin(const Camera& camera, float aspect, float nearPlane)
+    {
+        cpuStart = std::chrono::steady_clock::now();
+        Stats.staticRebuilds = 0;
+        Stats.dynamicCasters = 0;
+        dynamicThisFrame = false;
+
+        if (staticDirty)
+        {
+            for (int i = 0; i < SHADOW_CASCADES; ++i)
+                cached[i].valid = false;
+            staticDirty = false;
+        }
+
+        fitCascades(camera, aspect, nearPlane);
+
+        glUseProgram(depthProgram);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(0, 0, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
+        RenderCounters().StateChanges += 2;
+        glEnable(GL_DEPTH_TEST);
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(2.0f, 4.0f);
+    }
+
+    // true when the cascade's cached static layer is out of date
+    bool NeedsStaticLayer(int cascade) const
+    {
+        return !cached[cascade].valid;
+    }
+
+    // binds a cascade of the static cache as the render target
+    void BeginStaticLayer(int cascade)
+    {
+        if (Stats.staticRebuilds == 0)
+            staticTimer.Begin();
+        ++Stats.staticRebuilds;
+
+        bindLayer(staticDepth, cascade);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        cached[cascade].valid = true;
+    }
+
+    // copies every cached layer into the frame array so dynamic casters can be drawn on top
+    void BeginDynamicLayers()
+    {
+        if (Stats.staticRebuilds > 0)
+            staticTimer.End();
+
+        dynamicTimer.Begin();
+        glCopyImageSubData(staticDepth, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
+            frameDepth, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
+            SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, SHADOW_CASCADES);
+        dynamicThisFrame = true;
+    }
+
+    // binds a cascade of the frame array as the render target for dynamic casters
+    void BeginDynamicLayer(int cascade)
+    {
+        bindLayer(frameDepth, cascade);
+    }
+
+    // draws one caster into the currently bound layer; indexed when nIndices is not zero
+    void DrawCaster(GLuint vao, GLsizei nVertices, GLsizei nIndices, GLuint objectIndex)
+    {
+        glBindVertexArray(vao);
+        if (nIndices > 0)
+            glDrawElementsInstancedBaseInstance(GL_TRIANGLES, nIndices, GL_UNSIGNED_INT, NULL, 1, objectIndex);
+        else
+            glDrawArraysInstancedBaseInstance(GL_TRIANGLES, 0, nVertices, 1, objectIndex);
+        ++RenderCounters().StateChanges;
+        ++RenderCounters().DrawCalls;
+
+        if (dynamicThisFrame)
+            ++Stats.dynamicCasters;
+    }
+
+    // restores the default framebuffer and publishes the timings
+    void End(int viewportWidth, int viewportHeight)
+    {
+        if (dynamicThisFrame)
+            dynamicTimer.End();
+        else if (Stats.staticRebuilds > 0)
+            staticTimer.End();
+
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glBindVertexArray(0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, viewportWidth, viewportHeight);
+        RenderCounters().StateChanges += 2;
+
+        staticTimer.Collect();
+        dynamicTimer.Collect();
+        Stats.staticGpuMs = staticTimer.LastMs;
+        Stats.dynamicGpuMs = dynamicThisFrame ? dynamicTimer.AverageMs : 0.0f;
+        Stats.cpuMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - cpuStart).count();
+    }
+
+    // depth array to sample this frame: the composite when dynamic casters were drawn, otherwise the cache itself
+    GLuint GetShadowTexture() const
+    {
+        return dynamicThisFrame ? frameDepth : staticDepth;
+    }
+
+private:
+    // light-space placement of a cached cascade
+    struct CascadeCache
+    {
+        bool valid;
+        float centerX;
+        float centerY;
+        float extent;
+    };
+
+    GLuint depthProgram;
+    GLuint framebuffer;
+    GLuint staticDepth;
+    GLuint frameDepth;
+    GLint lightSpaceLoc;
+
+    glm::vec3 lightDirection;
+    glm::vec3 sceneMin;
+    glm::vec3 sceneMax;
+    bool staticDirty;
+    bool dynamicThisFrame;
+
+    CascadeCache cached[SHADOW_CASCADES];
+    GpuTimer staticTimer;
+    GpuTimer dynamicTimer;
+    std::chrono::steady_clock::time_point cpuStart;
+
+    GLuint createDepthArray()
+    {
+        const float border[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+
+        GLuint texture = GpuResources().GenTexture("shadow cascades");
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        GpuResources().TexStorage3D(GL_TEXTURE_2D_ARRAY, texture, 1, GL_DEPTH_COMPONENT32F, SHADOW_MAP_SIZE, SHADOW_MAP_SIZE, SHADOW_CASCADES);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        return texture;
+    }
+
+    void bindLayer(GLuint texture, int cascade)
+    {
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, cascade);
+        ++RenderCounters().StateChanges;
+        glUniformMatrix4fv(lightSpaceLoc, 1, GL_FALSE, glm::value_ptr(LightSpace[cascade]));
+    }
+
+    // splits the view distance and places a stable, texel-snapped orthographic box around each slice
+    void fitCascades(const Camera& camera, float aspect, float nearPlane)
+    {
+        glm::vec3 up = std::fabs(lightDirection.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), lightDirection, up);
+
+        // depth range covering every caster
+        float minZ = 1e30f, maxZ = -1e30f;
+        for (int i = 0; i < 8; ++i)
+        {
+            glm::vec3 corner((i & 1) ? sceneMax.x : sceneMin.x, (i & 2) ? sceneMax.y : sceneMin.y, (i & 4) ? sceneMax.z : sceneMin.z);
+            float z = (lightView * glm::vec4(corner, 1.0f)).z;
+            minZ = glm::min(minZ, z);
+            maxZ = glm::max(maxZ, z);
+        }
+
+        float tanHalfFov = std::tan(glm::radians(camera.Zoom) * 0.5f);
+        float farPlane = SHADOW_DISTANCE;
+        float sliceNear = nearPlane;
+
+        for (int i = 0; i < SHADOW_CASCADES; ++i)
+        {
+            float t = (float)(i + 1) / SHADOW_CASCADES;
+            float logSplit = nearPlane * std::pow(farPlane / nearPlane, t);
+            float uniformSplit = nearPlane + (farPlane - nearPlane) * t;
+            float sliceFar = SHADOW_SPLIT_LAMBDA * logSplit + (1.0f - SHADOW_SPLIT_LAMBDA) * uniformSplit;
+            SplitDepth[i] = sliceFar;
+
+            // bounding sphere of the slice, which does not change size as the camera turns
+            glm::vec3 center(0.0f);
+            glm::vec3 corners[8];
+            for (int c = 0; c < 8; ++c)
+            {
+                float d = (c & 4) ? sliceFar : sliceNear;
+                float h = d * tanHalfFov;
+                float w = h * aspect;
+                corners[c] = camera.Position + camera.Front * d
+                    + camera.Right * ((c & 1) ? w : -w)
+                    + camera.Up * ((c & 2) ? h : -h);
+                center += corners[c];
+            }
+            center /= 8.0f;
+
+            float radius = 0.0f;
+            for (int c = 0; c < 8; ++c)
+                radius = glm::max(radius, glm::length(corners[c] - center));
+            radius = std::ceil(radius * 16.0f) / 16.0f;
+
+            float extent = radius * SHADOW_CACHE_MARGIN;
+            glm::vec4 lightCenter = lightView * glm::vec4(center, 1.0f);
+
+            // keep the cached placement while the slice still fits inside it
+            CascadeCache& cache = cached[i];
+            bool fits = cache.valid && cache.extent == extent
+                && std::fabs(lightCenter.x - cache.centerX) + radius <= extent
+                && std::fabs(lightCenter.y - cache.centerY) + radius <= extent;
+            if (!fits)
+            {
+                float texel = 2.0f * extent / SHADOW_MAP_SIZE;
+                cache.valid = false;
+                cache.extent = extent;
+                cache.centerX = std::floor(lightCenter.x / texel) * texel;
+                cache.centerY = std::floor(lightCenter.y / texel) * texel;
+            }
+
+            glm::mat4 lightProjection = glm::ortho(cache.centerX - extent, cache.centerX + extent,
+                cache.centerY - extent, cache.centerY + extent, -maxZ - 1.0f, -minZ + 1.0f);
+            LightSpace[i] = lightProjection * lightView;
+
+            sliceNear = sliceFar;
+        }
+    }
+};
+#endif
@@ -0,0 +1,774 @@
+#ifndef SIMDMATH_H
+#define SIMDMATH_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <glm/gtx/transform.hpp>
+
+#include <cmath>
+#include <cstddef>
+
+// Batched transform math over arrays of objects, one function table per instruction set.
+// Every kernel repeats glm's own order of operations without fused multiply-adds, so each
+// level gives the same floats as the scalar glm code it replaces, only more of them per instruction.
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#define SIMDMATH_X86 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SIMDMATH_TARGET(isa)
+#else
+#include <cpuid.h>
+// wider levels are compiled per function and only called after the CPU says it has them;
+// contraction stays off so the compiler cannot fuse the multiplies and adds glm keeps apart
+#define SIMDMATH_TARGET(isa) __attribute__((target(isa), optimize("fp-contract=off")))
+#endif
+#endif
+
+#ifdef GLM_FORCE_QUAT_DATA_WXYZ
+#error "simdmath.h loads quaternions as x, y, z, w"
+#endif
+
+enum SimdMath_Level {
+    SIMDMATH_SCALAR,    // plain glm, the reference
+    SIMDMATH_SSE,       // one matrix column or point per register
+    SIMDMATH_AVX2,      // two per register
+    SIMDMATH_AVX512,    // four per register
+    NUM_SIMDMATH_LEVELS
+};
+
+struct SimdMathKernels
+{
+    const char* name;
+
+    // out[i] = a[i] * b[i]
+    void (*MultiplyMat4)(const glm::mat4* a, const glm::mat4* b, glm::mat4* out, size_t count);
+    // out[i] = a * b[i], e.g. view-projection times every model
+    void (*MultiplyMat4Shared)(const glm::mat4& a, const glm::mat4* b, glm::mat4* out, size_t count);
+    // out[i] = translate(t[i]) * mat4_cast(r[i]) * scale(s[i])
+    void (*ComposeTrs)(const glm::vec3* t, const glm::quat* r, const glm::vec3* s, glm::mat4* out, size_t count);
+    // out[i] = vec3(m * vec4(p[i], 1))
+    void (*TransformPoints)(const glm::mat4& m, const glm::vec3* p, glm::vec3* out, size_t count);
+    // world box of each object-space box, the same as transforming its eight corners
+    void (*TransformAabbs)(const glm::mat4* m, const glm::vec3* boundsMin, const glm::vec3* boundsMax,
+        glm::vec3* outMin, glm::vec3* outMax, size_t count);
+    // visible[i] = 0 when the world box is outside one of the planes, as BoxInFrustum decides it
+    void (*TestAabbsPlanes)(const glm::vec4 planes[6], const glm::vec3* boundsMin, const glm::vec3* boundsMax,
+        unsigned char* visible, size_t count);
+};
+
+namespace simdmath_detail
+{
+    // Scalar: the glm expressions the other levels are checked against
+
+    inline void multiplyScalar(const glm::mat4* a, const glm::mat4* b, glm::mat4* out, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+            out[i] = a[i] * b[i];
+    }
+
+    inline void multiplySharedScalar(const glm::mat4& a, const glm::mat4* b, glm::mat4* out, size_t count)
+    {
+        const glm::mat4 shared = a;
+        for (size_t i = 0; i < count; ++i)
+            out[i] = shared * b[i];
+    }
+
+    inline void composeScalar(const glm::vec3* t, const glm::quat* r, const glm::vec3* s, glm::mat4* out, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+            out[i] = glm::translate(t[i]) * glm::mat4_cast(r[i]) * glm::scale(s[i]);
+    }
+
+    inline void pointsScalar(const glm::mat4& m, const glm::vec3* p, glm::vec3* out, size_t count)
+    {
+        const glm::mat4 shared = m;
+        for (size_t i = 0; i < count; ++i)
+            out[i] = glm::vec3(shared * glm::vec4(p[i], 1.0f));
+    }
+
+    inline void aabbsScalar(const glm::mat4* m, const glm::vec3* boundsMin, const glm::vec3* boundsMax,
+        glm::vec3* outMin, glm::vec3* outMax, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            glm::vec3 worldMin(1e30f), worldMax(-1e30f);
+            for (int c = 0; c < 8; ++c)
+            {
+                glm::vec3 corner((c & 1) ? boundsMax[i].x : boundsMin[i].x,
+                    (c & 2) ? boundsMax[i].y : boundsMin[i].y,
+                    (c & 4) ? boundsMax[i].z : boundsMin[i].z);
+                glm::vec3 world = glm::vec3(m[i] * glm::vec4(corner, 1.0f));
+                worldMin = glm::min(worldMin, world);
+                worldMax = glm::max(worldMax, world);
+            }
+            outMin[i] = worldMin;
+            outMax[i] = worldMax;
+        }
+    }
+
+    inline void planesScalar(const glm::vec4 planes[6], const glm::vec3* boundsMin, const glm::vec3* boundsMax,
+        unsigned char* visible, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            glm::vec3 center = (boundsMin[i] + boundsMax[i]) * 0.5f;
+            glm::vec3 extent = (boundsMax[i] - boundsMin[i]) * 0.5f;
+            unsigned char inside = 1;
+            for (int p = 0; p < 6 && inside; ++p)
+            {
+                glm::vec3 normal(planes[p]);
+                float radius = glm::dot(extent, glm::abs(normal));
+                if (glm::dot(normal, center) + planes[p].w < -radius)
+                    inside = 0;
+            }
+            visible[i] = inside;
+        }
+    }
+
+#ifdef SIMDMATH_X86
+    // A column of each matrix is 16 contiguous bytes, a vec3 is 12 and is never read or written past its end
+
+    inline __m128 loadPoint(const glm::vec3& v, float w)
+    {
+        return _mm_set_ps(w, v.z, v.y, v.x);
+    }
+
+    inline void storePoint(glm::vec3& out, __m128 v)
+    {
+        _mm_storel_pi((__m64*)&out.x, v);
+        _mm_store_ss(&out.z, _mm_movehl_ps(v, v));
+    }
+
+    inline const float* columns(const glm::mat4& m)
+    {
+        return glm::value_ptr(m);
+    }
+
+    inline float* columns(glm::mat4& m)
+    {
+        return glm::value_ptr(m);
+    }
+
+    // Multiplies, adds and signs of the rotation part of mat4_cast, one column of the result per row:
+    // column k = (identity_k + sign_k * 2 * (a_k + b_k)) * scale_k, each a and b a product of two quaternion swizzles
+    const float TRS_SIGN[3][4] = { { -1.0f, 1.0f, 1.0f, 0.0f }, { 1.0f, -1.0f, 1.0f, 0.0f }, { 1.0f, 1.0f, -1.0f, 0.0f } };
+    const float TRS_B_SIGN[3][4] = { { 1.0f, 1.0f, -1.0f, 1.0f }, { -1.0f, 1.0f, 1.0f, 1.0f }, { 1.0f, -1.0f, 1.0f, 1.0f } };
+    const float TRS_IDENTITY[3][4] = { { 1.0f, 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 1.0f, 0.0f } };
+
+    // swizzles of (x, y, z, w) per column: a = (y,x,x)*(y,y,z), (x,x,y)*(y,x,z), (x,y,x)*(z,z,x)
+    // and b = (z,w,w)*(z,z,y), (w,z,w)*(z,z,x), (w,w,y)*(y,x,y)
+#define SIMDMATH_TRS_A0 _MM_SHUFFLE(3, 0, 0, 1)
+#define SIMDMATH_TRS_A0B _MM_SHUFFLE(3, 2, 1, 1)
+#define SIMDMATH_TRS_B0 _MM_SHUFFLE(3, 3, 3, 2)
+#define SIMDMATH_TRS_B0B _MM_SHUFFLE(3, 1, 2, 2)
+#define SIMDMATH_TRS_A1 _MM_SHUFFLE(3, 1, 0, 0)
+#define SIMDMATH_TRS_A1B _MM_SHUFFLE(3, 2, 0, 1)
+#define SIMDMATH_TRS_B1 _MM_SHUFFLE(3, 3, 2, 3)
+#define SIMDMATH_TRS_B1B _MM_SHUFFLE(3, 0, 2, 2)
+#define SIMDMATH_TRS_A2 _MM_SHUFFLE(3, 0, 1, 0)
+#define SIMDMATH_TRS_A2B _MM_SHUFFLE(3, 0, 2, 2)
+#define SIMDMATH_TRS_B2 _MM_SHUFFLE(3, 1, 3, 3)
+#define SIMDMATH_TRS_B2B _MM_SHUFFLE(3, 1, 0, 1)
+
+    // SSE2, which every x64 CPU has
+
+    inline void multiplySse(const glm::mat4* a, size_t aStep, const glm::mat4* b, glm::mat4* out, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i, a += aStep)
+        {
+            const float* ac = columns(*a);
+            const float* bc = columns(b[i]);
+            __m128 a0 = _mm_loadu_ps(ac), a1 = _mm_loadu_ps(ac + 4), a2 = _mm_loadu_ps(ac + 8), a3 = _mm_loadu_ps(ac + 12);
+            __m128 b0 = _mm_loadu_ps(bc), b1 = _mm_loadu_ps(bc + 4), b2 = _mm_loadu_ps(bc + 8), b3 = _mm_loadu_ps(bc + 12);
+            __m128 bs[4] = { b0, b1, b2, b3 };
+            float* oc = columns(out[i]);
+            for (int c = 0; c < 4; ++c)
+            {
+                __m128 r = _mm_add_ps(_mm_mul_ps(a0, _mm_shuffle_ps(bs[c], bs[c], 0x00)), _mm_mul_ps(a1, _mm_shuffle_ps(bs[c], bs[c], 0x55)));
+                r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_shuffle_ps(bs[c], bs[c], 0xAA)));
+                r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_shuffle_ps(bs[c], bs[c], 0xFF)));
+                _mm_storeu_ps(oc + 4 * c, r);
+            }
+        }
+    }
+
+    inline void multiplyPairsSse(const glm::mat4* a, const glm::mat4* b, glm::mat4* out, size_t count)
+    {
+        multiplySse(a, 1, b, out, count);
+    }
+
+    inline void multiplySharedSse(const glm::mat4& a, const glm::mat4* b, glm::mat4* out, size_t count)
+    {
+        multiplySse(&a, 0, b, out, count);
+    }
+
+    inline __m128 trsColumnSse(__m128 a, __m128 aB, __m128 b, __m128 bB, int k, float scale)
+    {
+        __m128 products = _mm_add_ps(_mm_mul_ps(a, aB), _mm_mul_ps(_mm_mul_ps(b, bB), _mm_loadu_ps(TRS_B_SIGN[k])));
+        __m128 twice = _mm_mul_ps(_mm_set1_ps(2.0f), products);
+        __m128 column = _mm_add_ps(_mm_loadu_ps(TRS_IDENTITY[k]), _mm_mul_ps(_mm_loadu_ps(TRS_SIGN[k]), twice));
+        return _mm_mul_ps(column, _mm_set1_ps(scale));
+    }
+
+    inline void composeSse(const glm::vec3* t, const glm::quat* r, const glm::vec3* s, glm::mat4* out, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            __m128 q = _mm_loadu_ps(&r[i].x);
+            float* oc = columns(out[i]);
+            _mm_storeu_ps(oc, trsColumnSse(_mm_shuffle_ps(q, q, SIMDMATH_TRS_A0), _mm_shuffle_ps(q, q, SIMDMATH_TRS_A0B),
+                _mm_shuffle_ps(q, q, SIMDMATH_TRS_B0), _mm_shuffle_ps(q, q, SIMDMATH_TRS_B0B), 0, s[i].x));
+            _mm_storeu_ps(oc + 4, trsColumnSse(_mm_shuffle_ps(q, q, SIMDMATH_TRS_A1), _mm_shuffle_ps(q, q, SIMDMATH_TRS_A1B),
+                _mm_shuffle_ps(q, q, SIMDMATH_TRS_B1), _mm_shuffle_ps(q, q, SIMDMATH_TRS_B1B), 1, s[i].y));
+            _mm_storeu_ps(oc + 8, trsColumnSse(_mm_shuffle_ps(q, q, SIMDMATH_TRS_A2), _mm_shuffle_ps(q, q, SIMDMATH_TRS_A2B),
+                _mm_shuffle_ps(q, q, SIMDMATH_TRS_B2), _mm_shuffle_ps(q, q, SIMDMATH_TRS_B2B), 2, s[i].z));
+            _mm_storeu_ps(oc + 12, loadPoint(t[i], 1.0f));
+        }
+    }
+
+    inline void pointsSse(const glm::mat4& m, const glm::vec3* p, glm::vec3* out, size_t count)
+    {
+        const float* mc = columns(m);
+        __m128 m0 = _mm_loadu_ps(mc), m1 = _mm_loadu_ps(mc + 4), m2 = _mm_loadu_ps(mc + 8), m3 = _mm_loadu_ps(mc + 12);
+        for (size_t i = 0; i < count; ++i)
+        {
+            __m128 xy = _mm_add_ps(_mm_mul_ps(m0, _mm_set1_ps(p[i].x)), _mm_mul_ps(m1, _mm_set1_ps(p[i].y)));
+            __m128 zw = _mm_add_ps(_mm_mul_ps(m2, _mm_set1_ps(p[i].z)), m3);
+            storePoint(out[i], _mm_add_ps(xy, zw));
+        }
+    }
+
+    // min and max of m_j * min_j and m_j * max_j per column, summed like a point; rounding is monotonic,
+    // so this is exactly the smallest and largest of the eight transformed corners
+    inline void aabbsSse(const glm::mat4* m, const glm::vec3* boundsMin, const glm::vec3* boundsMax,
+        glm::vec3* outMin, glm::vec3* outMax, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            const float* mc = columns(m[i]);
+            __m128 lo[3], hi[3];
+            const float mins[3] = { boundsMin[i].x, boundsMin[i].y, boundsMin[i].z };
+            const float maxs[3] = { boundsMax[i].x, boundsMax[i].y, boundsMax[i].z };
+            for (int j = 0; j < 3; ++j)
+            {
+                __m128 column = _mm_loadu_ps(mc + 4 * j);
+                __m128 a = _mm_mul_ps(column, _mm_set1_ps(mins[j]));
+                __m128 b = _mm_mul_ps(column, _mm_set1_ps(maxs[j]));
+                lo[j] = _mm_min_ps(a, b);
+                hi[j] = _mm_max_ps(a, b);
+            }
+            __m128 m3 = _mm_loadu_ps(mc + 12);
+            storePoint(outMin[i], _mm_add_ps(_mm_add_ps(lo[0], lo[1]), _mm_add_ps(lo[2], m3)));
+            storePoint(outMax[i], _mm_add_ps(_mm_add_ps(hi[0], hi[1]), _mm_add_ps(hi[2], m3)));
+        }
+    }
+
+    // planes laid out by component, padded to eight with planes every box is inside of
+    struct PlaneLanes
+    {
+        float nx[8], ny[8], nz[8], w[8];
+        float ax[8], ay[8], az[8];
+    };
+
+    inline void splitPlanes(const glm::vec4 planes[6], PlaneLanes& lanes)
+    {
+        for (int p = 0; p < 8; ++p)
+        {
+            glm::vec4 plane = p < 6 ? planes[p] : glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+            lanes.nx[p] = plane.x;
+            lanes.ny[p] = plane.y;
+            lanes.nz[p] = plane.z;
+            lanes.w[p] = plane.w;
+            lanes.ax[p] = fabsf(plane.x);
+            lanes.ay[p] = fabsf(plane.y);
+            lanes.az[p] = fabsf(plane.z);
+        }
+    }
+
+    inline void planesSse(const glm::vec4 planes[6], const glm::vec3* boundsMin, const glm::vec3* boundsMax,
+        unsigned char* visible, size_t count)
+    {
+        PlaneLanes lanes;
+        splitPlanes(planes, lanes);
+        __m128 nx[2], ny[2], nz[2], w[2], ax[2], ay[2], az[2];
+        for (int h = 0; h < 2; ++h)
+        {
+            nx[h] = _mm_loadu_ps(lanes.nx + 4 * h);
+            ny[h] = _mm_loadu_ps(lanes.ny + 4 * h);
+            nz[h] = _mm_loadu_ps(lanes.nz + 4 * h);
+            w[h] = _mm_loadu_ps(lanes.w + 4 * h);
+            ax[h] = _mm_loadu_ps(lanes.ax + 4 * h);
+            ay[h] = _mm_loadu_ps(lanes.ay + 4 * h);
+            az[h] = _mm_loadu_ps(lanes.az + 4 * h);
+        }
+
+        const __m128 half = _mm_set1_ps(0.5f);
+        for (size_t i = 0; i < count; ++i)
+        {
+            __m128 lo = loadPoint(boundsMin[i], 0.0f), hi = loadPoint(boundsMax[i], 0.0f);
+            __m128 center = _mm_mul_ps(_mm_add_ps(lo, hi), half);
+            __m128 extent = _mm_mul_ps(_mm_sub_ps(hi, lo), half);
+            __m128 cx = _mm_shuffle_ps(center, center, 0x00), cy = _mm_shuffle_ps(center, center, 0x55), cz = _mm_shuffle_ps(center, center, 0xAA);
+            __m128 ex = _mm_shuffle_ps(extent, extent, 0x00), ey = _mm_shuffle_ps(extent, extent, 0x55), ez = _mm_shuffle_ps(extent, extent, 0xAA);
+
+            int outside = 0;
+            for (int h = 0; h < 2; ++h)
+            {
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx[h], cx), _mm_mul_ps(ny[h], cy)), _mm_mul_ps(nz[h], cz)), w[h]);
+                __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, ax[h]), _mm_mul_ps(ey, ay[h])), _mm_mul_ps(ez, az[h]));
+                outside |= _mm_movemask_ps(_mm_cmplt_ps(distance, _mm_sub_ps(_mm_setzero_ps(), radius)));
+            }
+            visible[i] = outside == 0;
+        }
+    }
+
+    // AVX2: two matrices, columns or points per register, one in each 128-bit half
+
+    SIMDMATH_TARGET("avx2")
+    inline __m256 pairPoints(const glm::vec3& first, const glm::vec3& second, float w)
+    {
+        return _mm256_insertf128_ps(_mm256_castps128_ps256(loadPoint(first, w)), loadPoint(second, w), 1);
+    }
+
+    SIMDMATH_TARGET("avx2")
+    inline void storePairPoints(glm::vec3& first, glm::vec3& second, __m256 v)
+    {
+        storePoint(first, _mm256_castps256_ps128(v));
+        storePoint(second, _mm256_extractf128_ps(v, 1));
+    }
+
+    SIMDMATH_TARGET("avx2")
+    inline void multiplyAvx2(const glm::mat4* a, size_t aStep, const glm::mat4* b, glm::mat4* out, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i, a += aStep)
+        {
+            const float* ac = columns(*a);
+            const float* bc = columns(b[i]);
+            __m256 a0 = _mm256_broadcast_ps((const __m128*)ac), a1 = _mm256_broadcast_ps((const __m128*)(ac + 4));
+            __m256 a2 = _mm256_broadcast_ps((const __m128*)(ac + 8)), a3 = _mm256_broadcast_ps((const __m128*)(ac + 12));
+            __m256 b01 = _mm256_loadu_ps(bc), b23 = _mm256_loadu_ps(bc + 8);
+            __m256 bs[2] = { b01, b23 };
+            float* oc = columns(out[i]);
+            for (int h = 0; h < 2; ++h)
+            {
+                __m256 r = _mm256_add_ps(_mm256_mul_ps(a0, _mm256_permute_ps(bs[h], 0x00)), _mm256_mul_ps(a1, _mm256_permute_ps(bs[h], 0x55)));
+                r = _mm256_add_ps(r, _mm256_mul_ps(a2, _mm256_permute_ps(bs[h], 0xAA)));
+                r = _mm256_add_ps(r, _mm256_mul_ps(a3, _mm256_permute_ps(bs[h], 0xFF)));
+                _mm256_storeu_ps(oc + 8 * h, r);
+            }
+        }
+    }
+
+    SIMDMATH_TARGET("avx2")
+    inline void multiplyPairsAvx2(const glm::mat4* a, const glm::mat4* b, glm::mat4* out, size_t count)
+    {
+        multiplyAvx2(a, 1, b, out, count);
+    }
+
+    SIMDMATH_TARGET("avx2")
+    inline void multiplySharedAvx2(const glm::mat4& a, const glm::mat4* b, glm::mat4* out, size_t count)
+    {
+        multiplyAvx2(&a, 0, b, out, count);
+    }
+
+    SIMDMATH_TARGET("avx2")
+    inline __m256 trsColumnAvx2(__m256 q, int k, __m256 scale)
+    {
+        __m256 a, aB, b, bB;
+        if (k == 0)
+        {
+            a = _mm256_permute_ps(q, SIMDMATH_TRS_A0); aB = _mm256_permute_ps(q, SIMDMATH_TRS_A0B);
+            b = _mm256_permute_ps(q, SIMDMATH_TRS_B0); bB = _mm256_permute_ps(q, SIMDMATH_TRS_B0B);
+        }
+        else if (k == 1)
+        {
+            a = _mm256_permute_ps(q, SIMDMATH_TRS_A1); aB = _mm256_permute_ps(q, SIMDMATH_TRS_A1B);
+            b = _mm256_permute_ps(q, SIMDMATH_TRS_B1); bB = _mm256_permute_ps(q, SIMDMATH_TRS_B1B);
+        }
+        else
+        {
+            a = _mm256_permute_ps(q, SIMDMATH_TRS_A2); aB = _mm256_permute_ps(q, SIMDMATH_TRS_A2B);
+            b = _mm256_permute_ps(q, SIMDMATH_TRS_B2); bB = _mm256_permute_ps(q, SIMDMATH_TRS_B2B);
+        }
+        __m256 products = _mm256_add_ps(_mm256_mul_ps(a, aB), _mm256_mul_ps(_mm256_mul_ps(b, bB), _mm256_broadcast_ps((const __m128*)TRS_B_SIGN[k])));
+        __m256 twice = _mm256_mul_ps(_mm256_set1_ps(2.0f), products);
+        __m256 column = _mm256_add_ps(_mm256_broadcast_ps((const __m128*)TRS_IDENTITY[k]), _mm256_mul_ps(_mm256_broadcast_ps((const __m128*)TRS_SIGN[k]), twice));
+        return _mm256_mul_ps(column, scale);
+    }
+
+    SIMDMATH_TARGET("avx2")
+    inline void composeAvx2(const glm::vec3* t, const glm::quat* r, const glm::vec3* s, glm::mat4* out, size_t count)
+    {
+        size_t i = 0;
+        for (; i + 2 <= count; i += 2)
+        {
+            __m256 q = _mm256_loadu_ps(&r[i].x);
+            __m256 c0 = trsColumnAvx2(q, 0, _mm256_set_m128(_mm_set1_ps(s[i + 1].x), _mm_set1_ps(s[i].x)));
+            __m256 c1 = trsColumnAvx2(q, 1, _mm256_set_m128(_mm_set1_ps(s[i + 1].y), _mm_set1_ps(s[i].y)));
+            __m256 c2 = trsColumnAvx2(q, 2, _mm256_set_m128(_mm_set1_ps(s[i + 1].z), _mm_set1_ps(s[i].z)));
+            __m256 c3 = pairPoints(t[i], t[i + 1], 1.0f);
+
+            // halves hold the two objects, regroup them into each object's column pairs
+            float* first = columns(out[i]);
+            float* second = columns(out[i + 1]);
+            _mm256_storeu_ps(first, _mm256_permute2f128_ps(c0, c1, 0x20));
+            _mm256_storeu_ps(first + 8, _mm256_permute2f128_ps(c2, c3, 0x20));
+            _mm256_storeu_ps(second, _mm256_permute2f128_ps(c0, c1, 0x31));
+            _mm256_storeu_ps(second + 8, _mm256_permute2f128_ps(c2, c3, 0x31));
+        }
+        composeSse(t + i, r + i, s + i, out + i, count - i);
+    }
+
+    SIMDMATH_TARGET("avx2")
+    inline void pointsAvx2(const glm::mat4& m, const glm::vec3* p, glm::vec3* out, size_t count)
+    {
+        const float* mc = columns(m);
+        __m256 m0 = _mm256_broadcast_ps((const __m128*)mc), m1 = _mm256_broadcast_ps((const __m128*)(mc + 4));
+        __m256 m2 = _mm256_broadcast_ps((const __m128*)(mc + 8)), m3 = _mm256_broadcast_ps((const __m128*)(mc + 12));
+        size_t i = 0;
+        for (; i + 2 <= count; i += 2)
+        {
+            __m256 v = pairPoints(p[i], p[i + 1], 0.0f);
+            __m256 xy = _mm256_add_ps(_mm256_mul_ps(m0, _mm256_permute_ps(v, 0x00)), _mm256_mul_ps(m1, _mm256_permute_ps(v, 0x55)));
+            __m256 zw = _mm256_add_ps(_mm256_mul_ps(m2, _mm256_permute_ps(v, 0xAA)), m3);
+            storePairPoints(out[i], out[i + 1], _mm256_add_ps(xy, zw));
+        }
+        pointsSse(m, p + i, out + i, count - i);
+    }
+
+    SIMDMATH_TARGET("avx2")
+    inline void aabbsAvx2(const glm::mat4* m, const glm::vec3* boundsMin, const glm::vec3* boundsMax,
+        glm::vec3* outMin, glm::vec3* outMax, size_t count)
+    {
+        size_t i = 0;
+        for (; i + 2 <= count; i += 2)
+        {
+            const float* first = columns(m[i]);
+            const float* second = columns(m[i + 1]);
+            __m256 first01 = _mm256_loadu_ps(first), first23 = _mm256_loadu_ps(first + 8);
+            __m256 second01 = _mm256_loadu_ps(second), second23 = _mm256_loadu_ps(second + 8);
+            __m256 cols[4] = {
+                _mm256_permute2f128_ps(first01, second01, 0x20), _mm256_permute2f128_ps(first01, second01, 0x31),
+                _mm256_permute2f128_ps(first23, second23, 0x20), _mm256_permute2f128_ps(first23, second23, 0x31)
+            };
+            __m256 mins = pairPoints(boundsMin[i], boundsMin[i + 1], 0.0f);
+            __m256 maxs = pairPoints(boundsMax[i], boundsMax[i + 1], 0.0f);
+
+            __m256 a0 = _mm256_mul_ps(cols[0], _mm256_permute_ps(mins, 0x00)), b0 = _mm256_mul_ps(cols[0], _mm256_permute_ps(maxs, 0x00));
+            __m256 a1 = _mm256_mul_ps(cols[1], _mm256_permute_ps(mins, 0x55)), b1 = _mm256_mul_ps(cols[1], _mm256_permute_ps(maxs, 0x55));
+            __m256 a2 = _mm256_mul_ps(cols[2], _mm256_permute_ps(mins, 0xAA)), b2 = _mm256_mul_ps(cols[2], _mm256_permute_ps(maxs, 0xAA));
+            __m256 lo = _mm256_add_ps(_mm256_add_ps(_mm256_min_ps(a0, b0), _mm256_min_ps(a1, b1)), _mm256_add_ps(_mm256_min_ps(a2, b2), cols[3]));
+            __m256 hi = _mm256_add_ps(_mm256_add_ps(_mm256_max_ps(a0, b0), _mm256_max_ps(a1, b1)), _mm256_add_ps(_mm256_max_ps(a2, b2), cols[3]));
+            storePairPoints(outMin[i], outMin[i + 1], lo);
+            storePairPoints(outMax[i], outMax[i + 1], hi);
+        }
+        aabbsSse(m + i, boundsMin + i, boundsMax + i, outMin + i, outMax + i, count - i);
+    }
+
+    // all eight plane lanes in one register, one box per iteration
+    SIMDMATH_TARGET("avx2")
+    inline void planesAvx2(const glm::vec4 planes[6], const glm::vec3* boundsMin, const glm::vec3* boundsMax,
+        unsigned char* visible, size_t count)
+    {
+        PlaneLanes lanes;
+        splitPlanes(planes, lanes);
+        __m256 nx = _mm256_loadu_ps(lanes.nx), ny = _mm256_loadu_ps(lanes.ny), nz = _mm256_loadu_ps(lanes.nz), w = _mm256_loadu_ps(lanes.w);
+        __m256 ax = _mm256_loadu_ps(lanes.ax), ay = _mm256_loadu_ps(lanes.ay), az = _mm256_loadu_ps(lanes.az);
+
+        const __m128 half = _mm_set1_ps(0.5f);
+        for (size_t i = 0; i < count; ++i)
+        {
+            __m128 lo = loadPoint(boundsMin[i], 0.0f), hi = loadPoint(boundsMax[i], 0.0f);
+            __m128 center = _mm_mul_ps(_mm_add_ps(lo, hi), half);
+            __m128 extent = _mm_mul_ps(_mm_sub_ps(hi, lo), half);
+            __m256 c = _mm256_set_m128(center, center), e = _mm256_set_m128(extent, extent);
+
+            __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, _mm256_permute_ps(c, 0x00)),
+                _mm256_mul_ps(ny, _mm256_permute_ps(c, 0x55))), _mm256_mul_ps(nz, _mm256_permute_ps(c, 0xAA))), w);
+            __m256 radius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_permute_ps(e, 0x00), ax),
+                _mm256_mul_ps(_mm256_permute_ps(e, 0x55), ay)), _mm256_mul_ps(_mm256_permute_ps(e, 0xAA), az));
+            __m256 outside = _mm256_cmp_ps(distance, _mm256_sub_ps(_mm256_setzero_ps(), radius), _CMP_LT_OQ);
+            visible[i] = _mm256_movemask_ps(outside) == 0;
+        }
+    }
+
+    // AVX-512: a whole matrix, or four columns or points, per register
+
+    SIMDMATH_TARGET("avx512f")
+    inline __m512 quadPoints(const glm::vec3* p, float w)
+    {
+        __m512 v = _mm512_castps128_ps512(loadPoint(p[0], w));
+        v = _mm512_insertf32x4(v, loadPoint(p[1], w), 1);
+        v = _mm512_insertf32x4(v, loadPoint(p[2], w), 2);
+        return _mm512_insertf32x4(v, loadPoint(p[3], w), 3);
+    }
+
+    SIMDMATH_TARGET("avx512f")
+    inline void storeQuadPoints(glm::vec3* out, __m512 v)
+    {
+        storePoint(out[0], _mm512_castps512_ps128(v));
+        storePoint(out[1], _mm512_extractf32x4_ps(v, 1));
+        storePoint(out[2], _mm512_extractf32x4_ps(v, 2));
+        storePoint(out[3], _mm512_extractf32x4_ps(v, 3));
+    }
+
+    // swaps objects and columns of four registers of four columns each, its own inverse
+    SIMDMATH_TARGET("avx512f")
+    inline void transposeQuads(__m512& v0, __m512& v1, __m512& v2, __m512& v3)
+    {
+        __m512 t0 = _mm512_shuffle_f32x4(v0, v1, _MM_SHUFFLE(1, 0, 1, 0));
+        __m512 t1 = _mm512_shuffle_f32x4(v2, v3, _MM_SHUFFLE(1, 0, 1, 0));
+        __m512 t2 = _mm512_shuffle_f32x4(v0, v1, _MM_SHUFFLE(3, 2, 3, 2));
+        __m512 t3 = _mm512_shuffle_f32x4(v2, v3, _MM_SHUFFLE(3, 2, 3, 2));
+        v0 = _mm512_shuffle_f32x4(t0, t1, _MM_SHUFFLE(2, 0, 2, 0));
+        v1 = _mm512_shuffle_f32x4(t0, t1, _MM_SHUFFLE(3, 1, 3, 1));
+        v2 = _mm512_shuffle_f32x4(t2, t3, _MM_SHUFFLE(2, 0, 2, 0));
+        v3 = _mm512_shuffle_f32x4(t2, t3, _MM_SHUFFLE(3, 1, 3, 1));
+    }
+
+    SIMDMATH_TARGET("avx512f")
+    inline __m512 quadScalars(float a, float b, float c, float d)
+    {
+        return _mm512_set_ps(d, d, d, d, c, c, c, c, b, b, b, b, a, a, a, a);
+    }
+
+    SIMDMATH_TARGET("avx512f")
+    inline void multiplyAvx512(const glm::mat4* a, size_t aStep, const glm::mat4* b, glm::mat4* out, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i, a += aStep)
+        {
+            const float* ac = columns(*a);
+            __m512 a0 = _mm512_broadcast_f32x4(_mm_loadu_ps(ac)), a1 = _mm512_broadcast_f32x4(_mm_loadu_ps(ac + 4));
+            __m512 a2 = _mm512_broadcast_f32x4(_mm_loadu_ps(ac + 8)), a3 = _mm512_broadcast_f32x4(_mm_loadu_ps(ac + 12));
+            __m512 bm = _mm512_loadu_ps(columns(b[i]));
+            __m512 r = _mm512_add_ps(_mm512_mul_ps(a0, _mm512_permute_ps(bm, 0x00)), _mm512_mul_ps(a1, _mm512_permute_ps(bm, 0x55)));
+            r = _mm512_add_ps(r, _mm512_mul_ps(a2, _mm512_permute_ps(bm, 0xAA)));
+            r = _mm512_add_ps(r, _mm512_mul_ps(a3, _mm512_permute_ps(bm, 0xFF)));
+            _mm512_storeu_ps(columns(out[i]), r);
+        }
+    }
+
+    SIMDMATH_TARGET("avx512f")
+    inline void multiplyPairsAvx512(const glm::mat4* a, const glm::mat4* b, glm::mat4* out, size_t count)
+    {
+        multiplyAvx512(a, 1, b, out, count);
+    }
+
+    SIMDMATH_TARGET("avx512f")
+    inline void multiplySharedAvx512(const glm::mat4& a, const glm::mat4* b, glm::mat4* out, size_t count)
+    {
+        multiplyAvx512(&a, 0, b, out, count);
+    }
+
+    SIMDMATH_TARGET("avx512f")
+    inline __m512 trsColumnAvx512(__m512 q, int k, __m512 scale)
+    {
+        __m512 a, aB, b, bB;
+        if (k == 0)
+        {
+            a = _mm512_permute_ps(q, SIMDMATH_TRS_A0); aB = _mm512_permute_ps(q, SIMDMATH_TRS_A0B);
+            b = _mm512_permute_ps(q, SIMDMATH_TRS_B0); bB = _mm512_permute_ps(q, SIMDMATH_TRS_B0B);
+        }
+        else if (k == 1)
+        {
+            a = _mm512_permute_ps(q, SIMDMATH_TRS_A1); aB = _mm512_permute_ps(q, SIMDMATH_TRS_A1B);
+            b = _mm512_permute_ps(q, SIMDMATH_TRS_B1); bB = _mm512_permute_ps(q, SIMDMATH_TRS_B1B);
+        }
+        else
+        {
+            a = _mm512_permute_ps(q, SIMDMATH_TRS_A2); aB = _mm512_permute_ps(q, SIMDMATH_TRS_A2B);
+            b = _mm512_permute_ps(q, SIMDMATH_TRS_B2); bB = _mm512_permute_ps(q, SIMDMATH_TRS_B2B);
+        }
+        __m512 products = _mm512_add_ps(_mm512_mul_ps(a, aB), _mm512_mul_ps(_mm512_mul_ps(b, bB), _mm512_broadcast_f32x4(_mm_loadu_ps(TRS_B_SIGN[k]))));
+        __m512 twice = _mm512_mul_ps(_mm512_set1_ps(2.0f), products);
+        __m512 column = _mm512_add_ps(_mm512_broadcast_f32x4(_mm_loadu_ps(TRS_IDENTITY[k])),
+            _mm512_mul_ps(_mm512_broadcast_f32x4(_mm_loadu_ps(TRS_SIGN[k])), twice));
+        return _mm512_mul_ps(column, scale);
+    }
+
+    SIMDMATH_TARGET("avx512f")
+    inline void composeAvx512(const glm::vec3* t, const glm::quat* r, const glm::vec3* s, glm::mat4* out, size_t count)
+    {
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            __m512 q = _mm512_loadu_ps(&r[i].x);
+            __m512 c0 = trsColumnAvx512(q, 0, quadScalars(s[i].x, s[i + 1].x, s[i + 2].x, s[i + 3].x));
+            __m512 c1 = trsColumnAvx512(q, 1, quadScalars(s[i].y, s[i + 1].y, s[i + 2].y, s[i + 3].y));
+            __m512 c2 = trsColumnAvx512(q, 2, quadScalars(s[i].z, s[i + 1].z, s[i + 2].z, s[i + 3].z));
+            __m512 c3 = quadPoints(t + i, 1.0f);
+            transposeQuads(c0, c1, c2, c3);
+            _mm512_storeu_ps(columns(out[i]), c0);
+            _mm512_storeu_ps(columns(out[i + 1]), c1);
+            _mm512_storeu_ps(columns(out[i + 2]), c2);
+            _mm512_storeu_ps(columns(out[i + 3]), c3);
+        }
+        composeSse(t + i, r + i, s + i, out + i, count - i);
+    }
+
+    SIMDMATH_TARGET("avx512f")
+    inline void pointsAvx512(const glm::mat4& m, const glm::vec3* p, glm::vec3* out, size_t count)
+    {
+        const float* mc = columns(m);
+        __m512 m0 = _mm512_broadcast_f32x4(_mm_loadu_ps(mc)), m1 = _mm512_broadcast_f32x4(_mm_loadu_ps(mc + 4));
+        __m512 m2 = _mm512_broadcast_f32x4(_mm_loadu_ps(mc + 8)), m3 = _mm512_broadcast_f32x4(_mm_loadu_ps(mc + 12));
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            __m512 v = quadPoints(p + i, 0.0f);
+            __m512 xy = _mm512_add_ps(_mm512_mul_ps(m0, _mm512_permute_ps(v, 0x00)), _mm512_mul_ps(m1, _mm512_permute_ps(v, 0x55)));
+            __m512 zw = _mm512_add_ps(_mm512_mul_ps(m2, _mm512_permute_ps(v, 0xAA)), m3);
+            storeQuadPoints(out + i, _mm512_add_ps(xy, zw));
+        }
+        pointsSse(m, p + i, out + i, count - i);
+    }
+
+    SIMDMATH_TARGET("avx512f")
+    inline void aabbsAvx512(const glm::mat4* m, const glm::vec3* boundsMin, const glm::vec3* boundsMax,
+        glm::vec3* outMin, glm::vec3* outMax, size_t count)
+    {
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            __m512 c0 = _mm512_loadu_ps(columns(m[i])), c1 = _mm512_loadu_ps(columns(m[i + 1]));
+            __m512 c2 = _mm512_loadu_ps(columns(m[i + 2])), c3 = _mm512_loadu_ps(columns(m[i + 3]));
+            transposeQuads(c0, c1, c2, c3);
+            __m512 mins = quadPoints(boundsMin + i, 0.0f);
+            __m512 maxs = quadPoints(boundsMax + i, 0.0f);
+
+            __m512 a0 = _mm512_mul_ps(c0, _mm512_permute_ps(mins, 0x00)), b0 = _mm512_mul_ps(c0, _mm512_permute_ps(maxs, 0x00));
+            __m512 a1 = _mm512_mul_ps(c1, _mm512_permute_ps(mins, 0x55)), b1 = _mm512_mul_ps(c1, _mm512_permute_ps(maxs, 0x55));
+            __m512 a2 = _mm512_mul_ps(c2, _mm512_permute_ps(mins, 0xAA)), b2 = _mm512_mul_ps(c2, _mm512_permute_ps(maxs, 0xAA));
+            __m512 lo = _mm512_add_ps(_mm512_add_ps(_mm512_min_ps(a0, b0), _mm512_min_ps(a1, b1)), _mm512_add_ps(_mm512_min_ps(a2, b2), c3));
+            __m512 hi = _mm512_add_ps(_mm512_add_ps(_mm512_max_ps(a0, b0), _mm512_max_ps(a1, b1)), _mm512_add_ps(_mm512_max_ps(a2, b2), c3));
+            storeQuadPoints(outMin + i, lo);
+            storeQuadPoints(outMax + i, hi);
+        }
+        aabbsSse(m + i, boundsMin + i, boundsMax + i, outMin + i, outMax + i, count - i);
+    }
+
+    // both halves of a register set to the same eight lanes, without needing AVX-512DQ
+    SIMDMATH_TARGET("avx512f")
+    inline __m512 repeatLanes(const float* lanes)
+    {
+        __m256d half = _mm256_castps_pd(_mm256_loadu_ps(lanes));
+        return _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castpd256_pd512(half), half, 1));
+    }
+
+    // eight plane lanes for each of two boxes per iteration
+    SIMDMATH_TARGET("avx512f")
+    inline void planesAvx512(const glm::vec4 planes[6], const glm::vec3* boundsMin, const glm::vec3* boundsMax,
+        unsigned char* visible, size_t count)
+    {
+        PlaneLanes lanes;
+        splitPlanes(planes, lanes);
+        __m512 nx = repeatLanes(lanes.nx), ny = repeatLanes(lanes.ny), nz = repeatLanes(lanes.nz), w = repeatLanes(lanes.w);
+        __m512 ax = repeatLanes(lanes.ax), ay = repeatLanes(lanes.ay), az = repeatLanes(lanes.az);
+
+        const __m128 half = _mm_set1_ps(0.5f);
+        size_t i = 0;
+        for (; i + 2 <= count; i += 2)
+        {
+            __m128 centers[2], extents[2];
+            for (int b = 0; b < 2; ++b)
+            {
+                __m128 lo = loadPoint(boundsMin[i + b], 0.0f), hi = loadPoint(boundsMax[i + b], 0.0f);
+                centers[b] = _mm_mul_ps(_mm_add_ps(lo, hi), half);
+                extents[b] = _mm_mul_ps(_mm_sub_ps(hi, lo), half);
+            }
+            // lanes 0-7 test the first box, 8-15 the second
+            __m512 c = _mm512_insertf32x4(_mm512_insertf32x4(_mm512_broadcast_f32x4(centers[0]), centers[1], 2), centers[1], 3);
+            __m512 e = _mm512_insertf32x4(_mm512_insertf32x4(_mm512_broadcast_f32x4(extents[0]), extents[1], 2), extents[1], 3);
+
+            __m512 distance = _mm512_add_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(nx, _mm512_permute_ps(c, 0x00)),
+                _mm512_mul_ps(ny, _mm512_permute_ps(c, 0x55))), _mm512_mul_ps(nz, _mm512_permute_ps(c, 0xAA))), w);
+            __m512 radius = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(_mm512_permute_ps(e, 0x00), ax),
+                _mm512_mul_ps(_mm512_permute_ps(e, 0x55), ay)), _mm512_mul_ps(_mm512_permute_ps(e, 0xAA), az));
+            __mmask16 outside = _mm512_cmp_ps_mask(distance, _mm512_sub_ps(_mm512_setzero_ps(), radius), _CMP_LT_OQ);
+            visible[i] = (outside & 0x00FF) == 0;
+            visible[i + 1] = (outside & 0xFF00) == 0;
+        }
+        planesSse(planes, boundsMin + i, boundsMax + i, visible + i, count - i);
+    }
+
+    // cpuid and the OS's saved register state, so a CPU with AVX under an OS that does not save it stays on SSE
+    inline void cpuid(int leaf, int subleaf, unsigned int regs[4])
+    {
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuidex(info, leaf, subleaf);
+        for (int r = 0; r < 4; ++r)
+            regs[r] = (unsigned int)info[r];
+#else
+        __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+    }
+
+    inline unsigned long long savedState()
+    {
+#if defined(_MSC_VER)
+        return _xgetbv(0);
+#else
+        unsigned int lo, hi;
+        __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+        return ((unsigned long long)hi << 32) | lo;
+#endif
+    }
+
+    inline SimdMath_Level detectLevel()
+    {
+        unsigned int regs[4];
+        cpuid(0, 0, regs);
+        const unsigned int maxLeaf = regs[0];
+        if (maxLeaf < 7)
+            return SIMDMATH_SSE;
+
+        cpuid(1, 0, regs);
+        const bool osxsave = (regs[2] & (1u << 27)) != 0, avx = (regs[2] & (1u << 28)) != 0;
+        if (!osxsave || !avx)
+            return SIMDMATH_SSE;
+
+        const unsigned long long state = savedState();
+        cpuid(7, 0, regs);
+        const bool avx2 = (regs[1] & (1u << 5)) != 0 && (state & 0x6) == 0x6;
+        const bool avx512 = (regs[1] & (1u << 16)) != 0 && (state & 0xE6) == 0xE6;
+        return avx512 && avx2 ? SIMDMATH_AVX512 : avx2 ? SIMDMATH_AVX2 : SIMDMATH_SSE;
+    }
+#else
+    inline SimdMath_Level detectLevel()
+    {
+        return SIMDMATH_SCALAR;
+    }
+#endif
+}
+
+// The best level this CPU runs, detected once
+inline SimdMath_Level SimdMathBestLevel()
+{
+    static const SimdMath_Level best = simdmath_detail::detectLevel();
+    return best;
+}
+
+// Kernels of one level, NULL when the CPU or the build does not have it
+inline const SimdMathKernels* SimdMathLevel(SimdMath_Level level)
+{
+    using namespace simdmath_detail;
+    static const SimdMathKernels kernels[NUM_SIMDMATH_LEVELS] = {
+        { "scalar", multiplyScalar, multiplySharedScalar, composeScalar, pointsScalar, aabbsScalar, planesScalar },
+#ifdef SIMDMATH_X86
+        { "SSE2", multiplyPairsSse, multiplySharedSse, composeSse, pointsSse, aabbsSse, planesSse },
+        { "AVX2", multiplyPairsAvx2, multiplySharedAvx2, composeAvx2, pointsAvx2, aabbsAvx2, planesAvx2 },
+        { "AVX-512", multiplyPairsAvx512, multiplySharedAvx512, composeAvx512, pointsAvx512, aabbsAvx512, planesAvx512 },
+#endif
+    };
+    return level <= SimdMathBestLevel() ? &kernels[level] : NULL;
+}
+
+// Kernels of the best level
+inline const SimdMathKernels& SimdMath()
+{
+    return *SimdMathLevel(SimdMathBestLevel());
+}
+#endif
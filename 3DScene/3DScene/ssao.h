@@ -0,0 +1,294 @@
+#ifndef SSAO_H
+#define SSAO_H
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "gputimer.h" // GPU time of the passes
+#include "resources.h" // GPU resource tracking
+
+// GPU time the passes may take together; presets are stepped down above it
+const float SSAO_DEFAULT_BUDGET_MS = 1.0f;
+// A preset is only raised when the one above was measured under this share of the budget, or never measured
+const float SSAO_RAISE_FRACTION = 0.7f;
+// Results a preset is timed over before the next change, on top of the queries in flight from the last one
+const unsigned int SSAO_SETTLE_SAMPLES = 30;
+// View space distance a sample reaches, and how dark full occlusion gets
+const float SSAO_RADIUS = 0.35f;
+const float SSAO_INTENSITY = 1.0f;
+// Largest sample disc in half resolution pixels, so close-ups cost no more than the scene at a distance
+const float SSAO_MAX_RADIUS_PIXELS = 48.0f;
+// Depth difference, relative to the depth, at which the blur and the upsample stop mixing two texels
+const float SSAO_DEPTH_SHARPNESS = 16.0f;
+
+// Quality presets, cheapest first; the passes pick one from their measured cost unless it is fixed
+enum Ssao_Quality {
+    SSAO_LOW,
+    SSAO_MEDIUM,
+    SSAO_HIGH,
+    NUM_SSAO_QUALITIES
+};
+
+namespace ssao_detail
+{
+    struct Preset
+    {
+        const char* name;
+        int samples;        // per half resolution pixel, rotated by the 4x4 interleave
+        int blurRadius;     // taps on each side, per blur direction
+    };
+
+    const Preset PRESETS[NUM_SSAO_QUALITIES] = {
+        { "low", 6, 2 },
+        { "medium", 10, 3 },
+        { "high", 16, 4 }
+    };
+
+    inline GLuint createTexture(const char* label, GLenum format, int width, int height)
+    {
+        GLuint texture = GpuResources().GenTexture(label);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        GpuResources().TexStorage2D(GL_TEXTURE_2D, texture, 1, format, width, height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return texture;
+    }
+}
+
+// Screen-space ambient occlusion computed at half resolution and multiplied into the shaded scene.
+// Four compute passes: view space depth and normals reduced from the depth buffer, occlusion with a
+// sample pattern rotated over 4x4 pixel blocks, a depth-aware blur in x and then y that averages the
+// pattern out, and a bilateral upsample that darkens the full resolution color in place.
+// The passes are timed together; with automatic quality the preset moves down while over the budget
+// and back up only to a preset whose measured cost fits.
+class AmbientOcclusion
+{
+public:
+    // smoothed GPU time of the passes
+    GpuTimer Timer;
+    // last measured cost of each preset, 0 until it has run long enough
+    float PresetMs[NUM_SSAO_QUALITIES];
+    // number of preset changes
+    unsigned int Changes;
+
+    AmbientOcclusion() : Changes(0), budgetMs(SSAO_DEFAULT_BUDGET_MS), quality(SSAO_MEDIUM), automatic(true),
+        prepareProgram(0), occlusionProgram(0), blurProgram(0), upsampleProgram(0), depthNormal(0), width(0), height(0), settledAt(0)
+    {
+        occlusion[0] = occlusion[1] = 0;
+        for (int i = 0; i < NUM_SSAO_QUALITIES; ++i)
+            PresetMs[i] = 0.0f;
+    }
+
+    // the four compute programs; width and height are the window's, the most the scene is rendered at
+    void Create(GLuint prepare, GLuint occlude, GLuint blur, GLuint upsample, int windowWidth, int windowHeight)
+    {
+        prepareProgram = prepare;
+        occlusionProgram = occlude;
+        blurProgram = blur;
+        upsampleProgram = upsample;
+        Timer.Create();
+        Resize(windowWidth, windowHeight);
+    }
+
+    void Destroy()
+    {
+        destroyTextures();
+        Timer.Destroy();
+    }
+
+    bool IsCreated() const
+    {
+        return upsampleProgram != 0;
+    }
+
+    // Half resolution targets for a window of this size; measured costs start over as they depend on it
+    void Resize(int windowWidth, int windowHeight)
+    {
+        if (!upsampleProgram || windowWidth <= 0 || windowHeight <= 0 || (windowWidth == width && windowHeight == height))
+            return;
+
+        width = windowWidth;
+        height = windowHeight;
+        destroyTextures();
+        const int halfWidth = (width + 1) / 2;
+        const int halfHeight = (height + 1) / 2;
+        depthNormal = ssao_detail::createTexture("ssao depth and normals", GL_RGBA16F, halfWidth, halfHeight);
+        occlusion[0] = ssao_detail::createTexture("ssao occlusion", GL_R8, halfWidth, halfHeight);
+        occlusion[1] = ssao_detail::createTexture("ssao blur", GL_R8, halfWidth, halfHeight);
+        forgetCosts();
+    }
+
+    // a fixed preset, or automatic to follow the measured cost
+    void SetQuality(Ssao_Quality fixedQuality, bool automaticQuality)
+    {
+        quality = fixedQuality;
+        automatic = automaticQuality;
+        settledAt = Timer.Samples + GPU_TIMER_QUERIES;
+    }
+
+    void SetBudget(float milliseconds)
+    {
+        budgetMs = milliseconds;
+    }
+
+    float Budget() const { return budgetMs; }
+    bool Automatic() const { return automatic; }
+    const char* QualityName() const { return ssao_detail::PRESETS[quality].name; }
+
+    // Darkens the scene's color texture where it is occluded. renderWidth and renderHeight are the part of
+    // the targets the scene was drawn into, projection the matrix it was drawn with.
+    void Apply(GLuint colorTexture, GLuint depthTexture, int renderWidth, int renderHeight, const glm::mat4& projection)
+    {
+        if (!upsampleProgram || renderWidth <= 0 || renderHeight <= 0)
+            return;
+
+        const ssao_detail::Preset& preset = ssao_detail::PRESETS[quality];
+        const int halfWidth = (renderWidth + 1) / 2;
+        const int halfHeight = (renderHeight + 1) / 2;
+        const glm::mat4 inverseProjection = glm::inverse(projection);
+        Timer.Begin();
+
+        // view space normals and depth of one texel in each 2x2 of the depth buffer
+        glUseProgram(prepareProgram);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        glUniform1i(glGetUniformLocation(prepareProgram, "depthBuffer"), 0);
+        glUniform2i(glGetUniformLocation(prepareProgram, "renderSize"), renderWidth, renderHeight);
+        glUniformMatrix4fv(glGetUniformLocation(prepareProgram, "inverseProjection"), 1, GL_FALSE, glm::value_ptr(inverseProjection));
+        glBindImageTexture(0, depthNormal, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+        dispatch(halfWidth, halfHeight);
+
+        // occlusion; the sample disc shrinks with distance, projection[1][1] is the cotangent of half the field of view
+        glUseProgram(occlusionProgram);
+        glBindTexture(GL_TEXTURE_2D, depthNormal);
+        glUniform1i(glGetUniformLocation(occlusionProgram, "depthNormal"), 0);
+        glUniform2i(glGetUniformLocation(occlusionProgram, "size"), halfWidth, halfHeight);
+        glUniform2f(glGetUniformLocation(occlusionProgram, "viewScale"), 1.0f / projection[0][0], 1.0f / projection[1][1]);
+        glUniform1f(glGetUniformLocation(occlusionProgram, "projectionScale"), 0.5f * projection[1][1] * halfHeight);
+        glUniform1f(glGetUniformLocation(occlusionProgram, "radius"), SSAO_RADIUS);
+        glUniform1f(glGetUniformLocation(occlusionProgram, "maxRadiusPixels"), SSAO_MAX_RADIUS_PIXELS);
+        glUniform1f(glGetUniformLocation(occlusionProgram, "intensity"), SSAO_INTENSITY);
+        glUniform1i(glGetUniformLocation(occlusionProgram, "sampleCount"), preset.samples);
+        glBindImageTexture(0, occlusion[0], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R8);
+        dispatch(halfWidth, halfHeight);
+
+        // blur in x into the second texture, then in y back into the first
+        glUseProgram(blurProgram);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, depthNormal);
+        glUniform1i(glGetUniformLocation(blurProgram, "occlusion"), 0);
+        glUniform1i(glGetUniformLocation(blurProgram, "depthNormal"), 1);
+        glUniform2i(glGetUniformLocation(blurProgram, "size"), halfWidth, halfHeight);
+        glUniform1i(glGetUniformLocation(blurProgram, "blurRadius"), preset.blurRadius);
+        glUniform1f(glGetUniformLocation(blurProgram, "sharpness"), SSAO_DEPTH_SHARPNESS);
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, occlusion[pass]);
+            glUniform2i(glGetUniformLocation(blurProgram, "direction"), pass == 0 ? 1 : 0, pass == 0 ? 0 : 1);
+            glBindImageTexture(0, occlusion[1 - pass], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R8);
+            dispatch(halfWidth, halfHeight);
+        }
+
+        // back to full resolution, each pixel weighing the four nearest half resolution texels by depth
+        glUseProgram(upsampleProgram);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, depthNormal);
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, occlusion[0]);
+        glUniform1i(glGetUniformLocation(upsampleProgram, "depthBuffer"), 0);
+        glUniform1i(glGetUniformLocation(upsampleProgram, "depthNormal"), 1);
+        glUniform1i(glGetUniformLocation(upsampleProgram, "occlusion"), 2);
+        glUniform2i(glGetUniformLocation(upsampleProgram, "renderSize"), renderWidth, renderHeight);
+        glUniformMatrix4fv(glGetUniformLocation(upsampleProgram, "inverseProjection"), 1, GL_FALSE, glm::value_ptr(inverseProjection));
+        glUniform1f(glGetUniformLocation(upsampleProgram, "sharpness"), SSAO_DEPTH_SHARPNESS);
+        glBindImageTexture(0, colorTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA8);
+        dispatch(renderWidth, renderHeight);
+
+        // the present pass samples the color next
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        RenderCounters().StateChanges += 4;
+        Timer.End();
+
+        if (automatic)
+            adapt();
+    }
+
+private:
+    float budgetMs;
+    Ssao_Quality quality;
+    bool automatic;
+    GLuint prepareProgram;
+    GLuint occlusionProgram;
+    GLuint blurProgram;
+    GLuint upsampleProgram;
+    GLuint depthNormal;     // view space normal in xyz, view space depth in w
+    GLuint occlusion[2];    // occlusion and the blur's intermediate
+    int width;
+    int height;
+    unsigned int settledAt; // timer sample count from which the current preset's cost is its own
+
+    // every pass waits for the images the one before it wrote
+    void dispatch(int threadsX, int threadsY)
+    {
+        glDispatchCompute((threadsX + 7) / 8, (threadsY + 7) / 8, 1);
+        ++RenderCounters().Dispatches;
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+    }
+
+    // Steps down while over the budget; steps up to a preset that was measured under it, or never measured
+    void adapt()
+    {
+        if (Timer.Samples < settledAt + SSAO_SETTLE_SAMPLES)
+            return;
+
+        PresetMs[quality] = Timer.AverageMs;
+        int next = quality;
+        if (Timer.AverageMs > budgetMs && quality > SSAO_LOW)
+            next = quality - 1;
+        else if (quality + 1 < NUM_SSAO_QUALITIES && Timer.AverageMs < budgetMs * SSAO_RAISE_FRACTION &&
+            (PresetMs[quality + 1] == 0.0f || PresetMs[quality + 1] <= budgetMs))
+            next = quality + 1;
+
+        if (next != quality)
+        {
+            quality = (Ssao_Quality)next;
+            ++Changes;
+        }
+        settledAt = Timer.Samples + GPU_TIMER_QUERIES;
+    }
+
+    void forgetCosts()
+    {
+        for (int i = 0; i < NUM_SSAO_QUALITIES; ++i)
+            PresetMs[i] = 0.0f;
+        settledAt = Timer.Samples + GPU_TIMER_QUERIES;
+    }
+
+    void destroyTextures()
+    {
+        if (depthNormal)
+            GpuResources().DeleteTexture(depthNormal);
+        for (int i = 0; i < 2; ++i)
+        {
+            if (occlusion[i])
+                GpuResources().DeleteTexture(occlusion[i]);
+        }
+    }
+
+    AmbientOcclusion(const AmbientOcclusion&);
+    AmbientOcclusion& operator=(const AmbientOcclusion&);
+};
+#endif
@@ -0,0 +1,262 @@
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include <GL/glew.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "resources.h" // GPU resource tracking
+
+// Compiles and links programs without waiting on them.
+// Every Add hands its shaders and the link to the driver and returns at once; with
+// GL_KHR_parallel_shader_compile the driver works through them on its own threads and
+// Ready polls GL_COMPLETION_STATUS_KHR, so the caller can keep drawing in the meantime.
+// Without the extension the first status query blocks as it always did, and Ready says so.
+class ProgramCompiler
+{
+public:
+    ProgramCompiler() : parallel(false), started(false)
+    {
+    }
+
+    // asks for as many compiler threads as the driver offers; called once after glewInit
+    void Begin()
+    {
+        if (started)
+            return;
+
+        started = true;
+        parallel = GLEW_KHR_parallel_shader_compile != 0;
+        if (parallel)
+            glMaxShaderCompilerThreadsKHR(0xFFFFFFFFu);
+    }
+
+    bool Parallel() const { return parallel; }
+
+    // queues a vertex and fragment program; returns the handle for Ready and Finish
+    int Add(const char* label, const char* vertexSource, const char* fragmentSource)
+    {
+        Program program = start(label);
+        program.shaders[0] = compile(GL_VERTEX_SHADER, "vertex shader", vertexSource);
+        program.shaders[1] = compile(GL_FRAGMENT_SHADER, "fragment shader", fragmentSource);
+        program.shaderCount = 2;
+        return link(program);
+    }
+
+    int AddCompute(const char* label, const char* computeSource)
+    {
+        Program program = start(label);
+        program.shaders[0] = compile(GL_COMPUTE_SHADER, "compute shader", computeSource);
+        program.shaderCount = 1;
+        return link(program);
+    }
+
+    // true once the link has completed; never blocks when the driver compiles in parallel
+    bool Ready(int handle)
+    {
+        Program& program = programs[handle];
+        if (!program.ready)
+        {
+            GLint complete = GL_TRUE;
+            if (parallel)
+                glGetProgramiv(program.id, GL_COMPLETION_STATUS_KHR, &complete);
+            if (complete)
+            {
+                program.ready = true;
+                program.readyMs = std::chrono::duration<float, std::milli>(Clock::now() - program.submitted).count();
+            }
+        }
+        return program.ready;
+    }
+
+    bool AllReady()
+    {
+        bool ready = true;
+        for (size_t i = 0; i < programs.size(); ++i)
+            ready = Ready((int)i) && ready;
+        return ready;
+    }
+
+    // waits for the program if needed and checks it, printing the logs of whatever failed;
+    // returns the linked program, or 0 after deleting it
+    GLuint Finish(int handle)
+    {
+        Ready(handle);
+        Program& program = programs[handle];
+
+        GLint success = 0;
+        char infoLog[512];
+        glGetProgramiv(program.id, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            for (int s = 0; s < program.shaderCount; ++s)
+            {
+                GLint compiled = 0;
+                glGetShaderiv(program.shaders[s], GL_COMPILE_STATUS, &compiled);
+                if (compiled)
+                    continue;
+
+                GLint type = 0;
+                glGetShaderiv(program.shaders[s], GL_SHADER_TYPE, &type);
+                glGetShaderInfoLog(program.shaders[s], sizeof(infoLog), NULL, infoLog);
+                std::cout << "ERROR::SHADER::" << (type == GL_VERTEX_SHADER ? "VERTEX" : type == GL_FRAGMENT_SHADER ? "FRAGMENT" : "COMPUTE")
+                    << "::COMPILATION_FAILED (" << program.label << ")\n" << infoLog << std::endl;
+            }
+            glGetProgramInfoLog(program.id, sizeof(infoLog), NULL, infoLog);
+            std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED (" << program.label << ")\n" << infoLog << std::endl;
+        }
+
+        // the linked program keeps the compiled code, the shader objects are no longer needed
+        for (int s = 0; s < program.shaderCount; ++s)
+        {
+            glDetachShader(program.id, program.shaders[s]);
+            GpuResources().DeleteShader(program.shaders[s]);
+        }
+        program.shaderCount = 0;
+
+        GLuint id = program.id;
+        if (!success)
+            GpuResources().DeleteProgram(id);
+        return id;
+    }
+
+    // time from submission to a completed link, 0 until Ready returned true
+    float ReadyMs(int handle) const { return programs[handle].readyMs; }
+    const std::string& Label(int handle) const { return programs[handle].label; }
+    int Size() const { return (int)programs.size(); }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Program
+    {
+        std::string label;
+        GLuint id;
+        GLuint shaders[2];
+        int shaderCount;
+        Clock::time_point submitted;
+        bool ready;
+        float readyMs;
+    };
+
+    bool parallel;
+    bool started;
+    std::vector<Program> programs;
+
+    Program start(const char* label)
+    {
+        Begin();
+        Program program;
+        program.label = label;
+        program.id = GpuResources().CreateProgram(label);
+        program.shaderCount = 0;
+        program.submitted = Clock::now();
+        program.ready = false;
+        program.readyMs = 0.0f;
+        return program;
+    }
+
+    static GLuint compile(GLenum type, const char* label, const char* source)
+    {
+        GLuint shader = GpuResources().CreateShader(type, label);
+        glShaderSource(shader, 1, &source, NULL);
+        glCompileShader(shader);
+        return shader;
+    }
+
+    // linking right away is fine: the driver orders it after the compiles, and the status is only read later
+    int link(Program& program)
+    {
+        for (int s = 0; s < program.shaderCount; ++s)
+            glAttachShader(program.id, program.shaders[s]);
+        glLinkProgram(program.id);
+        programs.push_back(program);
+        return (int)programs.size() - 1;
+    }
+};
+
+// Phases of startup measured from process start, recorded from any thread and printed once the first full frame is out
+class StartupTimeline
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    StartupTimeline() : origin(Clock::now()), reported(false)
+    {
+    }
+
+    Clock::time_point Now() const { return Clock::now(); }
+
+    // a phase that ran from begin until now
+    void Record(const char* phase, Clock::time_point begin, const char* thread = "main")
+    {
+        add(phase, thread, begin, Clock::now());
+    }
+
+    // a phase timed by someone else, e.g. a job on a worker
+    void Record(const char* phase, Clock::time_point begin, Clock::time_point end, const char* thread)
+    {
+        add(phase, thread, begin, end);
+    }
+
+    // a moment rather than a phase, e.g. the first frame on screen
+    void Mark(const char* event, const char* thread = "main")
+    {
+        Clock::time_point now = Clock::now();
+        add(event, thread, now, now);
+    }
+
+    bool Reported() const { return reported; }
+
+    void Report(std::ostream& out)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::stable_sort(phases.begin(), phases.end(), [](const Phase& a, const Phase& b) { return a.beginMs < b.beginMs; });
+
+        out << "INFO: Startup timeline (ms from process start):" << std::endl;
+        for (size_t i = 0; i < phases.size(); ++i)
+        {
+            out << "INFO:   " << std::fixed << std::setprecision(1) << std::setw(8) << phases[i].beginMs;
+            if (phases[i].endMs > phases[i].beginMs)
+                out << " - " << std::setw(8) << phases[i].endMs << "  " << std::setw(7) << phases[i].endMs - phases[i].beginMs << " ms";
+            else
+                out << std::string(24, ' ');
+            out << "  [" << phases[i].thread << "] " << phases[i].name << std::endl;
+        }
+        out.unsetf(std::ios::floatfield);
+        out << std::setprecision(6);
+        reported = true;
+    }
+
+private:
+    struct Phase
+    {
+        std::string name;
+        std::string thread;
+        float beginMs, endMs;
+    };
+
+    Clock::time_point origin;
+    bool reported;
+    std::mutex mutex;
+    std::vector<Phase> phases;
+
+    void add(const char* name, const char* thread, Clock::time_point begin, Clock::time_point end)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Phase entry = { name, thread, milliseconds(begin), milliseconds(end) };
+        phases.push_back(entry);
+    }
+
+    float milliseconds(Clock::time_point time) const
+    {
+        return std::chrono::duration<float, std::milli>(time - origin).count();
+    }
+};
+#endif
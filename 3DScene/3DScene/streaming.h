@@ -0,0 +1,584 @@
+#ifndef STREAMING_H
+#define STREAMING_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "resources.h" // GPU resource tracking
+#include "geometry.h" // Shapes the generated cells are built from
+#include "ring.h" // Object index attribute
+#include "cull.h" // Frustum test of the cells
+
+// Side of one square cell in world units, cells tile the XZ plane
+const float STREAM_CELL_SIZE = 16.0f;
+// Cells per side of the generated world, centered on the origin
+const int STREAM_WORLD_CELLS = 32;
+// Cells whose center lies within this distance of the camera are requested
+const float STREAM_LOAD_RADIUS = 56.0f;
+// Missing cells closer than this show as holes, and count as an I/O stall
+const float STREAM_NEAR_RADIUS = 24.0f;
+// GPU memory the resident cells may use before the least recently used are evicted
+const size_t STREAM_DEFAULT_BUDGET_MB = 16;
+// Bytes uploaded per frame at most, the rest waits for the next frame
+const size_t STREAM_UPLOAD_BYTES_PER_FRAME = 2 << 20;
+// Height of the generated ground, below the desk
+const float STREAM_GROUND_HEIGHT = -4.5f;
+
+const unsigned int STREAM_FILE_MAGIC = 0x444C5257; // "WRLD"
+const unsigned int STREAM_FILE_VERSION = 1;
+
+// Pack file layout: StreamFileHeader, one StreamCellEntry per cell (row major from the -X -Z corner),
+// then the vertex and index data of every cell. Vertices are world-space position and color.
+struct StreamFileHeader
+{
+    unsigned int magic;
+    unsigned int version;
+    int cellsPerSide;
+    float cellSize;
+};
+
+struct StreamCellEntry
+{
+    unsigned int offset;    // from the start of the file
+    unsigned int nVertices;
+    unsigned int nIndices;
+    float boundsMin[3];
+    float boundsMax[3];
+};
+
+namespace streaming_detail
+{
+    // Appends a generated shape moved to position, bounds included
+    inline void AppendShape(const GeometryDesc& desc, const glm::vec3& position, GeometryData& cell)
+    {
+        GeometryData shape;
+        GenerateGeometry(desc, shape);
+
+        const GLuint first = (GLuint)(cell.vertices.size() / cell.floatsPerVertex);
+        for (size_t v = 0; v < shape.vertices.size(); v += shape.floatsPerVertex)
+        {
+            glm::vec3 world = glm::vec3(shape.vertices[v], shape.vertices[v + 1], shape.vertices[v + 2]) + position;
+            cell.vertices.push_back(world.x);
+            cell.vertices.push_back(world.y);
+            cell.vertices.push_back(world.z);
+            for (int c = 3; c < cell.floatsPerVertex; ++c)
+                cell.vertices.push_back(shape.vertices[v + c]);
+
+            cell.boundsMin = glm::min(cell.boundsMin, world);
+            cell.boundsMax = glm::max(cell.boundsMax, world);
+        }
+        for (size_t i = 0; i < shape.indices.size(); ++i)
+            cell.indices.push_back(first + shape.indices[i]);
+    }
+
+    // Small deterministic generator so a cell always gets the same content
+    inline float Random(unsigned int& state)
+    {
+        state = state * 1664525u + 1013904223u;
+        return (state >> 8) * (1.0f / 16777216.0f);
+    }
+}
+
+// Builds the content of cell (x, z): a ground tile and a handful of buildings and props
+inline void GenerateStreamCell(int x, int z, int cellsPerSide, GeometryData& cell)
+{
+    using namespace streaming_detail;
+
+    cell.vertices.clear();
+    cell.indices.clear();
+    cell.floatsPerVertex = FloatsPerVertex(VERTEX_POSITION_COLOR);
+    cell.boundsMin = glm::vec3(1e30f);
+    cell.boundsMax = glm::vec3(-1e30f);
+
+    const float half = STREAM_CELL_SIZE * 0.5f;
+    const glm::vec3 center((x - cellsPerSide * 0.5f + 0.5f) * STREAM_CELL_SIZE, STREAM_GROUND_HEIGHT, (z - cellsPerSide * 0.5f + 0.5f) * STREAM_CELL_SIZE);
+    unsigned int state = (unsigned int)(x * 73856093) ^ (unsigned int)(z * 19349663);
+
+    const float shade = 0.25f + 0.1f * ((x + z) & 1);
+    AppendShape(GeometryDesc::Plane(half, half, 2, 2, glm::vec4(shade, shade + 0.05f, shade, 1.0f)), center, cell);
+
+    const int nProps = 4 + (int)(Random(state) * 8.0f);
+    for (int i = 0; i < nProps; ++i)
+    {
+        glm::vec3 position = center + glm::vec3((Random(state) - 0.5f) * (STREAM_CELL_SIZE - 3.0f), 0.0f, (Random(state) - 0.5f) * (STREAM_CELL_SIZE - 3.0f));
+        glm::vec4 color(0.3f + Random(state) * 0.6f, 0.3f + Random(state) * 0.6f, 0.3f + Random(state) * 0.6f, 1.0f);
+        float size = 0.5f + Random(state) * 1.0f;
+
+        switch ((int)(Random(state) * 3.0f))
+        {
+        case 0:
+        {
+            float height = size * (1.0f + Random(state) * 6.0f);
+            position.y += height;
+            AppendShape(GeometryDesc::RoundedBox(glm::vec3(size, height, size), 0.1f, 1, color), position, cell);
+        }
+        break;
+        case 1:
+            position.y += size;
+            AppendShape(GeometryDesc::Sphere(size, 12, 6, color), position, cell);
+            break;
+        default:
+            position.y += size * 1.5f;
+            AppendShape(GeometryDesc::Cylinder(size * 0.5f, size * 3.0f, 12, color), position, cell);
+            break;
+        }
+    }
+}
+
+// Generates the whole world and writes it as one pack file; returns false when the file cannot be written
+inline bool WriteStreamWorld(const char* path, int cellsPerSide)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file)
+        return false;
+
+    StreamFileHeader header = { STREAM_FILE_MAGIC, STREAM_FILE_VERSION, cellsPerSide, STREAM_CELL_SIZE };
+    std::vector<StreamCellEntry> entries(cellsPerSide * cellsPerSide);
+    unsigned int offset = (unsigned int)(sizeof(header) + entries.size() * sizeof(StreamCellEntry));
+
+    // the table is written last, once every offset is known
+    fseek(file, offset, SEEK_SET);
+    GeometryData cell;
+    bool ok = true;
+    for (int z = 0; z < cellsPerSide && ok; ++z)
+    {
+        for (int x = 0; x < cellsPerSide && ok; ++x)
+        {
+            GenerateStreamCell(x, z, cellsPerSide, cell);
+
+            StreamCellEntry& entry = entries[z * cellsPerSide + x];
+            entry.offset = offset;
+            entry.nVertices = (unsigned int)(cell.vertices.size() / cell.floatsPerVertex);
+            entry.nIndices = (unsigned int)cell.indices.size();
+            for (int a = 0; a < 3; ++a)
+            {
+                entry.boundsMin[a] = cell.boundsMin[a];
+                entry.boundsMax[a] = cell.boundsMax[a];
+            }
+
+            ok = fwrite(cell.vertices.data(), sizeof(GLfloat), cell.vertices.size(), file) == cell.vertices.size()
+                && fwrite(cell.indices.data(), sizeof(GLuint), cell.indices.size(), file) == cell.indices.size();
+            offset += (unsigned int)(cell.vertices.size() * sizeof(GLfloat) + cell.indices.size() * sizeof(GLuint));
+        }
+    }
+
+    fseek(file, 0, SEEK_SET);
+    ok = ok && fwrite(&header, sizeof(header), 1, file) == 1
+        && fwrite(entries.data(), sizeof(StreamCellEntry), entries.size(), file) == entries.size();
+    return fclose(file) == 0 && ok;
+}
+
+// Streams the cells of a pack file around the camera.
+// A background thread reads the cells the render thread asks for, nearest and most in view first.
+// The render thread uploads finished reads within a per-frame byte limit and keeps the uploaded
+// cells in an LRU residency cache under a byte budget. It only ever try-locks the shared queues,
+// so a busy I/O thread delays a request by a frame instead of blocking rendering.
+class CellStreamer
+{
+public:
+    // resident cells found when wanted, and wanted cells that were not resident
+    unsigned int Hits;
+    unsigned int Misses;
+    // frames where a cell near the camera was still missing
+    unsigned int IoStalls;
+    // frames whose request refresh or result pickup found the I/O thread holding the lock
+    unsigned int LockMisses;
+    unsigned int Loads;
+    unsigned int Evictions;
+    // I/O thread time spent reading, and bytes read, as of the last Update that got the lock
+    float IoMs;
+    size_t BytesRead;
+
+    CellStreamer() : Hits(0), Misses(0), IoStalls(0), LockMisses(0), Loads(0), Evictions(0), IoMs(0.0f), BytesRead(0),
+        budget(STREAM_DEFAULT_BUDGET_MB << 20), residentBytes(0), cellsPerSide(0), cellSize(STREAM_CELL_SIZE), frame(0),
+        indexBuffer(0), reading(false), file(NULL), busy(-1), stopping(false), ioMs(0.0f), bytesRead(0)
+    {
+    }
+
+    ~CellStreamer()
+    {
+        stopThread();
+    }
+
+    // reads the cell table and starts the I/O thread; indexBuffer feeds the object index attribute
+    bool Open(const char* path, GLuint objectIndexBuffer)
+    {
+        file = fopen(path, "rb");
+        if (!file)
+            return false;
+
+        StreamFileHeader header;
+        if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != STREAM_FILE_MAGIC || header.version != STREAM_FILE_VERSION || header.cellsPerSide <= 0)
+        {
+            fclose(file);
+            file = NULL;
+            return false;
+        }
+
+        cellsPerSide = header.cellsPerSide;
+        cellSize = header.cellSize;
+        entries.resize(cellsPerSide * cellsPerSide);
+        unreadable.assign(entries.size(), false);
+        if (fread(entries.data(), sizeof(StreamCellEntry), entries.size(), file) != entries.size())
+        {
+            fclose(file);
+            file = NULL;
+            return false;
+        }
+
+        indexBuffer = objectIndexBuffer;
+        stopping = false;
+        worker = std::thread(&CellStreamer::ioThread, this);
+        return true;
+    }
+
+    // stops the I/O thread and frees every resident cell
+    void Close()
+    {
+        stopThread();
+        if (file)
+            fclose(file);
+        file = NULL;
+
+        while (!lru.empty())
+            evict(lru.back());
+        staged.clear();
+        reading = false;
+    }
+
+    // budget in bytes; 0 keeps every loaded cell
+    void SetBudget(size_t budgetBytes)
+    {
+        budget = budgetBytes;
+    }
+
+    // Frees cells not drawn this frame, least recently used first; registered with the GPU tracker
+    size_t Evict(size_t bytesWanted)
+    {
+        size_t freed = 0;
+        while (freed < bytesWanted && !lru.empty() && resident[lru.back()].lastUse < frame)
+        {
+            freed += resident[lru.back()].bytes;
+            evict(lru.back());
+        }
+        return freed;
+    }
+
+    // Requests the cells around the camera, uploads finished reads and trims the cache. Never waits on the I/O thread.
+    void Update(const glm::vec3& cameraPosition, const glm::vec3& cameraFront)
+    {
+        if (!file)
+            return;
+        ++frame;
+
+        // Wanted cells, cheapest first: distance, stretched for cells behind the camera
+        wanted.clear();
+        glm::vec2 eye(cameraPosition.x, cameraPosition.z);
+        glm::vec2 front(cameraFront.x, cameraFront.z);
+        front = glm::length(front) > 1e-4f ? glm::normalize(front) : glm::vec2(0.0f);
+        const int reach = (int)std::ceil(STREAM_LOAD_RADIUS / cellSize);
+        const int centerX = (int)std::floor(eye.x / cellSize + cellsPerSide * 0.5f);
+        const int centerZ = (int)std::floor(eye.y / cellSize + cellsPerSide * 0.5f);
+        bool nearMissing = false;
+
+        for (int z = centerZ - reach; z <= centerZ + reach; ++z)
+        {
+            for (int x = centerX - reach; x <= centerX + reach; ++x)
+            {
+                if (x < 0 || z < 0 || x >= cellsPerSide || z >= cellsPerSide)
+                    continue;
+
+                glm::vec2 toCell = cellCenter(x, z) - eye;
+                float distance = glm::length(toCell);
+                if (distance > STREAM_LOAD_RADIUS)
+                    continue;
+
+                const int key = z * cellsPerSide + x;
+                if (unreadable[key])
+                    continue;
+
+                std::map<int, ResidentCell>::iterator found = resident.find(key);
+                if (found != resident.end())
+                {
+                    ++Hits;
+                    touch(found->second);
+                    continue;
+                }
+
+                ++Misses;
+                nearMissing = nearMissing || distance < STREAM_NEAR_RADIUS;
+                float facing = distance > 1e-4f ? glm::dot(toCell / distance, front) : 1.0f;
+                wanted.push_back(std::make_pair(distance * (1.5f - 0.5f * facing), key));
+            }
+        }
+        std::sort(wanted.begin(), wanted.end());
+        if (nearMissing)
+            ++IoStalls;
+
+        // Hand the new request list over and pick up finished reads, unless the I/O thread holds the lock
+        std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+        if (lock.owns_lock())
+        {
+            requests.clear();
+            for (size_t i = 0; i < wanted.size(); ++i)
+            {
+                if (wanted[i].second != busy && !isStaged(wanted[i].second) && !isCompleted(wanted[i].second))
+                    requests.push_back(wanted[i].second);
+            }
+            while (!completed.empty())
+            {
+                staged.push_back(std::move(completed.front()));
+                completed.pop_front();
+            }
+            reading = !requests.empty() || busy != -1;
+            IoMs = ioMs;
+            BytesRead = bytesRead;
+            lock.unlock();
+            wake.notify_one();
+        }
+        else
+        {
+            ++LockMisses;
+        }
+
+        // Upload what fits in this frame
+        size_t uploaded = 0;
+        while (!staged.empty() && uploaded < STREAM_UPLOAD_BYTES_PER_FRAME)
+        {
+            uploaded += upload(staged.front());
+            staged.pop_front();
+        }
+
+        // Cells not drawn this frame go first once over budget
+        if (budget > 0 && residentBytes > budget)
+            Evict(residentBytes - budget);
+    }
+
+    // draws the resident cells wanted this frame that are in view; objectIndex selects the identity transform
+    int Draw(const glm::mat4& viewProjection, GLuint objectIndex) const
+    {
+        glm::vec4 planes[6];
+        ExtractFrustumPlanes(viewProjection, planes);
+        const glm::mat4 identity(1.0f);
+
+        int drawn = 0;
+        for (std::map<int, ResidentCell>::const_iterator it = resident.begin(); it != resident.end(); ++it)
+        {
+            const ResidentCell& cell = it->second;
+            if (cell.lastUse != frame || !BoxInFrustum(planes, identity, cell.boundsMin, cell.boundsMax))
+                continue;
+
+            glBindVertexArray(cell.vao);
+            glDrawElementsInstancedBaseInstance(GL_TRIANGLES, cell.nIndices, GL_UNSIGNED_INT, NULL, 1, objectIndex);
+            ++drawn;
+        }
+        glBindVertexArray(0);
+        RenderCounters().StateChanges += drawn + 1;
+        RenderCounters().DrawCalls += drawn;
+        return drawn;
+    }
+
+    size_t ResidentCells() const { return resident.size(); }
+    size_t ResidentBytes() const { return residentBytes; }
+    size_t Budget() const { return budget; }
+    // cells still being read or waiting for upload, as of the last Update
+    bool Pending() const { return reading || !staged.empty(); }
+
+private:
+    // One cell read from disk, waiting for upload
+    struct CellData
+    {
+        int key;
+        std::vector<GLfloat> vertices;
+        std::vector<GLuint> indices;
+    };
+
+    struct ResidentCell
+    {
+        GLuint vao, vbo, ebo;
+        GLsizei nIndices;
+        glm::vec3 boundsMin, boundsMax;
+        size_t bytes;
+        unsigned int lastUse;               // frame the cell was last wanted
+        std::list<int>::iterator lruEntry;  // position in the LRU list, most recent at the front
+    };
+
+    size_t budget;
+    size_t residentBytes;
+    int cellsPerSide;
+    float cellSize;
+    unsigned int frame;
+    GLuint indexBuffer;
+    std::vector<StreamCellEntry> entries;
+    std::vector<bool> unreadable;           // cells whose read failed, never requested again
+    std::map<int, ResidentCell> resident;
+    std::list<int> lru;
+    std::deque<CellData> staged;            // read but not uploaded yet, render thread only
+    bool reading;                           // requests handed over or a read in progress at the last Update that got the lock
+    std::vector<std::pair<float, int> > wanted; // cells missing around the camera, kept so Update reuses its room
+
+    // shared with the I/O thread under mutex
+    FILE* file;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<int> requests;              // cells to read, first is most urgent
+    std::deque<CellData> completed;
+    int busy;                               // cell being read, -1 when idle
+    bool stopping;
+    float ioMs;
+    size_t bytesRead;
+
+    glm::vec2 cellCenter(int x, int z) const
+    {
+        return glm::vec2((x - cellsPerSide * 0.5f + 0.5f) * cellSize, (z - cellsPerSide * 0.5f + 0.5f) * cellSize);
+    }
+
+    bool isStaged(int key) const
+    {
+        for (size_t i = 0; i < staged.size(); ++i)
+        {
+            if (staged[i].key == key)
+                return true;
+        }
+        return false;
+    }
+
+    bool isCompleted(int key) const
+    {
+        for (size_t i = 0; i < completed.size(); ++i)
+        {
+            if (completed[i].key == key)
+                return true;
+        }
+        return false;
+    }
+
+    void touch(ResidentCell& cell)
+    {
+        cell.lastUse = frame;
+        lru.splice(lru.begin(), lru, cell.lruEntry);
+    }
+
+    size_t upload(const CellData& data)
+    {
+        if (data.indices.empty())
+            unreadable[data.key] = true;
+        if (resident.count(data.key) || data.indices.empty())
+            return 0;
+
+        const StreamCellEntry& entry = entries[data.key];
+        const GLint stride = sizeof(GLfloat) * FloatsPerVertex(VERTEX_POSITION_COLOR);
+
+        ResidentCell& cell = resident[data.key];
+        cell.nIndices = (GLsizei)data.indices.size();
+        cell.boundsMin = glm::vec3(entry.boundsMin[0], entry.boundsMin[1], entry.boundsMin[2]);
+        cell.boundsMax = glm::vec3(entry.boundsMax[0], entry.boundsMax[1], entry.boundsMax[2]);
+        cell.bytes = data.vertices.size() * sizeof(GLfloat) + data.indices.size() * sizeof(GLuint);
+        cell.lastUse = frame;
+        lru.push_front(data.key);
+        cell.lruEntry = lru.begin();
+        residentBytes += cell.bytes;
+
+        cell.vao = GpuResources().GenVertexArray("cell vao");
+        glBindVertexArray(cell.vao);
+
+        cell.vbo = GpuResources().GenBuffer("cell vbo");
+        glBindBuffer(GL_ARRAY_BUFFER, cell.vbo);
+        GpuResources().BufferData(GL_ARRAY_BUFFER, cell.vbo, data.vertices.size() * sizeof(GLfloat), data.vertices.data(), GL_STATIC_DRAW);
+
+        cell.ebo = GpuResources().GenBuffer("cell ebo");
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cell.ebo);
+        GpuResources().BufferData(GL_ELEMENT_ARRAY_BUFFER, cell.ebo, data.indices.size() * sizeof(GLuint), data.indices.data(), GL_STATIC_DRAW);
+
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, 0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride, (char*)(sizeof(GLfloat) * 3));
+        glEnableVertexAttribArray(1);
+        glBindVertexArray(0);
+
+        BindObjectIndexAttribute(cell.vao, indexBuffer);
+        ++Loads;
+        return cell.bytes;
+    }
+
+    void evict(int key)
+    {
+        std::map<int, ResidentCell>::iterator it = resident.find(key);
+        if (it == resident.end())
+            return;
+
+        GpuResources().DeleteVertexArray(it->second.vao);
+        GpuResources().DeleteBuffer(it->second.vbo);
+        GpuResources().DeleteBuffer(it->second.ebo);
+        residentBytes -= it->second.bytes;
+        lru.erase(it->second.lruEntry);
+        resident.erase(it);
+        ++Evictions;
+    }
+
+    // Reads requested cells one at a time, holding the lock only to take a request and hand back the result
+    void ioThread()
+    {
+        for (;;)
+        {
+            CellData data;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !requests.empty(); });
+                if (stopping)
+                    return;
+
+                data.key = requests.front();
+                requests.erase(requests.begin());
+                busy = data.key;
+            }
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            const StreamCellEntry& entry = entries[data.key];
+            data.vertices.resize((size_t)entry.nVertices * FloatsPerVertex(VERTEX_POSITION_COLOR));
+            data.indices.resize(entry.nIndices);
+            bool ok = fseek(file, (long)entry.offset, SEEK_SET) == 0
+                && fread(data.vertices.data(), sizeof(GLfloat), data.vertices.size(), file) == data.vertices.size()
+                && fread(data.indices.data(), sizeof(GLuint), data.indices.size(), file) == data.indices.size();
+            float readMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            ioMs += readMs;
+            bytesRead += data.vertices.size() * sizeof(GLfloat) + data.indices.size() * sizeof(GLuint);
+            if (!ok)
+                data.indices.clear(); // handed back empty so the render thread stops asking for it
+            completed.push_back(std::move(data));
+            busy = -1;
+        }
+    }
+
+    void stopThread()
+    {
+        if (!worker.joinable())
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            requests.clear();
+        }
+        wake.notify_one();
+        worker.join();
+    }
+};
+#endif
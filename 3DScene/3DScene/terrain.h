@@ -0,0 +1,643 @@
+#ifndef TERRAIN_H
+#define TERRAIN_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <stb_image.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <list>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "resources.h" // GPU resource tracking
+#include "cull.h" // Frustum test of the nodes
+
+// Quads per side of every node; a node at level L spans TERRAIN_TILE_QUADS << L heightfield samples
+const int TERRAIN_TILE_QUADS = 32;
+const int TERRAIN_TILE_SAMPLES = TERRAIN_TILE_QUADS + 1;
+// Height tiles kept on the GPU, one layer of the tile array each
+const int TERRAIN_CACHE_TILES = 256;
+// Tiles uploaded per frame at most, the rest waits for the next frame
+const int TERRAIN_UPLOADS_PER_FRAME = 8;
+// Distance, in leaf node sides, out to which leaves are drawn; every coarser level reaches twice as far
+const float TERRAIN_LOD_RANGE = 3.0f;
+// Part of each level's range, from its start, drawn before vertices begin to morph into the coarser level
+const float TERRAIN_MORPH_START = 0.7f;
+// Skirt below every node edge, as a part of the node side; hides cracks while a neighbour's tile streams in
+const float TERRAIN_SKIRT_DEPTH = 0.05f;
+// Texture unit the height tiles are bound to while drawing
+const GLint TERRAIN_HEIGHT_TEXTURE_UNIT = 3;
+// Samples per side of the heightfield written when the file is missing, a power of two plus one
+const int TERRAIN_GENERATED_SAMPLES = 2049;
+
+namespace terrain_detail
+{
+    inline float hash(int x, int z)
+    {
+        unsigned int h = (unsigned int)x * 73856093u ^ (unsigned int)z * 19349663u;
+        h = (h ^ (h >> 13)) * 1274126177u;
+        return (h ^ (h >> 16)) * (1.0f / 4294967296.0f);
+    }
+
+    // Value noise with smooth interpolation between lattice points
+    inline float valueNoise(float x, float z)
+    {
+        const int x0 = (int)std::floor(x), z0 = (int)std::floor(z);
+        float fx = x - x0, fz = z - z0;
+        fx = fx * fx * (3.0f - 2.0f * fx);
+        fz = fz * fz * (3.0f - 2.0f * fz);
+        const float a = hash(x0, z0) + (hash(x0 + 1, z0) - hash(x0, z0)) * fx;
+        const float b = hash(x0, z0 + 1) + (hash(x0 + 1, z0 + 1) - hash(x0, z0 + 1)) * fx;
+        return a + (b - a) * fz;
+    }
+}
+
+// Writes a fractal heightfield as 16-bit little-endian samples, row major, samplesPerSide squared.
+// The middle is a flat clearing that rises into hills towards the edges; false when the file cannot be written.
+inline bool WriteTerrainHeights(const char* path, int samplesPerSide)
+{
+    using namespace terrain_detail;
+
+    FILE* file = fopen(path, "wb");
+    if (!file)
+        return false;
+
+    std::vector<unsigned char> row(samplesPerSide * 2);
+    const float center = (samplesPerSide - 1) * 0.5f;
+    bool ok = true;
+    for (int z = 0; z < samplesPerSide && ok; ++z)
+    {
+        for (int x = 0; x < samplesPerSide; ++x)
+        {
+            float height = 0.0f, amplitude = 0.5f, frequency = 1.0f / 256.0f;
+            for (int octave = 0; octave < 7; ++octave)
+            {
+                height += valueNoise(x * frequency, z * frequency) * amplitude;
+                amplitude *= 0.5f;
+                frequency *= 2.0f;
+            }
+
+            const float distance = std::sqrt((x - center) * (x - center) + (z - center) * (z - center)) / center;
+            const float hills = glm::clamp((distance - 0.02f) / 0.3f, 0.0f, 1.0f);
+            height = 0.2f + (height - 0.2f) * hills * hills * (3.0f - 2.0f * hills);
+
+            const unsigned int sample = (unsigned int)(glm::clamp(height, 0.0f, 1.0f) * 65535.0f + 0.5f);
+            row[x * 2] = (unsigned char)(sample & 0xFF);
+            row[x * 2 + 1] = (unsigned char)(sample >> 8);
+        }
+        ok = fwrite(row.data(), 1, row.size(), file) == row.size();
+    }
+    return fclose(file) == 0 && ok;
+}
+
+// Chunked LOD terrain over a heightfield too large to keep in memory.
+// The heightfield is covered by a quadtree of nodes that all share one 32x32 quad grid; a node at level L
+// samples every 2^L heights, so a node costs the same triangles at every level and the floor drawn stays
+// near constant however large the file is. Each frame the tree is walked from the root: a node is split
+// while the camera is within the range of its children's level and their height tiles are resident,
+// otherwise it is drawn whole. Vertices morph into the coarser level towards the end of each range (CDLOD),
+// so neighbouring levels meet without cracks; a skirt under every edge covers the gaps left while a
+// finer tile is still streaming in.
+// Height tiles are read by a background thread, from a 16-bit raw file row by row or from a decoded PNG,
+// and live in an LRU cache of texture array layers; the root tile is always resident.
+class ChunkedTerrain
+{
+public:
+    // nodes and triangles drawn last frame
+    int NodesDrawn;
+    int Triangles;
+    // nodes drawn coarser than wanted because a child tile was not resident
+    unsigned int Misses;
+    unsigned int LockMisses;
+    unsigned int Loads;
+    unsigned int Evictions;
+    // I/O thread time spent reading, and bytes read, as of the last Update that got the lock
+    float IoMs;
+    size_t BytesRead;
+
+    ChunkedTerrain() : NodesDrawn(0), Triangles(0), Misses(0), LockMisses(0), Loads(0), Evictions(0), IoMs(0.0f), BytesRead(0),
+        width(0), height(0), rootLevel(0), spacing(1.0f), heightScale(1.0f), heightOffset(0.0f), origin(0.0f), frame(0),
+        nIndices(0), vao(0), gridVbo(0), ebo(0), instanceVbo(0), heightTiles(0), reading(false), uploadsBlocked(false),
+        file(NULL), pixels(NULL), busy(~0ull), stopping(false), ioMs(0.0f), bytesRead(0)
+    {
+    }
+
+    ~ChunkedTerrain()
+    {
+        stopThread();
+    }
+
+    // Opens a .png or 16-bit raw heightfield (square, size taken from the file length) with samples spacing
+    // apart, centered on the origin; heights span heightScale and the center sample sits at centerHeight
+    bool Open(const char* path, float sampleSpacing, float scale, float centerHeight)
+    {
+        const size_t length = strlen(path);
+        if (length > 4 && (strcmp(path + length - 4, ".png") == 0 || strcmp(path + length - 4, ".PNG") == 0))
+        {
+            // rows stay in file order, z grows down the image
+            int channels = 0;
+            stbi_set_flip_vertically_on_load(0);
+            pixels = stbi_load_16(path, &width, &height, &channels, 1);
+            if (!pixels)
+                return false;
+        }
+        else
+        {
+            file = fopen(path, "rb");
+            if (!file)
+                return false;
+
+            fseek(file, 0, SEEK_END);
+            const long bytes = ftell(file);
+            width = height = (int)std::floor(std::sqrt(bytes / 2.0) + 0.5);
+            if (width < 2 || (long)width * width * 2 != bytes)
+            {
+                fclose(file);
+                file = NULL;
+                return false;
+            }
+        }
+
+        rootLevel = 0;
+        while ((TERRAIN_TILE_QUADS << rootLevel) < std::max(width, height) - 1)
+            ++rootLevel;
+        spacing = sampleSpacing;
+        heightScale = scale;
+        origin = glm::vec2(-(width - 1) * 0.5f, -(height - 1) * 0.5f) * spacing;
+
+        unsigned short center = 0;
+        readSamples(height / 2, width / 2, 1, 1, &center);
+        heightOffset = centerHeight - center / 65535.0f * heightScale;
+
+        createBuffers();
+
+        // the root is read here, so there is always something to draw
+        TileData root;
+        root.key = tileKey(rootLevel, 0, 0);
+        readTile(root);
+        upload(root);
+        rootKey = root.key;
+
+        stopping = false;
+        worker = std::thread(&ChunkedTerrain::ioThread, this);
+        return true;
+    }
+
+    // stops the I/O thread and frees the tiles and buffers
+    void Close()
+    {
+        stopThread();
+        if (file)
+            fclose(file);
+        file = NULL;
+        if (pixels)
+            stbi_image_free(pixels);
+        pixels = NULL;
+
+        resident.clear();
+        lru.clear();
+        staged.clear();
+        freeLayers.clear();
+        reading = uploadsBlocked = false;
+        if (vao)
+        {
+            GpuResources().DeleteVertexArray(vao);
+            GpuResources().DeleteBuffer(gridVbo);
+            GpuResources().DeleteBuffer(ebo);
+            GpuResources().DeleteBuffer(instanceVbo);
+            GpuResources().DeleteTexture(heightTiles);
+        }
+    }
+
+    bool IsOpen() const { return vao != 0; }
+
+    // Selects the nodes to draw, requests the tiles the camera is waiting for and uploads finished reads.
+    // Never waits on the I/O thread.
+    void Update(const glm::vec3& cameraPosition, const glm::mat4& viewProjection)
+    {
+        if (!vao)
+            return;
+        ++frame;
+
+        glm::vec4 planes[6];
+        ExtractFrustumPlanes(viewProjection, planes);
+        instances.clear();
+        wanted.clear();
+        select(rootLevel, 0, 0, cameraPosition, planes);
+
+        NodesDrawn = (int)instances.size();
+        Triangles = NodesDrawn * nIndices / 3;
+
+        // coarse tiles first (the level is stored negated), they unlock the levels below them; then nearest first
+        std::sort(wanted.begin(), wanted.end());
+
+        std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+        if (lock.owns_lock())
+        {
+            requests.clear();
+            for (size_t i = 0; i < wanted.size(); ++i)
+            {
+                const unsigned long long key = wanted[i].second;
+                if (key != busy && !isQueued(staged, key) && !isQueued(completed, key))
+                    requests.push_back(key);
+            }
+            while (!completed.empty())
+            {
+                staged.push_back(std::move(completed.front()));
+                completed.pop_front();
+            }
+            reading = !requests.empty() || busy != ~0ull;
+            IoMs = ioMs;
+            BytesRead = bytesRead;
+            lock.unlock();
+            wake.notify_one();
+        }
+        else
+        {
+            ++LockMisses;
+        }
+
+        uploadsBlocked = false;
+        for (int uploaded = 0; uploaded < TERRAIN_UPLOADS_PER_FRAME && !staged.empty(); ++uploaded)
+        {
+            if (!upload(staged.front()))
+            {
+                uploadsBlocked = true;
+                break;
+            }
+            staged.pop_front();
+        }
+
+        // Orphan the instance buffer rather than wait for last frame's draw to finish with it
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVbo);
+        GpuResources().BufferData(GL_ARRAY_BUFFER, instanceVbo, std::max<size_t>(instances.size(), 1) * sizeof(NodeInstance), NULL, GL_STREAM_DRAW);
+        if (!instances.empty())
+            glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(NodeInstance), instances.data());
+        RenderCounters().UploadedBytes += instances.size() * sizeof(NodeInstance);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // draws the nodes selected by the last Update with program, which reads the terrain uniforms below
+    void Draw(GLuint program, const glm::vec3& cameraPosition) const
+    {
+        if (!vao || instances.empty())
+            return;
+
+        glUseProgram(program);
+        glActiveTexture(GL_TEXTURE0 + TERRAIN_HEIGHT_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, heightTiles);
+        glActiveTexture(GL_TEXTURE0);
+        glUniform1i(glGetUniformLocation(program, "heights"), TERRAIN_HEIGHT_TEXTURE_UNIT);
+        glUniform2f(glGetUniformLocation(program, "heightMap"), heightScale, heightOffset);
+        glUniform2f(glGetUniformLocation(program, "terrainMax"), origin.x + (width - 1) * spacing, origin.y + (height - 1) * spacing);
+        glUniform3f(glGetUniformLocation(program, "cameraPosition"), cameraPosition.x, cameraPosition.y, cameraPosition.z);
+
+        glBindVertexArray(vao);
+        glDrawElementsInstanced(GL_TRIANGLES, nIndices, GL_UNSIGNED_INT, NULL, (GLsizei)instances.size());
+        glBindVertexArray(0);
+        RenderCounters().StateChanges += 3;
+        ++RenderCounters().DrawCalls;
+    }
+
+    int Width() const { return width; }
+    int Height() const { return height; }
+    int Levels() const { return rootLevel + 1; }
+    size_t ResidentTiles() const { return resident.size(); }
+    // tiles still being read or waiting for upload, as of the last Update; tiles waiting for a layer that
+    // every drawn node uses do not count, they only fit once the view changes
+    bool Pending() const { return reading || (!staged.empty() && !uploadsBlocked); }
+
+private:
+    // One node's height samples, read from disk and waiting for upload
+    struct TileData
+    {
+        unsigned long long key;
+        std::vector<unsigned short> samples;
+    };
+
+    struct ResidentTile
+    {
+        int layer;
+        float minHeight, maxHeight;                         // world heights of the tile's samples
+        unsigned int lastUse;                               // frame the tile was last walked through
+        std::list<unsigned long long>::iterator lruEntry;   // position in the LRU list, most recent at the front
+    };
+
+    // Per-node vertex attributes, 4 and 5 in the terrain shader
+    struct NodeInstance
+    {
+        glm::vec4 node;     // world x and z of the corner, side, tile layer
+        glm::vec4 lod;      // morph start and end distance, skirt depth
+    };
+
+    int width, height;
+    int rootLevel;
+    float spacing, heightScale, heightOffset;
+    glm::vec2 origin;                                       // world x and z of sample (0, 0)
+    unsigned int frame;
+    unsigned long long rootKey;
+    GLsizei nIndices;
+    GLuint vao, gridVbo, ebo, instanceVbo, heightTiles;
+    std::map<unsigned long long, ResidentTile> resident;
+    std::list<unsigned long long> lru;
+    std::vector<int> freeLayers;
+    std::deque<TileData> staged;                            // read but not uploaded yet, render thread only
+    bool reading;                                           // requests handed over or a read in progress at the last Update that got the lock
+    bool uploadsBlocked;                                    // the last Update found no layer to upload into
+    std::vector<NodeInstance> instances;
+    std::vector<std::pair<std::pair<int, float>, unsigned long long> > wanted;
+
+    // shared with the I/O thread under mutex; the file and pixels are only read by it after Open
+    FILE* file;
+    unsigned short* pixels;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<unsigned long long> requests;               // tiles to read, first is most urgent
+    std::deque<TileData> completed;
+    unsigned long long busy;                                // tile being read, ~0 when idle
+    bool stopping;
+    float ioMs;
+    size_t bytesRead;
+
+    static unsigned long long tileKey(int level, int x, int z)
+    {
+        return (unsigned long long)level << 56 | (unsigned long long)z << 28 | (unsigned long long)x;
+    }
+
+    static bool isQueued(const std::deque<TileData>& queue, unsigned long long key)
+    {
+        for (size_t i = 0; i < queue.size(); ++i)
+        {
+            if (queue[i].key == key)
+                return true;
+        }
+        return false;
+    }
+
+    // distance at which a node of this level hands over to the next coarser one
+    float lodRange(int level) const
+    {
+        return TERRAIN_TILE_QUADS * spacing * TERRAIN_LOD_RANGE * (float)(1 << level);
+    }
+
+    // One grid shared by every node: TERRAIN_TILE_SAMPLES vertices per side plus a ring of skirt
+    // vertices, which repeat the edge position and are pushed down in the shader
+    void createBuffers()
+    {
+        std::vector<GLfloat> grid;
+        const int side = TERRAIN_TILE_SAMPLES + 2;
+        for (int row = -1; row <= TERRAIN_TILE_SAMPLES; ++row)
+        {
+            for (int column = -1; column <= TERRAIN_TILE_SAMPLES; ++column)
+            {
+                const bool skirt = row < 0 || column < 0 || row == TERRAIN_TILE_SAMPLES || column == TERRAIN_TILE_SAMPLES;
+                grid.push_back((GLfloat)std::max(0, std::min(column, TERRAIN_TILE_QUADS)));
+                grid.push_back((GLfloat)std::max(0, std::min(row, TERRAIN_TILE_QUADS)));
+                grid.push_back(skirt ? 1.0f : 0.0f);
+            }
+        }
+
+        std::vector<GLuint> indices;
+        for (int row = 0; row < side - 1; ++row)
+        {
+            for (int column = 0; column < side - 1; ++column)
+            {
+                const GLuint corner = row * side + column;
+                indices.push_back(corner);
+                indices.push_back(corner + side);
+                indices.push_back(corner + 1);
+                indices.push_back(corner + 1);
+                indices.push_back(corner + side);
+                indices.push_back(corner + side + 1);
+            }
+        }
+        nIndices = (GLsizei)indices.size();
+
+        vao = GpuResources().GenVertexArray("terrain vao");
+        glBindVertexArray(vao);
+
+        gridVbo = GpuResources().GenBuffer("terrain grid vbo");
+        glBindBuffer(GL_ARRAY_BUFFER, gridVbo);
+        GpuResources().BufferData(GL_ARRAY_BUFFER, gridVbo, grid.size() * sizeof(GLfloat), grid.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), 0);
+        glEnableVertexAttribArray(0);
+
+        ebo = GpuResources().GenBuffer("terrain ebo");
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        GpuResources().BufferData(GL_ELEMENT_ARRAY_BUFFER, ebo, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+
+        instanceVbo = GpuResources().GenBuffer("terrain node vbo");
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVbo);
+        GpuResources().BufferData(GL_ARRAY_BUFFER, instanceVbo, sizeof(NodeInstance), NULL, GL_STREAM_DRAW);
+        glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(NodeInstance), 0);
+        glVertexAttribDivisor(4, 1);
+        glEnableVertexAttribArray(4);
+        glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, sizeof(NodeInstance), (char*)sizeof(glm::vec4));
+        glVertexAttribDivisor(5, 1);
+        glEnableVertexAttribArray(5);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        heightTiles = GpuResources().GenTexture("terrain height tiles");
+        glBindTexture(GL_TEXTURE_2D_ARRAY, heightTiles);
+        GpuResources().TexStorage3D(GL_TEXTURE_2D_ARRAY, heightTiles, 1, GL_R16, TERRAIN_TILE_SAMPLES, TERRAIN_TILE_SAMPLES, TERRAIN_CACHE_TILES);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        for (int layer = TERRAIN_CACHE_TILES - 1; layer >= 0; --layer)
+            freeLayers.push_back(layer);
+    }
+
+    // Walks the quadtree below node (level, x, z), whose tile is resident
+    void select(int level, int x, int z, const glm::vec3& camera, const glm::vec4 planes[6])
+    {
+        ResidentTile& tile = resident[tileKey(level, x, z)];
+        const float side = (float)(TERRAIN_TILE_QUADS << level) * spacing;
+        const glm::vec2 corner = origin + glm::vec2((float)x, (float)z) * side;
+        const glm::vec3 boundsMin(corner.x, tile.minHeight - side * TERRAIN_SKIRT_DEPTH, corner.y);
+        const glm::vec3 boundsMax(corner.x + side, tile.maxHeight, corner.y + side);
+        if (!BoxInFrustum(planes, glm::mat4(1.0f), boundsMin, boundsMax))
+            return;
+
+        tile.lastUse = frame;
+        lru.splice(lru.begin(), lru, tile.lruEntry);
+
+        const glm::vec3 nearest = glm::clamp(camera, boundsMin, boundsMax);
+        const float distance = glm::length(nearest - camera);
+        if (level > 0 && distance < lodRange(level - 1))
+        {
+            // split only once every child that covers part of the heightfield can be drawn
+            const int childSamples = TERRAIN_TILE_QUADS << (level - 1);
+            bool ready = true;
+            for (int child = 0; child < 4; ++child)
+            {
+                const int cx = x * 2 + (child & 1), cz = z * 2 + (child >> 1);
+                if (cx * childSamples >= width - 1 || cz * childSamples >= height - 1)
+                    continue;
+
+                const unsigned long long key = tileKey(level - 1, cx, cz);
+                if (!resident.count(key))
+                {
+                    wanted.push_back(std::make_pair(std::make_pair(1 - level, distance), key));
+                    ready = false;
+                }
+            }
+
+            if (ready)
+            {
+                for (int child = 0; child < 4; ++child)
+                {
+                    const int cx = x * 2 + (child & 1), cz = z * 2 + (child >> 1);
+                    if (cx * childSamples < width - 1 && cz * childSamples < height - 1)
+                        select(level - 1, cx, cz, camera, planes);
+                }
+                return;
+            }
+            ++Misses;
+        }
+
+        const float end = lodRange(level);
+        const float start = level > 0 ? lodRange(level - 1) : 0.0f;
+        NodeInstance instance;
+        instance.node = glm::vec4(corner.x, corner.y, side, (float)tile.layer);
+        instance.lod = glm::vec4(start + (end - start) * TERRAIN_MORPH_START, end, side * TERRAIN_SKIRT_DEPTH, 0.0f);
+        instances.push_back(instance);
+    }
+
+    // Copies a finished read into a free layer, evicting the least recently used tile not walked this frame;
+    // false when every layer is still in use
+    bool upload(const TileData& data)
+    {
+        if (resident.count(data.key))
+            return true;
+
+        if (freeLayers.empty())
+        {
+            // the root stays, even out of view
+            if (lru.back() == rootKey)
+                lru.splice(lru.begin(), lru, resident[rootKey].lruEntry);
+            if (resident[lru.back()].lastUse == frame)
+                return false;
+
+            std::map<unsigned long long, ResidentTile>::iterator oldest = resident.find(lru.back());
+            freeLayers.push_back(oldest->second.layer);
+            lru.pop_back();
+            resident.erase(oldest);
+            ++Evictions;
+        }
+
+        ResidentTile& tile = resident[data.key];
+        tile.layer = freeLayers.back();
+        freeLayers.pop_back();
+        const unsigned short lowest = *std::min_element(data.samples.begin(), data.samples.end());
+        const unsigned short highest = *std::max_element(data.samples.begin(), data.samples.end());
+        tile.minHeight = lowest / 65535.0f * heightScale + heightOffset;
+        tile.maxHeight = highest / 65535.0f * heightScale + heightOffset;
+        tile.lastUse = frame;
+        lru.push_front(data.key);
+        tile.lruEntry = lru.begin();
+
+        // rows of 33 16-bit samples are not 4-byte aligned
+        glBindTexture(GL_TEXTURE_2D_ARRAY, heightTiles);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, tile.layer, TERRAIN_TILE_SAMPLES, TERRAIN_TILE_SAMPLES, 1, GL_RED, GL_UNSIGNED_SHORT, data.samples.data());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        RenderCounters().UploadedBytes += data.samples.size() * sizeof(unsigned short);
+        ++Loads;
+        return true;
+    }
+
+    // Reads count samples every step along row starting at column, clamped to the heightfield edge
+    void readSamples(int row, int column, int count, int step, unsigned short* out)
+    {
+        row = std::min(row, height - 1);
+        if (pixels)
+        {
+            for (int i = 0; i < count; ++i)
+                out[i] = pixels[(size_t)row * width + std::min(column + i * step, width - 1)];
+            return;
+        }
+
+        // one read covers the run of the row the samples come from
+        const int last = std::min(column + (count - 1) * step, width - 1);
+        std::vector<unsigned char> bytes((last - column + 1) * 2);
+        if (fseek(file, ((long)row * width + column) * 2, SEEK_SET) != 0 || fread(bytes.data(), 1, bytes.size(), file) != bytes.size())
+            bytes.assign(bytes.size(), 0);
+        for (int i = 0; i < count; ++i)
+        {
+            const int at = std::min(column + i * step, width - 1) - column;
+            out[i] = (unsigned short)(bytes[at * 2] | bytes[at * 2 + 1] << 8);
+        }
+    }
+
+    void readTile(TileData& data)
+    {
+        const int level = (int)(data.key >> 56);
+        const int z = (int)(data.key >> 28 & 0xFFFFFFF), x = (int)(data.key & 0xFFFFFFF);
+        const int step = 1 << level;
+        const int firstRow = z * TERRAIN_TILE_QUADS * step, firstColumn = x * TERRAIN_TILE_QUADS * step;
+
+        data.samples.resize(TERRAIN_TILE_SAMPLES * TERRAIN_TILE_SAMPLES);
+        for (int row = 0; row < TERRAIN_TILE_SAMPLES; ++row)
+            readSamples(firstRow + row * step, firstColumn, TERRAIN_TILE_SAMPLES, step, &data.samples[row * TERRAIN_TILE_SAMPLES]);
+    }
+
+    // Reads requested tiles one at a time, holding the lock only to take a request and hand back the result
+    void ioThread()
+    {
+        for (;;)
+        {
+            TileData data;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !requests.empty(); });
+                if (stopping)
+                    return;
+
+                data.key = requests.front();
+                requests.erase(requests.begin());
+                busy = data.key;
+            }
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            readTile(data);
+            float readMs = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            ioMs += readMs;
+            bytesRead += data.samples.size() * sizeof(unsigned short);
+            completed.push_back(std::move(data));
+            busy = ~0ull;
+        }
+    }
+
+    void stopThread()
+    {
+        if (!worker.joinable())
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            requests.clear();
+        }
+        wake.notify_one();
+        worker.join();
+    }
+};
+#endif
@@ -0,0 +1,394 @@
+#ifndef TEXARRAY_H
+#define TEXARRAY_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <stb_image.h>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "resources.h" // GPU resource tracking
+#include "ktx2.h" // Cooked block compressed textures
+
+// Largest width and height of a layer; larger images are halved until they fit
+const GLsizei TEXARRAY_LAYER_SIZE = 1024;
+// Repeated edge texels around images sharing a layer, keeps mip levels up to log2(padding) from bleeding
+const GLsizei TEXARRAY_PADDING = 8;
+
+// Where an added image ended up: array layer and the part of the layer it covers
+struct TextureSlot
+{
+    int layer;          // -1 when the image is not packed
+    glm::vec4 uvRect;   // offset (xy) and scale (zw) that map the image's 0..1 UVs into the layer
+};
+
+// Packs RGBA8 images of any size into the layers of one GL_TEXTURE_2D_ARRAY.
+// Images filling a whole layer get it to themselves, smaller ones share layers as a padded atlas
+// (shelf packing, tallest first). Every object then samples the same texture with its layer and
+// UV rectangle coming from the per-object data, so differently textured objects need no binds between draws.
+// Cooked block compressed images are uploaded as they are, one per layer with their own mips; they
+// cannot be atlased or mixed with raw images, so such an array holds images of one size and format.
+class TextureArrayPacker
+{
+public:
+    // format applies to every layer; GL_SRGB8_ALPHA8 once lighting happens in linear space
+    explicit TextureArrayPacker(GLenum format = GL_RGBA8, GLsizei size = TEXARRAY_LAYER_SIZE)
+        : internalFormat(format), layerSize(size), texture(0), layers(0), compressed(false)
+    {
+    }
+
+    // copies the pixels; returns the handle to look the slot up with after Build
+    int Add(const unsigned char* rgba, int width, int height, const char* name)
+    {
+        if (compressed)
+        {
+            std::cout << "WARNING: " << name << " is not compressed like the other textures of the array" << std::endl;
+            return -1;
+        }
+
+        Image image;
+        image.name = name ? name : "";
+        image.width = width;
+        image.height = height;
+        image.pixels.assign(rgba, rgba + (size_t)width * height * 4);
+
+        // halve until the image fits a layer
+        while (image.width > layerSize || image.height > layerSize)
+            halve(image);
+
+        image.slot.layer = -1;
+        image.slot.uvRect = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+        images.push_back(image);
+        return (int)images.size() - 1;
+    }
+
+    // loads an image file with stb_image; returns -1 when it cannot be read
+    int AddFile(const char* path)
+    {
+        int width, height, channels;
+        stbi_set_flip_vertically_on_load(1);
+        unsigned char* pixels = stbi_load(path, &width, &height, &channels, 4);
+        if (!pixels)
+        {
+            std::cout << "WARNING: could not load texture " << path << ": " << stbi_failure_reason() << std::endl;
+            return -1;
+        }
+
+        int handle = Add(pixels, width, height, path);
+        stbi_image_free(pixels);
+        return handle;
+    }
+
+    // keeps the blocks of every mip level, levels[0] being the full size; returns -1 when the
+    // image does not match the size and format of the compressed images already added
+    int AddCompressed(GLenum format, int width, int height, const std::vector<std::vector<unsigned char> >& levels, const char* name)
+    {
+        if (!images.empty() && (!compressed || format != internalFormat || width != images[0].width || height != images[0].height))
+        {
+            std::cout << "WARNING: " << name << " does not match the format and size of the other textures of the array" << std::endl;
+            return -1;
+        }
+
+        compressed = true;
+        internalFormat = format;
+
+        Image image;
+        image.name = name ? name : "";
+        image.width = width;
+        image.height = height;
+        image.levels = levels;
+        image.slot.layer = (int)images.size();
+        image.slot.uvRect = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+        images.push_back(image);
+        return (int)images.size() - 1;
+    }
+
+    // loads a texture cooked with --cook; returns -1 when it cannot be read. Touches no GL state, so it may run
+    // before the context exists; whether the GPU supports the format is for the caller to check before Build
+    int AddKtx2File(const char* path)
+    {
+        CookedTexture cooked;
+        if (!ReadKtx2(path, cooked))
+        {
+            std::cout << "WARNING: could not load cooked texture " << path << std::endl;
+            return -1;
+        }
+        return AddCompressed(CookedGLFormat(cooked.format), cooked.width, cooked.height, cooked.levels, path);
+    }
+
+    // packs every added image, uploads the layers with their mip chains and frees the CPU copies
+    bool Build()
+    {
+        if (images.empty())
+            return false;
+        if (compressed)
+            return buildCompressed();
+
+        // layers shrink to the smallest power of two holding the largest image
+        int largest = 1;
+        for (size_t i = 0; i < images.size(); ++i)
+            largest = std::max(largest, std::max(images[i].width, images[i].height));
+        while (layerSize / 2 >= largest)
+            layerSize /= 2;
+
+        std::vector<Placement> placements;
+        layers = pack(placements);
+
+        GLint maxLayers = 0;
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+        if (layers > maxLayers)
+        {
+            std::cout << "ERROR: " << layers << " texture layers needed, the GPU allows " << maxLayers << std::endl;
+            return false;
+        }
+
+        GLsizei levels = 1;
+        while ((layerSize >> levels) > 0)
+            ++levels;
+
+        texture = GpuResources().GenTexture("texture array");
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        GpuResources().TexStorage3D(GL_TEXTURE_2D_ARRAY, texture, levels, internalFormat, layerSize, layerSize, layers);
+
+        // Each layer is assembled on the CPU, uploaded, and its mips are generated together at the end
+        std::vector<unsigned char> layer((size_t)layerSize * layerSize * 4);
+        bool shared = false;
+        for (int l = 0; l < layers; ++l)
+        {
+            std::fill(layer.begin(), layer.end(), (unsigned char)0);
+            for (size_t p = 0; p < placements.size(); ++p)
+            {
+                if (placements[p].layer != l)
+                    continue;
+
+                const Image& image = images[placements[p].image];
+                blit(image, placements[p].x, placements[p].y, placements[p].padding, layer);
+                shared = shared || placements[p].padding > 0;
+            }
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, l, layerSize, layerSize, 1, GL_RGBA, GL_UNSIGNED_BYTE, layer.data());
+        }
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        // past log2(padding) the atlas neighbours would blend into each other
+        if (shared)
+        {
+            GLint maxLevel = 0;
+            while ((TEXARRAY_PADDING >> (maxLevel + 1)) > 0)
+                ++maxLevel;
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, maxLevel);
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        for (size_t i = 0; i < images.size(); ++i)
+            std::vector<unsigned char>().swap(images[i].pixels);
+        return true;
+    }
+
+    TextureSlot Slot(int handle) const
+    {
+        if (handle < 0 || handle >= (int)images.size())
+        {
+            TextureSlot none = { -1, glm::vec4(0.0f, 0.0f, 1.0f, 1.0f) };
+            return none;
+        }
+        return images[handle].slot;
+    }
+
+    void Bind(GLenum unit) const
+    {
+        glActiveTexture(unit);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    }
+
+    void Destroy()
+    {
+        if (texture)
+            GpuResources().DeleteTexture(texture);
+        images.clear();
+        layers = 0;
+        compressed = false;
+    }
+
+    GLuint GetTexture() const { return texture; }
+    int Layers() const { return layers; }
+    size_t Size() const { return images.size(); }
+    bool Compressed() const { return compressed; }
+    GLenum Format() const { return internalFormat; }
+
+private:
+    struct Image
+    {
+        std::string name;
+        int width, height;
+        std::vector<unsigned char> pixels;
+        std::vector<std::vector<unsigned char> > levels; // blocks of each mip level when compressed
+        TextureSlot slot;
+    };
+
+    struct Placement
+    {
+        int image;
+        int layer;
+        int x, y;       // corner of the image itself, inside its padding
+        int padding;
+    };
+
+    GLenum internalFormat;
+    GLsizei layerSize;
+    GLuint texture;
+    int layers;
+    bool compressed;
+    std::vector<Image> images;
+
+    // one layer per image with the cooked mips uploaded block for block; levels missing from any image are dropped
+    bool buildCompressed()
+    {
+        GLint maxLayers = 0;
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+        layers = (int)images.size();
+        if (layers > maxLayers)
+        {
+            std::cout << "ERROR: " << layers << " texture layers needed, the GPU allows " << maxLayers << std::endl;
+            return false;
+        }
+
+        size_t levels = images[0].levels.size();
+        for (size_t i = 1; i < images.size(); ++i)
+            levels = std::min(levels, images[i].levels.size());
+
+        texture = GpuResources().GenTexture("texture array");
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        GpuResources().TexStorage3D(GL_TEXTURE_2D_ARRAY, texture, (GLsizei)levels, internalFormat, images[0].width, images[0].height, layers);
+        for (int l = 0; l < layers; ++l)
+        {
+            for (size_t level = 0; level < levels; ++level)
+            {
+                GLsizei width = std::max(1, images[l].width >> (int)level), height = std::max(1, images[l].height >> (int)level);
+                const std::vector<unsigned char>& blocks = images[l].levels[level];
+                glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, (GLint)level, 0, 0, l, width, height, 1, internalFormat, (GLsizei)blocks.size(), blocks.data());
+            }
+        }
+
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        for (size_t i = 0; i < images.size(); ++i)
+            std::vector<std::vector<unsigned char> >().swap(images[i].levels);
+        return true;
+    }
+
+    // 2x2 box filter, odd edges keep their last row or column
+    static void halve(Image& image)
+    {
+        int width = std::max(1, image.width / 2);
+        int height = std::max(1, image.height / 2);
+        std::vector<unsigned char> pixels((size_t)width * height * 4);
+        for (int y = 0; y < height; ++y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                int x0 = std::min(x * 2, image.width - 1), x1 = std::min(x * 2 + 1, image.width - 1);
+                int y0 = std::min(y * 2, image.height - 1), y1 = std::min(y * 2 + 1, image.height - 1);
+                for (int c = 0; c < 4; ++c)
+                {
+                    int sum = image.pixels[((size_t)y0 * image.width + x0) * 4 + c] + image.pixels[((size_t)y0 * image.width + x1) * 4 + c]
+                        + image.pixels[((size_t)y1 * image.width + x0) * 4 + c] + image.pixels[((size_t)y1 * image.width + x1) * 4 + c];
+                    pixels[((size_t)y * width + x) * 4 + c] = (unsigned char)((sum + 2) / 4);
+                }
+            }
+        }
+        image.width = width;
+        image.height = height;
+        image.pixels.swap(pixels);
+    }
+
+    // Shelf packing: images sorted tallest first fill rows left to right, rows stack up, full layers open a new one
+    int pack(std::vector<Placement>& placements)
+    {
+        std::vector<int> order(images.size());
+        for (size_t i = 0; i < order.size(); ++i)
+            order[i] = (int)i;
+        std::sort(order.begin(), order.end(), [this](int a, int b) { return images[a].height > images[b].height; });
+
+        int layer = -1;
+        int shelfY = 0, shelfHeight = 0, cursorX = 0;
+        for (size_t o = 0; o < order.size(); ++o)
+        {
+            Image& image = images[order[o]];
+            Placement placement;
+            placement.image = order[o];
+
+            // a full size image takes a layer of its own without padding
+            if (image.width == layerSize && image.height == layerSize)
+            {
+                placement.layer = ++layer;
+                placement.x = placement.y = placement.padding = 0;
+                shelfY = shelfHeight = layerSize;
+                cursorX = layerSize;
+            }
+            else
+            {
+                const int padding = TEXARRAY_PADDING;
+                int width = std::min(image.width + padding * 2, (int)layerSize);
+                int height = std::min(image.height + padding * 2, (int)layerSize);
+                if (layer < 0 || cursorX + width > layerSize)
+                {
+                    // next shelf
+                    shelfY += shelfHeight;
+                    shelfHeight = 0;
+                    cursorX = 0;
+                }
+                if (layer < 0 || shelfY + height > layerSize)
+                {
+                    ++layer;
+                    shelfY = shelfHeight = cursorX = 0;
+                }
+
+                // images too large for padding on both sides lose the padding that does not fit
+                placement.layer = layer;
+                placement.padding = std::min(padding, (int)(layerSize - image.width) / 2);
+                placement.padding = std::min(placement.padding, (int)(layerSize - image.height) / 2);
+                placement.x = cursorX + placement.padding;
+                placement.y = shelfY + placement.padding;
+                cursorX += width;
+                shelfHeight = std::max(shelfHeight, height);
+            }
+
+            // the shader keeps UVs half a texel inside this rectangle so level 0 never filters in the padding
+            image.slot.layer = placement.layer;
+            image.slot.uvRect = glm::vec4((float)placement.x / layerSize, (float)placement.y / layerSize,
+                (float)image.width / layerSize, (float)image.height / layerSize);
+            placements.push_back(placement);
+        }
+        return layer + 1;
+    }
+
+    // copies an image into the layer and extends its edges over the padding
+    void blit(const Image& image, int x, int y, int padding, std::vector<unsigned char>& layer) const
+    {
+        for (int row = -padding; row < image.height + padding; ++row)
+        {
+            int sourceRow = std::min(std::max(row, 0), image.height - 1);
+            for (int column = -padding; column < image.width + padding; ++column)
+            {
+                int sourceColumn = std::min(std::max(column, 0), image.width - 1);
+                const unsigned char* source = &image.pixels[((size_t)sourceRow * image.width + sourceColumn) * 4];
+                unsigned char* destination = &layer[((size_t)(y + row) * layerSize + (x + column)) * 4];
+                for (int c = 0; c < 4; ++c)
+                    destination[c] = source[c];
+            }
+        }
+    }
+};
+#endif
@@ -0,0 +1,734 @@
+#ifndef TEXCOOK_H
+#define TEXCOOK_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "ktx2.h" // Cooked formats and the container
+
+// SSE2 is the baseline on every target this project builds for; the scalar path stays for comparison and other CPUs
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TEXCOOK_SIMD 1
+#endif
+
+// Largest side of level 0 unless the cook asks for another
+const int TEXCOOK_DEFAULT_MAX_SIZE = 1024;
+
+// An RGBA8 image in sRGB, rows bottom to top like the GL upload
+struct CookImage
+{
+    int width, height;
+    std::vector<unsigned char> pixels;
+};
+
+namespace texcook_detail
+{
+    inline const float* SrgbToLinearTable()
+    {
+        static float table[256];
+        static bool built = false;
+        if (!built)
+        {
+            for (int i = 0; i < 256; ++i)
+            {
+                float c = i / 255.0f;
+                table[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+            }
+            built = true;
+        }
+        return table;
+    }
+
+    inline unsigned char LinearToSrgb(float c)
+    {
+        c = std::min(1.0f, std::max(0.0f, c));
+        c = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.0f / 2.4f) - 0.055f;
+        return (unsigned char)(c * 255.0f + 0.5f);
+    }
+
+    // Halves one axis with the [1 3 3 1]/8 kernel, clamping at the edges; x is the axis being halved
+    inline void Downsample(const std::vector<float>& in, int width, int height, bool horizontal, std::vector<float>& out)
+    {
+        const int outWidth = horizontal ? std::max(1, width / 2) : width;
+        const int outHeight = horizontal ? height : std::max(1, height / 2);
+        const int length = horizontal ? width : height;
+        out.assign((size_t)outWidth * outHeight * 4, 0.0f);
+        if (length == 1)
+        {
+            out = in;
+            return;
+        }
+
+        for (int y = 0; y < outHeight; ++y)
+        {
+            for (int x = 0; x < outWidth; ++x)
+            {
+                const int center = (horizontal ? x : y) * 2;
+                const int taps[4] = { std::max(center - 1, 0), center, std::min(center + 1, length - 1), std::min(center + 2, length - 1) };
+                const float weights[4] = { 0.125f, 0.375f, 0.375f, 0.125f };
+                float* destination = &out[((size_t)y * outWidth + x) * 4];
+                for (int t = 0; t < 4; ++t)
+                {
+                    const float* source = horizontal ? &in[((size_t)y * width + taps[t]) * 4] : &in[((size_t)taps[t] * width + x) * 4];
+                    for (int c = 0; c < 4; ++c)
+                        destination[c] += source[c] * weights[t];
+                }
+            }
+        }
+    }
+
+    // Palette entries as floats, rows of RGBA
+    struct Palette
+    {
+        float colors[16][4];
+        int size;
+    };
+
+    // Pixels of one 4x4 block split into channel planes, the layout the SSE index search reads
+    struct BlockPixels
+    {
+        float channels[4][16];
+    };
+
+    inline void LoadBlock(const CookImage& image, int blockX, int blockY, unsigned char rgba[64], BlockPixels& block)
+    {
+        for (int i = 0; i < 16; ++i)
+        {
+            // blocks past the edge repeat the last row or column
+            int x = std::min(blockX * 4 + (i & 3), image.width - 1);
+            int y = std::min(blockY * 4 + (i >> 2), image.height - 1);
+            const unsigned char* source = &image.pixels[((size_t)y * image.width + x) * 4];
+            for (int c = 0; c < 4; ++c)
+            {
+                rgba[i * 4 + c] = source[c];
+                block.channels[c][i] = source[c];
+            }
+        }
+    }
+
+    // Nearest palette entry for each pixel, returns the summed squared error over the given channels
+    inline float SelectIndicesScalar(const BlockPixels& block, const Palette& palette, int channels, unsigned char indices[16])
+    {
+        float total = 0.0f;
+        for (int i = 0; i < 16; ++i)
+        {
+            float best = 1e30f;
+            for (int p = 0; p < palette.size; ++p)
+            {
+                float distance = 0.0f;
+                for (int c = 0; c < channels; ++c)
+                {
+                    float d = block.channels[c][i] - palette.colors[p][c];
+                    distance += d * d;
+                }
+                if (distance < best)
+                {
+                    best = distance;
+                    indices[i] = (unsigned char)p;
+                }
+            }
+            total += best;
+        }
+        return total;
+    }
+
+    // Same search four pixels at a time, the palette entry index kept per lane
+    inline float SelectIndices(const BlockPixels& block, const Palette& palette, int channels, unsigned char indices[16])
+    {
+#ifdef TEXCOOK_SIMD
+        float total = 0.0f;
+        for (int i = 0; i < 16; i += 4)
+        {
+            __m128 pixel[4];
+            for (int c = 0; c < channels; ++c)
+                pixel[c] = _mm_loadu_ps(&block.channels[c][i]);
+
+            __m128 best = _mm_set1_ps(1e30f);
+            __m128i bestIndex = _mm_setzero_si128();
+            for (int p = 0; p < palette.size; ++p)
+            {
+                __m128 distance = _mm_setzero_ps();
+                for (int c = 0; c < channels; ++c)
+                {
+                    __m128 d = _mm_sub_ps(pixel[c], _mm_set1_ps(palette.colors[p][c]));
+                    distance = _mm_add_ps(distance, _mm_mul_ps(d, d));
+                }
+                __m128 closer = _mm_cmplt_ps(distance, best);
+                best = _mm_min_ps(distance, best);
+                __m128i mask = _mm_castps_si128(closer);
+                bestIndex = _mm_or_si128(_mm_and_si128(mask, _mm_set1_epi32(p)), _mm_andnot_si128(mask, bestIndex));
+            }
+
+            float errors[4];
+            int found[4];
+            _mm_storeu_ps(errors, best);
+            _mm_storeu_si128((__m128i*)found, bestIndex);
+            for (int k = 0; k < 4; ++k)
+            {
+                indices[i + k] = (unsigned char)found[k];
+                total += errors[k];
+            }
+        }
+        return total;
+#else
+        return SelectIndicesScalar(block, palette, channels, indices);
+#endif
+    }
+
+    // Endpoints from the extremes of the block along its principal axis
+    inline void PrincipalEndpoints(const BlockPixels& block, int channels, float e0[4], float e1[4])
+    {
+        float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        for (int c = 0; c < channels; ++c)
+        {
+            for (int i = 0; i < 16; ++i)
+                mean[c] += block.channels[c][i];
+            mean[c] /= 16.0f;
+        }
+
+        float covariance[4][4] = {};
+        for (int i = 0; i < 16; ++i)
+        {
+            for (int a = 0; a < channels; ++a)
+            {
+                for (int b = 0; b < channels; ++b)
+                    covariance[a][b] += (block.channels[a][i] - mean[a]) * (block.channels[b][i] - mean[b]);
+            }
+        }
+
+        // power iteration from the diagonal, a handful of steps settle on 4x4 blocks
+        float axis[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        for (int iteration = 0; iteration < 8; ++iteration)
+        {
+            float next[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+            float length = 0.0f;
+            for (int a = 0; a < channels; ++a)
+            {
+                for (int b = 0; b < channels; ++b)
+                    next[a] += covariance[a][b] * axis[b];
+                length = std::max(length, std::fabs(next[a]));
+            }
+            if (length <= 0.0f)
+                break;
+            for (int a = 0; a < channels; ++a)
+                axis[a] = next[a] / length;
+        }
+
+        float low = 1e30f, high = -1e30f;
+        for (int i = 0; i < 16; ++i)
+        {
+            float t = 0.0f;
+            for (int c = 0; c < channels; ++c)
+                t += (block.channels[c][i] - mean[c]) * axis[c];
+            low = std::min(low, t);
+            high = std::max(high, t);
+        }
+
+        float lengthSquared = 0.0f;
+        for (int c = 0; c < channels; ++c)
+            lengthSquared += axis[c] * axis[c];
+        lengthSquared = lengthSquared > 0.0f ? lengthSquared : 1.0f;
+        for (int c = 0; c < 4; ++c)
+        {
+            e0[c] = c < channels ? std::min(255.0f, std::max(0.0f, mean[c] + axis[c] * low / lengthSquared)) : 255.0f;
+            e1[c] = c < channels ? std::min(255.0f, std::max(0.0f, mean[c] + axis[c] * high / lengthSquared)) : 255.0f;
+        }
+    }
+
+    // Least squares endpoints for the chosen indices; weights[i] is how far index i lies from e0 toward e1
+    inline bool RefineEndpoints(const BlockPixels& block, int channels, const unsigned char indices[16], const float* weights, float e0[4], float e1[4])
+    {
+        float a = 0.0f, b = 0.0f, c = 0.0f;
+        float x0[4] = { 0.0f, 0.0f, 0.0f, 0.0f }, x1[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        for (int i = 0; i < 16; ++i)
+        {
+            float w = weights[indices[i]];
+            a += (1.0f - w) * (1.0f - w);
+            b += (1.0f - w) * w;
+            c += w * w;
+            for (int k = 0; k < channels; ++k)
+            {
+                x0[k] += (1.0f - w) * block.channels[k][i];
+                x1[k] += w * block.channels[k][i];
+            }
+        }
+
+        float determinant = a * c - b * b;
+        if (std::fabs(determinant) < 1e-6f)
+            return false;
+        for (int k = 0; k < channels; ++k)
+        {
+            e0[k] = std::min(255.0f, std::max(0.0f, (c * x0[k] - b * x1[k]) / determinant));
+            e1[k] = std::min(255.0f, std::max(0.0f, (a * x1[k] - b * x0[k]) / determinant));
+        }
+        return true;
+    }
+
+    inline unsigned short PackRgb565(const float color[4])
+    {
+        int r = (int)(color[0] * 31.0f / 255.0f + 0.5f), g = (int)(color[1] * 63.0f / 255.0f + 0.5f), b = (int)(color[2] * 31.0f / 255.0f + 0.5f);
+        return (unsigned short)((r << 11) | (g << 5) | b);
+    }
+
+    inline void UnpackRgb565(unsigned short packed, int color[3])
+    {
+        int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+        color[0] = (r << 3) | (r >> 2);
+        color[1] = (g << 2) | (g >> 4);
+        color[2] = (b << 3) | (b >> 2);
+    }
+
+    // The four colors of a BC1 block in 4-color mode, as the hardware decodes them
+    inline void ColorPalette(unsigned short c0, unsigned short c1, Palette& palette)
+    {
+        int a[3], b[3];
+        UnpackRgb565(c0, a);
+        UnpackRgb565(c1, b);
+        palette.size = 4;
+        for (int c = 0; c < 3; ++c)
+        {
+            palette.colors[0][c] = (float)a[c];
+            palette.colors[1][c] = (float)b[c];
+            palette.colors[2][c] = (float)((2 * a[c] + b[c]) / 3);
+            palette.colors[3][c] = (float)((a[c] + 2 * b[c]) / 3);
+        }
+        for (int p = 0; p < 4; ++p)
+            palette.colors[p][3] = 255.0f;
+    }
+
+    inline float TryColorBlock(const BlockPixels& block, const float e0[4], const float e1[4], unsigned char out[8])
+    {
+        unsigned short c0 = PackRgb565(e0), c1 = PackRgb565(e1);
+        // 4-color mode needs c0 > c1; equal endpoints decode every index as c0 anyway
+        if (c0 < c1)
+            std::swap(c0, c1);
+
+        Palette palette;
+        ColorPalette(c0, c1, palette);
+        unsigned char indices[16];
+        float error = SelectIndices(block, palette, 3, indices);
+        if (c0 == c1)
+            memset(indices, 0, sizeof(indices));
+
+        unsigned int bits = 0;
+        for (int i = 0; i < 16; ++i)
+            bits |= (unsigned int)indices[i] << (i * 2);
+        out[0] = (unsigned char)c0; out[1] = (unsigned char)(c0 >> 8);
+        out[2] = (unsigned char)c1; out[3] = (unsigned char)(c1 >> 8);
+        for (int k = 0; k < 4; ++k)
+            out[4 + k] = (unsigned char)(bits >> (k * 8));
+        return error;
+    }
+
+    // BC1 color block: principal axis endpoints, then one least squares pass if it lowers the error
+    inline void EncodeColorBlock(const BlockPixels& block, unsigned char out[8])
+    {
+        float e0[4], e1[4];
+        PrincipalEndpoints(block, 3, e0, e1);
+        float error = TryColorBlock(block, e0, e1, out);
+
+        // decode the chosen indices back to their position between c0 and c1
+        static const float weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+        unsigned char indices[16];
+        unsigned int bits = out[4] | (out[5] << 8) | (out[6] << 16) | ((unsigned int)out[7] << 24);
+        for (int i = 0; i < 16; ++i)
+            indices[i] = (unsigned char)((bits >> (i * 2)) & 3);
+        unsigned short c0 = (unsigned short)(out[0] | (out[1] << 8)), c1 = (unsigned short)(out[2] | (out[3] << 8));
+        int unpacked0[3], unpacked1[3];
+        UnpackRgb565(c0, unpacked0);
+        UnpackRgb565(c1, unpacked1);
+        for (int c = 0; c < 3; ++c)
+        {
+            e0[c] = (float)unpacked0[c];
+            e1[c] = (float)unpacked1[c];
+        }
+
+        unsigned char refined[8];
+        if (c0 != c1 && RefineEndpoints(block, 3, indices, weights, e0, e1) && TryColorBlock(block, e0, e1, refined) < error)
+            memcpy(out, refined, sizeof(refined));
+    }
+
+    // BC3 alpha block in 8-value mode: a0 the highest alpha, a1 the lowest
+    inline void EncodeAlphaBlock(const unsigned char rgba[64], unsigned char out[8])
+    {
+        int high = 0, low = 255;
+        for (int i = 0; i < 16; ++i)
+        {
+            high = std::max(high, (int)rgba[i * 4 + 3]);
+            low = std::min(low, (int)rgba[i * 4 + 3]);
+        }
+
+        int values[8] = { high, low };
+        for (int k = 1; k < 7; ++k)
+            values[k + 1] = ((7 - k) * high + k * low) / 7;
+
+        unsigned long long bits = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+            int best = 0;
+            for (int k = 1; k < 8 && high > low; ++k)
+            {
+                if (std::abs(values[k] - rgba[i * 4 + 3]) < std::abs(values[best] - rgba[i * 4 + 3]))
+                    best = k;
+            }
+            bits |= (unsigned long long)best << (i * 3);
+        }
+
+        out[0] = (unsigned char)high;
+        out[1] = (unsigned char)low;
+        for (int k = 0; k < 6; ++k)
+            out[2 + k] = (unsigned char)(bits >> (k * 8));
+    }
+
+    // BC7 mode 6 weights for 4-bit indices
+    const int BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+    struct Bc7Mode6
+    {
+        int endpoints[2][4];    // 7 bits per channel
+        int pbits[2];
+        unsigned char indices[16];
+        float error;
+    };
+
+    inline void Bc7Palette(const Bc7Mode6& block, Palette& palette)
+    {
+        palette.size = 16;
+        for (int p = 0; p < 16; ++p)
+        {
+            for (int c = 0; c < 4; ++c)
+            {
+                int a = (block.endpoints[0][c] << 1) | block.pbits[0];
+                int b = (block.endpoints[1][c] << 1) | block.pbits[1];
+                palette.colors[p][c] = (float)(((64 - BC7_WEIGHTS[p]) * a + BC7_WEIGHTS[p] * b + 32) >> 6);
+            }
+        }
+    }
+
+    // Tries every p-bit pair for the endpoints and keeps the one with the lowest error
+    inline void TryBc7Endpoints(const BlockPixels& block, const float e0[4], const float e1[4], Bc7Mode6& best)
+    {
+        for (int p = 0; p < 4; ++p)
+        {
+            Bc7Mode6 candidate;
+            candidate.pbits[0] = p & 1;
+            candidate.pbits[1] = p >> 1;
+            for (int c = 0; c < 4; ++c)
+            {
+                candidate.endpoints[0][c] = std::min(127, std::max(0, (int)((e0[c] - candidate.pbits[0]) * 0.5f + 0.5f)));
+                candidate.endpoints[1][c] = std::min(127, std::max(0, (int)((e1[c] - candidate.pbits[1]) * 0.5f + 0.5f)));
+            }
+
+            Palette palette;
+            Bc7Palette(candidate, palette);
+            candidate.error = SelectIndices(block, palette, 4, candidate.indices);
+            if (candidate.error < best.error)
+                best = candidate;
+        }
+    }
+
+    // BC7 mode 6: one RGBA subset, 7-bit endpoints with a p-bit each and 4-bit indices
+    inline void EncodeBc7Block(const BlockPixels& block, unsigned char out[16])
+    {
+        Bc7Mode6 best;
+        best.error = 1e30f;
+
+        float e0[4], e1[4];
+        PrincipalEndpoints(block, 4, e0, e1);
+        TryBc7Endpoints(block, e0, e1, best);
+
+        // two least squares passes; each keeps the result only when it helps
+        float weights[16];
+        for (int p = 0; p < 16; ++p)
+            weights[p] = BC7_WEIGHTS[p] / 64.0f;
+        for (int pass = 0; pass < 2 && best.error > 0.0f; ++pass)
+        {
+            if (!RefineEndpoints(block, 4, best.indices, weights, e0, e1))
+                break;
+            TryBc7Endpoints(block, e0, e1, best);
+        }
+
+        // the anchor index has no top bit, so swap the endpoints when it would need one
+        if (best.indices[0] >= 8)
+        {
+            for (int c = 0; c < 4; ++c)
+                std::swap(best.endpoints[0][c], best.endpoints[1][c]);
+            std::swap(best.pbits[0], best.pbits[1]);
+            for (int i = 0; i < 16; ++i)
+                best.indices[i] = (unsigned char)(15 - best.indices[i]);
+        }
+
+        memset(out, 0, 16);
+        int position = 0;
+        auto put = [&](unsigned int value, int count)
+        {
+            for (int b = 0; b < count; ++b, ++position)
+                out[position >> 3] |= (unsigned char)(((value >> b) & 1) << (position & 7));
+        };
+
+        put(1 << 6, 7);
+        for (int c = 0; c < 4; ++c)
+        {
+            put(best.endpoints[0][c], 7);
+            put(best.endpoints[1][c], 7);
+        }
+        put(best.pbits[0], 1);
+        put(best.pbits[1], 1);
+        put(best.indices[0], 3);
+        for (int i = 1; i < 16; ++i)
+            put(best.indices[i], 4);
+    }
+
+    inline void DecodeColorBlock(const unsigned char* in, unsigned char rgba[64], bool alwaysFourColors)
+    {
+        unsigned short c0 = (unsigned short)(in[0] | (in[1] << 8)), c1 = (unsigned short)(in[2] | (in[3] << 8));
+        int a[3], b[3];
+        UnpackRgb565(c0, a);
+        UnpackRgb565(c1, b);
+        int colors[4][4];
+        for (int c = 0; c < 3; ++c)
+        {
+            colors[0][c] = a[c];
+            colors[1][c] = b[c];
+            if (c0 > c1 || alwaysFourColors)
+            {
+                colors[2][c] = (2 * a[c] + b[c]) / 3;
+                colors[3][c] = (a[c] + 2 * b[c]) / 3;
+            }
+            else
+            {
+                colors[2][c] = (a[c] + b[c]) / 2;
+                colors[3][c] = 0;
+            }
+        }
+        colors[0][3] = colors[1][3] = colors[2][3] = 255;
+        colors[3][3] = c0 > c1 || alwaysFourColors ? 255 : 0;
+
+        unsigned int bits = in[4] | (in[5] << 8) | (in[6] << 16) | ((unsigned int)in[7] << 24);
+        for (int i = 0; i < 16; ++i)
+        {
+            for (int c = 0; c < 4; ++c)
+                rgba[i * 4 + c] = (unsigned char)colors[(bits >> (i * 2)) & 3][c];
+        }
+    }
+
+    inline void DecodeAlphaBlock(const unsigned char* in, unsigned char rgba[64])
+    {
+        int values[8] = { in[0], in[1] };
+        if (in[0] > in[1])
+        {
+            for (int k = 1; k < 7; ++k)
+                values[k + 1] = ((7 - k) * in[0] + k * in[1]) / 7;
+        }
+        else
+        {
+            for (int k = 1; k < 5; ++k)
+                values[k + 1] = ((5 - k) * in[0] + k * in[1]) / 5;
+            values[6] = 0;
+            values[7] = 255;
+        }
+
+        unsigned long long bits = 0;
+        for (int k = 0; k < 6; ++k)
+            bits |= (unsigned long long)in[2 + k] << (k * 8);
+        for (int i = 0; i < 16; ++i)
+            rgba[i * 4 + 3] = (unsigned char)values[(bits >> (i * 3)) & 7];
+    }
+
+    // Mode 6 only; blocks in any other mode decode to black, which the PSNR would show plainly
+    inline void DecodeBc7Block(const unsigned char* in, unsigned char rgba[64])
+    {
+        int position = 0;
+        auto get = [&](int count)
+        {
+            unsigned int value = 0;
+            for (int b = 0; b < count; ++b, ++position)
+                value |= (unsigned int)((in[position >> 3] >> (position & 7)) & 1) << b;
+            return value;
+        };
+
+        if (get(7) != (1 << 6))
+        {
+            memset(rgba, 0, 64);
+            return;
+        }
+
+        Bc7Mode6 block;
+        for (int c = 0; c < 4; ++c)
+        {
+            block.endpoints[0][c] = get(7);
+            block.endpoints[1][c] = get(7);
+        }
+        block.pbits[0] = get(1);
+        block.pbits[1] = get(1);
+        Palette palette;
+        Bc7Palette(block, palette);
+        for (int i = 0; i < 16; ++i)
+        {
+            int index = get(i == 0 ? 3 : 4);
+            for (int c = 0; c < 4; ++c)
+                rgba[i * 4 + c] = (unsigned char)palette.colors[index][c];
+        }
+    }
+}
+
+// Halves the image with a [1 3 3 1] filter applied in linear light until it fits maxSize, then keeps
+// halving to 1x1 for the mip chain. Alpha is filtered as it is stored. levels[0] is the full size image.
+inline void BuildMipChain(const CookImage& source, int maxSize, std::vector<CookImage>& levels)
+{
+    using namespace texcook_detail;
+    const float* toLinear = SrgbToLinearTable();
+
+    int width = source.width, height = source.height;
+    std::vector<float> linear((size_t)width * height * 4), scratch, next;
+    for (size_t i = 0; i < source.pixels.size(); ++i)
+        linear[i] = (i & 3) == 3 ? source.pixels[i] / 255.0f : toLinear[source.pixels[i]];
+
+    levels.clear();
+    for (;;)
+    {
+        if (width <= maxSize && height <= maxSize)
+        {
+            CookImage level;
+            level.width = width;
+            level.height = height;
+            level.pixels.resize(linear.size());
+            for (size_t i = 0; i < linear.size(); ++i)
+                level.pixels[i] = (i & 3) == 3 ? (unsigned char)(std::min(1.0f, std::max(0.0f, linear[i])) * 255.0f + 0.5f) : LinearToSrgb(linear[i]);
+            levels.push_back(level);
+        }
+        if (width == 1 && height == 1)
+            break;
+
+        Downsample(linear, width, height, true, scratch);
+        width = std::max(1, width / 2);
+        Downsample(scratch, width, height, false, next);
+        height = std::max(1, height / 2);
+        linear.swap(next);
+    }
+}
+
+// Compresses one level into 4x4 blocks, rows of blocks shared between threads
+inline void EncodeLevel(const CookImage& image, Cooked_Format format, std::vector<unsigned char>& blocks, unsigned int threadCount)
+{
+    using namespace texcook_detail;
+
+    const int blocksWide = (image.width + 3) / 4, blocksHigh = (image.height + 3) / 4;
+    const unsigned int blockBytes = CookedBlockBytes(format);
+    blocks.assign((size_t)blocksWide * blocksHigh * blockBytes, 0);
+
+    std::atomic<int> nextRow(0);
+    auto worker = [&]()
+    {
+        for (int row = nextRow++; row < blocksHigh; row = nextRow++)
+        {
+            for (int column = 0; column < blocksWide; ++column)
+            {
+                unsigned char rgba[64];
+                BlockPixels block;
+                LoadBlock(image, column, row, rgba, block);
+                unsigned char* out = &blocks[((size_t)row * blocksWide + column) * blockBytes];
+                if (format == COOKED_BC1)
+                {
+                    EncodeColorBlock(block, out);
+                }
+                else if (format == COOKED_BC3)
+                {
+                    EncodeAlphaBlock(rgba, out);
+                    EncodeColorBlock(block, out + 8);
+                }
+                else
+                {
+                    EncodeBc7Block(block, out);
+                }
+            }
+        }
+    };
+
+    threadCount = std::max(1u, std::min(threadCount, (unsigned int)blocksHigh));
+    std::vector<std::thread> threads;
+    for (unsigned int t = 1; t < threadCount; ++t)
+        threads.push_back(std::thread(worker));
+    worker();
+    for (size_t t = 0; t < threads.size(); ++t)
+        threads[t].join();
+}
+
+// Expands a compressed level back to RGBA8, for measuring what the encoder lost
+inline void DecodeLevel(const std::vector<unsigned char>& blocks, Cooked_Format format, int width, int height, CookImage& image)
+{
+    using namespace texcook_detail;
+
+    image.width = width;
+    image.height = height;
+    image.pixels.assign((size_t)width * height * 4, 0);
+    const int blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4;
+    const unsigned int blockBytes = CookedBlockBytes(format);
+    for (int row = 0; row < blocksHigh; ++row)
+    {
+        for (int column = 0; column < blocksWide; ++column)
+        {
+            const unsigned char* in = &blocks[((size_t)row * blocksWide + column) * blockBytes];
+            unsigned char rgba[64];
+            if (format == COOKED_BC1)
+            {
+                DecodeColorBlock(in, rgba, false);
+            }
+            else if (format == COOKED_BC3)
+            {
+                DecodeColorBlock(in + 8, rgba, true);
+                DecodeAlphaBlock(in, rgba);
+            }
+            else
+            {
+                DecodeBc7Block(in, rgba);
+            }
+
+            for (int i = 0; i < 16; ++i)
+            {
+                int x = column * 4 + (i & 3), y = row * 4 + (i >> 2);
+                if (x < width && y < height)
+                    memcpy(&image.pixels[((size_t)y * width + x) * 4], &rgba[i * 4], 4);
+            }
+        }
+    }
+}
+
+// Peak signal to noise ratio in dB over the color channels, plus alpha for formats that keep it
+inline double ComputePsnr(const CookImage& a, const CookImage& b, bool alpha)
+{
+    double total = 0.0;
+    size_t count = 0;
+    for (size_t i = 0; i < a.pixels.size(); ++i)
+    {
+        if ((i & 3) == 3 && !alpha)
+            continue;
+        double d = (double)a.pixels[i] - b.pixels[i];
+        total += d * d;
+        ++count;
+    }
+    if (total <= 0.0 || count == 0)
+        return 99.0;
+    return 10.0 * std::log10(255.0 * 255.0 / (total / count));
+}
+
+// Builds the mip chain and compresses every level; threadCount 0 uses every hardware thread
+inline void CookTexture(const CookImage& source, Cooked_Format format, int maxSize, CookedTexture& cooked, std::vector<CookImage>& levels, unsigned int threadCount = 0)
+{
+    if (threadCount == 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+    BuildMipChain(source, maxSize, levels);
+    cooked.format = format;
+    cooked.width = levels[0].width;
+    cooked.height = levels[0].height;
+    cooked.levels.resize(levels.size());
+    for (size_t level = 0; level < levels.size(); ++level)
+        EncodeLevel(levels[level], format, cooked.levels[level], threadCount);
+}
+#endif